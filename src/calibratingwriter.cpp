@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "calibratingwriter.h"
+#include "pixelconv.h"
+
+#include <cstdlib>
+
+static const size_t BufferAlignment = 4096;
+
+CalibratingWriter::CalibratingWriter(FitsWriter *writer,
+                                     const std::string &darkFile,
+                                     const std::string &flatFile)
+    : m_writer(writer),
+      m_darkFile(darkFile),
+      m_flatFile(flatFile),
+      m_pixelType(Uint8),
+      m_numPixels(0),
+      m_buffer(0)
+{
+}
+
+CalibratingWriter::~CalibratingWriter()
+{
+    close();
+    delete m_writer;
+}
+
+bool CalibratingWriter::open(const std::string &fname, PixelType pixelType,
+                             int width, int height, int count, bool clobber)
+{
+    clearError();
+
+    if (isOpen()) {
+        setError("File already opened.");
+        return false;
+    }
+
+    if (pixelType != Uint8 && pixelType != Uint16) {
+        setError("Only 8 and 16 bit unsigned pixels can be calibrated.");
+        return false;
+    }
+
+    if (width <= 0 || height <= 0) {
+        setError("Invalid width, height or count.");
+        return false;
+    }
+
+    m_numPixels = size_t(width) * size_t(height);
+    if (m_darkFile.empty())
+        m_dark.assign(m_numPixels, 0);
+    else if (!readMaster(m_darkFile, width, height, m_dark))
+        return false;
+
+    if (m_flatFile.empty())
+        m_gain.assign(m_numPixels, 1);
+    else {
+        if (!readMaster(m_flatFile, width, height, m_gain))
+            return false;
+
+        double sum = 0;
+        size_t n = 0;
+        for (size_t i = 0; i < m_numPixels; ++i)
+            if (m_gain[i] > 0) {
+                sum += m_gain[i];
+                ++n;
+            }
+        if (n == 0) {
+            setError("The flat field '" + m_flatFile +
+                     "' has no positive pixels.");
+            return false;
+        }
+        double mean = sum / n;
+        for (size_t i = 0; i < m_numPixels; ++i)
+            m_gain[i] = m_gain[i] > 0 ? float(mean / m_gain[i]) : 0;
+    }
+
+    if (posix_memalign(reinterpret_cast<void **>(&m_buffer), BufferAlignment,
+                       m_numPixels * bytesPerPixel(pixelType)) != 0) {
+        m_buffer = 0;
+        setError("Cannot allocate the calibration buffer.");
+        return false;
+    }
+
+    if (!m_writer->open(fname, pixelType, width, height, count, clobber)) {
+        setError(m_writer->lastError());
+        std::free(m_buffer);
+        m_buffer = 0;
+        return false;
+    }
+    m_pixelType = pixelType;
+
+    if ((!m_darkFile.empty() &&
+         !writeFileKey("DARKFILE", m_darkFile,
+                       "master dark subtracted from the frames")) ||
+        (!m_flatFile.empty() &&
+         !writeFileKey("FLATFILE", m_flatFile,
+                       "flat field the frames were divided by"))) {
+        std::string msg = lastError();
+        close();
+        setError(msg);
+        return false;
+    }
+    return true;
+}
+
+void CalibratingWriter::close()
+{
+    if (!isOpen())
+        return;
+
+    clearError();
+    m_writer->close();
+    if (!m_writer->lastError().empty())
+        setError(m_writer->lastError());
+
+    std::free(m_buffer);
+    m_buffer = 0;
+    m_pixelType = Uint8;
+    m_numPixels = 0;
+    std::vector<float>().swap(m_dark);
+    std::vector<float>().swap(m_gain);
+}
+
+bool CalibratingWriter::isOpen() const
+{
+    return m_writer->isOpen();
+}
+
+bool CalibratingWriter::writeFrame(long index, unsigned char *data)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write frame, file not open.");
+        return false;
+    }
+
+    if (m_pixelType == Uint16)
+        calibrateUint16(reinterpret_cast<const unsigned short *>(data),
+                        &m_dark[0], &m_gain[0],
+                        reinterpret_cast<unsigned short *>(m_buffer),
+                        m_numPixels);
+    else
+        calibrateUint8(data, &m_dark[0], &m_gain[0], m_buffer, m_numPixels);
+
+    if (!m_writer->writeFrame(index, m_buffer)) {
+        setError(m_writer->lastError());
+        return false;
+    }
+    return true;
+}
+
+bool CalibratingWriter::writeKey(int datatype, const char *keyname,
+                                 void *value, const char *comment)
+{
+    clearError();
+    if (!m_writer->writeKey(datatype, keyname, value, comment)) {
+        setError(m_writer->lastError());
+        return false;
+    }
+    return true;
+}
+
+bool CalibratingWriter::resize(int count)
+{
+    clearError();
+    if (!m_writer->resize(count)) {
+        setError(m_writer->lastError());
+        return false;
+    }
+    return true;
+}
+
+bool CalibratingWriter::writeFrameInfo(long index, const FrameInfo &info)
+{
+    clearError();
+    if (!m_writer->writeFrameInfo(index, info)) {
+        setError(m_writer->lastError());
+        return false;
+    }
+    return true;
+}
+
+unsigned long long CalibratingWriter::bytesWritten() const
+{
+    return m_writer->bytesWritten();
+}
+
+bool CalibratingWriter::readMaster(const std::string &fname, int width,
+                                   int height, std::vector<float> &pixels)
+{
+    int status = 0;
+    fitsfile *file = 0;
+    fits_open_image(&file, fname.c_str(), READONLY, &status);
+    if (status != 0) {
+        setError("Cannot open the calibration file '" + fname + "'.", status);
+        return false;
+    }
+
+    int bitpix = 0, naxis = 0;
+    long naxes[3] = { 0, 0, 0 };
+    fits_get_img_param(file, 3, &bitpix, &naxis, naxes, &status);
+    if (status != 0 || naxis < 2 || naxes[0] != width || naxes[1] != height) {
+        if (status != 0)
+            setError("Cannot read the calibration file '" + fname + "'.",
+                     status);
+        else
+            setError("The image in '" + fname + "' does not match the "
+                     "frame size.");
+        status = 0;
+        fits_close_file(file, &status);
+        return false;
+    }
+
+    // of a cube only the first frame is used
+    pixels.resize(m_numPixels);
+    long fpixel[3] = { 1, 1, 1 };
+    fits_read_pix(file, TFLOAT, fpixel, LONGLONG(m_numPixels), 0,
+                  &pixels[0], 0, &status);
+    if (status != 0) {
+        setError("Cannot read the calibration file '" + fname + "'.", status);
+        status = 0;
+        fits_close_file(file, &status);
+        return false;
+    }
+
+    fits_close_file(file, &status);
+    return true;
+}
+
+// only the base name is recorded, the directory rarely fits into the card
+bool CalibratingWriter::writeFileKey(const char *keyname,
+                                     const std::string &fname,
+                                     const char *comment)
+{
+    std::string::size_type pos = fname.rfind('/');
+    // a name longer than the card is cut by the writer, after its quotes
+    // are escaped
+    std::string name = fname.substr(pos == std::string::npos ? 0 : pos + 1);
+    return writeKey(TSTRING, keyname, const_cast<char *>(name.c_str()),
+                    comment);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_CALIBRATINGWRITER_H
+#define PVREC_CALIBRATINGWRITER_H
+
+#include "fitswriter.h"
+#include <vector>
+
+/*
+    Applies a master dark and flat field to each frame before it is passed
+    on to the wrapped writer, i.e. frame = (frame - dark) * gain with
+    gain = mean(flat) / flat. The result is rounded and clipped to the pixel
+    type of the frames, which stays unchanged.
+
+    The masters are read with CFITSIO when the file is opened, from the first
+    image of the given files, and must have the size of the frames. Either
+    one may be omitted. The flat field is expected to be dark corrected
+    already; its pixels <= 0 are set to 0 in the frames. The file names are
+    recorded as DARKFILE and FLATFILE in the header.
+ */
+class CalibratingWriter : public FitsWriter
+{
+public:
+    // takes ownership of the writer, empty file names are not used
+    CalibratingWriter(FitsWriter *writer, const std::string &darkFile,
+                      const std::string &flatFile);
+    virtual ~CalibratingWriter();
+
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber = false);
+    virtual void close();
+    virtual bool isOpen() const;
+
+    virtual bool writeFrame(long index, unsigned char *data);
+    virtual bool writeKey(int datatype, const char *keyname, void *value,
+                          const char *comment);
+    virtual bool resize(int count);
+    virtual bool writeFrameInfo(long index, const FrameInfo &info);
+    virtual unsigned long long bytesWritten() const;
+
+protected:
+    bool readMaster(const std::string &fname, int width, int height,
+                    std::vector<float> &pixels);
+    bool writeFileKey(const char *keyname, const std::string &fname,
+                      const char *comment);
+
+private:
+    FitsWriter *m_writer;
+    std::string m_darkFile;
+    std::string m_flatFile;
+    PixelType m_pixelType;
+    size_t m_numPixels;
+    std::vector<float> m_dark;
+    std::vector<float> m_gain;
+    unsigned char *m_buffer;
+};
+
+#endif // PVREC_CALIBRATINGWRITER_H
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_CAMERA_H
+#define PVREC_CAMERA_H
+
+#include <string>
+#include <vector>
+#include <PvApi.h>
+
+/*
+    Abstract camera backend used by the Recorder.
+
+    The interface mirrors the parts of the PvApi the Recorder needs, using
+    the same types and error codes, so that the recording pipeline can be
+    driven by other sources than a real GigE camera.
+ */
+class Camera
+{
+public:
+    typedef std::vector<tPvCameraInfoEx> CameraInfoVector;
+
+    virtual ~Camera() {}
+
+    virtual std::string apiVersionStr() const = 0;
+    virtual CameraInfoVector availableCameras(int timeout) const = 0;
+
+    virtual tPvErr open(unsigned long uniqueId) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+
+    virtual tPvErr attrUint32Get(const char *name, tPvUint32 *value) const = 0;
+    virtual tPvErr attrUint32Set(const char *name, tPvUint32 value) = 0;
+    virtual tPvErr attrFloat32Get(const char *name, tPvFloat32 *value) const = 0;
+    virtual tPvErr attrFloat32Set(const char *name, tPvFloat32 value) = 0;
+    virtual tPvErr attrEnumGet(const char *name, char *buffer,
+                               unsigned long bufferSize) const = 0;
+    virtual tPvErr attrEnumSet(const char *name, const char *value) = 0;
+    virtual tPvErr attrStringGet(const char *name, char *buffer,
+                                 unsigned long bufferSize) const = 0;
+    virtual tPvErr commandRun(const char *name) = 0;
+
+    virtual tPvErr captureStart() = 0;
+    virtual tPvErr captureEnd() = 0;
+    virtual tPvErr captureAdjustPacketSize(unsigned long maxPacketSize) = 0;
+    virtual tPvErr captureQueueFrame(tPvFrame *frame,
+                                     tPvFrameCallback callback = 0) = 0;
+    virtual tPvErr captureWaitForFrameDone(tPvFrame *frame,
+                                           unsigned long timeout) = 0;
+    virtual tPvErr captureQueueClear() = 0;
+};
+
+#endif // PVREC_CAMERA_H
@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2010 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cfitsiowriter.h"
+#include <cassert>
+#include <algorithm>
+
+CfitsioWriter::CfitsioWriter()
+    : m_pixelType(Uint8),
+      m_width(0),
+      m_height(0),
+      m_count(0),
+      m_file(0),
+      m_clobber(false)
+{
+}
+
+CfitsioWriter::CfitsioWriter(const std::string &fname, PixelType pixelType,
+                             int width, int height, int count, bool clobber)
+    : m_pixelType(Uint8),
+      m_width(0),
+      m_height(0),
+      m_count(0),
+      m_file(0),
+      m_clobber(false)
+{
+    open(fname, pixelType, width, height, count, clobber);
+}
+
+CfitsioWriter::~CfitsioWriter()
+{
+    close();
+}
+
+bool CfitsioWriter::open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber)
+{
+    clearError();
+
+    if (m_file) {
+        setError("File already opened.");
+        return false;
+    }
+
+    assert(m_fname.empty());
+    assert(m_clobber == false);
+    assert(m_pixelType == Uint8);
+    assert(m_width == 0);
+    assert(m_height == 0);
+    assert(m_count == 0);
+
+    if (width <= 0 || height <= 0 || count <= 0) {
+        setError("Invalid width, height or count.");
+        return false;
+    }    
+
+    int status = 0;
+    std::string fnameClobber = clobber ? ("!" + fname) : fname;
+    fits_create_file(&m_file, fnameClobber.c_str(), &status);
+    if (status != 0) {
+        setError("Cannot create the file '" + fname + "'.", status);
+        return false;
+    }
+
+    m_pixelType = pixelType;
+
+    long naxes[3];
+    naxes[0] = width;
+    naxes[1] = height;
+    naxes[2] = count;
+    fits_create_img(m_file, imageType(), 3, naxes, &status);
+    if (status != 0) {
+        setError("Cannot allocate file space.", status);
+        close();
+        return false;
+    }
+
+    // try to remove the 2 default comments entries from the header
+    fits_delete_key(m_file, "COMMENT", &status);
+    fits_delete_key(m_file, "COMMENT", &status);
+
+    // write time stamp to the header
+    fits_write_date(m_file, &status);
+    if (status != 0) {
+        setError("Cannot write date.", status);
+        close();
+        return false;
+    }
+
+    m_fname = fname;
+    m_clobber = clobber;
+    m_width = width;
+    m_height = height;
+    m_count = count;
+
+    return true;
+}
+
+void CfitsioWriter::close()
+{
+    if (!m_file)
+        return;
+
+    clearError();
+    writeFrameTable();
+
+    int status = 0;
+    fits_close_file(m_file, &status);
+    frameTable().clear();
+
+    m_fname.clear();
+    m_pixelType = Uint8;
+    m_width = 0;
+    m_height = 0;
+    m_count = 0;
+    m_file = 0;
+    m_clobber = false;
+}
+
+bool CfitsioWriter::isOpen() const
+{
+    return m_file != 0;
+}
+
+bool CfitsioWriter::writeFrame(long index, unsigned char *data)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write frame, file not open.");
+        return false;
+    }
+
+    if (index < 1 || index > m_count) {
+        setError("Frame index out of bounds.");
+        return false;
+    }
+
+    int status = 0;
+    int dataType = TBYTE;
+    if (m_pixelType == Int16)
+        dataType = TSHORT;
+    else if (m_pixelType == Uint16)
+        dataType = TUSHORT;
+    else if (m_pixelType == Int32)
+        dataType = TINT;
+    long fpixel[3] = { 1, 1, 0 };
+    fpixel[2] += index;
+    LONGLONG nelem = m_width * m_height;
+
+    fits_write_pix(m_file, dataType, fpixel, nelem, data, &status);
+    if (status != 0) {
+        setError("Cannot write frame.", status);
+        return false;
+    }
+
+    addBytesWritten(size_t(nelem) * bytesPerPixel(m_pixelType));
+
+    return true;
+}
+
+bool CfitsioWriter::resize(int count)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot resize image, file not open.");
+        return false;
+    }
+
+    if (count <= 0) {
+        setError("Invalid count.");
+        return false;
+    }
+
+    int status = 0;
+    long naxes[3];
+    naxes[0] = m_width;
+    naxes[1] = m_height;
+    naxes[2] = count;
+    fits_resize_img(m_file, imageType(), 3, naxes, &status);
+    if (status != 0) {
+        setError("Cannot resize image.", status);
+        return false;
+    }
+
+    m_count = count;
+    return true;
+}
+
+// appends the frame table as binary table extension
+bool CfitsioWriter::writeFrameTable()
+{
+    FrameTable &table = frameTable();
+    table.truncate(m_count);
+    if (table.numRows() == 0)
+        return true;
+    return writeTableRows();
+}
+
+// writes the full batches while recording, so that they don't pile up in
+// memory
+bool CfitsioWriter::flushFrameTable()
+{
+    if (!writeTableRows())
+        return false;
+
+    int status = 0;
+    fits_flush_buffer(m_file, 0, &status);
+    if (status != 0) {
+        setError("Cannot write frame table.", status);
+        return false;
+    }
+    return true;
+}
+
+// appends the rows held in memory to the table extension, which is created
+// with the first rows; the image stays the current HDU
+bool CfitsioWriter::writeTableRows()
+{
+    FrameTable &table = frameTable();
+    int status = 0;
+    if (table.numWrittenRows() > 0) {
+        fits_movabs_hdu(m_file, 2, 0, &status);
+    } else {
+            char *names[FrameTable::NumColumns];
+        char *formats[FrameTable::NumColumns];
+        char *units[FrameTable::NumColumns];
+        for (int i = 0; i < FrameTable::NumColumns; ++i) {
+            names[i] = const_cast<char *>(FrameTable::columnName(i));
+            formats[i] = const_cast<char *>(FrameTable::columnFormat(i));
+            units[i] = const_cast<char *>(FrameTable::columnUnit(i));
+        }
+
+        char extname[] = "FRAMEINFO";
+        fits_create_tbl(m_file, BINARY_TBL, 0, FrameTable::NumColumns, names,
+                        formats, units, extname, &status);
+    }
+
+    // write whole column batches instead of single rows
+    size_t numRows = table.numRows();
+    LONGLONG firstRow = LONGLONG(table.numWrittenRows()) + 1;
+    for (size_t first = 0; first < numRows && status == 0;
+            first += FrameTable::BatchRows)
+    {
+        LONGLONG row = firstRow + LONGLONG(first);
+        LONGLONG n = LONGLONG(std::min(FrameTable::BatchRows,
+                                       numRows - first));
+        fits_write_col(m_file, TLONGLONG, FrameTable::Index + 1, row, 1, n,
+                       const_cast<LONGLONG *>(&table.indexColumn()[first]),
+                       &status);
+        fits_write_col(m_file, TLONGLONG, FrameTable::FrameCount + 1, row, 1,
+                       n, const_cast<LONGLONG *>(
+                           &table.frameCountColumn()[first]), &status);
+        fits_write_col(m_file, TLONGLONG, FrameTable::Timestamp + 1, row, 1,
+                       n, const_cast<LONGLONG *>(
+                           &table.timestampColumn()[first]), &status);
+        fits_write_col(m_file, TDOUBLE, FrameTable::HostTime + 1, row, 1, n,
+                       const_cast<double *>(&table.hostTimeColumn()[first]),
+                       &status);
+        fits_write_col(m_file, TINT, FrameTable::Status + 1, row, 1, n,
+                       const_cast<int *>(&table.statusColumn()[first]),
+                       &status);
+        fits_write_col(m_file, TDOUBLE, FrameTable::Mean + 1, row, 1, n,
+                       const_cast<double *>(&table.meanColumn()[first]),
+                       &status);
+        fits_write_col(m_file, TDOUBLE, FrameTable::Rms + 1, row, 1, n,
+                       const_cast<double *>(&table.rmsColumn()[first]),
+                       &status);
+        fits_write_col(m_file, TINT, FrameTable::MinValue + 1, row, 1, n,
+                       const_cast<int *>(&table.minValueColumn()[first]),
+                       &status);
+        fits_write_col(m_file, TINT, FrameTable::MaxValue + 1, row, 1, n,
+                       const_cast<int *>(&table.maxValueColumn()[first]),
+                       &status);
+        fits_write_col(m_file, TINT, FrameTable::Saturated + 1, row, 1, n,
+                       const_cast<int *>(&table.saturatedColumn()[first]),
+                       &status);
+        fits_write_col(m_file, TDOUBLE, FrameTable::Sharpness + 1, row, 1, n,
+                       const_cast<double *>(&table.sharpnessColumn()[first]),
+                       &status);
+        fits_write_col(m_file, TLONGLONG, FrameTable::RecordIndex + 1, row, 1,
+                       n, const_cast<LONGLONG *>(
+                           &table.recordIndexColumn()[first]), &status);
+        fits_write_col(m_file, TINT, FrameTable::NumCombined + 1, row, 1, n,
+                       const_cast<int *>(&table.numCombinedColumn()[first]),
+                       &status);
+    }
+
+    // back to the image even if writing the rows failed
+    int moveStatus = 0;
+    fits_movabs_hdu(m_file, 1, 0, &moveStatus);
+    if (status != 0 || moveStatus != 0) {
+        setError("Cannot write frame table.", status ? status : moveStatus);
+        return false;
+    }
+    table.setRowsWritten();
+    return true;
+}
+
+int CfitsioWriter::imageType() const
+{
+    if (m_pixelType == Int16)
+        return SHORT_IMG;
+    else if (m_pixelType == Uint16)
+        return USHORT_IMG;  // CFITSIO adds BZERO = 32768
+    else if (m_pixelType == Int32)
+        return LONG_IMG;
+    return BYTE_IMG;
+}
+
+bool CfitsioWriter::writeKey(int datatype, const char *keyname, void *value,
+                             const char *comment)
+{
+    clearError();
+
+    int status = 0;
+    fits_write_key(m_file, datatype, keyname, value, comment, &status);
+    if (status != 0) {
+        setError("Cannot write header entry.", status);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2010 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CFITSIOWRITER_H
+#define CFITSIOWRITER_H
+
+#include "fitswriter.h"
+
+/*
+    FitsWriter backend using the CFITSIO library.
+ */
+class CfitsioWriter : public FitsWriter
+{
+public:
+    CfitsioWriter();
+    CfitsioWriter(const std::string &fname, PixelType pixelType,
+                  int width, int height, int count, bool clobber = false);
+    virtual ~CfitsioWriter();
+
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber = false);
+    virtual void close();
+    virtual bool isOpen() const;
+
+    virtual bool writeFrame(long index, unsigned char *data);
+    virtual bool writeKey(int datatype, const char *keyname, void *value,
+                          const char *comment);
+    virtual bool resize(int count);
+
+protected:
+    virtual bool flushFrameTable();
+
+    int imageType() const;
+    bool writeFrameTable();
+    bool writeTableRows();
+
+private:
+    std::string m_fname;
+    PixelType m_pixelType;
+    int m_width;
+    int m_height;
+    int m_count;
+    fitsfile *m_file;
+    bool m_clobber;
+};
+
+#endif // CFITSIOWRITER_H
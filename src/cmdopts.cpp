@@ -24,6 +24,7 @@
  */
 
 #include "cmdopts.h"
+#include "stackingwriter.h"
 #include <getopt.h>
 #include <sstream>
 #include <iostream>
@@ -38,10 +39,45 @@ static const int DefaultPixelBits = 8;
 static const std::string DefaultPixelFormat = "Mono8";
 static const std::string DefaultTriggerMode = "FixedRate";
 static const unsigned int DefaultTriggerDelay = 0;
-static const int DefaultCameraId = 0;
 static const int DefaultNumBuffers = 10;
 static const unsigned int DefaultPacketSize = 0;
 static const double DefaultBandwidth = 115.0;
+static const int DefaultSimWidth = 1024;
+static const int DefaultSimHeight = 1024;
+static const int DefaultLuckyWindow = 100;
+
+// long options without a short equivalent
+enum {
+    OptQueue = 256,
+    OptOverflow,
+    OptSimSize,
+    OptSimMissing,
+    OptSimDrop,
+    OptSimJitter,
+    OptHugePages,
+    OptNoLock,
+    OptSegmentFrames,
+    OptSegmentSize,
+    OptSegmentTime,
+    OptPreTrigger,
+    OptEventLevel,
+    OptControl,
+    OptCpus,
+    OptRoi,
+    OptBinning,
+    OptStats,
+    OptStatsInterval,
+    OptMachine,
+    OptCallbacks,
+    OptZeroCopy,
+    OptStack,
+    OptDark,
+    OptFlat,
+    OptLucky,
+    OptLuckyWindow,
+    OptReplay,
+    OptReplayFast
+};
 
 template <class T>
 bool fromString(T &value, const std::string &str) {
@@ -50,6 +86,54 @@ bool fromString(T &value, const std::string &str) {
     return !ss.fail();
 }
 
+static std::vector<std::string> split(const std::string &str, char sep)
+{
+    std::vector<std::string> result;
+    std::string::size_type start = 0, pos;
+    while ((pos = str.find(sep, start)) != std::string::npos) {
+        result.push_back(str.substr(start, pos - start));
+        start = pos + 1;
+    }
+    result.push_back(str.substr(start));
+    return result;
+}
+
+// parses WIDTHxHEIGHT followed by an optional +X+Y offset
+static bool parseGeometry(const std::string &str, int &width, int &height,
+                          int &x, int &y)
+{
+    std::string::size_type xpos = str.find('x');
+    std::string::size_type plus = str.find('+');
+    if (xpos == std::string::npos || (plus != std::string::npos && plus < xpos))
+        return false;
+    if (!fromString(width, str.substr(0, xpos)) ||
+            !fromString(height, str.substr(xpos + 1, plus - xpos - 1)))
+        return false;
+
+    x = y = 0;
+    if (plus != std::string::npos) {
+        std::vector<std::string> offset = split(str.substr(plus + 1), '+');
+        if (offset.size() != 2 || !fromString(x, offset[0]) ||
+                !fromString(y, offset[1]))
+            return false;
+    }
+    return width > 0 && height > 0 && x >= 0 && y >= 0;
+}
+
+// parses a CPU number or a range like 2-5
+static bool parseCpuSet(std::vector<int> &cpus, const std::string &str)
+{
+    std::vector<std::string> range = split(str, '-');
+    int first, last;
+    if (range.size() > 2 || !fromString(first, range[0]) ||
+            !fromString(last, range.back()) || first < 0 || last < first)
+        return false;
+    cpus.clear();
+    for (int i = first; i <= last; ++i)
+        cpus.push_back(i);
+    return true;
+}
+
 CmdLineOptions::CmdLineOptions(int argc, char **argv)
     : m_argc(argc),
       m_argv(argv),
@@ -59,13 +143,43 @@ CmdLineOptions::CmdLineOptions(int argc, char **argv)
       pixelFormat(DefaultPixelFormat),
       triggerMode(DefaultTriggerMode),
       triggerDelay(DefaultTriggerDelay),
-      cameraId(DefaultCameraId),
+      roiX(0),
+      roiY(0),
+      roiWidth(0),
+      roiHeight(0),
+      binX(1),
+      binY(1),
       packetSize(DefaultPacketSize),
       bandwidth(DefaultBandwidth),
       numBuffers(DefaultNumBuffers),
+      queueSize(0),
+      dropOnOverflow(false),
+      callbacks(false),
+      writer("cfitsio"),
+      zeroCopy(false),
+      stackSize(1),
+      luckyPercent(0),
+      luckyWindow(DefaultLuckyWindow),
+      hugePages(false),
+      segmentFrames(0),
+      segmentSize(0),
+      segmentTime(0),
+      preTriggerFrames(0),
+      eventLevel(0),
+      statsInterval(1),
+      lockMemory(true),
+      quiet(false),
+      machineProgress(false),
       force(false),
       list(false),
-      info(false)
+      info(false),
+      simulate(false),
+      simWidth(DefaultSimWidth),
+      simHeight(DefaultSimHeight),
+      simMissingRate(0),
+      simDropRate(0),
+      simJitter(0),
+      replayFast(false)
 {
     if (argc > 0)
         m_appName = argv[0];
@@ -73,7 +187,7 @@ CmdLineOptions::CmdLineOptions(int argc, char **argv)
 
 CmdLineOptions::Result CmdLineOptions::parse()
 {
-    static const char *short_opts = "n:r:e:b:t:d:c:N:m:B:fliVh";
+    static const char *short_opts = "n:r:e:b:t:d:c:N:m:B:w:qfliSVh";
     static const struct option long_opts[] = {
         { "count", required_argument, 0, 'n' },
         { "framerate", required_argument, 0, 'r' },
@@ -85,9 +199,41 @@ CmdLineOptions::Result CmdLineOptions::parse()
         { "buffers", required_argument, 0, 'N' },
         { "mtu", required_argument, 0, 'm' },
         { "bandwidth", required_argument, 0, 'B' },
+        { "queue", required_argument, 0, OptQueue },
+        { "overflow", required_argument, 0, OptOverflow },
+        { "writer", required_argument, 0, 'w' },
+        { "hugepages", no_argument, 0, OptHugePages },
+        { "seg-frames", required_argument, 0, OptSegmentFrames },
+        { "seg-size", required_argument, 0, OptSegmentSize },
+        { "seg-time", required_argument, 0, OptSegmentTime },
+        { "no-lock", no_argument, 0, OptNoLock },
+        { "pre", required_argument, 0, OptPreTrigger },
+        { "event-level", required_argument, 0, OptEventLevel },
+        { "control", required_argument, 0, OptControl },
+        { "cpus", required_argument, 0, OptCpus },
+        { "roi", required_argument, 0, OptRoi },
+        { "binning", required_argument, 0, OptBinning },
+        { "stats", required_argument, 0, OptStats },
+        { "stats-interval", required_argument, 0, OptStatsInterval },
+        { "callbacks", no_argument, 0, OptCallbacks },
+        { "zero-copy", no_argument, 0, OptZeroCopy },
+        { "stack", required_argument, 0, OptStack },
+        { "lucky", required_argument, 0, OptLucky },
+        { "lucky-window", required_argument, 0, OptLuckyWindow },
+        { "dark", required_argument, 0, OptDark },
+        { "flat", required_argument, 0, OptFlat },
+        { "quiet", no_argument, 0, 'q' },
+        { "machine", no_argument, 0, OptMachine },
         { "force", no_argument, 0, 'f' },
         { "list", no_argument, 0, 'l' },
         { "info", no_argument, 0, 'i' },
+        { "simulate", no_argument, 0, 'S' },
+        { "sim-size", required_argument, 0, OptSimSize },
+        { "sim-missing", required_argument, 0, OptSimMissing },
+        { "sim-drop", required_argument, 0, OptSimDrop },
+        { "sim-jitter", required_argument, 0, OptSimJitter },
+        { "replay", required_argument, 0, OptReplay },
+        { "replay-fast", no_argument, 0, OptReplayFast },
         { "version", no_argument, 0, 'V' },
         { "help", no_argument, 0, 'h' },
         { 0, 0, 0, 0 }
@@ -107,8 +253,8 @@ CmdLineOptions::Result CmdLineOptions::parse()
                 cerr << m_appName << ": -n must be an integer." << endl;
                 return Error;
             }
-            if (numFrames <= 0) {
-                cerr << m_appName << ": -n must be greater than 0." << endl;
+            if (numFrames < 0) {
+                cerr << m_appName << ": -n must not be negative." << endl;
                 return Error;
             }
             break;
@@ -140,10 +286,12 @@ CmdLineOptions::Result CmdLineOptions::parse()
             }
             if (pixelBits == 8)
                 pixelFormat = "Mono8";
+            else if (pixelBits == 12)
+                pixelFormat = "Mono12Packed";
             else if (pixelBits == 16)
                 pixelFormat = "Mono16";
             else {
-                cerr << m_appName << ": -b must be 8 or 16" << endl;
+                cerr << m_appName << ": -b must be 8, 12 or 16" << endl;
                 return Error;
             }}
             break;
@@ -172,12 +320,16 @@ CmdLineOptions::Result CmdLineOptions::parse()
                 return Error;
             }
             break;
-        case 'c':
-            if (!fromString(cameraId, optarg)) {
-                cerr << m_appName << ": -c must be an unsigned integer."
-                     << endl;
-                return Error;
-            }
+        case 'c': {
+            std::vector<std::string> ids = split(optarg, ',');
+            cameraIds.assign(ids.size(), 0);
+            for (size_t i = 0; i < ids.size(); ++i) {
+                if (!fromString(cameraIds[i], ids[i]) || cameraIds[i] == 0) {
+                    cerr << m_appName
+                         << ": -c must be a list of unique IDs." << endl;
+                    return Error;
+                }
+            }}
             break;
         case 'N':
             if (!fromString(numBuffers, optarg)) {
@@ -206,6 +358,169 @@ CmdLineOptions::Result CmdLineOptions::parse()
                 return Error;
             }
             break;
+        case OptQueue:
+            if (!fromString(queueSize, optarg)) {
+                cerr << m_appName << ": --queue must be an integer." << endl;
+                return Error;
+            }
+            if (queueSize < 0) {
+                cerr << m_appName << ": --queue must not be negative." << endl;
+                return Error;
+            }
+            break;
+        case OptOverflow: {
+            std::string oa(optarg);
+            std::transform(oa.begin(), oa.end(), oa.begin(), ::tolower);
+            if (oa == "block")
+                dropOnOverflow = false;
+            else if (oa == "drop")
+                dropOnOverflow = true;
+            else {
+                cerr << m_appName << ": --overflow must be block or drop."
+                     << endl;
+                return Error;
+            }}
+            break;
+        case 'w': {
+            std::string wa(optarg);
+            std::transform(wa.begin(), wa.end(), wa.begin(), ::tolower);
+            if (wa != "cfitsio" && wa != "raw" && wa != "mmap" &&
+                    wa != "rice" && wa != "uring" && wa != "uring-direct") {
+                cerr << m_appName << ": -w must be cfitsio, raw, mmap, rice, "
+                     << "uring or uring-direct." << endl;
+                return Error;
+            }
+            writer = wa;
+            }
+            break;
+        case OptSegmentFrames:
+            if (!fromString(segmentFrames, optarg) || segmentFrames == 0) {
+                cerr << m_appName
+                     << ": --seg-frames must be a positive integer."
+                     << endl;
+                return Error;
+            }
+            break;
+        case OptSegmentSize:
+            if (!fromString(segmentSize, optarg) || segmentSize <= 0) {
+                cerr << m_appName
+                     << ": --seg-size must be a positive number." << endl;
+                return Error;
+            }
+            break;
+        case OptSegmentTime:
+            if (!fromString(segmentTime, optarg) || segmentTime <= 0) {
+                cerr << m_appName
+                     << ": --seg-time must be a positive number." << endl;
+                return Error;
+            }
+            break;
+        case OptPreTrigger:
+            if (!fromString(preTriggerFrames, optarg) ||
+                    preTriggerFrames <= 0) {
+                cerr << m_appName
+                     << ": --pre must be a positive integer." << endl;
+                return Error;
+            }
+            break;
+        case OptStack:
+            if (!fromString(stackSize, optarg) || stackSize <= 0 ||
+                    stackSize > StackingWriter::MaxStackSize) {
+                cerr << m_appName << ": --stack must be an integer between 1 "
+                     << "and " << StackingWriter::MaxStackSize << "." << endl;
+                return Error;
+            }
+            break;
+        case OptEventLevel:
+            if (!fromString(eventLevel, optarg) || eventLevel <= 0) {
+                cerr << m_appName
+                     << ": --event-level must be a positive number." << endl;
+                return Error;
+            }
+            break;
+        case OptLucky:
+            if (!fromString(luckyPercent, optarg) || luckyPercent <= 0 ||
+                    luckyPercent > 100) {
+                cerr << m_appName << ": --lucky must be a percentage between "
+                     << "0 and 100." << endl;
+                return Error;
+            }
+            break;
+        case OptLuckyWindow:
+            if (!fromString(luckyWindow, optarg) || luckyWindow <= 0) {
+                cerr << m_appName
+                     << ": --lucky-window must be a positive integer." << endl;
+                return Error;
+            }
+            break;
+        case OptDark:
+            darkFile = optarg;
+            break;
+        case OptFlat:
+            flatFile = optarg;
+            break;
+        case OptControl:
+            controlSocket = optarg;
+            break;
+        case OptCpus: {
+            std::vector<std::string> sets = split(optarg, ',');
+            cpuSets.assign(sets.size(), std::vector<int>());
+            for (size_t i = 0; i < sets.size(); ++i) {
+                if (!parseCpuSet(cpuSets[i], sets[i])) {
+                    cerr << m_appName
+                         << ": --cpus must be a list of CPUs or CPU ranges."
+                         << endl;
+                    return Error;
+                }
+            }}
+            break;
+        case OptStats:
+            statsFile = optarg;
+            break;
+        case OptStatsInterval:
+            if (!fromString(statsInterval, optarg) || statsInterval <= 0) {
+                cerr << m_appName
+                     << ": --stats-interval must be a positive number."
+                     << endl;
+                return Error;
+            }
+            break;
+        case OptRoi:
+            if (!parseGeometry(optarg, roiWidth, roiHeight, roiX, roiY)) {
+                cerr << m_appName << ": --roi must be WIDTHxHEIGHT[+X+Y]."
+                     << endl;
+                return Error;
+            }
+            break;
+        case OptBinning: {
+            std::string sa(optarg);
+            std::string::size_type pos = sa.find('x');
+            if (!fromString(binX, sa.substr(0, pos)) ||
+                    !fromString(binY, pos == std::string::npos
+                                ? sa : sa.substr(pos + 1)) ||
+                    binX < 1 || binY < 1) {
+                cerr << m_appName << ": --binning must be N or NxM." << endl;
+                return Error;
+            }}
+            break;
+        case OptHugePages:
+            hugePages = true;
+            break;
+        case OptNoLock:
+            lockMemory = false;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case OptCallbacks:
+            callbacks = true;
+            break;
+        case OptZeroCopy:
+            zeroCopy = true;
+            break;
+        case OptMachine:
+            machineProgress = true;
+            break;
         case 'f':
             force = true;
             break;
@@ -215,6 +530,52 @@ CmdLineOptions::Result CmdLineOptions::parse()
         case 'i':
             info = true;
             break;
+        case 'S':
+            simulate = true;
+            break;
+        case OptSimSize: {
+            std::string sa(optarg);
+            std::string::size_type pos = sa.find('x');
+            if (pos == std::string::npos ||
+                    !fromString(simWidth, sa.substr(0, pos)) ||
+                    !fromString(simHeight, sa.substr(pos + 1)) ||
+                    simWidth <= 0 || simHeight <= 0) {
+                cerr << m_appName << ": --sim-size must be WIDTHxHEIGHT."
+                     << endl;
+                return Error;
+            }}
+            break;
+        case OptSimMissing:
+            if (!fromString(simMissingRate, optarg) ||
+                    simMissingRate < 0 || simMissingRate > 1) {
+                cerr << m_appName
+                     << ": --sim-missing must be a number between 0 and 1."
+                     << endl;
+                return Error;
+            }
+            break;
+        case OptSimDrop:
+            if (!fromString(simDropRate, optarg) ||
+                    simDropRate < 0 || simDropRate > 1) {
+                cerr << m_appName
+                     << ": --sim-drop must be a number between 0 and 1."
+                     << endl;
+                return Error;
+            }
+            break;
+        case OptSimJitter:
+            if (!fromString(simJitter, optarg) || simJitter < 0) {
+                cerr << m_appName
+                     << ": --sim-jitter must be a positive number." << endl;
+                return Error;
+            }
+            break;
+        case OptReplay:
+            replayFile = optarg;
+            break;
+        case OptReplayFast:
+            replayFast = true;
+            break;
         case 'V':
             return Version;
         case 'h':
@@ -229,6 +590,45 @@ CmdLineOptions::Result CmdLineOptions::parse()
     if (list || info)
         return Ok;
 
+    bool segments = segmentFrames > 0 || segmentSize > 0 || segmentTime > 0;
+    if (numFrames == 0 && !segments && preTriggerFrames == 0) {
+        cerr << m_appName << ": -n 0 needs a --seg-* option." << endl;
+        return Error;
+    }
+
+    size_t numCameras = cameraIds.empty() ? 1 : cameraIds.size();
+    if (!cpuSets.empty() && cpuSets.size() != numCameras) {
+        cerr << m_appName << ": --cpus needs one entry per camera." << endl;
+        return Error;
+    }
+
+    if (preTriggerFrames > 0 && segments) {
+        cerr << m_appName << ": --pre cannot be used with --seg-* options."
+             << endl;
+        return Error;
+    }
+
+    bool calibrate = !darkFile.empty() || !flatFile.empty();
+    bool decorated = segments || stackSize > 1 || luckyPercent > 0 ||
+            calibrate;
+    if (zeroCopy && (writer != "mmap" || pixelFormat != "Mono8" ||
+                     preTriggerFrames > 0 || decorated)) {
+        cerr << m_appName << ": --zero-copy needs -w mmap and 8 bit pixels, "
+             << "without --pre, --stack, --lucky, --dark, --flat and --seg-* "
+             << "options." << endl;
+        return Error;
+    }
+
+    if (replayFast && replayFile.empty()) {
+        cerr << m_appName << ": --replay-fast needs --replay." << endl;
+        return Error;
+    }
+
+    if (stackSize > 1 && writer == "rice") {
+        cerr << m_appName << ": --stack cannot be used with -w rice." << endl;
+        return Error;
+    }
+
     if (optind >= m_argc) {
         cerr << m_appName << ": no filename specified." << endl;
         return Error;
@@ -241,6 +641,11 @@ CmdLineOptions::Result CmdLineOptions::parse()
 
     fname = m_argv[optind];
 
+    if (decorated && (writer == "uring" || writer == "uring-direct"))
+        cerr << m_appName << ": warning: -w " << writer << " writes "
+             << "synchronously with --stack, --lucky, --dark, --flat and "
+             << "--seg-* options." << endl;
+
     return Ok;
 }
 
@@ -256,19 +661,56 @@ std::string CmdLineOptions::help() const
     std::stringstream ss;
     ss << usage() << "\n\n"
        << "Options:\n"
-       << "  -n, --count       Number of frames to record (default: " << DefaultNumFrames << ")\n"
+       << "  -n, --count       Number of frames to record, 0 until interrupted (default: " << DefaultNumFrames << ")\n"
        << "  -r, --framerate   Maximum frame rate in Hz (default: " << DefaultFrameRate << ")\n"
        << "  -e, --exposure    Exposure time in miliseconds (default: " << DefaultExposureTime << ")\n"
-       << "  -b, --bits        Bits per pixel, 8 or 16 (default: " << DefaultPixelBits << ")\n"
+       << "  -b, --bits        Bits per pixel, 8, 12 (packed) or 16 (default: " << DefaultPixelBits << ")\n"
        << "  -t, --trigger     Trigger mode (default: " << DefaultTriggerMode << ")\n"
        << "  -d, --delay       Trigger delay in microseconds (default: " << DefaultTriggerMode << ")\n"
-       << "  -c, --camera      Select camera by its unique ID (default: auto)\n"
+       << "  -c, --camera      Comma separated unique IDs of the cameras (default: auto)\n"
+       << "      --roi         Region of interest WIDTHxHEIGHT[+X+Y] in binned pixels\n"
+       << "      --binning     Horizontal and vertical binning, N or NxM (default: 1)\n"
        << "  -N, --buffers     Number of frame buffers (default: " << DefaultNumBuffers << ")\n"
        << "  -m, --mtu         Packet size (default: auto)\n"
-       << "  -B, --bandwidth   Stream bandwidth in MB/s (default: " << DefaultBandwidth << ")\n"
+       << "  -B, --bandwidth   Stream bandwidth in MB/s, shared by all cameras (default: " << DefaultBandwidth << ")\n"
+       << "      --queue       Size of the write queue (default: number of buffers)\n"
+       << "      --overflow    Action on a full write queue, block or drop (default: block)\n"
+       << "      --callbacks   Take frames from driver callbacks, in any completion order\n"
+       << "  -w, --writer      FITS writer, cfitsio, raw, mmap, rice, uring or uring-direct (default: cfitsio),\n"
+       << "                    uring writes synchronously with --stack, --lucky, --dark, --flat or --seg-*\n"
+       << "      --zero-copy   Capture 8 bit frames straight into the file mapping of -w mmap,\n"
+       << "                    not with --pre, --stack, --lucky, --dark, --flat or --seg-*\n"
+       << "      --seg-frames  Start a new file after this number of frames\n"
+       << "      --seg-size    Start a new file after this size in MB\n"
+       << "      --seg-time    Start a new file after this time in seconds\n"
+       << "      --stack       Co-add this many frames into each 32 bit image (default: 1)\n"
+       << "      --lucky       Keep only this percentage of the sharpest frames of each window\n"
+       << "      --lucky-window\n"
+       << "                    Frames per lucky imaging window (default: " << DefaultLuckyWindow << ")\n"
+       << "      --dark        Subtract the master dark in this FITS file from each frame\n"
+       << "      --flat        Divide each frame by the normalized flat field in this FITS file\n"
+       << "      --pre         Record an event with this many frames before and -n after it\n"
+       << "      --event-level Trigger an event on frames with a higher mean pixel value\n"
+       << "      --control     Accept trigger and stop commands on this UNIX socket\n"
+       << "      --stats       Write telemetry to this file, JSON lines or Prometheus (*.prom)\n"
+       << "      --stats-interval\n"
+       << "                    Seconds between telemetry updates (default: 1)\n"
+       << "      --cpus        CPU or CPU range for each camera, e.g. 2,3 or 2-3,4-5\n"
+       << "      --hugepages   Allocate frame buffers from huge pages if available\n"
+       << "      --no-lock     Don't lock the frame buffers into memory\n"
+       << "  -q, --quiet       Don't show the recording progress\n"
+       << "      --machine     Print the progress as key=value lines for other programs\n"
        << "  -f, --force       Overwrite the output file if it already exists\n"
        << "  -l, --list        List available cameras and quit\n"
        << "  -i, --info        Show informations on the available cameras and quit\n"
+       << "  -S, --simulate    Use a simulated camera instead of a real one\n"
+       << "      --sim-size    Sensor size of the simulated camera (default: "
+                << DefaultSimWidth << "x" << DefaultSimHeight << ")\n"
+       << "      --sim-missing Probability of frames with missing data (default: 0)\n"
+       << "      --sim-drop    Probability of dropped frames (default: 0)\n"
+       << "      --sim-jitter  Frame delivery jitter in microseconds (default: 0)\n"
+       << "      --replay      Replay a recorded FITS file instead of using a camera\n"
+       << "      --replay-fast Replay as fast as possible instead of at the recorded timing\n"
        << "  -V, --version     Show program version and quit\n"
        << "  -h, --help        Show this help message and quit";
     return ss.str();
@@ -27,6 +27,7 @@
 #define CMDOPTS_H
 
 #include <string>
+#include <vector>
 
 class CmdLineOptions
 {
@@ -48,13 +49,50 @@ public:
     std::string pixelFormat;
     std::string triggerMode;
     unsigned int triggerDelay;
-    unsigned int cameraId;
+    std::vector<unsigned long> cameraIds;
+    std::vector<std::vector<int> > cpuSets;
+    int roiX;
+    int roiY;
+    int roiWidth;
+    int roiHeight;
+    int binX;
+    int binY;
     unsigned int packetSize;
     double bandwidth;
     int numBuffers;
+    int queueSize;
+    bool dropOnOverflow;
+    bool callbacks;
+    std::string writer;
+    bool zeroCopy;
+    int stackSize;
+    double luckyPercent;
+    int luckyWindow;
+    std::string darkFile;
+    std::string flatFile;
+    bool hugePages;
+    unsigned long segmentFrames;
+    double segmentSize;
+    double segmentTime;
+    int preTriggerFrames;
+    double eventLevel;
+    std::string controlSocket;
+    std::string statsFile;
+    double statsInterval;
+    bool lockMemory;
+    bool quiet;
+    bool machineProgress;
     bool force;
     bool list;
     bool info;
+    bool simulate;
+    int simWidth;
+    int simHeight;
+    double simMissingRate;
+    double simDropRate;
+    double simJitter;
+    std::string replayFile;
+    bool replayFast;
 
 private:
     int m_argc;
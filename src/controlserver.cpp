@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "controlserver.h"
+#include "recorder.h"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// poll timeout in ms, limits the time close() has to wait for the thread
+static const int PollTimeout = 100;
+
+// longest accepted command line
+static const size_t MaxLineLength = 256;
+
+ControlServer::ControlServer(const std::vector<Recorder *> &recorders)
+    : m_recorders(recorders),
+      m_listenFd(-1),
+      m_quit(0)
+{
+}
+
+ControlServer::~ControlServer()
+{
+    close();
+}
+
+bool ControlServer::listen(const std::string &path)
+{
+    close();
+    m_errorStr.clear();
+
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        m_errorStr = "Invalid control socket name '" + path + "'.";
+        return false;
+    }
+    std::strcpy(addr.sun_path, path.c_str());
+
+    // a socket left over by a previous run is replaced, other files are not
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        bind(fd, reinterpret_cast<struct sockaddr *>(&addr),
+             sizeof(addr)) != 0 ||
+        ::listen(fd, 4) != 0)
+    {
+        m_errorStr = "Cannot listen on control socket '" + path + "': " +
+                std::strerror(errno);
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+
+    m_listenFd = fd;
+    m_path = path;
+    __atomic_store_n(&m_quit, 0, __ATOMIC_RELAXED);
+    if (!start()) {
+        m_errorStr = "Cannot start control thread.";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ControlServer::close()
+{
+    __atomic_store_n(&m_quit, 1, __ATOMIC_RELAXED);
+    join();
+
+    if (m_listenFd >= 0) {
+        ::close(m_listenFd);
+        unlink(m_path.c_str());
+        m_listenFd = -1;
+    }
+    m_path.clear();
+}
+
+bool ControlServer::isListening() const
+{
+    return m_listenFd >= 0;
+}
+
+std::string ControlServer::lastError() const
+{
+    return m_errorStr;
+}
+
+void ControlServer::run()
+{
+    int clientFd = -1;
+    std::string line;
+
+    while (!__atomic_load_n(&m_quit, __ATOMIC_RELAXED))
+    {
+        // serve one client at a time, others wait in the listen backlog
+        struct pollfd pfd;
+        pfd.fd = (clientFd >= 0) ? clientFd : m_listenFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, PollTimeout) <= 0)
+            continue;
+
+        if (clientFd < 0) {
+            clientFd = accept(m_listenFd, 0, 0);
+            line.clear();
+            continue;
+        }
+
+        char buf[128];
+        ssize_t n = read(clientFd, buf, sizeof(buf));
+        if (n <= 0) {
+            ::close(clientFd);
+            clientFd = -1;
+            continue;
+        }
+
+        line.append(buf, n);
+        std::string::size_type pos;
+        while ((pos = line.find('\n')) != std::string::npos) {
+            std::string reply = execute(line.substr(0, pos)) + "\n";
+            line.erase(0, pos + 1);
+            if (send(clientFd, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)
+                break;
+        }
+        if (line.size() > MaxLineLength) {
+            ::close(clientFd);
+            clientFd = -1;
+        }
+    }
+
+    if (clientFd >= 0)
+        ::close(clientFd);
+}
+
+std::string ControlServer::execute(const std::string &command)
+{
+    // ignore surrounding white space, e.g. from "\r\n" line endings
+    const char *ws = " \t\r";
+    std::string::size_type first = command.find_first_not_of(ws);
+    if (first == std::string::npos)
+        return "error: empty command";
+    std::string cmd = command.substr(
+            first, command.find_last_not_of(ws) - first + 1);
+
+    if (cmd != "trigger" && cmd != "stop")
+        return "error: unknown command '" + cmd + "'";
+
+    for (size_t i = 0; i < m_recorders.size(); ++i) {
+        if (cmd == "trigger")
+            m_recorders[i]->triggerEvent();
+        else
+            m_recorders[i]->stop();
+    }
+    return "ok";
+}
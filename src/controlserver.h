@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_CONTROLSERVER_H
+#define PVREC_CONTROLSERVER_H
+
+#include "thread.h"
+#include <string>
+#include <vector>
+
+class Recorder;
+
+/*
+    Listens on a local UNIX socket for line based commands and forwards them
+    to the running recorders. Known commands are "trigger" and "stop", each one
+    is answered with "ok" or "error: <message>".
+ */
+class ControlServer : private Thread
+{
+public:
+    explicit ControlServer(const std::vector<Recorder *> &recorders);
+    virtual ~ControlServer();
+
+    bool listen(const std::string &path);
+    void close();
+    bool isListening() const;
+
+    std::string lastError() const;
+
+protected:
+    virtual void run();
+    std::string execute(const std::string &command);
+
+private:
+    std::vector<Recorder *> m_recorders;
+    std::string m_path;
+    int m_listenFd;
+    int m_quit;
+    std::string m_errorStr;
+};
+
+#endif // PVREC_CONTROLSERVER_H
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "cubereader.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// parses an integer key, false if it is missing or not an integer
+static bool intKey(const FitsHeader &header, const char *keyname, long &value)
+{
+    std::string s = header.value(keyname);
+    if (s.empty())
+        return false;
+    char *end;
+    errno = 0;
+    value = std::strtol(s.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+static long long getBigEndian64(const unsigned char *p)
+{
+    unsigned long long v = 0;
+    for (int i = 0; i < 8; ++i)
+        v = (v << 8) | p[i];
+    return (long long)v;
+}
+
+CubeReader::CubeReader()
+    : m_data(0),
+      m_size(0),
+      m_dataOffset(0),
+      m_pixelType(FitsWriter::Uint8),
+      m_width(0),
+      m_height(0),
+      m_count(0),
+      m_frameSize(0),
+      m_tableOffset(0),
+      m_tableRows(0),
+      m_rowSize(0)
+{
+}
+
+CubeReader::~CubeReader()
+{
+    close();
+}
+
+bool CubeReader::open(const std::string &fname)
+{
+    close();
+
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd < 0) {
+        setSysError("Cannot open the file '" + fname + "'.", errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        setSysError("Cannot stat the file '" + fname + "'.", errno);
+        ::close(fd);
+        return false;
+    }
+    if (st.st_size < off_t(FitsHeader::BlockSize)) {
+        setError("The file '" + fname + "' is not a FITS file.");
+        ::close(fd);
+        return false;
+    }
+
+    // the mapping stays valid after closing the file
+    m_size = size_t(st.st_size);
+    void *p = mmap(0, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        setSysError("Cannot map the file '" + fname + "'.", errno);
+        m_size = 0;
+        return false;
+    }
+    m_data = static_cast<const unsigned char *>(p);
+    m_fname = fname;
+
+    if (!parseImage()) {
+        std::string error = m_errorStr;
+        close();
+        m_errorStr = error;
+        return false;
+    }
+    parseFrameTable(m_dataOffset +
+                    FitsHeader::roundUpToBlock(m_count * m_frameSize));
+    return true;
+}
+
+void CubeReader::close()
+{
+    if (m_data)
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+    m_data = 0;
+    m_size = 0;
+    m_fname.clear();
+    m_header.clear();
+    m_dataOffset = 0;
+    m_pixelType = FitsWriter::Uint8;
+    m_width = m_height = 0;
+    m_count = 0;
+    m_frameSize = 0;
+    m_tableHeader.clear();
+    m_tableOffset = 0;
+    m_tableRows = 0;
+    m_rowSize = 0;
+}
+
+bool CubeReader::isOpen() const
+{
+    return m_data != 0;
+}
+
+bool CubeReader::parseImage()
+{
+    const std::string fileStr = " in '" + m_fname + "'.";
+    if (!m_header.parse(reinterpret_cast<const char *>(m_data), m_size,
+                        m_dataOffset) || m_header.value("SIMPLE") != "T") {
+        setError("No valid primary FITS header" + fileStr);
+        return false;
+    }
+
+    long bitpix, naxis, width, height, count = 1, bzero = 0;
+    if (!intKey(m_header, "BITPIX", bitpix) ||
+            !intKey(m_header, "NAXIS", naxis)) {
+        setError("BITPIX or NAXIS missing" + fileStr);
+        return false;
+    }
+    if (naxis == 0) {
+        setError("No image in the primary HDU, compressed files are not"
+                 " supported" + fileStr);
+        return false;
+    }
+    if ((naxis != 2 && naxis != 3) ||
+            !intKey(m_header, "NAXIS1", width) ||
+            !intKey(m_header, "NAXIS2", height) ||
+            (naxis == 3 && !intKey(m_header, "NAXIS3", count)) ||
+            width < 1 || height < 1 || count < 0) {
+        setError("No valid image cube" + fileStr);
+        return false;
+    }
+    if (m_header.contains("BZERO") && !intKey(m_header, "BZERO", bzero)) {
+        setError("Invalid BZERO" + fileStr);
+        return false;
+    }
+
+    if (bitpix == 8 && bzero == 0)
+        m_pixelType = FitsWriter::Uint8;
+    else if (bitpix == 16 && bzero == 0)
+        m_pixelType = FitsWriter::Int16;
+    else if (bitpix == 16 && bzero == 32768)
+        m_pixelType = FitsWriter::Uint16;
+    else if (bitpix == 32 && bzero == 0)
+        m_pixelType = FitsWriter::Int32;
+    else {
+        setError("Unsupported BITPIX or BZERO" + fileStr);
+        return false;
+    }
+
+    m_width = int(width);
+    m_height = int(height);
+    m_count = count;
+    m_frameSize = size_t(width) * height
+                * FitsWriter::bytesPerPixel(m_pixelType);
+    if (m_dataOffset + m_count * m_frameSize > m_size) {
+        setError("The image data is truncated" + fileStr);
+        return false;
+    }
+    return true;
+}
+
+// only tables with the INDEX column written by FrameTable are used, other
+// extensions are ignored
+void CubeReader::parseFrameTable(size_t offset)
+{
+    FitsHeader &h = m_tableHeader;
+    size_t headerSize;
+    long rowSize, numRows, pcount = 0;
+    if (offset >= m_size ||
+            !h.parse(reinterpret_cast<const char *>(m_data) + offset,
+                     m_size - offset, headerSize) ||
+            h.value("XTENSION") != "BINTABLE" ||
+            h.value("EXTNAME") != "FRAMEINFO" ||
+            h.value("TTYPE1") != "INDEX" || h.value("TFORM1") != "1K" ||
+            !intKey(h, "NAXIS1", rowSize) || !intKey(h, "NAXIS2", numRows) ||
+            (h.contains("PCOUNT") && !intKey(h, "PCOUNT", pcount)) ||
+            rowSize < 8 || numRows < 0 || pcount != 0 ||
+            offset + headerSize + size_t(rowSize) * numRows > m_size) {
+        h.clear();
+        return;
+    }
+
+    m_tableOffset = offset + headerSize;
+    m_tableRows = numRows;
+    m_rowSize = size_t(rowSize);
+}
+
+const FitsHeader & CubeReader::header() const
+{
+    return m_header;
+}
+
+FitsWriter::PixelType CubeReader::pixelType() const
+{
+    return m_pixelType;
+}
+
+int CubeReader::width() const
+{
+    return m_width;
+}
+
+int CubeReader::height() const
+{
+    return m_height;
+}
+
+long CubeReader::numFrames() const
+{
+    return m_count;
+}
+
+size_t CubeReader::frameSize() const
+{
+    return m_frameSize;
+}
+
+const unsigned char * CubeReader::frame(long index) const
+{
+    if (index < 1 || index > m_count)
+        return 0;
+    return m_data + m_dataOffset + (index - 1) * m_frameSize;
+}
+
+long CubeReader::pixel(long index, int x, int y) const
+{
+    const unsigned char *p = frame(index);
+    if (!p || x < 0 || x >= m_width || y < 0 || y >= m_height)
+        return 0;
+
+    int bpp = FitsWriter::bytesPerPixel(m_pixelType);
+    p += (size_t(y) * m_width + x) * bpp;
+    switch (m_pixelType)
+    {
+    case FitsWriter::Uint8:
+        return p[0];
+    case FitsWriter::Int16:
+        return short((p[0] << 8) | p[1]);
+    case FitsWriter::Uint16:
+        return long(short((p[0] << 8) | p[1])) + 32768;
+    case FitsWriter::Int32:
+        return int((unsigned(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+    }
+    return 0;
+}
+
+void CubeReader::adviseFrames(long first, long last, bool sequential) const
+{
+    if (!frame(first) || !frame(last) || first > last)
+        return;
+
+    // madvise() needs a page aligned start
+    size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+    size_t begin = size_t(frame(first) - m_data);
+    size_t end = size_t(frame(last) - m_data) + m_frameSize;
+    begin -= begin % pageSize;
+    void *addr = const_cast<unsigned char *>(m_data + begin);
+    if (sequential) {
+        madvise(addr, end - begin, MADV_SEQUENTIAL);
+        madvise(addr, end - begin, MADV_WILLNEED);
+    } else {
+        madvise(addr, end - begin, MADV_RANDOM);
+    }
+}
+
+bool CubeReader::hasFrameTable() const
+{
+    return m_rowSize != 0;
+}
+
+const FitsHeader & CubeReader::frameTableHeader() const
+{
+    return m_tableHeader;
+}
+
+long CubeReader::numTableRows() const
+{
+    return m_tableRows;
+}
+
+size_t CubeReader::tableRowSize() const
+{
+    return m_rowSize;
+}
+
+const unsigned char * CubeReader::tableRow(long row) const
+{
+    if (row < 0 || row >= m_tableRows)
+        return 0;
+    return m_data + m_tableOffset + row * m_rowSize;
+}
+
+long CubeReader::tableRowIndex(long row) const
+{
+    const unsigned char *p = tableRow(row);
+    return p ? long(getBigEndian64(p)) : 0;
+}
+
+std::string CubeReader::lastError() const
+{
+    return m_errorStr;
+}
+
+void CubeReader::setError(const std::string &msg)
+{
+    m_errorStr = msg;
+}
+
+void CubeReader::setSysError(const std::string &msg, int errnum)
+{
+    setError(msg + " " + std::strerror(errnum) + ".");
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_CUBEREADER_H
+#define PVREC_CUBEREADER_H
+
+#include "fitsheader.h"
+#include "fitswriter.h"
+#include <string>
+
+/*
+    Read-only access to the FITS cubes recorded by pvrec, without CFITSIO.
+
+    The file is mapped into memory, so a frame is found by its offset and
+    only the pages of the frames actually read are loaded from disk. The
+    primary HDU must hold the uncompressed cube, as written by all writers
+    except the compressing one. The FRAMEINFO table following the cube is
+    optional.
+ */
+class CubeReader
+{
+public:
+    CubeReader();
+    ~CubeReader();
+
+    bool open(const std::string &fname);
+    void close();
+    bool isOpen() const;
+
+    const FitsHeader & header() const;
+    FitsWriter::PixelType pixelType() const;
+    int width() const;
+    int height() const;
+    long numFrames() const;
+    size_t frameSize() const;
+
+    // big endian pixels of the frame index, counted from 1 like the INDEX
+    // column of the frame table. Consecutive frames follow without gaps.
+    const unsigned char * frame(long index) const;
+
+    // value of a single pixel, x and y counted from 0
+    long pixel(long index, int x, int y) const;
+
+    // tells the kernel that the frames first to last are read soon, either
+    // sequentially or only a few bytes of each frame
+    void adviseFrames(long first, long last, bool sequential) const;
+
+    // raw rows of the FRAMEINFO table, counted from 0; files without table
+    // have no rows
+    bool hasFrameTable() const;
+    const FitsHeader & frameTableHeader() const;
+    long numTableRows() const;
+    size_t tableRowSize() const;
+    const unsigned char * tableRow(long row) const;
+    long tableRowIndex(long row) const;
+
+    std::string lastError() const;
+
+private:
+    CubeReader(const CubeReader &);
+    CubeReader & operator=(const CubeReader &);
+
+    bool parseImage();
+    void parseFrameTable(size_t offset);
+    void setError(const std::string &msg);
+    void setSysError(const std::string &msg, int errnum);
+
+    std::string m_fname;
+    const unsigned char *m_data;
+    size_t m_size;
+
+    FitsHeader m_header;
+    size_t m_dataOffset;
+    FitsWriter::PixelType m_pixelType;
+    int m_width;
+    int m_height;
+    long m_count;
+    size_t m_frameSize;
+
+    FitsHeader m_tableHeader;
+    size_t m_tableOffset;
+    long m_tableRows;
+    size_t m_rowSize;
+
+    std::string m_errorStr;
+};
+
+#endif // PVREC_CUBEREADER_H
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fitsheader.h"
+
+#include <cassert>
+#include <cstdio>
+#include <ctime>
+#include <fitsio.h>
+
+const size_t FitsHeader::BlockSize;
+const size_t FitsHeader::CardSize;
+
+FitsHeader::FitsHeader()
+    : m_size(0)
+{
+}
+
+void FitsHeader::clear()
+{
+    m_cards.clear();
+    m_size = 0;
+}
+
+bool FitsHeader::setCard(const std::string &card)
+{
+    assert(card.size() == CardSize);
+
+    // replace an existing key in place
+    std::vector<std::string>::iterator it = m_cards.begin();
+    for (; it != m_cards.end(); ++it) {
+        if (it->compare(0, 8, card, 0, 8) == 0) {
+            *it = card;
+            return true;
+        }
+    }
+
+    // keep one card for the END keyword
+    if (m_size != 0 && (m_cards.size() + 2) * CardSize > m_size)
+        return false;
+
+    m_cards.push_back(card);
+    return true;
+}
+
+bool FitsHeader::set(const std::string &keyname, const std::string &value,
+                     const char *comment)
+{
+    return setCard(card(keyname, value, comment));
+}
+
+bool FitsHeader::setDate()
+{
+    char date[32];
+    time_t now = std::time(0);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::gmtime(&now));
+    return set("DATE", stringValue(date),
+               "file creation date (YYYY-MM-DDThh:mm:ss UT)");
+}
+
+bool FitsHeader::setKey(int datatype, const char *keyname, void *value,
+                        const char *comment)
+{
+    std::string s;
+    switch (datatype)
+    {
+    case TSTRING:
+        s = stringValue(static_cast<const char *>(value));
+        break;
+    case TLOGICAL:
+        s = logicalValue(*static_cast<int *>(value) != 0);
+        break;
+    case TBYTE:
+        s = intValue(int(*static_cast<unsigned char *>(value)));
+        break;
+    case TSHORT:
+        s = intValue(*static_cast<short *>(value));
+        break;
+    case TUSHORT:
+        s = intValue(*static_cast<unsigned short *>(value));
+        break;
+    case TINT:
+        s = intValue(*static_cast<int *>(value));
+        break;
+    case TUINT:
+        s = intValue(*static_cast<unsigned int *>(value));
+        break;
+    case TLONG:
+        s = intValue(*static_cast<long *>(value));
+        break;
+    case TULONG:
+        s = intValue(*static_cast<unsigned long *>(value));
+        break;
+    case TLONGLONG:
+        s = intValue(*static_cast<LONGLONG *>(value));
+        break;
+    case TFLOAT:
+        s = floatValue(*static_cast<float *>(value), 7);
+        break;
+    case TDOUBLE:
+        s = floatValue(*static_cast<double *>(value), 15);
+        break;
+    default:
+        return false;
+    }
+
+    return set(keyname, s, comment);
+}
+
+bool FitsHeader::parse(const char *data, size_t size, size_t &headerSize)
+{
+    clear();
+    const std::string blank(CardSize, ' ');
+    for (size_t pos = 0; pos + CardSize <= size; pos += CardSize) {
+        std::string card(data + pos, CardSize);
+        if (card.compare(0, 8, "END     ") == 0) {
+            headerSize = roundUpToBlock(pos + CardSize);
+            return headerSize <= size;
+        }
+        if (card != blank)
+            m_cards.push_back(card);
+    }
+    clear();
+    return false;
+}
+
+// the card of a key, 0 if it is missing
+static const std::string * findCard(const std::vector<std::string> &cards,
+                                    const std::string &keyname)
+{
+    std::string key(keyname);
+    key.resize(8, ' ');
+    for (std::vector<std::string>::const_iterator it = cards.begin();
+            it != cards.end(); ++it)
+        if (it->compare(0, 8, key) == 0)
+            return &*it;
+    return 0;
+}
+
+std::string FitsHeader::value(const std::string &keyname) const
+{
+    const std::string *card = findCard(m_cards, keyname);
+    if (!card || card->compare(8, 2, "= ") != 0)
+        return std::string();
+
+    std::string::size_type pos = card->find_first_not_of(' ', 10);
+    if (pos == std::string::npos)
+        return std::string();
+
+    std::string value;
+    if ((*card)[pos] == '\'') {
+        // quotes in strings are doubled, trailing blanks are not significant
+        for (++pos; pos < card->size(); ++pos) {
+            if ((*card)[pos] == '\'') {
+                if (pos + 1 >= card->size() || (*card)[pos + 1] != '\'')
+                    break;
+                ++pos;
+            }
+            value += (*card)[pos];
+        }
+        pos = value.find_last_not_of(' ');
+        value.erase(pos == std::string::npos ? 0 : pos + 1);
+    } else {
+        std::string::size_type end = card->find_first_of(" /", pos);
+        value = card->substr(pos, end == std::string::npos
+                                  ? std::string::npos : end - pos);
+    }
+    return value;
+}
+
+bool FitsHeader::contains(const std::string &keyname) const
+{
+    return findCard(m_cards, keyname) != 0;
+}
+
+void FitsHeader::reserve(size_t spareBlocks)
+{
+    m_size = roundUpToBlock((m_cards.size() + 1) * CardSize)
+            + spareBlocks * BlockSize;
+}
+
+size_t FitsHeader::size() const
+{
+    return m_size;
+}
+
+size_t FitsHeader::numCards() const
+{
+    return m_cards.size();
+}
+
+std::string FitsHeader::toString() const
+{
+    std::string header;
+    header.reserve(m_size);
+    for (std::vector<std::string>::const_iterator it = m_cards.begin();
+            it != m_cards.end(); ++it)
+        header += *it;
+
+    // spare space is filled with blank cards in front of END, like CFITSIO
+    // does it, so the data unit starts right after the reserved header
+    if (m_size != 0)
+        header.resize(m_size - CardSize, ' ');
+    header += std::string("END").append(CardSize - 3, ' ');
+    header.resize(roundUpToBlock(header.size()), ' ');
+    return header;
+}
+
+size_t FitsHeader::roundUpToBlock(size_t size)
+{
+    return ((size + BlockSize - 1) / BlockSize) * BlockSize;
+}
+
+std::string FitsHeader::card(const std::string &keyname,
+                             const std::string &value, const char *comment)
+{
+    std::string card(keyname);
+    card.resize(8, ' ');
+    card += "= " + value;
+    if (comment && *comment)
+        card += std::string(" / ") + comment;
+    card.resize(CardSize, ' ');
+    return card;
+}
+
+// fixed format: numbers and logicals are right justified up to column 30
+std::string FitsHeader::fixedValue(const std::string &value)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%20s", value.c_str());
+    return buf;
+}
+
+std::string FitsHeader::floatValue(double value, int precision)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.*G", precision, value);
+
+    // FITS requires a decimal point in floating point values
+    std::string s(buf);
+    if (s.find('.') == std::string::npos) {
+        std::string::size_type pos = s.find('E');
+        if (pos == std::string::npos)
+            s += ".0";
+        else
+            s.insert(pos, ".0");
+    }
+    return fixedValue(s);
+}
+
+// quotes are doubled first, then the string is cut so that the closing
+// quote still fits into the card after "KEYNAME = "
+std::string FitsHeader::stringValue(const char *value)
+{
+    const size_t maxSize = CardSize - 11;
+    std::string s("'");
+    for (const char *c = value; *c; ++c) {
+        size_t n = (*c == '\'') ? 2 : 1;
+        if (s.size() + n > maxSize)
+            break;
+        s.append(n, *c);
+    }
+    // strings are padded to at least 8 characters
+    while (s.size() < 9)
+        s += ' ';
+    return s + "'";
+}
+
+std::string FitsHeader::logicalValue(bool value)
+{
+    return fixedValue(value ? "T" : "F");
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_FITSHEADER_H
+#define PVREC_FITSHEADER_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+
+/*
+    In-memory FITS header made of 80 character cards, used by the writers
+    which create FITS files without CFITSIO and by the cube reader.
+
+    Once the size is fixed by reserve(), the header can be rewritten in place
+    and new cards are only accepted as long as they fit.
+ */
+class FitsHeader
+{
+public:
+    static const size_t BlockSize = 2880;
+    static const size_t CardSize = 80;
+
+    FitsHeader();
+
+    void clear();
+
+    // replaces a card with the same keyword or appends it
+    bool setCard(const std::string &card);
+
+    // sets a key to an already formatted value
+    bool set(const std::string &keyname, const std::string &value,
+             const char *comment);
+
+    // sets DATE to the current time
+    bool setDate();
+
+    // sets a key using a CFITSIO datatype code, false if the datatype is not
+    // supported or the header is full
+    bool setKey(int datatype, const char *keyname, void *value,
+                const char *comment);
+
+    // reads the cards in front of END, blank cards are dropped. headerSize
+    // receives the size including the padding of the last block, false if
+    // there is no END within size bytes
+    bool parse(const char *data, size_t size, size_t &headerSize);
+
+    // the value of a key without comment, strings without quotes, an empty
+    // string if the key is missing
+    std::string value(const std::string &keyname) const;
+    bool contains(const std::string &keyname) const;
+
+    // fixes the size to the current cards plus some spare blocks
+    void reserve(size_t spareBlocks);
+
+    size_t size() const;
+    size_t numCards() const;
+
+    // all cards followed by END, padded to size()
+    std::string toString() const;
+
+    static size_t roundUpToBlock(size_t size);
+
+    static std::string card(const std::string &keyname,
+                            const std::string &value, const char *comment);
+    static std::string fixedValue(const std::string &value);
+    static std::string floatValue(double value, int precision);
+    // quoted string, long strings are cut to fit into a card
+    static std::string stringValue(const char *value);
+    static std::string logicalValue(bool value);
+    template <class T> static std::string intValue(T value);
+
+private:
+    std::vector<std::string> m_cards;
+    size_t m_size;
+};
+
+template <class T>
+std::string FitsHeader::intValue(T value)
+{
+    std::ostringstream ss;
+    ss << value;
+    return fixedValue(ss.str());
+}
+
+#endif // PVREC_FITSHEADER_H
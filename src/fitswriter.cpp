@@ -24,154 +24,111 @@
  */
 
 #include "fitswriter.h"
+#include "cfitsiowriter.h"
+#include "rawfitswriter.h"
+#include "mmapfitswriter.h"
+#include "ricefitswriter.h"
+#include "uringfitswriter.h"
 #include <sstream>
-#include <cassert>
 
-FitsWriter::FitsWriter(const std::string &fname, PixelType pixelType,
-                       int width, int height, int count, bool clobber)
-    : m_pixelType(Uint8),
-      m_width(0),
-      m_height(0),
-      m_count(0),
-      m_file(0),
-      m_clobber(false)
+FitsWriter * FitsWriter::create(Backend backend)
 {
-    open(fname, pixelType, width, height, count, clobber);
+    switch (backend)
+    {
+    case Raw:
+        return new RawFitsWriter;
+    case Mmap:
+        return new MmapFitsWriter;
+    case Rice:
+        return new RiceFitsWriter;
+    case Uring:
+        return new UringFitsWriter;
+    case UringDirect:
+        return new UringFitsWriter(true);
+    case Cfitsio:
+    default:
+        return new CfitsioWriter;
+    }
 }
 
-FitsWriter::~FitsWriter()
+int FitsWriter::bytesPerPixel(PixelType pixelType)
 {
-    close();
+    switch (pixelType)
+    {
+    case Int16:
+    case Uint16:
+        return 2;
+    case Int32:
+        return 4;
+    case Uint8:
+    default:
+        return 1;
+    }
 }
 
-bool FitsWriter::open(const std::string &fname, PixelType pixelType,
-                      int width, int height, int count, bool clobber)
+FitsWriter::FitsWriter()
+    : m_bytesWritten(0)
 {
-    clearError();
-
-    if (m_file) {
-        setError("File already opened.");
-        return false;
-    }
-
-    assert(m_fname.empty());
-    assert(m_clobber == false);
-    assert(m_pixelType == Uint8);
-    assert(m_width == 0);
-    assert(m_height == 0);
-    assert(m_count == 0);
-
-    if (width <= 0 || height <= 0 || count <= 0) {
-        setError("Invalid width, height or count.");
-        return false;
-    }    
-
-    int status = 0;
-    std::string fnameClobber = clobber ? ("!" + fname) : fname;
-    fits_create_file(&m_file, fnameClobber.c_str(), &status);
-    if (status != 0) {
-        setError("Cannot create the file '" + fname + "'.", status);
-        return false;
-    }
+}
 
-    long naxes[3];
-    naxes[0] = width;
-    naxes[1] = height;
-    naxes[2] = count;
-    int imageType = (pixelType == Int16) ? SHORT_IMG : BYTE_IMG;
-    fits_create_img(m_file, imageType, 3, naxes, &status);
-    if (status != 0) {
-        setError("Cannot allocate file space.", status);
-        close();
-        return false;
-    }
+FitsWriter::~FitsWriter()
+{
+}
 
-    // try to remove the 2 default comments entries from the header
-    fits_delete_key(m_file, "COMMENT", &status);
-    fits_delete_key(m_file, "COMMENT", &status);
+bool FitsWriter::writeFrameInfo(long index, const FrameInfo &info)
+{
+    clearError();
 
-    // write time stamp to the header
-    fits_write_date(m_file, &status);
-    if (status != 0) {
-        setError("Cannot write date.", status);
-        close();
+    if (!isOpen()) {
+        setError("Cannot write frame info, file not open.");
         return false;
     }
 
-    m_fname = fname;
-    m_clobber = clobber;
-    m_pixelType = pixelType;
-    m_width = width;
-    m_height = height;
-    m_count = count;
-
+    m_frameTable.append(index, info);
+    if (m_frameTable.hasFullBatch())
+        return flushFrameTable();
     return true;
 }
 
-void FitsWriter::close()
+bool FitsWriter::isAsync() const
 {
-    if (!m_file)
-        return;
-
-    int status = 0;
-    fits_close_file(m_file, &status);
-
-    m_fname.clear();
-    m_pixelType = Uint8;
-    m_width = 0;
-    m_height = 0;
-    m_count = 0;
-    m_file = 0;
-    m_clobber = false;
+    return false;
 }
 
-bool FitsWriter::isOpen() const
+bool FitsWriter::submitFrame(long, unsigned char *, void *)
 {
-    return m_file != 0;
+    setError("Asynchronous writes are not supported by this writer.");
+    return false;
 }
 
-bool FitsWriter::writeFrame(long index, unsigned char *data)
+bool FitsWriter::reapFrames(std::vector<CompletedWrite> &, bool)
 {
-    clearError();
-
-    if (!isOpen()) {
-        setError("Cannot write frame, file not open.");
-        return false;
-    }
-
-    if (index < 1 || index > m_count) {
-        setError("Frame index out of bounds.");
-        return false;
-    }
-
-    int status = 0;
-    int dataType = (m_pixelType == Int16) ? TSHORT : TBYTE;
-    long fpixel[3] = { 1, 1, 0 };
-    fpixel[2] += index;
-    LONGLONG nelem = m_width * m_height;
+    return true;
+}
 
-    fits_write_pix(m_file, dataType, fpixel, nelem, data, &status);
-    if (status != 0) {
-        setError("Cannot write frame.", status);
-        return false;
-    }
+int FitsWriter::pendingFrames() const
+{
+    return 0;
+}
 
-    return true;
+void FitsWriter::setFrameBuffers(const std::vector<unsigned char *> &)
+{
 }
 
-bool FitsWriter::writeKey(int datatype, const char *keyname, void *value,
-                          const char *comment)
+unsigned char * FitsWriter::frameBuffer(long)
 {
-    clearError();
+    return 0;
+}
 
-    int status = 0;
-    fits_write_key(m_file, datatype, keyname, value, comment, &status);
-    if (status != 0) {
-        setError("Cannot write header entry.", status);
-        return false;
-    }
+unsigned long long FitsWriter::bytesWritten() const
+{
+    return __atomic_load_n(&m_bytesWritten, __ATOMIC_RELAXED);
+}
 
-    return true;
+void FitsWriter::addBytesWritten(size_t bytes)
+{
+    __atomic_add_fetch(&m_bytesWritten, (unsigned long long)bytes,
+                       __ATOMIC_RELAXED);
 }
 
 std::string FitsWriter::lastError() const
@@ -198,3 +155,13 @@ void FitsWriter::clearError() const
 {
     m_errorStr.clear();
 }
+
+FrameTable & FitsWriter::frameTable()
+{
+    return m_frameTable;
+}
+
+bool FitsWriter::flushFrameTable()
+{
+    return true;
+}
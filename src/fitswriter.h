@@ -26,42 +26,103 @@
 #ifndef FITSWRITER_H
 #define FITSWRITER_H
 
+#include "frametable.h"
 #include <string>
+#include <vector>
 #include <fitsio.h>
 
+/*
+    Interface for writing frames into a 3-dimensional FITS image.
+
+    Header keys are passed using the CFITSIO datatype codes (TSTRING, TULONG,
+    ...) for all backends. Frame metadata is collected in memory and written
+    as FRAMEINFO binary table extension when the file is closed.
+ */
 class FitsWriter
 {
 public:
-    enum PixelType { Uint8, Int16 };
+    // Uint16 is stored as 16 bit signed integers with BZERO = 32768, Int32
+    // holds co-added frames
+    enum PixelType { Uint8, Int16, Uint16, Int32 };
+    enum Backend { Cfitsio, Raw, Mmap, Rice, Uring, UringDirect };
+
+    // result of a frame written by an asynchronous writer
+    struct CompletedWrite
+    {
+        void *tag;
+        bool ok;
+    };
+
+    // returns a new writer, which is not opened yet
+    static FitsWriter * create(Backend backend);
+
+    static int bytesPerPixel(PixelType pixelType);
 
-    FitsWriter(const std::string &fname, PixelType pixelType,
-               int width, int height, int count, bool clobber = false);
     virtual ~FitsWriter();
 
-    bool open(const std::string &fname, PixelType pixelType,
-              int width, int height, int count, bool clobber = false);
-    void close();
-    bool isOpen() const;
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count,
+                      bool clobber = false) = 0;
+    virtual void close() = 0;
+    virtual bool isOpen() const = 0;
+
+    virtual bool writeFrame(long index, unsigned char *data) = 0;
+    virtual bool writeKey(int datatype, const char *keyname, void *value,
+                          const char *comment) = 0;
+
+    // changes the number of frames (NAXIS3) of an opened file
+    virtual bool resize(int count) = 0;
 
-    bool writeFrame(long index, unsigned char *data);
-    bool writeKey(int datatype, const char *keyname, void *value,
-                  const char *comment);
+    // adds a row to the frame table
+    virtual bool writeFrameInfo(long index, const FrameInfo &info);
+
+    // Asynchronous writers accept frames with submitFrame() and report them
+    // back with reapFrames(), the data must stay untouched until then. The
+    // tag identifies the frame in the completion. The default
+    // implementations are for synchronous writers, which only support
+    // writeFrame(). The decorating writers are synchronous as well, they
+    // write through writeFrame() of the writer they wrap.
+    virtual bool isAsync() const;
+    virtual bool submitFrame(long index, unsigned char *data, void *tag);
+    virtual bool reapFrames(std::vector<CompletedWrite> &done, bool wait);
+    virtual int pendingFrames() const;
+
+    // announces the buffers frames are passed in, so that a writer can
+    // prepare them for faster I/O; each buffer holds at least one frame
+    virtual void setFrameBuffers(const std::vector<unsigned char *> &buffers);
+
+    // memory the frame at index is stored in, if the writer can take frames
+    // in place; writeFrame() with this buffer then doesn't copy any data
+    virtual unsigned char * frameBuffer(long index);
+
+    // image data passed to the file since the writer was created, after
+    // conversion or compression; decorating writers report the writer they
+    // wrap. A running total, the writer thread counts the increase per frame.
+    virtual unsigned long long bytesWritten() const;
 
     std::string lastError() const;
 
 protected:
+    FitsWriter();
     void setError(const std::string &msg, int code = 0) const;
     void clearError() const;
 
+    // safe to call from helper threads of the writer
+    void addBytesWritten(size_t bytes);
+
+    FrameTable & frameTable();
+    // called by writeFrameInfo() whenever the table holds a full batch;
+    // writers which can append rows to the file while recording write the
+    // batch and drop it, by default all rows are kept until close()
+    virtual bool flushFrameTable();
+
 private:
+    FitsWriter(const FitsWriter &);
+    FitsWriter & operator=(const FitsWriter &);
+
     mutable std::string m_errorStr;
-    std::string m_fname;
-    PixelType m_pixelType;
-    int m_width;
-    int m_height;
-    int m_count;
-    fitsfile *m_file;
-    bool m_clobber;
+    FrameTable m_frameTable;
+    unsigned long long m_bytesWritten;
 };
 
 #endif // FITSWRITER_H
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "framepool.h"
+
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// size of the huge pages used with MAP_HUGETLB (x86 default)
+static const size_t HugePageSize = 2 * 1024 * 1024;
+
+static size_t roundUp(size_t size, size_t alignment)
+{
+    return ((size + alignment - 1) / alignment) * alignment;
+}
+
+FramePool::FramePool()
+    : m_hugePages(false),
+      m_lockMemory(true),
+      m_locked(false),
+      m_hugePageBacked(false),
+      m_mappedHugePages(false),
+      m_memory(0),
+      m_memorySize(0),
+      m_bufferSize(0)
+{
+}
+
+FramePool::~FramePool()
+{
+    release();
+}
+
+void FramePool::setHugePages(bool enable)
+{
+    m_hugePages = enable;
+}
+
+bool FramePool::hugePages() const
+{
+    return m_hugePages;
+}
+
+void FramePool::setLockMemory(bool enable)
+{
+    m_lockMemory = enable;
+}
+
+bool FramePool::lockMemory() const
+{
+    return m_lockMemory;
+}
+
+bool FramePool::allocate(int count, size_t bufferSize)
+{
+    m_errorStr.clear();
+
+    // reuse the existing buffers, only reset the frame structures
+    bool reuse = m_memory && count == int(m_frames.size()) &&
+            bufferSize == m_bufferSize && m_hugePages == m_mappedHugePages;
+    if (reuse && m_lockMemory && !m_locked)
+        m_locked = (mlock(m_memory, m_memorySize) == 0);
+
+    if (!reuse) {
+        release();
+        if (count <= 0 || bufferSize == 0)
+            return true;
+
+        size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+        size_t stride = roundUp(bufferSize, pageSize);
+        m_memorySize = stride * size_t(count);
+
+        void *memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (m_hugePages) {
+            m_memorySize = roundUp(m_memorySize, HugePageSize);
+            memory = mmap(0, m_memorySize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            m_hugePageBacked = (memory != MAP_FAILED);
+        }
+#endif
+        // fall back to normal pages if no huge pages are available
+        if (memory == MAP_FAILED)
+            memory = mmap(0, m_memorySize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            m_errorStr = std::string("Cannot allocate frame buffers. ")
+                    + std::strerror(errno) + ".";
+            m_memorySize = 0;
+            m_hugePageBacked = false;
+            return false;
+        }
+        m_memory = static_cast<unsigned char *>(memory);
+
+        // locking also faults in all pages, without it touch them here;
+        // failing to lock (e.g. RLIMIT_MEMLOCK) is not an error
+        if (m_lockMemory)
+            m_locked = (mlock(m_memory, m_memorySize) == 0);
+        if (!m_locked)
+            std::memset(m_memory, 0, m_memorySize);
+
+        m_mappedHugePages = m_hugePages;
+        m_bufferSize = bufferSize;
+        m_frames.resize(count);
+        for (int i = 0; i < count; ++i)
+            m_frames[i].ImageBuffer = m_memory + size_t(i) * stride;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        void *buffer = m_frames[i].ImageBuffer;
+        std::memset(&m_frames[i], 0, sizeof(tPvFrame));
+        m_frames[i].ImageBuffer = buffer;
+        m_frames[i].ImageBufferSize = bufferSize;
+    }
+
+    return true;
+}
+
+void FramePool::release()
+{
+    if (m_memory) {
+        if (m_locked)
+            munlock(m_memory, m_memorySize);
+        munmap(m_memory, m_memorySize);
+    }
+
+    m_frames.clear();
+    m_memory = 0;
+    m_memorySize = 0;
+    m_bufferSize = 0;
+    m_locked = false;
+    m_hugePageBacked = false;
+}
+
+int FramePool::count() const
+{
+    return int(m_frames.size());
+}
+
+size_t FramePool::bufferSize() const
+{
+    return m_bufferSize;
+}
+
+tPvFrame * FramePool::frame(int i)
+{
+    return &m_frames[i];
+}
+
+bool FramePool::isLocked() const
+{
+    return m_locked;
+}
+
+bool FramePool::isHugePageBacked() const
+{
+    return m_hugePageBacked;
+}
+
+std::string FramePool::lastError() const
+{
+    return m_errorStr;
+}
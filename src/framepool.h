@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_FRAMEPOOL_H
+#define PVREC_FRAMEPOOL_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <PvApi.h>
+
+/*
+    Persistent pool of frames for the capture queue.
+
+    All image buffers live in one anonymous mapping, every buffer starts on
+    a page boundary. The mapping is optionally backed by huge pages and is
+    locked into memory if possible, so that capturing never page-faults.
+    allocate() keeps the existing buffers if the number and size of the
+    frames did not change, so consecutive recordings reuse the same memory.
+ */
+class FramePool
+{
+public:
+    FramePool();
+    ~FramePool();
+
+    void setHugePages(bool enable);
+    bool hugePages() const;
+
+    void setLockMemory(bool enable);
+    bool lockMemory() const;
+
+    bool allocate(int count, size_t bufferSize);
+    void release();
+
+    int count() const;
+    size_t bufferSize() const;
+    tPvFrame * frame(int i);
+
+    // state of the current mapping
+    bool isLocked() const;
+    bool isHugePageBacked() const;
+
+    std::string lastError() const;
+
+private:
+    FramePool(const FramePool &);
+    FramePool & operator=(const FramePool &);
+
+    bool m_hugePages;
+    bool m_lockMemory;
+    bool m_locked;
+    bool m_hugePageBacked;
+    bool m_mappedHugePages;
+    unsigned char *m_memory;
+    size_t m_memorySize;
+    size_t m_bufferSize;
+    std::vector<tPvFrame> m_frames;
+    std::string m_errorStr;
+};
+
+#endif // PVREC_FRAMEPOOL_H
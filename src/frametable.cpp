@@ -0,0 +1,484 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "frametable.h"
+#include "fitsheader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+
+const int FrameTable::NumColumns;
+const size_t FrameTable::RowSize;
+const size_t FrameTable::BatchRows;
+
+static const char *ColumnNames[FrameTable::NumColumns] = {
+    "INDEX", "FRAMECNT", "TIMESTMP", "HOSTTIME", "STATUS",
+    "MEAN", "RMS", "MINVAL", "MAXVAL", "NSAT", "SHARPNES", "RECINDEX",
+    "NCOMBINE"
+};
+
+static const char *ColumnFormats[FrameTable::NumColumns] = {
+    "1K", "1K", "1K", "1D", "1J",
+    "1D", "1D", "1J", "1J", "1J", "1D", "1K", "1J"
+};
+
+static const char *ColumnUnits[FrameTable::NumColumns] = {
+    "", "", "ticks", "s", "",
+    "ADU", "ADU", "ADU", "ADU", "", "ADU**2", "", ""
+};
+
+static const char *ColumnComments[FrameTable::NumColumns] = {
+    "frame index in the image",
+    "camera frame counter",
+    "camera time stamp, see TSFREQ",
+    "host receive time, seconds since 1970-01-01 UTC",
+    "PvApi frame status",
+    "mean pixel value",
+    "standard deviation of the pixel values",
+    "smallest pixel value",
+    "largest pixel value",
+    "number of saturated pixels",
+    "mean squared difference of adjacent pixels",
+    "frame index in the recording",
+    "frames co-added into the image"
+};
+
+template <class T>
+static unsigned char * putBigEndian(unsigned char *dst, T value)
+{
+    unsigned char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    std::reverse(bytes, bytes + sizeof(T));
+#endif
+    std::memcpy(dst, bytes, sizeof(T));
+    return dst + sizeof(T);
+}
+
+static std::string indexedKey(const char *keyname, int n)
+{
+    std::ostringstream ss;
+    ss << keyname << n;
+    return ss.str();
+}
+
+static bool pwriteAll(int fd, const unsigned char *data, size_t size,
+                      off_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= size_t(n);
+        offset += n;
+    }
+    return true;
+}
+
+static bool preadAll(int fd, unsigned char *data, size_t size, off_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pread(fd, data, size, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (n == 0) {
+            errno = EIO;
+            return false;
+        }
+        data += n;
+        size -= size_t(n);
+        offset += n;
+    }
+    return true;
+}
+
+template <class T>
+static void eraseFront(std::vector<T> &column, size_t count)
+{
+    column.erase(column.begin(), column.begin() + count);
+}
+
+FrameTable::FrameTable()
+    : m_numWritten(0),
+      m_writtenOffset(0)
+{
+}
+
+void FrameTable::append(long index, const FrameInfo &info)
+{
+    m_index.push_back(index);
+    m_frameCount.push_back(LONGLONG(info.frameCount));
+    m_timestamp.push_back(LONGLONG(info.timestamp));
+    m_hostTime.push_back(info.hostTime);
+    m_status.push_back(info.status);
+    m_mean.push_back(info.mean);
+    m_rms.push_back(info.rms);
+    m_minValue.push_back(info.minValue);
+    m_maxValue.push_back(info.maxValue);
+    m_saturated.push_back(info.saturated);
+    m_sharpness.push_back(info.sharpness);
+    m_recordIndex.push_back(info.recordIndex);
+    m_numCombined.push_back(info.numCombined);
+}
+
+void FrameTable::clear()
+{
+    m_index.clear();
+    m_frameCount.clear();
+    m_timestamp.clear();
+    m_hostTime.clear();
+    m_status.clear();
+    m_mean.clear();
+    m_rms.clear();
+    m_minValue.clear();
+    m_maxValue.clear();
+    m_saturated.clear();
+    m_sharpness.clear();
+    m_recordIndex.clear();
+    m_numCombined.clear();
+    m_numWritten = 0;
+    m_writtenOffset = 0;
+}
+
+void FrameTable::truncate(long index)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < m_index.size(); ++i) {
+        if (m_index[i] > index)
+            continue;
+        m_index[n] = m_index[i];
+        m_frameCount[n] = m_frameCount[i];
+        m_timestamp[n] = m_timestamp[i];
+        m_hostTime[n] = m_hostTime[i];
+        m_status[n] = m_status[i];
+        m_mean[n] = m_mean[i];
+        m_rms[n] = m_rms[i];
+        m_minValue[n] = m_minValue[i];
+        m_maxValue[n] = m_maxValue[i];
+        m_saturated[n] = m_saturated[i];
+        m_sharpness[n] = m_sharpness[i];
+        m_recordIndex[n] = m_recordIndex[i];
+        m_numCombined[n] = m_numCombined[i];
+        ++n;
+    }
+    m_index.resize(n);
+    m_frameCount.resize(n);
+    m_timestamp.resize(n);
+    m_hostTime.resize(n);
+    m_status.resize(n);
+    m_mean.resize(n);
+    m_rms.resize(n);
+    m_minValue.resize(n);
+    m_maxValue.resize(n);
+    m_saturated.resize(n);
+    m_sharpness.resize(n);
+    m_recordIndex.resize(n);
+    m_numCombined.resize(n);
+}
+
+size_t FrameTable::numRows() const
+{
+    return m_index.size();
+}
+
+size_t FrameTable::numWrittenRows() const
+{
+    return m_numWritten;
+}
+
+bool FrameTable::isEmpty() const
+{
+    return m_index.empty() && m_numWritten == 0;
+}
+
+bool FrameTable::hasFullBatch() const
+{
+    return m_index.size() >= BatchRows;
+}
+
+void FrameTable::setRowsWritten()
+{
+    m_numWritten += m_index.size();
+    dropRows(m_index.size());
+}
+
+const std::vector<LONGLONG> & FrameTable::indexColumn() const
+{
+    return m_index;
+}
+
+const std::vector<LONGLONG> & FrameTable::frameCountColumn() const
+{
+    return m_frameCount;
+}
+
+const std::vector<LONGLONG> & FrameTable::timestampColumn() const
+{
+    return m_timestamp;
+}
+
+const std::vector<double> & FrameTable::hostTimeColumn() const
+{
+    return m_hostTime;
+}
+
+const std::vector<int> & FrameTable::statusColumn() const
+{
+    return m_status;
+}
+
+const std::vector<double> & FrameTable::meanColumn() const
+{
+    return m_mean;
+}
+
+const std::vector<double> & FrameTable::rmsColumn() const
+{
+    return m_rms;
+}
+
+const std::vector<int> & FrameTable::minValueColumn() const
+{
+    return m_minValue;
+}
+
+const std::vector<int> & FrameTable::maxValueColumn() const
+{
+    return m_maxValue;
+}
+
+const std::vector<int> & FrameTable::saturatedColumn() const
+{
+    return m_saturated;
+}
+
+const std::vector<double> & FrameTable::sharpnessColumn() const
+{
+    return m_sharpness;
+}
+
+const std::vector<LONGLONG> & FrameTable::recordIndexColumn() const
+{
+    return m_recordIndex;
+}
+
+const std::vector<int> & FrameTable::numCombinedColumn() const
+{
+    return m_numCombined;
+}
+
+const char * FrameTable::columnName(int column)
+{
+    return ColumnNames[column];
+}
+
+const char * FrameTable::columnFormat(int column)
+{
+    return ColumnFormats[column];
+}
+
+const char * FrameTable::columnUnit(int column)
+{
+    return ColumnUnits[column];
+}
+
+void FrameTable::encodeRows(size_t first, size_t count,
+                            unsigned char *dst) const
+{
+    for (size_t i = first; i < first + count; ++i) {
+        dst = putBigEndian(dst, m_index[i]);
+        dst = putBigEndian(dst, m_frameCount[i]);
+        dst = putBigEndian(dst, m_timestamp[i]);
+        dst = putBigEndian(dst, m_hostTime[i]);
+        dst = putBigEndian(dst, m_status[i]);
+        dst = putBigEndian(dst, m_mean[i]);
+        dst = putBigEndian(dst, m_rms[i]);
+        dst = putBigEndian(dst, m_minValue[i]);
+        dst = putBigEndian(dst, m_maxValue[i]);
+        dst = putBigEndian(dst, m_saturated[i]);
+        dst = putBigEndian(dst, m_sharpness[i]);
+        dst = putBigEndian(dst, m_recordIndex[i]);
+        dst = putBigEndian(dst, m_numCombined[i]);
+    }
+}
+
+bool FrameTable::writeBatches(int fd, off_t offset)
+{
+    if (m_numWritten > 0 && offset != m_writtenOffset &&
+            !moveWrittenRows(fd, offset))
+        return false;
+    m_writtenOffset = offset;
+
+    size_t count = (numRows() / BatchRows) * BatchRows;
+    if (count == 0)
+        return true;
+
+    // the header is updated after the rows, so that it never counts rows
+    // which are not in the file yet; the padding completes the last block
+    off_t rowsOffset = offset + off_t(header(0).size());
+    size_t numRows = m_numWritten + count;
+    size_t dataSize = numRows * RowSize;
+    std::vector<unsigned char> padding(
+            FitsHeader::roundUpToBlock(dataSize) - dataSize);
+    std::string hdr = header(numRows);
+    if (!writeRows(fd, rowsOffset + off_t(m_numWritten * RowSize), 0,
+                   count) ||
+        (!padding.empty() && !pwriteAll(fd, &padding[0], padding.size(),
+                                        rowsOffset + off_t(dataSize))) ||
+        !pwriteAll(fd, reinterpret_cast<const unsigned char *>(hdr.data()),
+                   hdr.size(), offset))
+        return false;
+
+    m_numWritten = numRows;
+    dropRows(count);
+    return true;
+}
+
+bool FrameTable::write(int fd, off_t offset, off_t &end) const
+{
+    if (m_numWritten > 0 && offset != m_writtenOffset &&
+            !moveWrittenRows(fd, offset))
+        return false;
+
+    size_t numRows = m_numWritten + this->numRows();
+    std::string hdr = header(numRows);
+    if (!pwriteAll(fd, reinterpret_cast<const unsigned char *>(hdr.data()),
+                   hdr.size(), offset))
+        return false;
+    offset += off_t(hdr.size());
+
+    if (!writeRows(fd, offset + off_t(m_numWritten * RowSize), 0,
+                   this->numRows()))
+        return false;
+
+    // the caller pads the file with zeros up to end
+    end = offset + off_t(FitsHeader::roundUpToBlock(numRows * RowSize));
+    return true;
+}
+
+std::string FrameTable::header(size_t numRows) const
+{
+    typedef FitsHeader H;
+    FitsHeader header;
+    header.set("XTENSION", H::stringValue("BINTABLE"),
+               "binary table extension");
+    header.set("BITPIX", H::intValue(8), "8-bit bytes");
+    header.set("NAXIS", H::intValue(2), "2-dimensional binary table");
+    header.set("NAXIS1", H::intValue(RowSize), "width of table in bytes");
+    header.set("NAXIS2", H::intValue(numRows), "number of rows in table");
+    header.set("PCOUNT", H::intValue(0), "size of special data area");
+    header.set("GCOUNT", H::intValue(1), "one data group");
+    header.set("TFIELDS", H::intValue(NumColumns),
+               "number of fields in each row");
+    for (int i = 0; i < NumColumns; ++i) {
+        header.set(indexedKey("TTYPE", i + 1), H::stringValue(ColumnNames[i]),
+                   ColumnComments[i]);
+        header.set(indexedKey("TFORM", i + 1),
+                   H::stringValue(ColumnFormats[i]), "data format of field");
+        if (*ColumnUnits[i])
+            header.set(indexedKey("TUNIT", i + 1),
+                       H::stringValue(ColumnUnits[i]),
+                       "physical unit of field");
+    }
+    header.set("EXTNAME", H::stringValue("FRAMEINFO"),
+               "name of this binary table extension");
+    return header.toString();
+}
+
+// writes rows held in memory, encoded in batches
+bool FrameTable::writeRows(int fd, off_t offset, size_t first,
+                           size_t count) const
+{
+    std::vector<unsigned char> batch(std::min(count, BatchRows) * RowSize);
+    for (size_t i = first; i < first + count; i += BatchRows) {
+        size_t n = std::min(BatchRows, first + count - i);
+        encodeRows(i, n, &batch[0]);
+        if (!pwriteAll(fd, &batch[0], n * RowSize, offset))
+            return false;
+        offset += off_t(n * RowSize);
+    }
+    return true;
+}
+
+// moves the rows written by writeBatches() to the extension at offset; the
+// ranges may overlap, so the copy runs away from the destination end
+bool FrameTable::moveWrittenRows(int fd, off_t offset) const
+{
+    off_t headerSize = off_t(header(0).size());
+    off_t src = m_writtenOffset + headerSize;
+    off_t dst = offset + headerSize;
+    size_t size = m_numWritten * RowSize;
+    std::vector<unsigned char> buffer(BatchRows * RowSize);
+
+    for (size_t done = 0; done < size; ) {
+        size_t n = std::min(buffer.size(), size - done);
+        size_t pos = (dst < src) ? done : size - done - n;
+        if (!preadAll(fd, &buffer[0], n, src + off_t(pos)) ||
+                !pwriteAll(fd, &buffer[0], n, dst + off_t(pos)))
+            return false;
+        done += n;
+    }
+
+    // a table moved further back leaves its old copy in front of it, which
+    // would show up as image data there
+    if (dst > src) {
+        off_t end = std::min(offset, src + off_t(size));
+        std::fill(buffer.begin(), buffer.end(), 0);
+        for (off_t pos = m_writtenOffset; pos < end; ) {
+            size_t n = size_t(std::min(off_t(buffer.size()), end - pos));
+            if (!pwriteAll(fd, &buffer[0], n, pos))
+                return false;
+            pos += off_t(n);
+        }
+    }
+    return true;
+}
+
+void FrameTable::dropRows(size_t count)
+{
+    eraseFront(m_index, count);
+    eraseFront(m_frameCount, count);
+    eraseFront(m_timestamp, count);
+    eraseFront(m_hostTime, count);
+    eraseFront(m_status, count);
+    eraseFront(m_mean, count);
+    eraseFront(m_rms, count);
+    eraseFront(m_minValue, count);
+    eraseFront(m_maxValue, count);
+    eraseFront(m_saturated, count);
+    eraseFront(m_sharpness, count);
+    eraseFront(m_recordIndex, count);
+    eraseFront(m_numCombined, count);
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_FRAMETABLE_H
+#define PVREC_FRAMETABLE_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <fitsio.h>
+
+// per-frame metadata, written to a binary table extension
+struct FrameInfo
+{
+    unsigned long frameCount;       // camera frame counter
+    unsigned long long timestamp;   // camera time stamp in ticks
+    double hostTime;                // receive time, seconds since the epoch
+    int status;                     // tPvErr status of the frame
+    double mean;                    // mean pixel value
+    double rms;                     // standard deviation of the pixels
+    int minValue;
+    int maxValue;
+    int saturated;                  // pixels at the saturation level
+    double sharpness;               // mean squared gradient
+    long recordIndex;               // index of the frame in the recording
+    int numCombined;                // frames co-added into the image
+};
+
+/*
+    Column store for the FRAMEINFO table. Rows are appended by the writer
+    thread while recording. Writers which know where the table goes write
+    every full batch to the file right away, so that only the last partial
+    batch is held in memory; the others write all rows on close.
+ */
+class FrameTable
+{
+public:
+    enum Column {
+        Index, FrameCount, Timestamp, HostTime, Status,
+        Mean, Rms, MinValue, MaxValue, Saturated, Sharpness, RecordIndex,
+        NumCombined
+    };
+    static const int NumColumns = 13;
+
+    // size of a table row in the FITS file
+    static const size_t RowSize = 84;
+
+    // number of rows converted and written at once
+    static const size_t BatchRows = 4096;
+
+    FrameTable();
+
+    void append(long index, const FrameInfo &info);
+    // drops all rows, also the count of written ones
+    void clear();
+
+    // drops the rows of frames beyond index, e.g. after a resize; rows
+    // already in the file are kept
+    void truncate(long index);
+
+    // rows held in memory
+    size_t numRows() const;
+    // rows already in the file, in front of the ones in memory
+    size_t numWrittenRows() const;
+    // neither rows in memory nor written ones
+    bool isEmpty() const;
+    bool hasFullBatch() const;
+
+    // counts the rows in memory as written and drops them, for writers
+    // which write the rows themselves
+    void setRowsWritten();
+
+    const std::vector<LONGLONG> & indexColumn() const;
+    const std::vector<LONGLONG> & frameCountColumn() const;
+    const std::vector<LONGLONG> & timestampColumn() const;
+    const std::vector<double> & hostTimeColumn() const;
+    const std::vector<int> & statusColumn() const;
+    const std::vector<double> & meanColumn() const;
+    const std::vector<double> & rmsColumn() const;
+    const std::vector<int> & minValueColumn() const;
+    const std::vector<int> & maxValueColumn() const;
+    const std::vector<int> & saturatedColumn() const;
+    const std::vector<double> & sharpnessColumn() const;
+    const std::vector<LONGLONG> & recordIndexColumn() const;
+    const std::vector<int> & numCombinedColumn() const;
+
+    static const char * columnName(int column);
+    static const char * columnFormat(int column);
+    static const char * columnUnit(int column);
+
+    // converts rows into the big endian FITS row format
+    void encodeRows(size_t first, size_t count, unsigned char *dst) const;
+
+    // writes the full batches into the FITS extension at the given offset
+    // and drops them, rows written before are moved there first if the
+    // offset has changed; the header counts the rows written so far, so the
+    // file stays readable if the recording ends without close()
+    bool writeBatches(int fd, off_t offset);
+
+    // writes the table as a FITS extension at the given offset using
+    // pwrite(), end receives the block aligned end of the extension. Rows
+    // written by writeBatches() are moved if the offset has changed.
+    bool write(int fd, off_t offset, off_t &end) const;
+
+private:
+    std::string header(size_t numRows) const;
+    bool writeRows(int fd, off_t offset, size_t first, size_t count) const;
+    bool moveWrittenRows(int fd, off_t offset) const;
+    void dropRows(size_t count);
+
+    std::vector<LONGLONG> m_index;
+    std::vector<LONGLONG> m_frameCount;
+    std::vector<LONGLONG> m_timestamp;
+    std::vector<double> m_hostTime;
+    std::vector<int> m_status;
+    std::vector<double> m_mean;
+    std::vector<double> m_rms;
+    std::vector<int> m_minValue;
+    std::vector<int> m_maxValue;
+    std::vector<int> m_saturated;
+    std::vector<double> m_sharpness;
+    std::vector<LONGLONG> m_recordIndex;
+    std::vector<int> m_numCombined;
+
+    size_t m_numWritten;
+    off_t m_writtenOffset;  // where writeBatches() put the extension
+};
+
+#endif // PVREC_FRAMETABLE_H
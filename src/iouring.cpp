@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "iouring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef PVREC_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// the numbers are the same on all architectures, but older C libraries
+// don't know them yet
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+template <class T>
+static inline T * ringField(void *ring, unsigned offset)
+{
+    return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+#endif // PVREC_HAVE_IO_URING
+
+IoUring::IoUring()
+    : m_fd(-1),
+      m_sqRing(0),
+      m_sqRingSize(0),
+      m_cqRing(0),
+      m_cqRingSize(0),
+      m_sqes(0),
+      m_sqesSize(0),
+      m_sqHead(0),
+      m_sqTail(0),
+      m_sqMask(0),
+      m_sqArray(0),
+      m_sqEntries(0),
+      m_cqHead(0),
+      m_cqTail(0),
+      m_cqMask(0),
+      m_cqes(0),
+      m_toSubmit(0)
+{
+}
+
+IoUring::~IoUring()
+{
+    release();
+}
+
+bool IoUring::isOpen() const
+{
+    return m_fd >= 0;
+}
+
+#ifdef PVREC_HAVE_IO_URING
+
+bool IoUring::init(unsigned entries)
+{
+    release();
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0)
+        return false;
+    m_fd = fd;
+
+    // newer kernels map both rings with a single mapping
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes +
+            params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+    void *sqRing = mmap(0, m_sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        int err = errno;
+        release();
+        errno = err;
+        return false;
+    }
+    m_sqRing = sqRing;
+
+    if (single)
+        m_cqRing = m_sqRing;
+    else {
+        void *cqRing = mmap(0, m_cqRingSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            int err = errno;
+            release();
+            errno = err;
+            return false;
+        }
+        m_cqRing = cqRing;
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(0, m_sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        int err = errno;
+        release();
+        errno = err;
+        return false;
+    }
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    m_sqHead = ringField<unsigned>(m_sqRing, params.sq_off.head);
+    m_sqTail = ringField<unsigned>(m_sqRing, params.sq_off.tail);
+    m_sqMask = ringField<unsigned>(m_sqRing, params.sq_off.ring_mask);
+    m_sqArray = ringField<unsigned>(m_sqRing, params.sq_off.array);
+    m_sqEntries = params.sq_entries;
+    m_cqHead = ringField<unsigned>(m_cqRing, params.cq_off.head);
+    m_cqTail = ringField<unsigned>(m_cqRing, params.cq_off.tail);
+    m_cqMask = ringField<unsigned>(m_cqRing, params.cq_off.ring_mask);
+    m_cqes = ringField<io_uring_cqe>(m_cqRing, params.cq_off.cqes);
+    m_toSubmit = 0;
+    return true;
+}
+
+void IoUring::release()
+{
+    if (m_sqes)
+        munmap(m_sqes, m_sqesSize);
+    if (m_cqRing && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing)
+        munmap(m_sqRing, m_sqRingSize);
+    if (m_fd >= 0)
+        close(m_fd);
+
+    m_fd = -1;
+    m_sqRing = m_cqRing = 0;
+    m_sqes = 0;
+    m_sqHead = m_sqTail = m_sqMask = m_sqArray = 0;
+    m_cqHead = m_cqTail = m_cqMask = 0;
+    m_cqes = 0;
+    m_sqEntries = 0;
+    m_toSubmit = 0;
+}
+
+bool IoUring::registerBuffers(const struct iovec *buffers, unsigned count)
+{
+    return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS,
+                   buffers, count) == 0;
+}
+
+void IoUring::unregisterBuffers()
+{
+    syscall(__NR_io_uring_register, m_fd, IORING_UNREGISTER_BUFFERS, 0, 0);
+}
+
+bool IoUring::prepareWrite(int fd, const void *data, size_t size,
+                           off_t offset, int bufIndex,
+                           unsigned long long userData)
+{
+    // the kernel consumes entries up to the head, we own the tail
+    unsigned tail = *m_sqTail;
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (tail - head >= m_sqEntries)
+        return false;
+
+    unsigned index = tail & *m_sqMask;
+    io_uring_sqe *sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (bufIndex >= 0) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->off = (unsigned long long)offset;
+    sqe->addr = (unsigned long long)(size_t)data;
+    sqe->len = unsigned(size);
+    sqe->buf_index = (bufIndex >= 0) ? (unsigned short)bufIndex : 0;
+    sqe->user_data = userData;
+    m_sqArray[index] = index;
+
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++m_toSubmit;
+    return true;
+}
+
+bool IoUring::submit(unsigned minComplete)
+{
+    unsigned flags = (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        int n = int(syscall(__NR_io_uring_enter, m_fd, m_toSubmit,
+                            minComplete, flags, 0, 0));
+        if (n >= 0) {
+            m_toSubmit -= std::min(unsigned(n), m_toSubmit);
+            return true;
+        }
+        if (errno != EINTR)
+            return false;
+    }
+}
+
+bool IoUring::popCompletion(unsigned long long &userData, int &result)
+{
+    // the kernel produces entries up to the tail, we own the head
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return false;
+
+    const io_uring_cqe *cqe = &m_cqes[head & *m_cqMask];
+    userData = cqe->user_data;
+    result = cqe->res;
+    __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#else // PVREC_HAVE_IO_URING
+
+bool IoUring::init(unsigned)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+void IoUring::release()
+{
+}
+
+bool IoUring::registerBuffers(const struct iovec *, unsigned)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+void IoUring::unregisterBuffers()
+{
+}
+
+bool IoUring::prepareWrite(int, const void *, size_t, off_t, int,
+                           unsigned long long)
+{
+    return false;
+}
+
+bool IoUring::submit(unsigned)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+bool IoUring::popCompletion(unsigned long long &, int &)
+{
+    return false;
+}
+
+#endif // PVREC_HAVE_IO_URING
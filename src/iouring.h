@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_IOURING_H
+#define PVREC_IOURING_H
+
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/*
+    Minimal io_uring instance for file writes, using the raw system calls.
+
+    Only the parts needed by UringFitsWriter are covered: plain and fixed
+    buffer writes, buffer registration and completion polling. The instance
+    must only be used by one thread. Without kernel headers for io_uring
+    (PVREC_HAVE_IO_URING not defined) init() fails with ENOSYS.
+ */
+class IoUring
+{
+public:
+    IoUring();
+    ~IoUring();
+
+    // the kernel rounds the number of entries up to a power of two
+    bool init(unsigned entries);
+    void release();
+    bool isOpen() const;
+
+    bool registerBuffers(const struct iovec *buffers, unsigned count);
+    void unregisterBuffers();
+
+    // queues a write, a bufIndex >= 0 selects a registered buffer which
+    // must contain the data; fails if the submission queue is full
+    bool prepareWrite(int fd, const void *data, size_t size, off_t offset,
+                      int bufIndex, unsigned long long userData);
+
+    // submits all queued writes and waits for minComplete completions,
+    // returns false and sets errno on failure
+    bool submit(unsigned minComplete = 0);
+
+    // takes the next completion, result is the return value of the write
+    bool popCompletion(unsigned long long &userData, int &result);
+
+private:
+    IoUring(const IoUring &);
+    IoUring & operator=(const IoUring &);
+
+    int m_fd;
+    void *m_sqRing;
+    size_t m_sqRingSize;
+    void *m_cqRing;
+    size_t m_cqRingSize;
+    io_uring_sqe *m_sqes;
+    size_t m_sqesSize;
+    unsigned *m_sqHead;
+    unsigned *m_sqTail;
+    unsigned *m_sqMask;
+    unsigned *m_sqArray;
+    unsigned m_sqEntries;
+    unsigned *m_cqHead;
+    unsigned *m_cqTail;
+    unsigned *m_cqMask;
+    io_uring_cqe *m_cqes;
+    unsigned m_toSubmit;
+};
+
+#endif // PVREC_IOURING_H
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mmapfitswriter.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// the mapping is written back and released in chunks of about this size
+static const size_t FlushChunkSize = 32 * 1024 * 1024;
+
+MmapFitsWriter::MmapFitsWriter()
+    : m_map(0),
+      m_mapSize(0),
+      m_mapOffset(0),
+      m_framesPerFlush(1),
+      m_flushRequested(0),
+      m_flushed(0),
+      m_quit(false),
+      m_flusher(this)
+{
+}
+
+MmapFitsWriter::~MmapFitsWriter()
+{
+    close();
+}
+
+bool MmapFitsWriter::open(const std::string &fname, PixelType pixelType,
+                          int width, int height, int count, bool clobber)
+{
+    if (!RawFitsWriter::open(fname, pixelType, width, height, count,
+                             clobber))
+        return false;
+
+    // allocate all blocks up front; without fallocate() support the file
+    // stays sparse and a full disk shows up as SIGBUS instead of an error
+    int fd = fileDescriptor();
+    off_t fileSize = imageEnd();
+    if (fallocate(fd, 0, 0, fileSize) != 0 &&
+            (errno != EOPNOTSUPP || ftruncate(fd, fileSize) != 0)) {
+        int err = errno;
+        RawFitsWriter::close();
+        setSysError("Cannot allocate the file '" + fname + "'.", err);
+        return false;
+    }
+
+    // mappings start on a page boundary, the header size is a multiple of
+    // the FITS block size only
+    off_t pageSize = sysconf(_SC_PAGESIZE);
+    m_mapOffset = frameOffset(1) / pageSize * pageSize;
+    m_mapSize = size_t(frameOffset(count + 1) - m_mapOffset);
+    void *map = mmap(0, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                     m_mapOffset);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        m_mapSize = 0;
+        RawFitsWriter::close();
+        setSysError("Cannot map the file '" + fname + "'.", err);
+        return false;
+    }
+    m_map = static_cast<unsigned char *>(map);
+    madvise(m_map, m_mapSize, MADV_SEQUENTIAL);
+
+    m_framesPerFlush = long(FlushChunkSize / frameSize()) + 1;
+    m_flushRequested = 0;
+    m_flushed = 0;
+    m_quit = false;
+    if (!m_flusher.start()) {
+        close();
+        setError("Cannot start flusher thread.");
+        return false;
+    }
+
+    return true;
+}
+
+void MmapFitsWriter::close()
+{
+    if (!isOpen())
+        return;
+
+    if (m_flusher.isRunning()) {
+        {
+            MutexLocker lock(m_mutex);
+            m_quit = true;
+            m_flushWanted.wakeAll();
+        }
+        m_flusher.join();
+    }
+
+    if (m_map) {
+        munmap(m_map, m_mapSize);
+        m_map = 0;
+        m_mapSize = 0;
+    }
+
+    // writes the header and frame table and truncates the file
+    RawFitsWriter::close();
+}
+
+bool MmapFitsWriter::writeFrame(long index, unsigned char *data)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write frame, file not open.");
+        return false;
+    }
+
+    if (index < 1 || index > count()) {
+        setError("Frame index out of bounds.");
+        return false;
+    }
+
+    // larger pixels are stored big endian, 8 bit frames may have been
+    // captured in place already
+    unsigned char *slot = frameSlot(index);
+    if (pixelType() != Uint8 || data != slot)
+        convertFrame(data, slot);
+    addBytesWritten(frameSize());
+
+    if (index % m_framesPerFlush == 0)
+        requestFlush(index);
+    return true;
+}
+
+bool MmapFitsWriter::resize(int count)
+{
+    if (isOpen() && count > this->count()) {
+        clearError();
+        setError("Cannot grow a memory mapped file.");
+        return false;
+    }
+    return RawFitsWriter::resize(count);
+}
+
+unsigned char * MmapFitsWriter::frameBuffer(long index)
+{
+    if (!m_map || pixelType() != Uint8 || index < 1 || index > count())
+        return 0;
+    return frameSlot(index);
+}
+
+unsigned char * MmapFitsWriter::frameSlot(long index) const
+{
+    return m_map + (frameOffset(index) - m_mapOffset);
+}
+
+void MmapFitsWriter::requestFlush(long lastIndex)
+{
+    MutexLocker lock(m_mutex);
+    if (lastIndex > m_flushRequested) {
+        m_flushRequested = lastIndex;
+        m_flushWanted.wakeOne();
+    }
+}
+
+// writes the given file range back and drops its pages, so that written
+// frames don't occupy memory until the file is closed
+void MmapFitsWriter::flush(off_t begin, off_t end)
+{
+    off_t pageSize = sysconf(_SC_PAGESIZE);
+    begin = begin / pageSize * pageSize;
+    if (end <= begin)
+        return;
+
+    unsigned char *start = m_map + (begin - m_mapOffset);
+    size_t size = size_t(end - begin);
+    msync(start, size, MS_SYNC);
+    madvise(start, size, MADV_DONTNEED);
+    posix_fadvise(fileDescriptor(), begin, end - begin, POSIX_FADV_DONTNEED);
+}
+
+void MmapFitsWriter::Flusher::run()
+{
+    MmapFitsWriter *w = m_writer;
+    MutexLocker lock(w->m_mutex);
+    while (!w->m_quit)
+    {
+        if (w->m_flushRequested <= w->m_flushed) {
+            w->m_flushWanted.wait(w->m_mutex);
+            continue;
+        }
+
+        // the page with the end of the last requested frame may still be
+        // shared with the next frame, it is flushed the next time
+        long first = w->m_flushed + 1;
+        long last = w->m_flushRequested;
+        w->m_flushed = last;
+        w->m_mutex.unlock();
+        w->flush(w->frameOffset(first), w->frameOffset(last + 1) /
+                 sysconf(_SC_PAGESIZE) * sysconf(_SC_PAGESIZE));
+        w->m_mutex.lock();
+    }
+}
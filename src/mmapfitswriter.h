@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MMAPFITSWRITER_H
+#define MMAPFITSWRITER_H
+
+#include "rawfitswriter.h"
+#include "thread.h"
+#include <sys/types.h>
+
+/*
+    RawFitsWriter variant which maps the image data into memory.
+
+    open() allocates the blocks of the whole file with fallocate(), so that
+    no extents have to be allocated during the recording, and maps the data
+    unit. Frames are converted straight into their slot of the mapping,
+    without a write syscall per frame. A background thread writes completed
+    chunks of the mapping back with msync() and drops them from memory, so
+    dirty pages neither pile up nor crowd out other page cache.
+
+    8 bit frames need no conversion, so frameBuffer() hands out the slots
+    and frames captured into them are written without any copy.
+
+    The number of frames can only shrink after open().
+ */
+class MmapFitsWriter : public RawFitsWriter
+{
+public:
+    MmapFitsWriter();
+    virtual ~MmapFitsWriter();
+
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber = false);
+    virtual void close();
+
+    virtual bool writeFrame(long index, unsigned char *data);
+    virtual bool resize(int count);
+
+    // 8 bit frames can be captured straight into their slot
+    virtual unsigned char * frameBuffer(long index);
+
+protected:
+    unsigned char * frameSlot(long index) const;
+    void requestFlush(long lastIndex);
+    void flush(off_t begin, off_t end);
+
+private:
+    class Flusher : public Thread
+    {
+    public:
+        explicit Flusher(MmapFitsWriter *writer) : m_writer(writer) {}
+    protected:
+        virtual void run();
+    private:
+        MmapFitsWriter *m_writer;
+    };
+    friend class Flusher;
+
+    unsigned char *m_map;
+    size_t m_mapSize;
+    off_t m_mapOffset;
+    long m_framesPerFlush;
+    long m_flushRequested;  // frames up to this index may be flushed
+    long m_flushed;
+    bool m_quit;
+    Mutex m_mutex;
+    WaitCondition m_flushWanted;
+    Flusher m_flusher;
+};
+
+#endif // MMAPFITSWRITER_H
@@ -0,0 +1,1133 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "pixelconv.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PVREC_X86_KERNELS
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define PVREC_BIG_ENDIAN
+#endif
+
+// subtracting 32768 from a 16 bit value is the same as flipping its sign bit
+static const unsigned short SignBit = 0x8000;
+
+// the sign bit of a byte swapped value, flipped before swapping it back
+static const unsigned short SwappedSignBit = 0x0080;
+
+static void toFitsInt16Scalar(const unsigned short *src, unsigned short *dst,
+                              size_t n)
+{
+#ifdef PVREC_BIG_ENDIAN
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = src[i];
+#else
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (unsigned short)((src[i] >> 8) | (src[i] << 8));
+#endif
+}
+
+static void toFitsUint16Scalar(const unsigned short *src, unsigned short *dst,
+                               size_t n)
+{
+#ifdef PVREC_BIG_ENDIAN
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = src[i] ^ SignBit;
+#else
+    for (size_t i = 0; i < n; ++i) {
+        unsigned short v = src[i] ^ SignBit;
+        dst[i] = (unsigned short)((v >> 8) | (v << 8));
+    }
+#endif
+}
+
+static void fromFitsUint16Scalar(const unsigned short *src,
+                                 unsigned short *dst, size_t n)
+{
+#ifdef PVREC_BIG_ENDIAN
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = src[i] ^ SignBit;
+#else
+    for (size_t i = 0; i < n; ++i) {
+        unsigned short v = (unsigned short)((src[i] >> 8) | (src[i] << 8));
+        dst[i] = v ^ SignBit;
+    }
+#endif
+}
+
+static void toFitsInt32Scalar(const unsigned int *src, unsigned int *dst,
+                              size_t n)
+{
+#ifdef PVREC_BIG_ENDIAN
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = src[i];
+#else
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = __builtin_bswap32(src[i]);
+#endif
+}
+
+static void accumulateUint8Scalar(const unsigned char *src, unsigned int *acc,
+                                  size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        acc[i] += src[i];
+}
+
+static void accumulateUint16Scalar(const unsigned short *src,
+                                   unsigned int *acc, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        acc[i] += src[i];
+}
+
+// the value is clipped before it is rounded by truncation, so that all
+// kernels give the same result; NaN becomes 0
+static inline float calibratePixel(float v, float dark, float gain,
+                                   float maxValue)
+{
+    v = (v - dark) * gain;
+    if (!(v > 0))
+        return 0;
+    if (v > maxValue)
+        v = maxValue;
+    return v + 0.5f;
+}
+
+static void calibrateUint8Scalar(const unsigned char *src, const float *dark,
+                                 const float *gain, unsigned char *dst,
+                                 size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (unsigned char)calibratePixel(src[i], dark[i], gain[i], 255);
+}
+
+static void calibrateUint16Scalar(const unsigned short *src, const float *dark,
+                                  const float *gain, unsigned short *dst,
+                                  size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (unsigned short)calibratePixel(src[i], dark[i], gain[i],
+                                                65535);
+}
+
+size_t packedMono12Size(size_t n)
+{
+    return (3 * n + 1) / 2;
+}
+
+// both unpack versions go from the end of the buffer to its start, so that
+// no packed byte is overwritten before it has been read
+
+static void unpackMono12Scalar(unsigned char *buffer, size_t n, size_t first)
+{
+    unsigned short *dst = reinterpret_cast<unsigned short *>(buffer);
+    size_t i = n;
+    if ((n - first) % 2) {
+        --i;
+        const unsigned char *p = buffer + 3 * (i / 2);
+        dst[i] = (unsigned short)((p[0] << 4) | (p[1] & 0x0f));
+    }
+    while (i > first) {
+        i -= 2;
+        const unsigned char *p = buffer + 3 * (i / 2);
+        unsigned int b0 = p[0], b1 = p[1], b2 = p[2];
+        dst[i + 1] = (unsigned short)((b2 << 4) | (b1 >> 4));
+        dst[i] = (unsigned short)((b0 << 4) | (b1 & 0x0f));
+    }
+}
+
+// widest rows the vector statistics kernels handle without overflowing
+// their 16 and 32 bit per-row sums
+static const size_t MaxStatsRowWidth = 65536;
+
+static void clearStats(PixelStats &s)
+{
+    s.sum = 0;
+    s.sumSquares = 0;
+    s.gradient = 0;
+    s.saturated = 0;
+    s.min = ~0u;
+    s.max = 0;
+}
+
+// adds the pixels of a row from x on, next is the row below or 0
+template <class T>
+static void rowStatsScalar(const T *row, const T *next, size_t x,
+                           size_t width, unsigned int saturation,
+                           PixelStats &s)
+{
+    for (; x < width; ++x) {
+        unsigned long long v = row[x];
+        s.sum += v;
+        s.sumSquares += v * v;
+        if (v < s.min)
+            s.min = (unsigned int)v;
+        if (v > s.max)
+            s.max = (unsigned int)v;
+        if (v >= saturation)
+            ++s.saturated;
+        if (x + 1 < width) {
+            long long d = (long long)row[x + 1] - (long long)v;
+            s.gradient += (unsigned long long)(d * d);
+        }
+        if (next) {
+            long long d = (long long)next[x] - (long long)v;
+            s.gradient += (unsigned long long)(d * d);
+        }
+    }
+}
+
+template <class T>
+static void pixelStatsScalar(const T *src, size_t width, size_t height,
+                             unsigned int saturation, PixelStats &s)
+{
+    for (size_t y = 0; y < height; ++y) {
+        const T *row = src + y * width;
+        rowStatsScalar(row, y + 1 < height ? row + width : 0, 0, width,
+                       saturation, s);
+    }
+}
+
+#ifdef PVREC_X86_KERNELS
+
+// the byte swap is done with two shifts, the offset with a xor on the
+// high byte before (or the low byte after) swapping
+
+__attribute__((target("sse2")))
+static void convertSse2(const unsigned short *src, unsigned short *dst,
+                        size_t n, unsigned short mask)
+{
+    const __m128i m = _mm_set1_epi16(short(mask));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        v = _mm_xor_si128(v, m);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+    }
+    for (; i < n; ++i) {
+        unsigned short v = src[i] ^ mask;
+        dst[i] = (unsigned short)((v >> 8) | (v << 8));
+    }
+}
+
+__attribute__((target("avx2")))
+static void convertAvx2(const unsigned short *src, unsigned short *dst,
+                        size_t n, unsigned short mask)
+{
+    const __m256i m = _mm256_set1_epi16(short(mask));
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(src + i));
+        v = _mm256_xor_si256(v, m);
+        v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), v);
+    }
+    convertSse2(src + i, dst + i, n - i, mask);
+}
+
+static void toFitsInt16Sse2(const unsigned short *src, unsigned short *dst,
+                            size_t n)
+{
+    convertSse2(src, dst, n, 0);
+}
+
+static void toFitsUint16Sse2(const unsigned short *src, unsigned short *dst,
+                             size_t n)
+{
+    convertSse2(src, dst, n, SignBit);
+}
+
+static void toFitsInt16Avx2(const unsigned short *src, unsigned short *dst,
+                            size_t n)
+{
+    convertAvx2(src, dst, n, 0);
+}
+
+static void toFitsUint16Avx2(const unsigned short *src, unsigned short *dst,
+                             size_t n)
+{
+    convertAvx2(src, dst, n, SignBit);
+}
+
+static void fromFitsUint16Sse2(const unsigned short *src, unsigned short *dst,
+                               size_t n)
+{
+    convertSse2(src, dst, n, SwappedSignBit);
+}
+
+static void fromFitsUint16Avx2(const unsigned short *src, unsigned short *dst,
+                               size_t n)
+{
+    convertAvx2(src, dst, n, SwappedSignBit);
+}
+
+// SSE2 has no byte shuffle, the 32 bit swap exchanges the bytes of each
+// 16 bit half and then the two halves
+
+__attribute__((target("sse2")))
+static void toFitsInt32Sse2(const unsigned int *src, unsigned int *dst,
+                            size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+    }
+    toFitsInt32Scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void toFitsInt32Avx2(const unsigned int *src, unsigned int *dst,
+                            size_t n)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(src + i));
+        v = _mm256_shuffle_epi8(v, shuffle);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), v);
+    }
+    toFitsInt32Sse2(src + i, dst + i, n - i);
+}
+
+// pixels are widened by unpacking them with zeros, 16 at a time for 8 bit
+// and 8 at a time for 16 bit pixels
+
+__attribute__((target("sse2")))
+static inline void addEpi32(unsigned int *acc, __m128i v)
+{
+    __m128i *p = reinterpret_cast<__m128i *>(acc);
+    _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), v));
+}
+
+__attribute__((target("sse2")))
+static void accumulateUint8Sse2(const unsigned char *src, unsigned int *acc,
+                                size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        addEpi32(acc + i, _mm_unpacklo_epi16(lo, zero));
+        addEpi32(acc + i + 4, _mm_unpackhi_epi16(lo, zero));
+        addEpi32(acc + i + 8, _mm_unpacklo_epi16(hi, zero));
+        addEpi32(acc + i + 12, _mm_unpackhi_epi16(hi, zero));
+    }
+    accumulateUint8Scalar(src + i, acc + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void accumulateUint16Sse2(const unsigned short *src, unsigned int *acc,
+                                 size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        addEpi32(acc + i, _mm_unpacklo_epi16(v, zero));
+        addEpi32(acc + i + 4, _mm_unpackhi_epi16(v, zero));
+    }
+    accumulateUint16Scalar(src + i, acc + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline void addEpi32Avx2(unsigned int *acc, __m256i v)
+{
+    __m256i *p = reinterpret_cast<__m256i *>(acc);
+    _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), v));
+}
+
+__attribute__((target("avx2")))
+static void accumulateUint8Avx2(const unsigned char *src, unsigned int *acc,
+                                size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        addEpi32Avx2(acc + i, _mm256_cvtepu8_epi32(v));
+        addEpi32Avx2(acc + i + 8, _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+    }
+    accumulateUint8Scalar(src + i, acc + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulateUint16Avx2(const unsigned short *src, unsigned int *acc,
+                                 size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        addEpi32Avx2(acc + i, _mm256_cvtepu16_epi32(v));
+    }
+    accumulateUint16Scalar(src + i, acc + i, n - i);
+}
+
+// calibration widens the pixels to 32 bit floats, 4 or 8 at a time; max
+// comes before min so that NaN ends up as 0, like in the scalar version
+
+__attribute__((target("sse2")))
+static inline __m128i calibrateEpi32Sse2(__m128i v, const float *dark,
+                                         const float *gain, __m128 maxValue)
+{
+    __m128 f = _mm_sub_ps(_mm_cvtepi32_ps(v), _mm_loadu_ps(dark));
+    f = _mm_mul_ps(f, _mm_loadu_ps(gain));
+    f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), maxValue);
+    return _mm_cvttps_epi32(_mm_add_ps(f, _mm_set1_ps(0.5f)));
+}
+
+__attribute__((target("sse2")))
+static void calibrateUint8Sse2(const unsigned char *src, const float *dark,
+                               const float *gain, unsigned char *dst, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 maxValue = _mm_set1_ps(255);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i a0 = calibrateEpi32Sse2(_mm_unpacklo_epi16(lo, zero),
+                                        dark + i, gain + i, maxValue);
+        __m128i a1 = calibrateEpi32Sse2(_mm_unpackhi_epi16(lo, zero),
+                                        dark + i + 4, gain + i + 4, maxValue);
+        __m128i a2 = calibrateEpi32Sse2(_mm_unpacklo_epi16(hi, zero),
+                                        dark + i + 8, gain + i + 8, maxValue);
+        __m128i a3 = calibrateEpi32Sse2(_mm_unpackhi_epi16(hi, zero),
+                                        dark + i + 12, gain + i + 12, maxValue);
+        v = _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+    }
+    calibrateUint8Scalar(src + i, dark + i, gain + i, dst + i, n - i);
+}
+
+// SSE2 only packs signed 32 bit values, so they are offset by 32768 first
+__attribute__((target("sse2")))
+static void calibrateUint16Sse2(const unsigned short *src, const float *dark,
+                                const float *gain, unsigned short *dst,
+                                size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i offset = _mm_set1_epi32(32768);
+    const __m128i sign = _mm_set1_epi16(short(SignBit));
+    const __m128 maxValue = _mm_set1_ps(65535);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i a0 = calibrateEpi32Sse2(_mm_unpacklo_epi16(v, zero),
+                                        dark + i, gain + i, maxValue);
+        __m128i a1 = calibrateEpi32Sse2(_mm_unpackhi_epi16(v, zero),
+                                        dark + i + 4, gain + i + 4, maxValue);
+        v = _mm_packs_epi32(_mm_sub_epi32(a0, offset),
+                            _mm_sub_epi32(a1, offset));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_xor_si128(v, sign));
+    }
+    calibrateUint16Scalar(src + i, dark + i, gain + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i calibrateEpi32Avx2(__m256i v, const float *dark,
+                                         const float *gain, __m256 maxValue)
+{
+    __m256 f = _mm256_sub_ps(_mm256_cvtepi32_ps(v), _mm256_loadu_ps(dark));
+    f = _mm256_mul_ps(f, _mm256_loadu_ps(gain));
+    f = _mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), maxValue);
+    return _mm256_cvttps_epi32(_mm256_add_ps(f, _mm256_set1_ps(0.5f)));
+}
+
+// the 256 bit packs work on each 128 bit lane, the permutation restores
+// the pixel order
+__attribute__((target("avx2")))
+static void calibrateUint8Avx2(const unsigned char *src, const float *dark,
+                               const float *gain, unsigned char *dst, size_t n)
+{
+    const __m256 maxValue = _mm256_set1_ps(255);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m256i a0 = calibrateEpi32Avx2(_mm256_cvtepu8_epi32(v),
+                                        dark + i, gain + i, maxValue);
+        __m256i a1 = calibrateEpi32Avx2(
+                _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)),
+                dark + i + 8, gain + i + 8, maxValue);
+        __m256i w = _mm256_permute4x64_epi64(_mm256_packus_epi32(a0, a1),
+                                             _MM_SHUFFLE(3, 1, 2, 0));
+        v = _mm_packus_epi16(_mm256_castsi256_si128(w),
+                             _mm256_extracti128_si256(w, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+    }
+    calibrateUint8Sse2(src + i, dark + i, gain + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void calibrateUint16Avx2(const unsigned short *src, const float *dark,
+                                const float *gain, unsigned short *dst,
+                                size_t n)
+{
+    const __m256 maxValue = _mm256_set1_ps(65535);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v0 = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(src + i));
+        __m128i v1 = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(src + i + 8));
+        __m256i a0 = calibrateEpi32Avx2(_mm256_cvtepu16_epi32(v0),
+                                        dark + i, gain + i, maxValue);
+        __m256i a1 = calibrateEpi32Avx2(_mm256_cvtepu16_epi32(v1),
+                                        dark + i + 8, gain + i + 8, maxValue);
+        __m256i w = _mm256_permute4x64_epi64(_mm256_packus_epi32(a0, a1),
+                                             _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), w);
+    }
+    calibrateUint16Sse2(src + i, dark + i, gain + i, dst + i, n - i);
+}
+
+// The shuffle puts the middle byte of a pair into the low byte of both
+// words, the outer bytes into the high bytes. Shifted right by 4, the odd
+// words are complete, the even ones take the low nibble from the unshifted
+// word. Each 128 bit lane unpacks 12 bytes into 8 pixels, its load reads 4
+// bytes more, which belong to the next block or the tail.
+__attribute__((target("avx2")))
+static void unpackMono12Avx2(unsigned char *buffer, size_t n)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+            1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11,
+            1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11);
+    const __m256i shifted = _mm256_set1_epi32(int(0xffff0ff0));
+    const __m256i lowNibble = _mm256_set1_epi32(0x0000000f);
+
+    size_t numBlocks = n / 16;
+    while (numBlocks > 0 && 24 * numBlocks + 4 > packedMono12Size(n))
+        --numBlocks;
+    unpackMono12Scalar(buffer, n, 16 * numBlocks);
+
+    for (size_t b = numBlocks; b-- > 0; ) {
+        const unsigned char *src = buffer + 24 * b;
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(src))),
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 12)),
+                1);
+        v = _mm256_shuffle_epi8(v, shuffle);
+        v = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(v, 4), shifted),
+                            _mm256_and_si256(v, lowNibble));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(buffer + 32 * b), v);
+    }
+}
+
+// The statistics kernels keep 64 bit sums, except for the squares of 8 bit
+// pixels and the per-lane sums of 16 bit pixels and saturation counts,
+// which are accumulated in narrower lanes for one row. Absolute
+// differences are formed with saturating subtractions, the squares of 16
+// bit values with the 32x32 to 64 bit multiplication of the even lanes.
+// The last pixels of each row go through the scalar code.
+
+__attribute__((target("sse2")))
+static inline __m128i widenEpi32Sse2(__m128i v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_add_epi64(_mm_unpacklo_epi32(v, zero),
+                         _mm_unpackhi_epi32(v, zero));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i squaresEpi32Sse2(__m128i v)
+{
+    __m128i odd = _mm_srli_epi64(v, 32);
+    return _mm_add_epi64(_mm_mul_epu32(v, v), _mm_mul_epu32(odd, odd));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i absDiffEpu8Sse2(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i absDiffEpu16Sse2(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+// sum of squares of 16 unsigned 8 bit values in four 32 bit lanes
+__attribute__((target("sse2")))
+static inline __m128i squaresEpu8Sse2(__m128i v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    return _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+}
+
+// sum of squares of 8 unsigned 16 bit values in two 64 bit lanes
+__attribute__((target("sse2")))
+static inline __m128i squaresEpu16Sse2(__m128i v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_add_epi64(squaresEpi32Sse2(_mm_unpacklo_epi16(v, zero)),
+                         squaresEpi32Sse2(_mm_unpackhi_epi16(v, zero)));
+}
+
+__attribute__((target("sse2")))
+static inline unsigned long long sumEpi64Sse2(__m128i v)
+{
+    unsigned long long lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), v);
+    return lanes[0] + lanes[1];
+}
+
+__attribute__((target("sse2")))
+static void pixelStatsUint8Sse2(const unsigned char *src, size_t width,
+                                size_t height, unsigned int saturation,
+                                PixelStats &s)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i level = _mm_set1_epi8(char(std::min(saturation, 255u)));
+    const __m128i one = _mm_set1_epi8(saturation <= 255 ? 1 : 0);
+    __m128i sum = zero, squares = zero, gradient = zero, saturated = zero;
+    __m128i vmin = _mm_set1_epi8(char(0xff)), vmax = zero;
+
+    for (size_t y = 0; y < height; ++y) {
+        const unsigned char *row = src + y * width;
+        const unsigned char *next = y + 1 < height ? row + width : 0;
+        __m128i rowSquares = zero, rowGradient = zero;
+        size_t x = 0;
+        for (; x + 17 <= width; x += 16) {
+            __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(row + x));
+            __m128i r = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(row + x + 1));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+            rowSquares = _mm_add_epi32(rowSquares, squaresEpu8Sse2(v));
+            vmin = _mm_min_epu8(vmin, v);
+            vmax = _mm_max_epu8(vmax, v);
+            __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(v, level), v);
+            saturated = _mm_add_epi64(saturated, _mm_sad_epu8(
+                    _mm_and_si128(ge, one), zero));
+            rowGradient = _mm_add_epi32(rowGradient,
+                                        squaresEpu8Sse2(absDiffEpu8Sse2(v, r)));
+            if (next) {
+                __m128i d = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i *>(next + x));
+                rowGradient = _mm_add_epi32(
+                        rowGradient, squaresEpu8Sse2(absDiffEpu8Sse2(v, d)));
+            }
+        }
+        squares = _mm_add_epi64(squares, widenEpi32Sse2(rowSquares));
+        gradient = _mm_add_epi64(gradient, widenEpi32Sse2(rowGradient));
+        rowStatsScalar(row, next, x, width, saturation, s);
+    }
+
+    s.sum += sumEpi64Sse2(sum);
+    s.sumSquares += sumEpi64Sse2(squares);
+    s.gradient += sumEpi64Sse2(gradient);
+    s.saturated += sumEpi64Sse2(saturated);
+    unsigned char lo[16], hi[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lo), vmin);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(hi), vmax);
+    for (int i = 0; i < 16; ++i) {
+        s.min = std::min(s.min, (unsigned int)lo[i]);
+        s.max = std::max(s.max, (unsigned int)hi[i]);
+    }
+}
+
+// SSE2 only compares and orders signed 16 bit values, so pixels are
+// offset by flipping the sign bit for these
+__attribute__((target("sse2")))
+static void pixelStatsUint16Sse2(const unsigned short *src, size_t width,
+                                 size_t height, unsigned int saturation,
+                                 PixelStats &s)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i sign = _mm_set1_epi16(short(SignBit));
+    const __m128i level = _mm_set1_epi16(
+            short(std::min(saturation, 65535u) ^ SignBit));
+    const __m128i one = _mm_set1_epi16(saturation <= 65535 ? 1 : 0);
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = zero, squares = zero, gradient = zero, saturated = zero;
+    __m128i vmin = _mm_set1_epi16(0x7fff), vmax = _mm_set1_epi16(-0x8000);
+
+    for (size_t y = 0; y < height; ++y) {
+        const unsigned short *row = src + y * width;
+        const unsigned short *next = y + 1 < height ? row + width : 0;
+        __m128i rowSum = zero, rowSaturated = zero;
+        size_t x = 0;
+        for (; x + 9 <= width; x += 8) {
+            __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(row + x));
+            __m128i r = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(row + x + 1));
+            rowSum = _mm_add_epi32(rowSum, _mm_add_epi32(
+                    _mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+            squares = _mm_add_epi64(squares, squaresEpu16Sse2(v));
+            __m128i sv = _mm_xor_si128(v, sign);
+            vmin = _mm_min_epi16(vmin, sv);
+            vmax = _mm_max_epi16(vmax, sv);
+            __m128i lt = _mm_cmplt_epi16(sv, level);
+            rowSaturated = _mm_add_epi16(rowSaturated,
+                                         _mm_andnot_si128(lt, one));
+            gradient = _mm_add_epi64(gradient,
+                                     squaresEpu16Sse2(absDiffEpu16Sse2(v, r)));
+            if (next) {
+                __m128i d = _mm_loadu_si128(
+                        reinterpret_cast<const __m128i *>(next + x));
+                gradient = _mm_add_epi64(
+                        gradient, squaresEpu16Sse2(absDiffEpu16Sse2(v, d)));
+            }
+        }
+        sum = _mm_add_epi64(sum, widenEpi32Sse2(rowSum));
+        saturated = _mm_add_epi64(saturated, widenEpi32Sse2(
+                _mm_madd_epi16(rowSaturated, ones)));
+        rowStatsScalar(row, next, x, width, saturation, s);
+    }
+
+    s.sum += sumEpi64Sse2(sum);
+    s.sumSquares += sumEpi64Sse2(squares);
+    s.gradient += sumEpi64Sse2(gradient);
+    s.saturated += sumEpi64Sse2(saturated);
+    unsigned short lo[8], hi[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lo), _mm_xor_si128(vmin, sign));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(hi), _mm_xor_si128(vmax, sign));
+    for (int i = 0; i < 8; ++i) {
+        s.min = std::min(s.min, (unsigned int)lo[i]);
+        s.max = std::max(s.max, (unsigned int)hi[i]);
+    }
+}
+
+// the 256 bit unpacks work on each 128 bit lane, which mixes up the pixel
+// order, but not the sums
+
+__attribute__((target("avx2")))
+static inline __m256i widenEpi32Avx2(__m256i v)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    return _mm256_add_epi64(_mm256_unpacklo_epi32(v, zero),
+                            _mm256_unpackhi_epi32(v, zero));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i squaresEpi32Avx2(__m256i v)
+{
+    __m256i odd = _mm256_srli_epi64(v, 32);
+    return _mm256_add_epi64(_mm256_mul_epu32(v, v),
+                            _mm256_mul_epu32(odd, odd));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i absDiffEpu8Avx2(__m256i a, __m256i b)
+{
+    return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i absDiffEpu16Avx2(__m256i a, __m256i b)
+{
+    return _mm256_or_si256(_mm256_subs_epu16(a, b), _mm256_subs_epu16(b, a));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i squaresEpu8Avx2(__m256i v)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_unpacklo_epi8(v, zero);
+    __m256i hi = _mm256_unpackhi_epi8(v, zero);
+    return _mm256_add_epi32(_mm256_madd_epi16(lo, lo),
+                            _mm256_madd_epi16(hi, hi));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i squaresEpu16Avx2(__m256i v)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    return _mm256_add_epi64(squaresEpi32Avx2(_mm256_unpacklo_epi16(v, zero)),
+                            squaresEpi32Avx2(_mm256_unpackhi_epi16(v, zero)));
+}
+
+__attribute__((target("avx2")))
+static inline unsigned long long sumEpi64Avx2(__m256i v)
+{
+    unsigned long long lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static void pixelStatsUint8Avx2(const unsigned char *src, size_t width,
+                                size_t height, unsigned int saturation,
+                                PixelStats &s)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i level = _mm256_set1_epi8(char(std::min(saturation, 255u)));
+    const __m256i one = _mm256_set1_epi8(saturation <= 255 ? 1 : 0);
+    __m256i sum = zero, squares = zero, gradient = zero, saturated = zero;
+    __m256i vmin = _mm256_set1_epi8(char(0xff)), vmax = zero;
+
+    for (size_t y = 0; y < height; ++y) {
+        const unsigned char *row = src + y * width;
+        const unsigned char *next = y + 1 < height ? row + width : 0;
+        __m256i rowSquares = zero, rowGradient = zero;
+        size_t x = 0;
+        for (; x + 33 <= width; x += 32) {
+            __m256i v = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(row + x));
+            __m256i r = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(row + x + 1));
+            sum = _mm256_add_epi64(sum, _mm256_sad_epu8(v, zero));
+            rowSquares = _mm256_add_epi32(rowSquares, squaresEpu8Avx2(v));
+            vmin = _mm256_min_epu8(vmin, v);
+            vmax = _mm256_max_epu8(vmax, v);
+            __m256i ge = _mm256_cmpeq_epi8(_mm256_max_epu8(v, level), v);
+            saturated = _mm256_add_epi64(saturated, _mm256_sad_epu8(
+                    _mm256_and_si256(ge, one), zero));
+            rowGradient = _mm256_add_epi32(
+                    rowGradient, squaresEpu8Avx2(absDiffEpu8Avx2(v, r)));
+            if (next) {
+                __m256i d = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(next + x));
+                rowGradient = _mm256_add_epi32(
+                        rowGradient, squaresEpu8Avx2(absDiffEpu8Avx2(v, d)));
+            }
+        }
+        squares = _mm256_add_epi64(squares, widenEpi32Avx2(rowSquares));
+        gradient = _mm256_add_epi64(gradient, widenEpi32Avx2(rowGradient));
+        rowStatsScalar(row, next, x, width, saturation, s);
+    }
+
+    s.sum += sumEpi64Avx2(sum);
+    s.sumSquares += sumEpi64Avx2(squares);
+    s.gradient += sumEpi64Avx2(gradient);
+    s.saturated += sumEpi64Avx2(saturated);
+    unsigned char lo[32], hi[32];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lo), vmin);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(hi), vmax);
+    for (int i = 0; i < 32; ++i) {
+        s.min = std::min(s.min, (unsigned int)lo[i]);
+        s.max = std::max(s.max, (unsigned int)hi[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void pixelStatsUint16Avx2(const unsigned short *src, size_t width,
+                                 size_t height, unsigned int saturation,
+                                 PixelStats &s)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i level = _mm256_set1_epi16(
+            short(std::min(saturation, 65535u)));
+    const __m256i one = _mm256_set1_epi16(saturation <= 65535 ? 1 : 0);
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = zero, squares = zero, gradient = zero, saturated = zero;
+    __m256i vmin = _mm256_set1_epi16(-1), vmax = zero;
+
+    for (size_t y = 0; y < height; ++y) {
+        const unsigned short *row = src + y * width;
+        const unsigned short *next = y + 1 < height ? row + width : 0;
+        __m256i rowSum = zero, rowSaturated = zero;
+        size_t x = 0;
+        for (; x + 17 <= width; x += 16) {
+            __m256i v = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(row + x));
+            __m256i r = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(row + x + 1));
+            rowSum = _mm256_add_epi32(rowSum, _mm256_add_epi32(
+                    _mm256_unpacklo_epi16(v, zero),
+                    _mm256_unpackhi_epi16(v, zero)));
+            squares = _mm256_add_epi64(squares, squaresEpu16Avx2(v));
+            vmin = _mm256_min_epu16(vmin, v);
+            vmax = _mm256_max_epu16(vmax, v);
+            __m256i ge = _mm256_cmpeq_epi16(_mm256_max_epu16(v, level), v);
+            rowSaturated = _mm256_add_epi16(rowSaturated,
+                                            _mm256_and_si256(ge, one));
+            gradient = _mm256_add_epi64(
+                    gradient, squaresEpu16Avx2(absDiffEpu16Avx2(v, r)));
+            if (next) {
+                __m256i d = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(next + x));
+                gradient = _mm256_add_epi64(
+                        gradient, squaresEpu16Avx2(absDiffEpu16Avx2(v, d)));
+            }
+        }
+        sum = _mm256_add_epi64(sum, widenEpi32Avx2(rowSum));
+        saturated = _mm256_add_epi64(saturated, widenEpi32Avx2(
+                _mm256_madd_epi16(rowSaturated, ones)));
+        rowStatsScalar(row, next, x, width, saturation, s);
+    }
+
+    s.sum += sumEpi64Avx2(sum);
+    s.sumSquares += sumEpi64Avx2(squares);
+    s.gradient += sumEpi64Avx2(gradient);
+    s.saturated += sumEpi64Avx2(saturated);
+    unsigned short lo[16], hi[16];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lo), vmin);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(hi), vmax);
+    for (int i = 0; i < 16; ++i) {
+        s.min = std::min(s.min, (unsigned int)lo[i]);
+        s.max = std::max(s.max, (unsigned int)hi[i]);
+    }
+}
+
+#endif // PVREC_X86_KERNELS
+
+enum Kernel { ScalarKernel, Sse2Kernel, Avx2Kernel };
+
+static Kernel selectKernel()
+{
+#if defined(PVREC_X86_KERNELS) && !defined(PVREC_BIG_ENDIAN)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return Avx2Kernel;
+    if (__builtin_cpu_supports("sse2"))
+        return Sse2Kernel;
+#endif
+    return ScalarKernel;
+}
+
+static const Kernel SelectedKernel = selectKernel();
+
+void toFitsInt16(const unsigned short *src, unsigned short *dst, size_t n)
+{
+    switch (SelectedKernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        toFitsInt16Avx2(src, dst, n);
+        break;
+    case Sse2Kernel:
+        toFitsInt16Sse2(src, dst, n);
+        break;
+#endif
+    default:
+        toFitsInt16Scalar(src, dst, n);
+    }
+}
+
+void toFitsUint16(const unsigned short *src, unsigned short *dst, size_t n)
+{
+    switch (SelectedKernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        toFitsUint16Avx2(src, dst, n);
+        break;
+    case Sse2Kernel:
+        toFitsUint16Sse2(src, dst, n);
+        break;
+#endif
+    default:
+        toFitsUint16Scalar(src, dst, n);
+    }
+}
+
+void fromFitsUint16(const unsigned short *src, unsigned short *dst, size_t n)
+{
+    switch (SelectedKernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        fromFitsUint16Avx2(src, dst, n);
+        break;
+    case Sse2Kernel:
+        fromFitsUint16Sse2(src, dst, n);
+        break;
+#endif
+    default:
+        fromFitsUint16Scalar(src, dst, n);
+    }
+}
+
+void toFitsInt32(const unsigned int *src, unsigned int *dst, size_t n)
+{
+    switch (SelectedKernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        toFitsInt32Avx2(src, dst, n);
+        break;
+    case Sse2Kernel:
+        toFitsInt32Sse2(src, dst, n);
+        break;
+#endif
+    default:
+        toFitsInt32Scalar(src, dst, n);
+    }
+}
+
+void accumulateUint8(const unsigned char *src, unsigned int *acc, size_t n)
+{
+    switch (SelectedKernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        accumulateUint8Avx2(src, acc, n);
+        break;
+    case Sse2Kernel:
+        accumulateUint8Sse2(src, acc, n);
+        break;
+#endif
+    default:
+        accumulateUint8Scalar(src, acc, n);
+    }
+}
+
+void accumulateUint16(const unsigned short *src, unsigned int *acc, size_t n)
+{
+    switch (SelectedKernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        accumulateUint16Avx2(src, acc, n);
+        break;
+    case Sse2Kernel:
+        accumulateUint16Sse2(src, acc, n);
+        break;
+#endif
+    default:
+        accumulateUint16Scalar(src, acc, n);
+    }
+}
+
+void calibrateUint8(const unsigned char *src, const float *dark,
+                    const float *gain, unsigned char *dst, size_t n)
+{
+    switch (SelectedKernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        calibrateUint8Avx2(src, dark, gain, dst, n);
+        break;
+    case Sse2Kernel:
+        calibrateUint8Sse2(src, dark, gain, dst, n);
+        break;
+#endif
+    default:
+        calibrateUint8Scalar(src, dark, gain, dst, n);
+    }
+}
+
+void calibrateUint16(const unsigned short *src, const float *dark,
+                     const float *gain, unsigned short *dst, size_t n)
+{
+    switch (SelectedKernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        calibrateUint16Avx2(src, dark, gain, dst, n);
+        break;
+    case Sse2Kernel:
+        calibrateUint16Sse2(src, dark, gain, dst, n);
+        break;
+#endif
+    default:
+        calibrateUint16Scalar(src, dark, gain, dst, n);
+    }
+}
+
+// SSE2 has no byte shuffle, the scalar version is used instead
+void unpackMono12(unsigned char *buffer, size_t n)
+{
+    switch (SelectedKernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        unpackMono12Avx2(buffer, n);
+        break;
+#endif
+    default:
+        unpackMono12Scalar(buffer, n, 0);
+    }
+}
+
+void pixelStatsUint8(const unsigned char *src, size_t width, size_t height,
+                     unsigned int saturation, PixelStats &stats)
+{
+    clearStats(stats);
+    Kernel kernel = width <= MaxStatsRowWidth ? SelectedKernel : ScalarKernel;
+    switch (kernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        pixelStatsUint8Avx2(src, width, height, saturation, stats);
+        break;
+    case Sse2Kernel:
+        pixelStatsUint8Sse2(src, width, height, saturation, stats);
+        break;
+#endif
+    default:
+        pixelStatsScalar(src, width, height, saturation, stats);
+    }
+    if (width == 0 || height == 0)
+        stats.min = 0;
+}
+
+void pixelStatsUint16(const unsigned short *src, size_t width, size_t height,
+                      unsigned int saturation, PixelStats &stats)
+{
+    clearStats(stats);
+    Kernel kernel = width <= MaxStatsRowWidth ? SelectedKernel : ScalarKernel;
+    switch (kernel)
+    {
+#ifdef PVREC_X86_KERNELS
+    case Avx2Kernel:
+        pixelStatsUint16Avx2(src, width, height, saturation, stats);
+        break;
+    case Sse2Kernel:
+        pixelStatsUint16Sse2(src, width, height, saturation, stats);
+        break;
+#endif
+    default:
+        pixelStatsScalar(src, width, height, saturation, stats);
+    }
+    if (width == 0 || height == 0)
+        stats.min = 0;
+}
+
+const char * pixelConvKernelName()
+{
+    switch (SelectedKernel)
+    {
+    case Avx2Kernel:
+        return "AVX2";
+    case Sse2Kernel:
+        return "SSE2";
+    default:
+        return "scalar";
+    }
+}
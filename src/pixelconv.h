@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_PIXELCONV_H
+#define PVREC_PIXELCONV_H
+
+#include <cstddef>
+
+/*
+    Converts n signed 16 bit pixels from host byte order into the big endian
+    byte order used by FITS files. The buffers may be unaligned but must not
+    overlap, unless src == dst.
+ */
+void toFitsInt16(const unsigned short *src, unsigned short *dst, size_t n);
+
+/*
+    Converts n unsigned 16 bit pixels into big endian FITS integers with an
+    offset of BZERO = 32768, i.e. 32768 is subtracted before the byte swap.
+ */
+void toFitsUint16(const unsigned short *src, unsigned short *dst, size_t n);
+
+/*
+    Converts n big endian FITS integers with BZERO = 32768 back into unsigned
+    16 bit pixels in host byte order, the inverse of toFitsUint16().
+    toFitsInt16() and toFitsInt32() are their own inverse.
+ */
+void fromFitsUint16(const unsigned short *src, unsigned short *dst, size_t n);
+
+/*
+    Converts n 32 bit integers from host byte order into big endian.
+ */
+void toFitsInt32(const unsigned int *src, unsigned int *dst, size_t n);
+
+/*
+    Adds n pixels to 32 bit accumulators, acc[i] += src[i], e.g. to co-add
+    frames. The buffers may be unaligned.
+ */
+void accumulateUint8(const unsigned char *src, unsigned int *acc, size_t n);
+void accumulateUint16(const unsigned short *src, unsigned int *acc, size_t n);
+
+/*
+    Calibrates n pixels, dst[i] = (src[i] - dark[i]) * gain[i], rounded to
+    the nearest integer and clipped to the range of the pixel type. The
+    buffers may be unaligned.
+ */
+void calibrateUint8(const unsigned char *src, const float *dark,
+                    const float *gain, unsigned char *dst, size_t n);
+void calibrateUint16(const unsigned short *src, const float *dark,
+                     const float *gain, unsigned short *dst, size_t n);
+
+/*
+    Unpacks n Mono12Packed pixels at the start of buffer in place into 16 bit
+    pixels in host byte order. Two pixels are packed into three bytes, the
+    8 high bits of the first, the 4 low bits of both with the second in the
+    upper nibble, and the 8 high bits of the second. The buffer must hold
+    2 * n bytes.
+ */
+size_t packedMono12Size(size_t n);
+void unpackMono12(unsigned char *buffer, size_t n);
+
+/*
+    Sums over the pixels of an image for the frame statistics. gradient is
+    the sum of the squared differences between horizontally and vertically
+    adjacent pixels, saturated the number of pixels >= the saturation level.
+ */
+struct PixelStats
+{
+    unsigned long long sum;
+    unsigned long long sumSquares;
+    unsigned long long gradient;
+    unsigned long long saturated;
+    unsigned int min;
+    unsigned int max;
+};
+
+void pixelStatsUint8(const unsigned char *src, size_t width, size_t height,
+                     unsigned int saturation, PixelStats &stats);
+void pixelStatsUint16(const unsigned short *src, size_t width, size_t height,
+                      unsigned int saturation, PixelStats &stats);
+
+/*
+    Returns the name of the conversion kernel selected at runtime.
+ */
+const char * pixelConvKernelName();
+
+#endif // PVREC_PIXELCONV_H
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "progressreporter.h"
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+using std::cout;
+using std::flush;
+
+// weight of the newest interval in the smoothed rates
+static const double RateSmoothing = 0.3;
+
+static double megabytes(unsigned long long bytes)
+{
+    return double(bytes) / (1024.0 * 1024.0);
+}
+
+ProgressReporter::ProgressReporter(
+        const std::vector<const Telemetry *> &telemetry, Mode mode)
+    : m_telemetry(telemetry),
+      m_mode(mode),
+      m_numFrames(0),
+      m_interval(0.5),
+      m_running(false),
+      m_quit(false),
+      m_lineLength(0)
+{
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    stop();
+}
+
+bool ProgressReporter::start(unsigned long numFrames, double interval)
+{
+    stop();
+    if (m_mode == Quiet)
+        return true;
+
+    m_numFrames = numFrames;
+    m_interval = interval;
+    m_quit = false;
+    m_lineLength = 0;
+    m_last.resize(m_telemetry.size());
+    m_fps.assign(m_telemetry.size(), 0);
+    m_mbps.assign(m_telemetry.size(), 0);
+    for (size_t i = 0; i < m_telemetry.size(); ++i)
+        m_telemetry[i]->snapshot(m_last[i]);
+
+    m_running = Thread::start();
+    return m_running;
+}
+
+void ProgressReporter::stop()
+{
+    if (!m_running)
+        return;
+
+    {
+        MutexLocker lock(m_mutex);
+        m_quit = true;
+        m_wake.wakeAll();
+    }
+    join();
+    report(true);
+    m_running = false;
+}
+
+void ProgressReporter::run()
+{
+    MutexLocker lock(m_mutex);
+    while (!m_quit) {
+        m_wake.wait(m_mutex, (unsigned long)(1e3 * m_interval));
+        if (!m_quit)
+            report(false);
+    }
+}
+
+void ProgressReporter::report(bool final)
+{
+    std::string line;
+    for (size_t i = 0; i < m_telemetry.size(); ++i)
+    {
+        TelemetrySnapshot s;
+        m_telemetry[i]->snapshot(s);
+
+        // rates are smoothed once the first frames arrived, the final line
+        // shows the last values
+        const TelemetrySnapshot &last = m_last[i];
+        double dt = s.time - last.time;
+        if (dt > 0 && !final) {
+            double fps = (s.framesQueued - last.framesQueued) / dt;
+            double mbps = megabytes(s.bytesWritten - last.bytesWritten) / dt;
+            double w = (last.framesQueued > 0) ? RateSmoothing : 1;
+            m_fps[i] += w * (fps - m_fps[i]);
+            m_mbps[i] += w * (mbps - m_mbps[i]);
+        }
+        m_last[i] = s;
+
+        if (m_mode == Machine)
+            line += machineLine(i, s, m_fps[i], m_mbps[i]);
+        else
+            line += (i > 0 ? " | " : "") + consoleLine(i, s, m_fps[i],
+                                                      m_mbps[i]);
+    }
+
+    if (m_mode == Machine) {
+        cout << line << flush;
+        return;
+    }
+
+    // overwrite the previous status line, padding over its leftovers
+    size_t length = line.size();
+    if (length < m_lineLength)
+        line.append(m_lineLength - length, ' ');
+    m_lineLength = length;
+    cout << "\r" << line << (final ? "\n" : "") << flush;
+}
+
+// frames the capture loop is done with, whether they were written or lost
+static unsigned long framesDone(const TelemetrySnapshot &s)
+{
+    return s.framesQueued + s.droppedFrames + s.discardedFrames +
+            s.failedFrames;
+}
+
+static double estimatedTime(unsigned long numFrames,
+                            const TelemetrySnapshot &s, double fps)
+{
+    unsigned long done = framesDone(s);
+    if (numFrames == 0 || fps <= 0)
+        return -1;
+    return done < numFrames ? (numFrames - done) / fps : 0;
+}
+
+std::string ProgressReporter::consoleLine(size_t camera,
+        const TelemetrySnapshot &s, double fps, double mbps) const
+{
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if (m_telemetry.size() > 1)
+        ss << "[" << camera << "] ";
+    ss << framesDone(s);
+    if (m_numFrames > 0)
+        ss << "/" << m_numFrames;
+    ss << " frames, " << fps << " fps, " << mbps << " MB/s";
+    if (s.droppedFrames > 0)
+        ss << ", " << s.droppedFrames << " dropped";
+    if (s.missingDataFrames > 0)
+        ss << ", " << s.missingDataFrames << " missing";
+    if (s.discardedFrames > 0)
+        ss << ", " << s.discardedFrames << " discarded";
+    if (s.failedFrames > 0)
+        ss << ", " << s.failedFrames << " failed";
+    double eta = estimatedTime(m_numFrames, s, fps);
+    if (eta > 0) {
+        unsigned long t = (unsigned long)(eta + 0.5);
+        ss << ", ETA " << t / 60 << ":" << std::setfill('0')
+           << std::setw(2) << t % 60 << std::setfill(' ');
+    }
+    return ss.str();
+}
+
+std::string ProgressReporter::machineLine(size_t camera,
+        const TelemetrySnapshot &s, double fps, double mbps) const
+{
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(3)
+       << "progress camera=" << camera
+       << " time=" << s.time
+       << " frames=" << framesDone(s)
+       << " queued=" << s.framesQueued
+       << " total=" << m_numFrames
+       << " written=" << s.framesWritten
+       << " fps=" << fps
+       << " mbps=" << mbps
+       << " dropped=" << s.droppedFrames
+       << " missing=" << s.missingDataFrames
+       << " discarded=" << s.discardedFrames
+       << " failed=" << s.failedFrames
+       << " queue=" << s.queueDepth()
+       << " eta=" << estimatedTime(m_numFrames, s, fps) << "\n";
+    return ss.str();
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_PROGRESSREPORTER_H
+#define PVREC_PROGRESSREPORTER_H
+
+#include "thread.h"
+#include "telemetry.h"
+#include <string>
+#include <vector>
+
+/*
+    Renders the progress of running recordings from their telemetry.
+
+    The reporter runs in its own thread and only reads the telemetry
+    counters, so a slow terminal can never stall the capture threads. In
+    Console mode a single status line is redrawn, in Machine mode one line
+    of key=value pairs per camera is printed each interval.
+ */
+class ProgressReporter : private Thread
+{
+public:
+    enum Mode { Quiet, Console, Machine };
+
+    ProgressReporter(const std::vector<const Telemetry *> &telemetry,
+                     Mode mode);
+    virtual ~ProgressReporter();
+
+    // numFrames is the number of frames per camera, 0 if unknown
+    bool start(unsigned long numFrames, double interval = 0.5);
+    // prints the final state and ends the status line
+    void stop();
+
+protected:
+    virtual void run();
+    void report(bool final);
+    std::string consoleLine(size_t camera, const TelemetrySnapshot &s,
+                            double fps, double mbps) const;
+    std::string machineLine(size_t camera, const TelemetrySnapshot &s,
+                            double fps, double mbps) const;
+
+private:
+    std::vector<const Telemetry *> m_telemetry;
+    Mode m_mode;
+    unsigned long m_numFrames;
+    double m_interval;
+    bool m_running;
+    bool m_quit;
+    size_t m_lineLength;
+    std::vector<TelemetrySnapshot> m_last;
+    std::vector<double> m_fps;
+    std::vector<double> m_mbps;
+    Mutex m_mutex;
+    WaitCondition m_wake;
+};
+
+#endif // PVREC_PROGRESSREPORTER_H
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "pvcamera.h"
+#include "pvutils.h"
+#include "thread.h"
+
+#include <sstream>
+
+// the PvApi is initialized once for all cameras of the process
+static Mutex apiMutex;
+static int apiUsers = 0;
+
+PvCamera::PvCamera()
+    : m_device(0)
+{
+    MutexLocker locker(apiMutex);
+    if (apiUsers++ == 0)
+        PvInitialize();
+}
+
+PvCamera::~PvCamera()
+{
+    close();
+
+    MutexLocker locker(apiMutex);
+    if (--apiUsers == 0)
+        PvUnInitialize();
+}
+
+std::string PvCamera::apiVersionStr() const
+{
+    unsigned long major, minor;
+    PvVersion(&major, &minor);
+
+    std::stringstream ss;
+    ss << major << "." << minor;
+    return ss.str();
+}
+
+PvCamera::CameraInfoVector PvCamera::availableCameras(int timeout) const
+{
+    // try to find a camera for timeout miliseconds
+    int numLoops = timeout / 100;
+    unsigned long camCount = 0;
+    for (int i = 0; i < numLoops && camCount < 1; ++i) {
+        camCount = PvCameraCount();
+        msleep(100);
+    }
+
+    if (camCount < 1)
+        return CameraInfoVector();
+
+    tPvCameraInfoEx *camInfos = new tPvCameraInfoEx[camCount];
+    unsigned long n = PvCameraListEx(camInfos, camCount, 0,
+                                     sizeof(tPvCameraInfoEx));
+
+    CameraInfoVector result;
+    for (unsigned long i = 0; i < n; ++i)
+        result.push_back(*(camInfos + i));
+
+    delete [] camInfos;
+    return result;
+}
+
+tPvErr PvCamera::open(unsigned long uniqueId)
+{
+    tPvErr err = PvCameraOpen(uniqueId, ePvAccessMaster, &m_device);
+    if (err != ePvErrSuccess)
+        m_device = 0;
+    return err;
+}
+
+void PvCamera::close()
+{
+    PvCameraClose(m_device);
+    m_device = 0;
+}
+
+bool PvCamera::isOpen() const
+{
+    return m_device != 0;
+}
+
+tPvErr PvCamera::attrUint32Get(const char *name, tPvUint32 *value) const
+{
+    return PvAttrUint32Get(m_device, name, value);
+}
+
+tPvErr PvCamera::attrUint32Set(const char *name, tPvUint32 value)
+{
+    return PvAttrUint32Set(m_device, name, value);
+}
+
+tPvErr PvCamera::attrFloat32Get(const char *name, tPvFloat32 *value) const
+{
+    return PvAttrFloat32Get(m_device, name, value);
+}
+
+tPvErr PvCamera::attrFloat32Set(const char *name, tPvFloat32 value)
+{
+    return PvAttrFloat32Set(m_device, name, value);
+}
+
+tPvErr PvCamera::attrEnumGet(const char *name, char *buffer,
+                             unsigned long bufferSize) const
+{
+    return PvAttrEnumGet(m_device, name, buffer, bufferSize, 0);
+}
+
+tPvErr PvCamera::attrEnumSet(const char *name, const char *value)
+{
+    return PvAttrEnumSet(m_device, name, value);
+}
+
+tPvErr PvCamera::attrStringGet(const char *name, char *buffer,
+                               unsigned long bufferSize) const
+{
+    return PvAttrStringGet(m_device, name, buffer, bufferSize, 0);
+}
+
+tPvErr PvCamera::commandRun(const char *name)
+{
+    return PvCommandRun(m_device, name);
+}
+
+tPvErr PvCamera::captureStart()
+{
+    return PvCaptureStart(m_device);
+}
+
+tPvErr PvCamera::captureEnd()
+{
+    return PvCaptureEnd(m_device);
+}
+
+tPvErr PvCamera::captureAdjustPacketSize(unsigned long maxPacketSize)
+{
+    return PvCaptureAdjustPacketSize(m_device, maxPacketSize);
+}
+
+tPvErr PvCamera::captureQueueFrame(tPvFrame *frame, tPvFrameCallback callback)
+{
+    return PvCaptureQueueFrame(m_device, frame, callback);
+}
+
+tPvErr PvCamera::captureWaitForFrameDone(tPvFrame *frame,
+                                         unsigned long timeout)
+{
+    return PvCaptureWaitForFrameDone(m_device, frame, timeout);
+}
+
+tPvErr PvCamera::captureQueueClear()
+{
+    return PvCaptureQueueClear(m_device);
+}
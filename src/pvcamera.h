@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_PVCAMERA_H
+#define PVREC_PVCAMERA_H
+
+#include "camera.h"
+
+/*
+    Camera backend for Prosilica GigE cameras using the PvApi.
+ */
+class PvCamera : public Camera
+{
+public:
+    PvCamera();
+    virtual ~PvCamera();
+
+    virtual std::string apiVersionStr() const;
+    virtual CameraInfoVector availableCameras(int timeout) const;
+
+    virtual tPvErr open(unsigned long uniqueId);
+    virtual void close();
+    virtual bool isOpen() const;
+
+    virtual tPvErr attrUint32Get(const char *name, tPvUint32 *value) const;
+    virtual tPvErr attrUint32Set(const char *name, tPvUint32 value);
+    virtual tPvErr attrFloat32Get(const char *name, tPvFloat32 *value) const;
+    virtual tPvErr attrFloat32Set(const char *name, tPvFloat32 value);
+    virtual tPvErr attrEnumGet(const char *name, char *buffer,
+                               unsigned long bufferSize) const;
+    virtual tPvErr attrEnumSet(const char *name, const char *value);
+    virtual tPvErr attrStringGet(const char *name, char *buffer,
+                                 unsigned long bufferSize) const;
+    virtual tPvErr commandRun(const char *name);
+
+    virtual tPvErr captureStart();
+    virtual tPvErr captureEnd();
+    virtual tPvErr captureAdjustPacketSize(unsigned long maxPacketSize);
+    virtual tPvErr captureQueueFrame(tPvFrame *frame,
+                                     tPvFrameCallback callback = 0);
+    virtual tPvErr captureWaitForFrameDone(tPvFrame *frame,
+                                           unsigned long timeout);
+    virtual tPvErr captureQueueClear();
+
+private:
+    PvCamera(const PvCamera &);
+    PvCamera & operator=(const PvCamera &);
+
+    tPvHandle m_device;
+};
+
+#endif // PVREC_PVCAMERA_H
@@ -24,6 +24,12 @@
  */
 
 #include "recorder.h"
+#include "simcamera.h"
+#include "replaycamera.h"
+#include "controlserver.h"
+#include "progressreporter.h"
+#include "thread.h"
+#include "pvutils.h"
 #include "cmdopts.h"
 #include "version.h"
 
@@ -32,7 +38,10 @@
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <cstring>
+#include <cstdio>
+#include <csignal>
 using namespace std;
 
 enum {
@@ -51,6 +60,96 @@ inline string permittedAccessString(unsigned long permittedAccess) {
     return string("None");
 }
 
+static std::vector<Recorder *> runningRecorders;
+
+extern "C" void stopRecording(int)
+{
+    for (size_t i = 0; i < runningRecorders.size(); ++i)
+        runningRecorders[i]->stop();
+}
+
+extern "C" void triggerRecording(int)
+{
+    for (size_t i = 0; i < runningRecorders.size(); ++i)
+        runningRecorders[i]->triggerEvent();
+}
+
+// Runs the recording of one camera in its own thread, the first camera is
+// recorded by the main thread. A failed recording stops all others.
+class RecordThread : public Thread
+{
+public:
+    RecordThread(Recorder *rec, const string &fname, int numFrames,
+                 bool overwrite)
+        : m_rec(rec), m_fname(fname), m_numFrames(numFrames),
+          m_overwrite(overwrite), m_ok(false) {}
+    bool ok() const { return m_ok; }
+
+protected:
+    virtual void run() {
+        m_ok = m_rec->record(m_fname, m_numFrames, m_overwrite);
+        if (!m_ok)
+            stopRecording(0);
+    }
+
+private:
+    Recorder *m_rec;
+    string m_fname;
+    int m_numFrames;
+    bool m_overwrite;
+    bool m_ok;
+};
+
+// name_cam<id>.fits for name.fits, used when recording more than one camera
+static string cameraFileName(const string &fname, unsigned long uniqueId)
+{
+    string::size_type slash = fname.rfind('/');
+    string::size_type dot = fname.rfind('.');
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        dot = fname.size();
+
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), "_cam%lu", uniqueId);
+    return fname.substr(0, dot) + suffix + fname.substr(dot);
+}
+
+static void printIndices(const char *what,
+                         const Recorder::IndexVector &indices)
+{
+    if (indices.empty())
+        return;
+    cout << "\n -> " << indices.size() << " " << what << ": ";
+    for (Recorder::IndexVector::const_iterator it = indices.begin();
+            it != indices.end(); ++it)
+        cout << *it << " ";
+    cout << endl;
+}
+
+static int run(const CmdLineOptions &opts,
+               const std::vector<unsigned long> &cameraIds,
+               const std::vector<Recorder *> &recorders,
+               const std::vector<string> &fileNames);
+
+// the writer decorators only use the synchronous interface of a backend
+inline string writerBackendString(FitsWriter::Backend backend,
+                                  bool decorated) {
+    if (decorated && backend == FitsWriter::Uring)
+        return string("uring (synchronous)");
+    else if (decorated && backend == FitsWriter::UringDirect)
+        return string("uring (synchronous, direct I/O)");
+    else if (backend == FitsWriter::Raw)
+        return string("raw");
+    else if (backend == FitsWriter::Mmap)
+        return string("mmap (preallocated)");
+    else if (backend == FitsWriter::Rice)
+        return string("rice (compressed)");
+    else if (backend == FitsWriter::Uring)
+        return string("uring (asynchronous)");
+    else if (backend == FitsWriter::UringDirect)
+        return string("uring (asynchronous, direct I/O)");
+    return string("cfitsio");
+}
+
 inline string interfaceTypeString(tPvInterface interfaceType) {
     if (interfaceType == ePvInterfaceEthernet)
         return string("GigE");
@@ -78,13 +177,106 @@ int main(int argc, char **argv)
         return E_OK;
     }
 
-    Recorder rec(opts.numBuffers);
-    cout << "PvApi Version: " << rec.apiVersionStr() << endl;
+    // an empty camera list selects the first available camera
+    std::vector<unsigned long> cameraIds = opts.cameraIds;
+    if (cameraIds.empty())
+        cameraIds.push_back(0);
+    const size_t numCameras = cameraIds.size();
+
+    SegmentLimits segmentLimits;
+    segmentLimits.frames = opts.segmentFrames;
+    segmentLimits.megabytes = opts.segmentSize;
+    segmentLimits.seconds = opts.segmentTime;
+
+    // one recorder per camera, the bandwidth is shared equally
+    std::vector<Recorder *> recorders;
+    std::vector<string> fileNames;
+    for (size_t i = 0; i < numCameras; ++i)
+    {
+        SimCamera *simCamera = 0;
+        if (!opts.replayFile.empty()) {
+            ReplayCamera *replayCamera = new ReplayCamera;
+            if (!replayCamera->load(opts.replayFile)) {
+                cerr << "Error: " << replayCamera->lastError() << endl;
+                delete replayCamera;
+                for (size_t k = 0; k < recorders.size(); ++k)
+                    delete recorders[k];
+                return E_ERR_OPEN;
+            }
+            if (cameraIds[i] != 0)
+                replayCamera->setUniqueId(cameraIds[i]);
+            replayCamera->setPaced(!opts.replayFast);
+            simCamera = replayCamera;
+        }
+        else if (opts.simulate) {
+            simCamera = new SimCamera(opts.simWidth, opts.simHeight);
+            if (cameraIds[i] != 0)
+                simCamera->setUniqueId(cameraIds[i]);
+            simCamera->setMissingDataRate(opts.simMissingRate);
+            simCamera->setDropRate(opts.simDropRate);
+            simCamera->setJitter(opts.simJitter);
+        }
+
+        Recorder *rec = new Recorder(opts.numBuffers, simCamera);
+        rec->setQueueSize(opts.queueSize);
+        rec->setOverflowPolicy(opts.dropOnOverflow
+                ? Recorder::DropOnOverflow : Recorder::BlockOnOverflow);
+        rec->setCaptureMode(opts.callbacks
+                ? Recorder::CallbackCapture : Recorder::WaitCapture);
+        if (opts.writer == "raw")
+            rec->setWriterBackend(FitsWriter::Raw);
+        else if (opts.writer == "mmap")
+            rec->setWriterBackend(FitsWriter::Mmap);
+        else if (opts.writer == "rice")
+            rec->setWriterBackend(FitsWriter::Rice);
+        else if (opts.writer == "uring")
+            rec->setWriterBackend(FitsWriter::Uring);
+        else if (opts.writer == "uring-direct")
+            rec->setWriterBackend(FitsWriter::UringDirect);
+        else
+            rec->setWriterBackend(FitsWriter::Cfitsio);
+        rec->setZeroCopy(opts.zeroCopy);
+        rec->setStackSize(opts.stackSize);
+        rec->setFrameSelection(opts.luckyWindow, opts.luckyPercent);
+        rec->setCalibrationFiles(opts.darkFile, opts.flatFile);
+        rec->setHugePages(opts.hugePages);
+        rec->setSegmentLimits(segmentLimits);
+        rec->setLockMemory(opts.lockMemory);
+        rec->setPreTriggerFrames(opts.preTriggerFrames);
+        rec->setEventLevel(opts.eventLevel);
+        if (!opts.cpuSets.empty())
+            rec->setCpuAffinity(opts.cpuSets[i]);
+        if (!opts.statsFile.empty())
+            rec->setStatsFile(numCameras > 1
+                    ? cameraFileName(opts.statsFile, cameraIds[i])
+                    : opts.statsFile, opts.statsInterval);
+        recorders.push_back(rec);
+
+        fileNames.push_back(numCameras > 1
+                ? cameraFileName(opts.fname, cameraIds[i]) : opts.fname);
+    }
+
+    int result = run(opts, cameraIds, recorders, fileNames);
+
+    for (size_t i = 0; i < recorders.size(); ++i)
+        delete recorders[i];
+    return result;
+}
+
+static int run(const CmdLineOptions &opts,
+               const std::vector<unsigned long> &cameraIds,
+               const std::vector<Recorder *> &recorders,
+               const std::vector<string> &fileNames)
+{
+    const size_t numCameras = recorders.size();
+    const bool segmented = recorders[0]->segmentLimits().isEnabled();
+    cout << "PvApi Version: " << recorders[0]->apiVersionStr() << endl;
 
     if (opts.list || opts.info)
     {
         cout << "Searching for cameras..." << endl;
-        Recorder::CameraInfoVector camInfoVec = rec.availableCameras(5000);
+        Recorder::CameraInfoVector camInfoVec =
+                recorders[0]->availableCameras(5000);
 
         if (camInfoVec.size() < 1) {
             cerr << "Error: No camera found." << endl;
@@ -111,7 +303,9 @@ int main(int argc, char **argv)
             int i = 0;
             Recorder::CameraInfoVector::const_iterator it = camInfoVec.begin();
             for (; it != camInfoVec.end(); ++it, ++i) {
-                if (opts.cameraId != 0 && opts.cameraId != it->UniqueId)
+                if (!opts.cameraIds.empty() &&
+                        std::find(opts.cameraIds.begin(), opts.cameraIds.end(),
+                                  it->UniqueId) == opts.cameraIds.end())
                     continue;
                 cout << "\nCamera " << i << ":"
                      << "\n    UniqueId .......... " << it->UniqueId
@@ -132,90 +326,276 @@ int main(int argc, char **argv)
         return E_OK;
     }
 
-    if (!opts.force && std::ifstream(opts.fname.c_str())) {
-        cerr << "Error: '" << opts.fname << "' already exists. Use -f to "
-             << "overwrite it." << endl;
-        return E_ERR_GENERIC;
-    }
-
-    cout << "Opening camera... " << flush;
-    if (!rec.openCamera(opts.cameraId)) {
-        cout << endl;
-        cerr << "Error: " << rec.lastError() << endl;
-        return E_ERR_OPEN;
+    std::vector<string> firstFiles;
+    for (size_t i = 0; i < numCameras; ++i) {
+        string firstFile = segmented
+                ? SegmentedWriter::segmentFileName(fileNames[i], 1)
+                : fileNames[i];
+        if (!opts.force && std::ifstream(firstFile.c_str())) {
+            cerr << "Error: '" << firstFile << "' already exists. Use -f to "
+                 << "overwrite it." << endl;
+            return E_ERR_GENERIC;
+        }
+        firstFiles.push_back(firstFile);
     }
-    cout << "Done" << endl;
 
-    tPvCameraInfoEx camInfo = rec.cameraInfo();
-    cout << "\nCamera infos:"
-         << "\n    UniqueId .......... " << camInfo.UniqueId
-         << "\n    CameraName ........ " << camInfo.CameraName
-         << "\n    ModelName ......... " << camInfo.ModelName
-         << "\n    SerialNumber ...... " << camInfo.SerialNumber
-         << "\n    FirmwareVersion ... " << camInfo.FirmwareVersion
-         << "\n    IP Address ........ " << rec.ipAddress()
-         << "\n    Sensor ............ " << rec.sensorWidth() << "x"
-                                         << rec.sensorHeight() << "@"
-                                         << rec.sensorBits()
-         << endl;
-
-    if (!rec.setFrameRate(opts.frameRate) ||
-        !rec.setExposureTime(opts.exposureTime) ||
-        !rec.setPixelFormat(opts.pixelFormat) ||
-        !rec.setTriggerMode(opts.triggerMode) ||
-        !rec.setTriggerDelay(opts.triggerDelay) ||
-        !rec.setPacketSize(opts.packetSize) ||
-        !rec.setBandwidth(opts.bandwidth))
+    for (size_t i = 0; i < numCameras; ++i)
     {
-        cerr << "Error: " << rec.lastError() << endl;
-        return E_ERR_SETUP;
+        Recorder &rec = *recorders[i];
+        if (numCameras > 1)
+            cout << "\nCamera " << i << ":" << endl;
+
+        cout << "Opening camera... " << flush;
+        if (!rec.openCamera(cameraIds[i])) {
+            cout << endl;
+            cerr << "Error: " << rec.lastError() << endl;
+            return E_ERR_OPEN;
+        }
+        cout << "Done" << endl;
+
+        tPvCameraInfoEx camInfo = rec.cameraInfo();
+        cout << "\nCamera infos:"
+             << "\n    UniqueId .......... " << camInfo.UniqueId
+             << "\n    CameraName ........ " << camInfo.CameraName
+             << "\n    ModelName ......... " << camInfo.ModelName
+             << "\n    SerialNumber ...... " << camInfo.SerialNumber
+             << "\n    FirmwareVersion ... " << camInfo.FirmwareVersion
+             << "\n    IP Address ........ " << rec.ipAddress()
+             << "\n    Sensor ............ " << rec.sensorWidth() << "x"
+                                             << rec.sensorHeight() << "@"
+                                             << rec.sensorBits()
+             << endl;
+
+        if (!rec.setFrameRate(opts.frameRate) ||
+            !rec.setExposureTime(opts.exposureTime) ||
+            !rec.setPixelFormat(opts.pixelFormat) ||
+            !rec.setTriggerMode(opts.triggerMode) ||
+            !rec.setTriggerDelay(opts.triggerDelay) ||
+            !rec.setPacketSize(opts.packetSize) ||
+            !rec.setBandwidth(opts.bandwidth / numCameras) ||
+            ((opts.binX > 1 || opts.binY > 1) &&
+                !rec.setBinning(opts.binX, opts.binY)) ||
+            (opts.roiWidth > 0 && !rec.setRegion(opts.roiX, opts.roiY,
+                                                 opts.roiWidth,
+                                                 opts.roiHeight)))
+        {
+            cerr << "Error: " << rec.lastError() << endl;
+            return E_ERR_SETUP;
+        }
+
+        cout << "\nSettings:"
+             << "\n    FrameRate ......... " << rec.frameRate() << " Hz (max)"
+             << "\n    ExposureTime ...... " << rec.exposureTime() << " ms"
+             << "\n    PixelFormat ....... " << rec.pixelFormat()
+             << "\n    TriggerMode ....... " << rec.triggerMode()
+             << "\n    TriggerDelay ...... " << rec.triggerDelay() << " us"
+             << "\n    Image ............. " << rec.imageWidth() << "x"
+                    << rec.imageHeight() << "+" << rec.regionX() << "+"
+                    << rec.regionY() << ", binning " << rec.binningX() << "x"
+                    << rec.binningY()
+             << "\n    Buffers ........... " << rec.numBuffers()
+                    << (rec.hugePages() ? " (huge pages requested)" : "")
+             << "\n    WriteQueue ........ "
+                    << (rec.queueSize() > 0 ? rec.queueSize()
+                                            : rec.numBuffers())
+                    << (rec.overflowPolicy() == Recorder::DropOnOverflow
+                            ? " (drop)" : " (block)")
+             << "\n    Capture ........... "
+                    << (rec.captureMode() == Recorder::CallbackCapture
+                            ? "callbacks" : "wait")
+             << "\n    Writer ............ "
+                    << writerBackendString(rec.writerBackend(),
+                                           rec.hasWriterDecorators())
+                    << (rec.zeroCopy() ? ", zero-copy" : "")
+             << "\n    PacketSize ........ " << rec.packetSize() << " bytes"
+             << "\n    Bandwidth ......... " << rec.bandwidth() << " MB/s"
+             << endl;
+
+        std::vector<int> cpus = rec.cpuAffinity();
+        if (!cpus.empty()) {
+            cout << "    CPUs .............. " << cpus.front();
+            if (cpus.size() > 1)
+                cout << "-" << cpus.back();
+            cout << endl;
+        }
+
+        if (!opts.replayFile.empty())
+            cout << "    Replay ............ " << opts.replayFile
+                 << (opts.replayFast ? " (as fast as possible)"
+                                     : " (recorded timing)") << endl;
+
+        if (!rec.statsFile().empty())
+            cout << "    StatsFile ......... " << rec.statsFile() << " (every "
+                 << opts.statsInterval << " s)" << endl;
+
+        if (segmented) {
+            cout << "    Segments .......... ";
+            if (opts.segmentFrames > 0)
+                cout << opts.segmentFrames << " frames ";
+            if (opts.segmentSize > 0)
+                cout << opts.segmentSize << " MB ";
+            if (opts.segmentTime > 0)
+                cout << opts.segmentTime << " s ";
+            cout << endl;
+        }
+
+        if (opts.preTriggerFrames > 0) {
+            cout << "    Event ............. " << opts.preTriggerFrames
+                 << " frames before, " << opts.numFrames << " after";
+            if (opts.eventLevel > 0)
+                cout << ", level " << opts.eventLevel;
+            cout << endl;
+        }
+
+        if (opts.stackSize > 1)
+            cout << "    Stacking .......... " << opts.stackSize
+                 << " frames per image" << endl;
+        if (opts.luckyPercent > 0)
+            cout << "    Lucky imaging ..... best " << opts.luckyPercent
+                 << "% of " << opts.luckyWindow << " frames" << endl;
+        if (!opts.darkFile.empty())
+            cout << "    Dark .............. " << opts.darkFile << endl;
+        if (!opts.flatFile.empty())
+            cout << "    Flat .............. " << opts.flatFile << endl;
     }
 
-    cout << "\nSettings:"
-         << "\n    FrameRate ......... " << rec.frameRate() << " Hz (max)"
-         << "\n    ExposureTime ...... " << rec.exposureTime() << " ms"
-         << "\n    PixelFormat ....... " << rec.pixelFormat()
-         << "\n    TriggerMode ....... " << rec.triggerMode()
-         << "\n    TriggerDelay ...... " << rec.triggerDelay() << " us"
-         << "\n    Buffers ........... " << rec.numBuffers()
-         << "\n    PacketSize ........ " << rec.packetSize() << " bytes"
-         << "\n    Bandwidth ......... " << rec.bandwidth() << " MB/s"
-         << endl;
+    ControlServer control(recorders);
+    if (!opts.controlSocket.empty()) {
+        if (!control.listen(opts.controlSocket)) {
+            cerr << "Error: " << control.lastError() << endl;
+            return E_ERR_SETUP;
+        }
+        cout << "    ControlSocket ..... " << opts.controlSocket << endl;
+    }
 
     cout << endl;
-    cout << "Recording " << opts.numFrames << " frame"
-         << (opts.numFrames != 1 ? "s" : "")
-         << " to '" << opts.fname << "':" << endl;
+    if (opts.preTriggerFrames > 0)
+        cout << "Waiting for an event (SIGUSR1"
+             << (opts.controlSocket.empty() ? "" : ", control socket")
+             << (opts.eventLevel > 0 ? ", level" : "") << ")";
+    else if (opts.numFrames > 0)
+        cout << "Recording " << opts.numFrames << " frame"
+             << (opts.numFrames != 1 ? "s" : "");
+    else
+        cout << "Recording until interrupted";
+    cout << " to '" << firstFiles[0] << "'";
+    for (size_t i = 1; i < numCameras; ++i)
+        cout << ", '" << firstFiles[i] << "'";
+    cout << (segmented ? ", ..." : "") << ":" << endl;
+
+    // Ctrl-C ends the recording cleanly, SIGUSR1 triggers an event
+    struct sigaction sa, oldSa, usrSa, oldUsrSa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopRecording;
+    sigemptyset(&sa.sa_mask);
+    usrSa = sa;
+    usrSa.sa_handler = triggerRecording;
+    runningRecorders = recorders;
+    sigaction(SIGINT, &sa, &oldSa);
+    sigaction(SIGUSR1, &usrSa, &oldUsrSa);
 
-    if (!rec.record(opts.fname, opts.numFrames, opts.force)) {
-        cerr << "Error: " << rec.lastError() << endl;
-        return E_ERR_RECORD;
+    // progress is shown by a thread of its own, so that a slow terminal
+    // cannot hold up the capture threads
+    std::vector<const Telemetry *> telemetry;
+    for (size_t i = 0; i < numCameras; ++i)
+        telemetry.push_back(&recorders[i]->telemetry());
+    ProgressReporter reporter(telemetry, opts.quiet ? ProgressReporter::Quiet
+            : opts.machineProgress ? ProgressReporter::Machine
+                                   : ProgressReporter::Console);
+    reporter.start(opts.numFrames > 0
+                   ? opts.preTriggerFrames + opts.numFrames : 0);
+
+    // the first camera is recorded by the main thread, all others in a
+    // thread of their own
+    std::vector<RecordThread *> threads;
+    bool ok = true;
+    for (size_t i = 1; i < numCameras && ok; ++i) {
+        RecordThread *thread = new RecordThread(recorders[i], fileNames[i],
+                                                opts.numFrames, opts.force);
+        if (thread->start()) {
+            threads.push_back(thread);
+        }
+        else {
+            delete thread;
+            cerr << "Error: Cannot start the recording of camera " << i
+                 << "." << endl;
+            stopRecording(0);
+            ok = false;
+        }
     }
 
-    Recorder::IndexVector droppedFrames = rec.droppedFrames();
-    if (!droppedFrames.empty()) {
-        cout << "\n -> " << droppedFrames.size()
-             << " dropped frame(s): ";
-        for (Recorder::IndexVector::iterator it = droppedFrames.begin();
-                it != droppedFrames.end(); ++it)
-            cout << *it << " ";
-        cout << endl;
+    std::vector<bool> recorded(numCameras, false);
+    if (ok)
+        recorded[0] = recorders[0]->record(fileNames[0], opts.numFrames,
+                                           opts.force);
+    else
+        recorders[0]->stop();
+
+    if (!recorded[0])
+        stopRecording(0);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i]->join();
+        recorded[i + 1] = threads[i]->ok();
+        delete threads[i];
     }
 
-    Recorder::IndexVector missingDataFrames = rec.missingDataFrames();
-    if (!missingDataFrames.empty()) {
-        cout << "\n -> " << missingDataFrames.size()
-             << " frame(s) with missing data: ";
-        for (Recorder::IndexVector::iterator it = missingDataFrames.begin();
-                it != missingDataFrames.end(); ++it)
-            cout << *it << " ";
-        cout << endl;
+    reporter.stop();
+    sigaction(SIGUSR1, &oldUsrSa, 0);
+    sigaction(SIGINT, &oldSa, 0);
+    runningRecorders.clear();
+    control.close();
+
+    int result = E_OK;
+    for (size_t i = 0; i < numCameras; ++i)
+    {
+        Recorder &rec = *recorders[i];
+        if (numCameras > 1)
+            cout << "\nCamera " << i << " ('" << firstFiles[i] << "'):";
+
+        if (!recorded[i]) {
+            if (numCameras > 1)
+                cout << endl;
+            if (!rec.lastError().empty())
+                cerr << "Error: " << rec.lastError() << endl;
+            result = E_ERR_RECORD;
+            continue;
+        }
+
+        if (opts.preTriggerFrames > 0) {
+            if (rec.eventFrame() > 0)
+                cout << "\n -> event at frame " << rec.eventFrame() << endl;
+            else
+                cout << "\n -> no event, nothing recorded" << endl;
+        }
+
+        // the frame pool falls back to what the system allows
+        if (rec.hugePages() && !rec.hugePageBuffers())
+            cout << "\n -> frame buffers without huge pages" << endl;
+        if (rec.lockMemory() && !rec.buffersLocked())
+            cout << "\n -> frame buffers not locked into memory" << endl;
+
+        printIndices("dropped frame(s)", rec.droppedFrames());
+        printIndices("frame(s) with missing data", rec.missingDataFrames());
+        printIndices("discarded frame(s)", rec.discardedFrames());
+
+        TelemetrySnapshot stats;
+        rec.telemetry().snapshot(stats);
+        if (stats.failedFrames > 0) {
+            cout << "\n -> " << stats.failedFrames << " failed frame(s)";
+            if (stats.lastFailure != 0)
+                cout << ", last error: "
+                     << PvErrorMessage(tPvErr(stats.lastFailure)) << " ["
+                     << PvErrorCodeStr(tPvErr(stats.lastFailure)) << "]";
+            cout << endl;
+        }
     }
 
     cout << endl;
-    cout << "Closing camera... " << flush;
-    rec.closeCamera();
+    cout << "Closing camera" << (numCameras > 1 ? "s" : "") << "... "
+         << flush;
+    for (size_t i = 0; i < numCameras; ++i)
+        recorders[i]->closeCamera();
     cout << "Done" << endl;
 
-    return E_OK;
+    return result;
 }
@@ -0,0 +1,591 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+    Throughput benchmark of the FitsWriter backends, for measuring writer
+    changes without a camera. Each run writes a file of synthetic frames
+    into every given directory and reports frames/s, GB/s and percentiles
+    of the write latency. Asynchronous writers are driven through
+    submitFrame() and reapFrames() like in the writer thread, their latency
+    is the time from the submission to the completion of a frame.
+ */
+
+#include "fitswriter.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+using namespace std;
+
+static const int DefaultNumFrames = 100;
+static const char DefaultSizes[] = "640x480,1024x1024,2048x2048";
+static const char DefaultBits[] = "8,16";
+// the uring writers fail to open without io_uring support
+#ifdef PVREC_HAVE_IO_URING
+static const char DefaultWriters[] = "cfitsio,raw,mmap,rice,uring";
+#else
+static const char DefaultWriters[] = "cfitsio,raw,mmap,rice";
+#endif
+static const char DefaultClobber[] = "off,on";
+
+// frames are taken in turn from this many different images, so that the
+// compressing writer doesn't see the same frame over and over
+static const int NumImages = 8;
+
+static const size_t BufferAlignment = 4096;
+
+// writes an asynchronous writer has in flight, the writer thread is limited
+// by the capture buffers the same way (default: 10)
+static const int WritesInFlight = 10;
+
+// file name of the benchmark file inside the tested directories
+static const char BenchFileName[] = "pvrec_bench.fits";
+
+struct WriterName
+{
+    const char *name;
+    FitsWriter::Backend backend;
+};
+
+static const WriterName writerNames[] = {
+    { "cfitsio", FitsWriter::Cfitsio },
+    { "raw", FitsWriter::Raw },
+    { "mmap", FitsWriter::Mmap },
+    { "rice", FitsWriter::Rice },
+    { "uring", FitsWriter::Uring },
+    { "uring-direct", FitsWriter::UringDirect }
+};
+static const int NumWriterNames = sizeof(writerNames) / sizeof(writerNames[0]);
+
+struct FrameSize
+{
+    int width;
+    int height;
+};
+
+struct Options
+{
+    int numFrames;
+    vector<FrameSize> sizes;
+    vector<int> bits;
+    vector<string> writers;
+    vector<bool> clobber;
+    bool sync;
+    vector<string> dirs;
+};
+
+struct Result
+{
+    double totalTime;               // open() to close() in seconds
+    vector<double> latencies;       // write of each frame in seconds
+};
+
+template <class T>
+bool fromString(T &value, const std::string &str) {
+    std::istringstream ss(str);
+    ss >> value;
+    return !ss.fail() && ss.eof();
+}
+
+static vector<string> split(const string &str, char sep)
+{
+    vector<string> result;
+    string::size_type start = 0, pos;
+    while ((pos = str.find(sep, start)) != string::npos) {
+        result.push_back(str.substr(start, pos - start));
+        start = pos + 1;
+    }
+    result.push_back(str.substr(start));
+    return result;
+}
+
+static double monotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool findWriter(const string &name, FitsWriter::Backend &backend)
+{
+    for (int i = 0; i < NumWriterNames; ++i)
+        if (name == writerNames[i].name) {
+            backend = writerNames[i].backend;
+            return true;
+        }
+    return false;
+}
+
+// name of the file system type of a directory, e.g. tmpfs or ext4
+static string fileSystemName(const string &dir)
+{
+    struct statfs fs;
+    if (statfs(dir.c_str(), &fs) != 0)
+        return "unknown";
+
+    switch ((unsigned long)fs.f_type)
+    {
+    case 0x01021994UL: return "tmpfs";
+    case 0x0000ef53UL: return "ext4";
+    case 0x58465342UL: return "xfs";
+    case 0x9123683eUL: return "btrfs";
+    case 0x00006969UL: return "nfs";
+    case 0x794c7630UL: return "overlay";
+    }
+
+    ostringstream ss;
+    ss << "0x" << hex << (unsigned long)fs.f_type;
+    return ss.str();
+}
+
+static string usage(const char *appName)
+{
+    ostringstream ss;
+    ss << "Usage: " << appName << " [options] [directory...]";
+    return ss.str();
+}
+
+static string helpMessage(const char *appName)
+{
+    ostringstream ss;
+    ss << usage(appName) << "\n\n"
+       << "Writes files of synthetic frames into each directory (default: .)\n"
+       << "with every combination of the options below.\n\n"
+       << "Options:\n"
+       << "  -n, --count       Frames per file (default: " << DefaultNumFrames << ")\n"
+       << "  -s, --size        Comma separated frame sizes WIDTHxHEIGHT (default: " << DefaultSizes << ")\n"
+       << "  -b, --bits        Comma separated bits per pixel, 8 or 16 (default: " << DefaultBits << ")\n"
+       << "  -w, --writer      Comma separated writers, cfitsio, raw, mmap, rice, uring\n"
+       << "                    or uring-direct (default: " << DefaultWriters << ")\n"
+       << "      --clobber     Overwrite an existing file, off, on or off,on (default: " << DefaultClobber << ")\n"
+       << "      --sync        Include an fsync() of the file in the time\n"
+       << "  -h, --help        Print this help message and exit\n\n"
+       << "Without --sync a run mostly measures writing into the page cache.";
+    return ss.str();
+}
+
+// returns 0 on success, 1 on invalid options and -1 if only the help
+// message was requested
+static int parseOptions(int argc, char **argv, Options &opts)
+{
+    enum { OptClobber = 256, OptSync };
+    static struct option longOptions[] = {
+        { "count", required_argument, 0, 'n' },
+        { "size", required_argument, 0, 's' },
+        { "bits", required_argument, 0, 'b' },
+        { "writer", required_argument, 0, 'w' },
+        { "clobber", required_argument, 0, OptClobber },
+        { "sync", no_argument, 0, OptSync },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    string sizes = DefaultSizes;
+    string bits = DefaultBits;
+    string writers = DefaultWriters;
+    string clobber = DefaultClobber;
+    opts.numFrames = DefaultNumFrames;
+    opts.sync = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:s:b:w:h", longOptions, 0)) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            if (!fromString(opts.numFrames, optarg) || opts.numFrames < 1) {
+                cerr << argv[0] << ": -n must be a positive integer." << endl;
+                return 1;
+            }
+            break;
+        case 's':
+            sizes = optarg;
+            break;
+        case 'b':
+            bits = optarg;
+            break;
+        case 'w':
+            writers = optarg;
+            break;
+        case OptClobber:
+            clobber = optarg;
+            break;
+        case OptSync:
+            opts.sync = true;
+            break;
+        case 'h':
+            cout << helpMessage(argv[0]) << endl;
+            return -1;
+        default:
+            cerr << argv[0] << ": `--help' gives usage information." << endl;
+            return 1;
+        }
+    }
+
+    vector<string> items = split(sizes, ',');
+    for (size_t i = 0; i < items.size(); ++i) {
+        string::size_type xpos = items[i].find('x');
+        FrameSize size;
+        if (xpos == string::npos ||
+                !fromString(size.width, items[i].substr(0, xpos)) ||
+                !fromString(size.height, items[i].substr(xpos + 1)) ||
+                size.width < 1 || size.height < 1) {
+            cerr << argv[0] << ": Invalid frame size '" << items[i]
+                 << "'." << endl;
+            return 1;
+        }
+        opts.sizes.push_back(size);
+    }
+
+    items = split(bits, ',');
+    for (size_t i = 0; i < items.size(); ++i) {
+        int value;
+        if (!fromString(value, items[i]) || (value != 8 && value != 16)) {
+            cerr << argv[0] << ": -b must be 8 or 16." << endl;
+            return 1;
+        }
+        opts.bits.push_back(value);
+    }
+
+    opts.writers = split(writers, ',');
+    for (size_t i = 0; i < opts.writers.size(); ++i) {
+        FitsWriter::Backend backend;
+        if (!findWriter(opts.writers[i], backend)) {
+            cerr << argv[0] << ": Unknown writer '" << opts.writers[i]
+                 << "'." << endl;
+            return 1;
+        }
+    }
+
+    items = split(clobber, ',');
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i] != "off" && items[i] != "on") {
+            cerr << argv[0] << ": --clobber must be off, on or off,on."
+                 << endl;
+            return 1;
+        }
+        opts.clobber.push_back(items[i] == "on");
+    }
+
+    for (int i = optind; i < argc; ++i)
+        opts.dirs.push_back(argv[i]);
+    if (opts.dirs.empty())
+        opts.dirs.push_back(".");
+
+    return 0;
+}
+
+// a smooth background with noise, the pixel values use 12 bits for 16 bit
+// frames like a typical camera
+static void fillImage(unsigned char *data, int width, int height, int bits,
+                      unsigned int seed)
+{
+    unsigned int maxValue = (bits == 8) ? 255 : 4095;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x) {
+            unsigned int value = maxValue / 4 +
+                    (unsigned int)(x + y) * (maxValue / 2) /
+                    (unsigned int)(width + height) +
+                    rand_r(&seed) % (maxValue / 16);
+            size_t i = size_t(y) * width + x;
+            if (bits == 8)
+                data[i] = (unsigned char)value;
+            else
+                reinterpret_cast<unsigned short *>(data)[i] =
+                        (unsigned short)value;
+        }
+}
+
+static bool syncFile(const string &fname)
+{
+    int fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = (fsync(fd) == 0);
+    ::close(fd);
+    return ok;
+}
+
+static void writeFrameInfo(FitsWriter *writer, long index)
+{
+    FrameInfo info;
+    memset(&info, 0, sizeof(info));
+    info.frameCount = index;
+    info.recordIndex = index;
+    info.numCombined = 1;
+    writer->writeFrameInfo(index, info);
+}
+
+static bool writeFrames(FitsWriter *writer, int numFrames,
+                        const vector<unsigned char *> &images,
+                        Result &result, string &error)
+{
+    for (int i = 0; i < numFrames; ++i) {
+        double t = monotonicTime();
+        if (!writer->writeFrame(i + 1, images[i % images.size()])) {
+            error = writer->lastError();
+            return false;
+        }
+        result.latencies.push_back(monotonicTime() - t);
+        writeFrameInfo(writer, i + 1);
+    }
+    return true;
+}
+
+// the tag of a write points to its submission time
+static bool reapFrames(FitsWriter *writer, bool wait,
+                       const vector<double> &submitTimes, Result &result,
+                       string &error)
+{
+    vector<FitsWriter::CompletedWrite> done;
+    if (!writer->reapFrames(done, wait)) {
+        error = writer->lastError();
+        return false;
+    }
+
+    double now = monotonicTime();
+    for (size_t i = 0; i < done.size(); ++i) {
+        if (!done[i].ok) {
+            error = writer->lastError();
+            return false;
+        }
+        const double *t = static_cast<const double *>(done[i].tag);
+        result.latencies.push_back(now - *t);
+        writeFrameInfo(writer, long(t - &submitTimes[0]) + 1);
+    }
+    return true;
+}
+
+static bool submitFrames(FitsWriter *writer, int numFrames,
+                         const vector<unsigned char *> &images,
+                         Result &result, string &error)
+{
+    vector<double> submitTimes(numFrames);
+    for (int i = 0; i < numFrames; ++i) {
+        while (writer->pendingFrames() >= WritesInFlight)
+            if (!reapFrames(writer, true, submitTimes, result, error))
+                return false;
+
+        submitTimes[i] = monotonicTime();
+        if (!writer->submitFrame(i + 1, images[i % images.size()],
+                                 &submitTimes[i])) {
+            error = writer->lastError();
+            return false;
+        }
+        if (!reapFrames(writer, false, submitTimes, result, error))
+            return false;
+    }
+
+    while (writer->pendingFrames() > 0)
+        if (!reapFrames(writer, true, submitTimes, result, error))
+            return false;
+    return true;
+}
+
+// writes one file, the time is measured from open() to close()
+static bool writeFile(FitsWriter *writer, const string &fname,
+                      FitsWriter::PixelType pixelType, int width, int height,
+                      int numFrames, bool clobber, bool sync,
+                      const vector<unsigned char *> &images,
+                      Result &result, string &error)
+{
+    result.latencies.clear();
+    result.latencies.reserve(numFrames);
+
+    double start = monotonicTime();
+    if (!writer->open(fname, pixelType, width, height, numFrames, clobber)) {
+        error = writer->lastError();
+        return false;
+    }
+    writer->setFrameBuffers(images);
+
+    bool ok = writer->isAsync()
+            ? submitFrames(writer, numFrames, images, result, error)
+            : writeFrames(writer, numFrames, images, result, error);
+    if (!ok)
+        return false;
+
+    writer->close();
+    if (!writer->lastError().empty()) {
+        error = writer->lastError();
+        return false;
+    }
+    if (sync && !syncFile(fname)) {
+        error = string("Cannot sync file: ") + strerror(errno);
+        return false;
+    }
+    result.totalTime = monotonicTime() - start;
+    return true;
+}
+
+static bool runBenchmark(FitsWriter::Backend backend, const string &fname,
+                         FitsWriter::PixelType pixelType, int width,
+                         int height, int numFrames, bool clobber, bool sync,
+                         const vector<unsigned char *> &images,
+                         Result &result, string &error)
+{
+    FitsWriter *writer = FitsWriter::create(backend);
+    bool ok = writeFile(writer, fname, pixelType, width, height, numFrames,
+                        clobber, sync, images, result, error);
+    delete writer;
+    return ok;
+}
+
+// nearest rank percentile of sorted values
+static double percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t rank = size_t(p / 100.0 * sorted.size() + 0.5);
+    rank = std::min(std::max(rank, size_t(1)), sorted.size());
+    return sorted[rank - 1];
+}
+
+static void printHeader()
+{
+    cout << left << setw(14) << "Writer" << setw(11) << "Size"
+         << right << setw(4) << "Bits" << setw(8) << "Clobber"
+         << setw(10) << "Frames/s" << setw(8) << "GB/s"
+         << setw(9) << "p50 us" << setw(9) << "p90 us"
+         << setw(9) << "p99 us" << setw(9) << "max us" << endl;
+}
+
+// the columns identifying a run
+static void printRun(const string &writerName, const FrameSize &size,
+                     int bits, bool clobber)
+{
+    ostringstream sizeStr;
+    sizeStr << size.width << "x" << size.height;
+    cout << left << setw(14) << writerName << setw(11) << sizeStr.str()
+         << right << setw(4) << bits << setw(8) << (clobber ? "on" : "off");
+}
+
+static void printResult(int numFrames, size_t frameSize, Result &result)
+{
+    sort(result.latencies.begin(), result.latencies.end());
+    cout << fixed << setprecision(1)
+         << setw(10) << numFrames / result.totalTime
+         << setprecision(3)
+         << setw(8) << numFrames * double(frameSize) / result.totalTime / 1e9
+         << setprecision(0)
+         << setw(9) << percentile(result.latencies, 50) * 1e6
+         << setw(9) << percentile(result.latencies, 90) * 1e6
+         << setw(9) << percentile(result.latencies, 99) * 1e6
+         << setw(9) << result.latencies.back() * 1e6 << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    int rc = parseOptions(argc, argv, opts);
+    if (rc != 0)
+        return rc < 0 ? 0 : 1;
+
+    bool failed = false;
+    for (size_t d = 0; d < opts.dirs.size(); ++d)
+    {
+        string fname = opts.dirs[d] + "/" + BenchFileName;
+        if (access(opts.dirs[d].c_str(), W_OK) != 0) {
+            cerr << "Cannot write to the directory '" << opts.dirs[d]
+                 << "'. " << strerror(errno) << "." << endl;
+            failed = true;
+            continue;
+        }
+
+        cout << "Directory " << opts.dirs[d] << " ("
+             << fileSystemName(opts.dirs[d]) << "), " << opts.numFrames
+             << " frames per file" << (opts.sync ? ", synced" : "") << ":\n"
+             << endl;
+        printHeader();
+
+        for (size_t s = 0; s < opts.sizes.size(); ++s)
+        for (size_t b = 0; b < opts.bits.size(); ++b)
+        {
+            const FrameSize &size = opts.sizes[s];
+            int bits = opts.bits[b];
+            FitsWriter::PixelType pixelType =
+                    (bits == 8) ? FitsWriter::Uint8 : FitsWriter::Uint16;
+            size_t frameSize = size_t(size.width) * size.height *
+                    FitsWriter::bytesPerPixel(pixelType);
+
+            vector<unsigned char *> images(NumImages);
+            for (int i = 0; i < NumImages; ++i) {
+                void *p;
+                if (posix_memalign(&p, BufferAlignment, frameSize) != 0) {
+                    cerr << "Cannot allocate the frame buffers." << endl;
+                    return 1;
+                }
+                images[i] = static_cast<unsigned char *>(p);
+                fillImage(images[i], size.width, size.height, bits, i + 1);
+            }
+
+            for (size_t w = 0; w < opts.writers.size(); ++w)
+            for (size_t c = 0; c < opts.clobber.size(); ++c)
+            {
+                FitsWriter::Backend backend = FitsWriter::Cfitsio;
+                findWriter(opts.writers[w], backend);
+                bool clobber = opts.clobber[c];
+
+                // without clobber the file must not exist, with clobber an
+                // existing file of the same size is overwritten
+                Result result;
+                string error;
+                unlink(fname.c_str());
+                bool ok = !clobber || runBenchmark(backend, fname, pixelType,
+                        size.width, size.height, opts.numFrames, false, false,
+                        images, result, error);
+                ok = ok && runBenchmark(backend, fname, pixelType,
+                        size.width, size.height, opts.numFrames, clobber,
+                        opts.sync, images, result, error);
+                unlink(fname.c_str());
+
+                printRun(opts.writers[w], size, bits, clobber);
+                if (ok)
+                    printResult(opts.numFrames, frameSize, result);
+                else {
+                    cout << "  failed: " << error << endl;
+                    failed = true;
+                }
+            }
+
+            for (int i = 0; i < NumImages; ++i)
+                free(images[i]);
+        }
+        cout << endl;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,512 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+    Extracts frames or pixel time series from a recorded FITS cube. The cube
+    is read through CubeReader, so only the requested frames are loaded from
+    disk, no matter how large the file is.
+ */
+
+#include "cubereader.h"
+#include "pixelconv.h"
+#include "thread.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+// frames are converted and written in pieces of about this size
+static const size_t ChunkSize = 8 << 20;
+
+static const int MaxThreads = 64;
+
+struct PixelPos
+{
+    int x;
+    int y;
+};
+
+struct Options
+{
+    long first;                 // 0 for all frames
+    long last;                  // 0 up to the last frame
+    vector<PixelPos> pixels;
+    bool raw;
+    int numThreads;
+    bool force;
+    string input;
+    string output;
+};
+
+template <class T>
+bool fromString(T &value, const std::string &str) {
+    std::istringstream ss(str);
+    ss >> value;
+    return !ss.fail() && ss.eof();
+}
+
+static bool writeAll(int fd, const unsigned char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+static bool pwriteAll(int fd, const unsigned char *data, size_t size,
+                      off_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= size_t(n);
+        offset += n;
+    }
+    return true;
+}
+
+// writes zeros up to the end of the FITS block
+static bool writePadding(int fd, size_t size)
+{
+    vector<unsigned char> zeros(FitsHeader::roundUpToBlock(size) - size, 0);
+    return zeros.empty() || writeAll(fd, &zeros[0], zeros.size());
+}
+
+static void putBigEndian64(unsigned char *p, long long value)
+{
+    for (int i = 7; i >= 0; --i, value >>= 8)
+        p[i] = (unsigned char)(value & 0xff);
+}
+
+/*
+    Converts the frames of a range into host byte order and writes them to
+    their offset in the output file. Several threads share the conversion
+    of a range, each one working on its own frames.
+ */
+class ConvertThread : public Thread
+{
+public:
+    ConvertThread(const CubeReader &reader, long first, long last,
+                  long outFirst, int fd)
+        : m_reader(reader), m_first(first), m_last(last),
+          m_outFirst(outFirst), m_fd(fd), m_errnum(0)
+    {}
+
+    // errno of a failed write, 0 on success
+    int error() const { return m_errnum; }
+
+    // converts in the calling thread
+    void convert() { run(); }
+
+protected:
+    virtual void run();
+
+private:
+    const CubeReader &m_reader;
+    long m_first;
+    long m_last;
+    long m_outFirst;
+    int m_fd;
+    int m_errnum;
+};
+
+void ConvertThread::run()
+{
+    const size_t frameSize = m_reader.frameSize();
+    const long chunkFrames = long(max<size_t>(1, ChunkSize / frameSize));
+    const FitsWriter::PixelType pixelType = m_reader.pixelType();
+    vector<unsigned char> buffer;
+    if (pixelType != FitsWriter::Uint8)
+        buffer.resize(chunkFrames * frameSize);
+
+    for (long index = m_first; index <= m_last; index += chunkFrames)
+    {
+        long n = min(chunkFrames, m_last - index + 1);
+        size_t size = n * frameSize;
+        const unsigned char *src = m_reader.frame(index);
+        const unsigned char *data = src;
+
+        switch (pixelType)
+        {
+        case FitsWriter::Uint8:
+            break;
+        case FitsWriter::Int16:
+            toFitsInt16(reinterpret_cast<const unsigned short *>(src),
+                        reinterpret_cast<unsigned short *>(&buffer[0]),
+                        size / 2);
+            data = &buffer[0];
+            break;
+        case FitsWriter::Uint16:
+            fromFitsUint16(reinterpret_cast<const unsigned short *>(src),
+                           reinterpret_cast<unsigned short *>(&buffer[0]),
+                           size / 2);
+            data = &buffer[0];
+            break;
+        case FitsWriter::Int32:
+            toFitsInt32(reinterpret_cast<const unsigned int *>(src),
+                        reinterpret_cast<unsigned int *>(&buffer[0]),
+                        size / 4);
+            data = &buffer[0];
+            break;
+        }
+
+        off_t offset = off_t(index - m_outFirst) * off_t(frameSize);
+        if (!pwriteAll(m_fd, data, size, offset)) {
+            m_errnum = errno;
+            return;
+        }
+    }
+}
+
+static string usage(const char *appName)
+{
+    ostringstream ss;
+    ss << "Usage: " << appName << " [options] input output";
+    return ss.str();
+}
+
+static string helpMessage(const char *appName)
+{
+    ostringstream ss;
+    ss << usage(appName) << "\n\n"
+       << "Copies a range of frames of a FITS cube recorded by pvrec into a new\n"
+       << "FITS file, together with their rows of the frame table. Only the\n"
+       << "extracted frames are read from the input file.\n\n"
+       << "Options:\n"
+       << "  -r, --range       Frames to extract, FIRST-LAST or FIRST, counted from 1\n"
+       << "                    (default: all frames)\n"
+       << "  -p, --pixel       Write the time series of the pixel X,Y as text instead,\n"
+       << "                    can be given several times, X and Y count from 0\n"
+       << "      --raw         Write the pixels in host byte order without header\n"
+       << "  -j, --threads     Threads converting the byte order with --raw (default: 1)\n"
+       << "  -f, --force       Overwrite an existing output file\n"
+       << "  -h, --help        Print this help message and exit\n\n"
+       << "The output - writes the time series to the standard output.";
+    return ss.str();
+}
+
+static bool parseRange(const string &str, long &first, long &last)
+{
+    string::size_type pos = str.find('-');
+    if (pos == string::npos) {
+        if (!fromString(first, str))
+            return false;
+        last = first;
+    } else if (!fromString(first, str.substr(0, pos)) ||
+               !fromString(last, str.substr(pos + 1))) {
+        return false;
+    }
+    return first >= 1 && last >= first;
+}
+
+// returns 0 on success, 1 on invalid options and -1 if only the help
+// message was requested
+static int parseOptions(int argc, char **argv, Options &opts)
+{
+    enum { OptRaw = 256 };
+    static struct option longOptions[] = {
+        { "range", required_argument, 0, 'r' },
+        { "pixel", required_argument, 0, 'p' },
+        { "raw", no_argument, 0, OptRaw },
+        { "threads", required_argument, 0, 'j' },
+        { "force", no_argument, 0, 'f' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    opts.first = opts.last = 0;
+    opts.raw = false;
+    opts.numThreads = 1;
+    opts.force = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "r:p:j:fh", longOptions, 0)) != -1)
+    {
+        switch (c)
+        {
+        case 'r':
+            if (!parseRange(optarg, opts.first, opts.last)) {
+                cerr << argv[0] << ": -r must be FIRST-LAST or FIRST with"
+                     << " 1 <= FIRST <= LAST." << endl;
+                return 1;
+            }
+            break;
+        case 'p':
+        {
+            string arg = optarg;
+            string::size_type pos = arg.find(',');
+            PixelPos pixel;
+            if (pos == string::npos ||
+                    !fromString(pixel.x, arg.substr(0, pos)) ||
+                    !fromString(pixel.y, arg.substr(pos + 1)) ||
+                    pixel.x < 0 || pixel.y < 0) {
+                cerr << argv[0] << ": -p must be X,Y." << endl;
+                return 1;
+            }
+            opts.pixels.push_back(pixel);
+            break;
+        }
+        case OptRaw:
+            opts.raw = true;
+            break;
+        case 'j':
+            if (!fromString(opts.numThreads, optarg) ||
+                    opts.numThreads < 1 || opts.numThreads > MaxThreads) {
+                cerr << argv[0] << ": -j must be between 1 and "
+                     << MaxThreads << "." << endl;
+                return 1;
+            }
+            break;
+        case 'f':
+            opts.force = true;
+            break;
+        case 'h':
+            cout << helpMessage(argv[0]) << endl;
+            return -1;
+        default:
+            cerr << argv[0] << ": `--help' gives usage information." << endl;
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        cerr << usage(argv[0]) << "\n"
+             << argv[0] << ": `--help' gives usage information." << endl;
+        return 1;
+    }
+    opts.input = argv[optind];
+    opts.output = argv[optind + 1];
+
+    if (opts.raw && !opts.pixels.empty()) {
+        cerr << argv[0] << ": --raw and -p cannot be combined." << endl;
+        return 1;
+    }
+    if (opts.output == "-" && opts.pixels.empty()) {
+        cerr << argv[0] << ": Only time series can be written to the"
+             << " standard output." << endl;
+        return 1;
+    }
+    return 0;
+}
+
+static bool writeTimeSeries(const CubeReader &reader, const Options &opts,
+                            int fd)
+{
+    // only a few bytes of each frame are read
+    reader.adviseFrames(opts.first, opts.last, false);
+
+    ostringstream ss;
+    ss << "# INDEX";
+    for (size_t i = 0; i < opts.pixels.size(); ++i)
+        ss << " " << opts.pixels[i].x << "," << opts.pixels[i].y;
+    ss << "\n";
+
+    for (long index = opts.first; index <= opts.last; ++index)
+    {
+        ss << index;
+        for (size_t i = 0; i < opts.pixels.size(); ++i)
+            ss << " " << reader.pixel(index, opts.pixels[i].x,
+                                      opts.pixels[i].y);
+        ss << "\n";
+
+        if (ss.tellp() >= streampos(ChunkSize) || index == opts.last) {
+            string s = ss.str();
+            if (!writeAll(fd, reinterpret_cast<const unsigned char *>(
+                              s.data()), s.size()))
+                return false;
+            ss.str("");
+        }
+    }
+    return true;
+}
+
+static bool writeRaw(const CubeReader &reader, const Options &opts, int fd)
+{
+    reader.adviseFrames(opts.first, opts.last, true);
+
+    long numFrames = opts.last - opts.first + 1;
+    int numThreads = int(min<long>(opts.numThreads, numFrames));
+    if (ftruncate(fd, off_t(numFrames) * off_t(reader.frameSize())) != 0)
+        return false;
+
+    // each thread gets an equal share of consecutive frames, the last one
+    // is converted by the calling thread
+    vector<ConvertThread *> threads;
+    long first = opts.first;
+    for (int i = 0; i < numThreads; ++i) {
+        long n = numFrames / numThreads + (i < numFrames % numThreads);
+        threads.push_back(new ConvertThread(reader, first, first + n - 1,
+                                            opts.first, fd));
+        first += n;
+    }
+
+    bool ok = true;
+    for (int i = 0; i + 1 < numThreads; ++i)
+        if (!threads[i]->start())
+            threads[i]->convert();
+    threads.back()->convert();
+
+    for (int i = 0; i < numThreads; ++i) {
+        threads[i]->join();
+        if (threads[i]->error() != 0) {
+            errno = threads[i]->error();
+            ok = false;
+        }
+        delete threads[i];
+    }
+    return ok;
+}
+
+static bool writeFits(const CubeReader &reader, const Options &opts, int fd)
+{
+    reader.adviseFrames(opts.first, opts.last, true);
+
+    long numFrames = opts.last - opts.first + 1;
+    FitsHeader header = reader.header();
+    header.set("NAXIS", FitsHeader::intValue(3), "number of data axes");
+    header.set("NAXIS3", FitsHeader::intValue(numFrames),
+               "length of data axis 3");
+    header.set("SRCFRAME", FitsHeader::intValue(opts.first),
+               "index of the first frame in the source file");
+    string hdr = header.toString();
+    if (!writeAll(fd, reinterpret_cast<const unsigned char *>(hdr.data()),
+                  hdr.size()))
+        return false;
+
+    // the frames are big endian already and written straight from the
+    // mapping, without any copy in user space
+    size_t dataSize = numFrames * reader.frameSize();
+    if (!writeAll(fd, reader.frame(opts.first), dataSize) ||
+            !writePadding(fd, dataSize))
+        return false;
+
+    if (!reader.hasFrameTable())
+        return true;
+
+    // rows of the extracted frames with their new INDEX
+    vector<unsigned char> rows;
+    size_t rowSize = reader.tableRowSize();
+    for (long row = 0; row < reader.numTableRows(); ++row) {
+        long index = reader.tableRowIndex(row);
+        if (index < opts.first || index > opts.last)
+            continue;
+        const unsigned char *p = reader.tableRow(row);
+        rows.insert(rows.end(), p, p + rowSize);
+        putBigEndian64(&rows[rows.size() - rowSize], index - opts.first + 1);
+    }
+
+    FitsHeader tableHeader = reader.frameTableHeader();
+    tableHeader.set("NAXIS2", FitsHeader::intValue(rows.size() / rowSize),
+                    "number of rows in table");
+    hdr = tableHeader.toString();
+    return writeAll(fd, reinterpret_cast<const unsigned char *>(hdr.data()),
+                    hdr.size()) &&
+           (rows.empty() || writeAll(fd, &rows[0], rows.size())) &&
+           writePadding(fd, rows.size());
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    int rc = parseOptions(argc, argv, opts);
+    if (rc != 0)
+        return rc < 0 ? 0 : 1;
+
+    CubeReader reader;
+    if (!reader.open(opts.input)) {
+        cerr << reader.lastError() << endl;
+        return 1;
+    }
+    if (opts.first == 0) {
+        opts.first = 1;
+        opts.last = reader.numFrames();
+    }
+    if (opts.last > reader.numFrames() || opts.first > opts.last) {
+        cerr << "The file '" << opts.input << "' has only "
+             << reader.numFrames() << " frames." << endl;
+        return 1;
+    }
+
+    for (size_t i = 0; i < opts.pixels.size(); ++i)
+        if (opts.pixels[i].x >= reader.width() ||
+                opts.pixels[i].y >= reader.height()) {
+            cerr << "The pixel " << opts.pixels[i].x << "," << opts.pixels[i].y
+                 << " is outside of the " << reader.width() << "x"
+                 << reader.height() << " frames." << endl;
+            return 1;
+        }
+
+    int fd = STDOUT_FILENO;
+    if (opts.output != "-") {
+        int flags = O_WRONLY | O_CREAT | (opts.force ? O_TRUNC : O_EXCL);
+        fd = open(opts.output.c_str(), flags, 0666);
+        if (fd < 0) {
+            cerr << "Cannot create the file '" << opts.output << "'. "
+                 << strerror(errno) << "." << endl;
+            return 1;
+        }
+    }
+
+    bool ok;
+    if (!opts.pixels.empty())
+        ok = writeTimeSeries(reader, opts, fd);
+    else if (opts.raw)
+        ok = writeRaw(reader, opts, fd);
+    else
+        ok = writeFits(reader, opts, fd);
+    if (!ok)
+        cerr << "Cannot write the file '" << opts.output << "'. "
+             << strerror(errno) << "." << endl;
+
+    if (fd != STDOUT_FILENO && ::close(fd) != 0 && ok) {
+        cerr << "Cannot close the file '" << opts.output << "'. "
+             << strerror(errno) << "." << endl;
+        ok = false;
+    }
+    if (!ok && opts.output != "-")
+        unlink(opts.output.c_str());
+    return ok ? 0 : 1;
+}
@@ -35,12 +35,26 @@ int msleep(unsigned int ms)
     Sleep(DWORD(ms));
     return 0;
 }
-#else
-int msleep(unsigned int ms)
+
+int microsleep(unsigned int us)
 {
-    time_t s = static_cast<time_t>(ms / 1000);
-    long ns = (ms - 1000 * s) * 1000000L;
+    Sleep(DWORD((us + 999) / 1000));
+    return 0;
+}
 
+double currentTime()
+{
+    // FILETIME counts 100 ns intervals since 1601-01-01
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    ULARGE_INTEGER t;
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    return (t.QuadPart - 116444736000000000ULL) * 1e-7;
+}
+#else
+static int nanosleepFull(time_t s, long ns)
+{
     timespec t, r;
     t.tv_sec = s;
     t.tv_nsec = ns;
@@ -55,6 +69,27 @@ int msleep(unsigned int ms)
 
     return 0;
 }
+
+int msleep(unsigned int ms)
+{
+    time_t s = static_cast<time_t>(ms / 1000);
+    long ns = (ms - 1000 * s) * 1000000L;
+    return nanosleepFull(s, ns);
+}
+
+int microsleep(unsigned int us)
+{
+    time_t s = static_cast<time_t>(us / 1000000);
+    long ns = (us - 1000000 * s) * 1000L;
+    return nanosleepFull(s, ns);
+}
+
+double currentTime()
+{
+    timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
 #endif
 
 
@@ -36,6 +36,16 @@
  */
 int msleep(unsigned int ms);
 
+/*
+    Sleep for us microseconds, see msleep().
+ */
+int microsleep(unsigned int us);
+
+/*
+    Returns the current time in seconds since 1970-01-01 UTC.
+ */
+double currentTime();
+
 /*
     Returns the name of the given error.
  */
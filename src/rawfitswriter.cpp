@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "rawfitswriter.h"
+#include "pixelconv.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// additional header space reserved for keys written after open()
+static const size_t SpareHeaderBlocks = 3;
+
+static const size_t BufferAlignment = 4096;
+
+RawFitsWriter::RawFitsWriter()
+    : m_pixelType(Uint8),
+      m_width(0),
+      m_height(0),
+      m_count(0),
+      m_fd(-1),
+      m_dataAlignment(0),
+      m_buffer(0)
+{
+}
+
+RawFitsWriter::~RawFitsWriter()
+{
+    close();
+}
+
+bool RawFitsWriter::open(const std::string &fname, PixelType pixelType,
+                         int width, int height, int count, bool clobber)
+{
+    clearError();
+
+    if (isOpen()) {
+        setError("File already opened.");
+        return false;
+    }
+
+    if (width <= 0 || height <= 0 || count <= 0) {
+        setError("Invalid width, height or count.");
+        return false;
+    }
+
+    // read access allows subclasses to map the file
+    int flags = O_RDWR | O_CREAT | (clobber ? O_TRUNC : O_EXCL);
+    m_fd = ::open(fname.c_str(), flags, 0666);
+    if (m_fd < 0) {
+        setSysError("Cannot create the file '" + fname + "'.", errno);
+        return false;
+    }
+
+    m_fname = fname;
+    m_pixelType = pixelType;
+    m_width = width;
+    m_height = height;
+    m_count = count;
+
+    int bitpix = 8 * bytesPerPixel(pixelType);
+    typedef FitsHeader H;
+    m_header.clear();
+    m_header.set("SIMPLE", H::logicalValue(true),
+                 "file does conform to FITS standard");
+    m_header.set("BITPIX", H::intValue(bitpix),
+                 "number of bits per data pixel");
+    m_header.set("NAXIS", H::intValue(3), "number of data axes");
+    m_header.set("NAXIS1", H::intValue(width), "length of data axis 1");
+    m_header.set("NAXIS2", H::intValue(height), "length of data axis 2");
+    m_header.set("NAXIS3", H::intValue(count), "length of data axis 3");
+    m_header.set("EXTEND", H::logicalValue(true),
+                 "FITS dataset may contain extensions");
+    if (pixelType == Uint16) {
+        m_header.set("BZERO", H::intValue(32768),
+                     "offset data range to that of unsigned short");
+        m_header.set("BSCALE", H::intValue(1), "default scaling factor");
+    }
+    m_header.setDate();
+
+    // the header size is fixed from now on
+    m_header.reserve(SpareHeaderBlocks);
+    for (size_t spare = SpareHeaderBlocks; m_dataAlignment > 0 &&
+                 m_header.size() % m_dataAlignment != 0; )
+        m_header.reserve(++spare);
+
+    if (pixelType != Uint8 &&
+            posix_memalign(reinterpret_cast<void **>(&m_buffer),
+                           BufferAlignment, frameSize()) != 0)
+    {
+        m_buffer = 0;
+        setError("Cannot allocate frame buffer.");
+        close();
+        return false;
+    }
+
+    if (!writeHeader()) {
+        std::string msg = lastError();
+        close();
+        setError(msg);
+        return false;
+    }
+
+    return true;
+}
+
+void RawFitsWriter::close()
+{
+    if (!isOpen())
+        return;
+
+    clearError();
+
+    // update the header and pad the data unit to a full FITS block, the
+    // frame table follows the image
+    writeHeader();
+    off_t fileSize = imageEnd();
+    FrameTable &table = frameTable();
+    table.truncate(m_count);
+    if (!table.isEmpty() && !table.write(m_fd, fileSize, fileSize))
+        setSysError("Cannot write frame table.", errno);
+    if (ftruncate(m_fd, fileSize) != 0)
+        setSysError("Cannot resize the file '" + m_fname + "'.", errno);
+    ::close(m_fd);
+    table.clear();
+
+    std::free(m_buffer);
+    m_buffer = 0;
+    m_fname.clear();
+    m_pixelType = Uint8;
+    m_width = 0;
+    m_height = 0;
+    m_count = 0;
+    m_fd = -1;
+    m_header.clear();
+}
+
+bool RawFitsWriter::isOpen() const
+{
+    return m_fd >= 0;
+}
+
+bool RawFitsWriter::writeFrame(long index, unsigned char *data)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write frame, file not open.");
+        return false;
+    }
+
+    if (index < 1 || index > m_count) {
+        setError("Frame index out of bounds.");
+        return false;
+    }
+
+    if (!writeAll(convertFrame(data), frameSize(), frameOffset(index))) {
+        setSysError("Cannot write frame.", errno);
+        return false;
+    }
+
+    addBytesWritten(frameSize());
+    return true;
+}
+
+bool RawFitsWriter::writeKey(int datatype, const char *keyname, void *value,
+                             const char *comment)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write header entry, file not open.");
+        return false;
+    }
+
+    if (!m_header.setKey(datatype, keyname, value, comment)) {
+        setError("Cannot write header entry, unsupported datatype or "
+                 "header is full.");
+        return false;
+    }
+
+    return true;
+}
+
+bool RawFitsWriter::resize(int count)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot resize image, file not open.");
+        return false;
+    }
+
+    if (count <= 0) {
+        setError("Invalid count.");
+        return false;
+    }
+
+    // the file itself is truncated or extended on close(), a frame table
+    // written already moves along with the end of the image
+    m_header.set("NAXIS3", FitsHeader::intValue(count),
+                 "length of data axis 3");
+    m_count = count;
+    if (!frameTable().writeBatches(m_fd, imageEnd())) {
+        setSysError("Cannot move frame table.", errno);
+        return false;
+    }
+    return true;
+}
+
+// appends the full batches behind the image, where close() puts the rest
+bool RawFitsWriter::flushFrameTable()
+{
+    if (!frameTable().writeBatches(m_fd, imageEnd())) {
+        setSysError("Cannot write frame table.", errno);
+        return false;
+    }
+    return true;
+}
+
+void RawFitsWriter::setSysError(const std::string &msg, int errnum) const
+{
+    setError(msg + " " + std::strerror(errnum) + ".");
+}
+
+bool RawFitsWriter::writeHeader()
+{
+    std::string header = m_header.toString();
+    if (!writeAll(reinterpret_cast<const unsigned char *>(header.data()),
+                  header.size(), 0))
+    {
+        setSysError("Cannot write header.", errno);
+        return false;
+    }
+    return true;
+}
+
+bool RawFitsWriter::writeAll(const unsigned char *data, size_t size,
+                             off_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pwrite(m_fd, data, size, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= size_t(n);
+        offset += n;
+    }
+    return true;
+}
+
+const unsigned char * RawFitsWriter::convertFrame(const unsigned char *data)
+{
+    if (m_pixelType == Uint8)
+        return data;
+
+    convertFrame(data, m_buffer);
+    return m_buffer;
+}
+
+void RawFitsWriter::convertFrame(const unsigned char *data,
+                                 unsigned char *dest) const
+{
+    if (m_pixelType == Uint8) {
+        std::memcpy(dest, data, frameSize());
+        return;
+    }
+
+    // larger pixels are stored big endian
+    size_t n = size_t(m_width) * size_t(m_height);
+    if (m_pixelType == Int32) {
+        toFitsInt32(reinterpret_cast<const unsigned int *>(data),
+                    reinterpret_cast<unsigned int *>(dest), n);
+        return;
+    }
+    const unsigned short *src = reinterpret_cast<const unsigned short *>(data);
+    unsigned short *dst = reinterpret_cast<unsigned short *>(dest);
+    if (m_pixelType == Uint16)
+        toFitsUint16(src, dst, n);
+    else
+        toFitsInt16(src, dst, n);
+}
+
+void RawFitsWriter::setDataAlignment(size_t alignment)
+{
+    m_dataAlignment = alignment;
+}
+
+size_t RawFitsWriter::frameSize() const
+{
+    return size_t(bytesPerPixel(m_pixelType)) * size_t(m_width) *
+            size_t(m_height);
+}
+
+off_t RawFitsWriter::frameOffset(long index) const
+{
+    return off_t(m_header.size()) + off_t(index - 1) * off_t(frameSize());
+}
+
+off_t RawFitsWriter::imageEnd() const
+{
+    return off_t(m_header.size()) + off_t(
+            FitsHeader::roundUpToBlock(size_t(m_count) * frameSize()));
+}
+
+int RawFitsWriter::fileDescriptor() const
+{
+    return m_fd;
+}
+
+FitsWriter::PixelType RawFitsWriter::pixelType() const
+{
+    return m_pixelType;
+}
+
+int RawFitsWriter::count() const
+{
+    return m_count;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RAWFITSWRITER_H
+#define RAWFITSWRITER_H
+
+#include "fitswriter.h"
+#include "fitsheader.h"
+#include <sys/types.h>
+
+/*
+    FitsWriter backend which writes the FITS file directly, without CFITSIO.
+
+    The primary header is built in memory and gets a fixed amount of spare
+    space, so that its size and thereby the location of every frame is known
+    when the file is opened. Frames are written with pwrite() to their
+    offsets, header keys are updated in memory and written back on close().
+ */
+class RawFitsWriter : public FitsWriter
+{
+public:
+    RawFitsWriter();
+    virtual ~RawFitsWriter();
+
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber = false);
+    virtual void close();
+    virtual bool isOpen() const;
+
+    virtual bool writeFrame(long index, unsigned char *data);
+    virtual bool writeKey(int datatype, const char *keyname, void *value,
+                          const char *comment);
+    virtual bool resize(int count);
+
+protected:
+    virtual bool flushFrameTable();
+
+    void setSysError(const std::string &msg, int errnum) const;
+    bool writeHeader();
+    bool writeAll(const unsigned char *data, size_t size, off_t offset);
+    const unsigned char * convertFrame(const unsigned char *data);
+    void convertFrame(const unsigned char *data, unsigned char *dest) const;
+
+    // makes the image data start at a multiple of alignment bytes, which
+    // must be a power of two; only effective before open()
+    void setDataAlignment(size_t alignment);
+
+    size_t frameSize() const;
+    off_t frameOffset(long index) const;
+    // size of the primary HDU, i.e. header and padded image data
+    off_t imageEnd() const;
+    int fileDescriptor() const;
+    PixelType pixelType() const;
+    int count() const;
+
+private:
+    std::string m_fname;
+    PixelType m_pixelType;
+    int m_width;
+    int m_height;
+    int m_count;
+    int m_fd;
+    size_t m_dataAlignment;
+    FitsHeader m_header;
+    unsigned char *m_buffer;
+};
+
+#endif // RAWFITSWRITER_H
@@ -26,32 +26,140 @@
 #include "recorder.h"
 #include "pvutils.h"
 #include "fitswriter.h"
+#include "writerthread.h"
+#include "segmentedwriter.h"
+#include "stackingwriter.h"
+#include "selectingwriter.h"
+#include "calibratingwriter.h"
+#include "pvcamera.h"
+#include "statswriter.h"
 #include "version.h"
 
 #include <cassert>
+#include <algorithm>
+#include <climits>
 #include <sstream>
 #include <cstring>  // for std::memset()
+#include <cstdio>   // for std::remove()
 #include <iostream>
-using std::cout;
 using std::cerr;
 using std::endl;
-using std::flush;
 
-Recorder::Recorder(int numBuffers)
-    : m_device(0),
+// timeout in ms when waiting for a frame in the capture loop
+static const unsigned long CaptureWaitTimeout = 10;
+
+// sleep time in microseconds when the capture thread has nothing to do
+static const unsigned int CaptureIdleSleepTime = 100;
+
+// time in seconds a frame completed out of order waits for older frames
+static const double ReorderTimeout = 0.05;
+
+// number of pixels sampled for the event level of a frame
+static const size_t EventLevelSamples = 4096;
+
+// mean of a regular subset of the pixel values, cheap enough to be computed
+// for every frame in the capture loop
+static double sampledMean(const tPvFrame *frame)
+{
+    size_t numPixels = frame->ImageSize;
+    if (frame->Format == ePvFmtMono16)
+        numPixels /= 2;
+    else if (frame->Format == ePvFmtMono12Packed)
+        numPixels = numPixels * 2 / 3;
+    if (numPixels == 0)
+        return 0;
+    size_t step = std::max(numPixels / EventLevelSamples, size_t(1));
+
+    double sum = 0;
+    size_t n = 0;
+    if (frame->Format == ePvFmtMono12Packed) {
+        // the frame is still packed here, only the 8 high bits are used
+        const unsigned char *p =
+                static_cast<const unsigned char *>(frame->ImageBuffer);
+        for (size_t k = 0; k < numPixels; k += step, ++n)
+            sum += p[3 * (k / 2) + 2 * (k % 2)] << 4;
+    }
+    else if (frame->Format == ePvFmtMono16) {
+        const unsigned short *p =
+                static_cast<const unsigned short *>(frame->ImageBuffer);
+        for (size_t k = 0; k < numPixels; k += step, ++n)
+            sum += p[k];
+    }
+    else {
+        const unsigned char *p =
+                static_cast<const unsigned char *>(frame->ImageBuffer);
+        for (size_t k = 0; k < numPixels; k += step, ++n)
+            sum += p[k];
+    }
+    return sum / n;
+}
+
+// removes all indices before first from a sorted index vector
+static void pruneIndices(Recorder::IndexVector &v, unsigned long first)
+{
+    v.erase(v.begin(), std::lower_bound(v.begin(), v.end(), first));
+}
+
+// makes the indices relative to first, which becomes index 1
+static void rebaseIndices(Recorder::IndexVector &v, unsigned long first)
+{
+    pruneIndices(v, first);
+    for (Recorder::IndexVector::iterator it = v.begin(); it != v.end(); ++it)
+        *it -= first - 1;
+}
+
+// completion callback of CallbackCapture, called by a driver thread
+static void PVDECL frameDone(tPvFrame *frame)
+{
+    static_cast<RingBuffer<tPvFrame *> *>(frame->Context[0])->push(frame);
+}
+
+// hands a frame over to the writer thread, returns false if the frame was
+// not taken because the queue is full and blocking is disabled
+static bool pushFrame(FrameItemQueue &queue, const FrameItem &item, bool block)
+{
+    if (queue.push(item))
+        return true;
+    if (!block)
+        return false;
+    while (!queue.push(item))
+        microsleep(CaptureIdleSleepTime);
+    return true;
+}
+
+Recorder::Recorder(int numBuffers, Camera *camera)
+    : m_camera(camera ? camera : new PvCamera),
       m_sensorBits(0),
       m_sensorWidth(0),
       m_sensorHeight(0),
       m_numBuffers(numBuffers),
-      m_frameBufferSize(0)
+      m_queueSize(0),
+      m_overflowPolicy(BlockOnOverflow),
+      m_captureMode(WaitCapture),
+      m_writerBackend(FitsWriter::Cfitsio),
+      m_zeroCopy(false),
+      m_stackSize(1),
+      m_selectionWindow(0),
+      m_selectionPercent(0),
+      m_statsInterval(1),
+      m_stop(0),
+      m_preTriggerFrames(0),
+      m_eventLevel(0),
+      m_eventPending(0),
+      m_eventFrame(0),
+      m_frameBufferSize(0),
+      m_doneQueue(0),
+      m_slotWriter(0),
+      m_nextSlot(1),
+      m_nextIndex(1)
 {
-    PvInitialize();
 }
 
 Recorder::~Recorder()
 {
     closeCamera();
-    PvUnInitialize();
+    m_framePool.release();
+    delete m_camera;
 }
 
 bool Recorder::openCamera(unsigned long camId)
@@ -61,7 +169,7 @@ bool Recorder::openCamera(unsigned long camId)
     if (isCameraOpen())
         closeCamera();
 
-    assert(m_device == 0);
+    assert(!m_camera->isOpen());
     
     CameraInfoVector camInfoVec = availableCameras();
     if (camInfoVec.size() < 1) {
@@ -72,20 +180,18 @@ bool Recorder::openCamera(unsigned long camId)
     // try to open the first camera with master access
     tPvErr err = ePvErrSuccess;
     CameraInfoVector::const_iterator it = camInfoVec.begin();
-    for (; it != camInfoVec.end() && !m_device; ++it)
+    for (; it != camInfoVec.end() && !m_camera->isOpen(); ++it)
     {
         if ((camId == 0 || camId == it->UniqueId) &&
                 (it->PermittedAccess & ePvAccessMaster) != 0)
         {
-            err = PvCameraOpen(it->UniqueId, ePvAccessMaster, &m_device);
-            if (err != ePvErrSuccess)
-                m_device = 0;
-            else
+            err = m_camera->open(it->UniqueId);
+            if (err == ePvErrSuccess)
                 m_camInfo = *it;
         }
     }
 
-    if (!m_device) {
+    if (!m_camera->isOpen()) {
         clearCameraInfo();
         if (err != ePvErrSuccess)
             setPvError("Cannot open camera.", err);
@@ -95,7 +201,7 @@ bool Recorder::openCamera(unsigned long camId)
     }
 
     char sensorType[32];
-    err = PvAttrEnumGet(m_device, "SensorType", sensorType, 32, 0);
+    err = m_camera->attrEnumGet("SensorType", sensorType, 32);
     if (err != ePvErrSuccess) {
         setPvError("Cannot get sensor type.", err);
         closeCamera();
@@ -111,7 +217,7 @@ bool Recorder::openCamera(unsigned long camId)
     }
 
     tPvUint32 sensorBits;
-    err = PvAttrUint32Get(m_device, "SensorBits", &sensorBits);
+    err = m_camera->attrUint32Get("SensorBits", &sensorBits);
     if (err != ePvErrSuccess) {
         setPvError("Cannot get sensor bit depth.", err);
         closeCamera();
@@ -119,7 +225,7 @@ bool Recorder::openCamera(unsigned long camId)
     }
 
     tPvUint32 sensorWidth;
-    err = PvAttrUint32Get(m_device, "SensorWidth", &sensorWidth);
+    err = m_camera->attrUint32Get("SensorWidth", &sensorWidth);
     if (err != ePvErrSuccess) {
         setPvError("Cannot get sensor width.", err);
         closeCamera();
@@ -127,7 +233,7 @@ bool Recorder::openCamera(unsigned long camId)
     }
 
     tPvUint32 sensorHeight;
-    err = PvAttrUint32Get(m_device, "SensorHeight", &sensorHeight);
+    err = m_camera->attrUint32Get("SensorHeight", &sensorHeight);
     if (err != ePvErrSuccess) {
         setPvError("Cannot get sensor height.", err);
         closeCamera();
@@ -135,7 +241,7 @@ bool Recorder::openCamera(unsigned long camId)
     }
 
     char ipAddress[32];
-    err = PvAttrStringGet(m_device, "DeviceIPAddress", ipAddress, 32, 0);
+    err = m_camera->attrStringGet("DeviceIPAddress", ipAddress, 32);
     if (err != ePvErrSuccess) {
         setPvError("Cannot get IP address.", err);
         closeCamera();
@@ -143,7 +249,7 @@ bool Recorder::openCamera(unsigned long camId)
     }
 
     char ethAddress[32];
-    err = PvAttrStringGet(m_device, "DeviceEthAddress", ethAddress, 32, 0);
+    err = m_camera->attrStringGet("DeviceEthAddress", ethAddress, 32);
     if (err != ePvErrSuccess) {
         setPvError("Cannot get MAC address.", err);
         closeCamera();
@@ -166,37 +272,37 @@ bool Recorder::initCamera()
 {
     tPvErr err;
 
-    err = PvAttrEnumSet(m_device, "ConfigFileIndex", "Factory");
+    err = m_camera->attrEnumSet("ConfigFileIndex", "Factory");
     if (err != ePvErrSuccess) {
         setPvError("Cannot select factory settings.", err);
         return false;
     }
 
-    err = PvCommandRun(m_device, "ConfigFileLoad");
+    err = m_camera->commandRun("ConfigFileLoad");
     if (err != ePvErrSuccess) {
         setPvError("Cannot load factory settings.", err);
         return false;
     }
 
-    err = PvAttrEnumSet(m_device, "AcquisitionMode", "Continuous");
+    err = m_camera->attrEnumSet("AcquisitionMode", "Continuous");
     if (err != ePvErrSuccess) {
         setPvError("Cannot set AcquisitionMode to Continuous.", err);
         return false;
     }
 
-    err = PvAttrEnumSet(m_device, "FrameStartTriggerMode", "FixedRate");
+    err = m_camera->attrEnumSet("FrameStartTriggerMode", "FixedRate");
     if (err != ePvErrSuccess) {
         setPvError("Cannot set FrameStartTriggerMode.", err);
         return false;
     }
 
-    err = PvAttrEnumSet(m_device, "SyncOut1Mode", "FrameTrigger");
+    err = m_camera->attrEnumSet("SyncOut1Mode", "FrameTrigger");
     if (err != ePvErrSuccess) {
         setPvError("Cannot set SyncOut1Mode.", err);
         return false;
     }
 
-    err = PvAttrEnumSet(m_device, "SyncOut2Mode", "FrameTrigger");
+    err = m_camera->attrEnumSet("SyncOut2Mode", "FrameTrigger");
     if (err != ePvErrSuccess) {
         setPvError("Cannot set SyncOut2Mode.", err);
         return false;
@@ -211,228 +317,694 @@ bool Recorder::initCamera()
     return true;
 }
 
-void Recorder::allocateFrames(int numBuffers, size_t bufferSize)
+bool Recorder::allocateFrames(int numBuffers, size_t bufferSize)
 {
-    if(!m_frameQueue.empty())
-        freeFrames();
+    freeFrames();
 
-    for (int i = 0; i < numBuffers; ++i)
-    {
-        unsigned char *buffer = new unsigned char[bufferSize];
-        tPvFrame *frame = new tPvFrame;
-        std::memset(frame, 0, sizeof(tPvFrame));
-        frame->ImageBuffer = buffer;
-        frame->ImageBufferSize = bufferSize;
-        m_frameQueue.push_back(frame);
+    // the pool keeps its buffers as long as the geometry does not change
+    if (!m_framePool.allocate(numBuffers, bufferSize)) {
+        setError(m_framePool.lastError());
+        return false;
     }
+
+    // without them the capture may page-fault, but it still works
+    if (m_framePool.lockMemory() && !m_framePool.isLocked())
+        cerr << endl << "Warning: Cannot lock the frame buffers into memory "
+                "(RLIMIT_MEMLOCK?)." << endl;
+    if (m_framePool.hugePages() && !m_framePool.isHugePageBacked())
+        cerr << endl << "Warning: No huge pages available, the frame buffers "
+                "use normal pages." << endl;
+
+    for (int i = 0; i < m_framePool.count(); ++i)
+        m_frames.push_back(m_framePool.frame(i));
+    return true;
 }
 
 void Recorder::freeFrames()
 {
-    while (!m_frameQueue.empty()) {
-        tPvFrame *frame = m_frameQueue.front();
-        delete [] reinterpret_cast<unsigned char *>(frame->ImageBuffer);
-        delete frame;
-        m_frameQueue.pop_front();
-    }
+    // zero-copy frames point into a file mapping which is gone by now
+    for (FrameVector::iterator it = m_frames.begin(); it != m_frames.end();
+            ++it)
+        if ((*it)->Context[2])
+            (*it)->ImageBuffer = (*it)->Context[2];
+    m_frameQueue.clear();
+    m_frames.clear();
 }
 
 void Recorder::closeCamera()
 {
-    PvCameraClose(m_device);
-    m_device = 0;
+    m_camera->close();
     m_sensorBits = 0;
     m_frameBufferSize = 0;
     m_droppedFrames.clear();
     m_missingDataFrames.clear();
+    m_discardedFrames.clear();
     freeFrames();
 }
 
 bool Recorder::isCameraOpen() const
 {
-    return m_device != 0;
+    return m_camera->isOpen();
 }
 
 bool Recorder::record(const std::string &fname, int numFrames, bool clobber)
 {
     clearError();
 
-    if (!m_device) {
+    if (!m_camera->isOpen()) {
         setError("Cannot start recording, camera device not opened.");
         return false;
     }
 
+    // in event mode numFrames is the number of post-trigger frames
+    int preFrames = m_preTriggerFrames;
+    if (preFrames > 0 && m_segmentLimits.isEnabled()) {
+        setError("Event recordings cannot be split into segments.");
+        return false;
+    }
+    if (numFrames < 0 || (numFrames == 0 && preFrames == 0 &&
+                          !m_segmentLimits.isEnabled())) {
+        setError("Unbounded recordings need a segment limit.");
+        return false;
+    }
+    if (m_zeroCopy && (preFrames > 0 || hasWriterDecorators())) {
+        setError("Zero-copy cannot be used with event recordings, segments,"
+                 " stacking, frame selection or calibration.");
+        return false;
+    }
+    __atomic_store_n(&m_stop, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_eventPending, 0, __ATOMIC_RELAXED);
+    m_eventFrame = 0;
+
     tPvErr err;
-    err = PvCaptureStart(m_device);
+    err = m_camera->captureStart();
     if (err != ePvErrSuccess) {
         setPvError("Cannot start capturing.", err);
         return false;
     }
 
-    int width = m_sensorWidth;
-    int height = m_sensorHeight;
+    // buffers and file follow the geometry the camera actually uses
+    int width = imageWidth();
+    int height = imageHeight();
     int bytesPerPixel = 1;
     FitsWriter::PixelType pixelType = FitsWriter::Uint8;
     std::string format = pixelFormat();
-    if (format == "Mono16") {
+    if (format == "Mono16" || format == "Mono12Packed") {
+        // Mono12Packed frames are unpacked in place by the writer thread,
+        // so their buffers need room for 16 bit pixels as well
         bytesPerPixel = 2;
-        pixelType = FitsWriter::Int16;
+        pixelType = FitsWriter::Uint16;
     }
     else if (format != "Mono8") {
         setError("Unsupported pixel format.");
-        PvCaptureEnd(m_device);
+        m_camera->captureEnd();
         return false;
     }
 
     m_frameBufferSize = size_t(bytesPerPixel * width * height);
-    allocateFrames(m_numBuffers, m_frameBufferSize);
+    // pre-trigger frames are held back from the driver until an event
+    if (!allocateFrames(m_numBuffers + preFrames, m_frameBufferSize)) {
+        m_camera->captureEnd();
+        return false;
+    }
 
-    for (FrameQueue::iterator it = m_frameQueue.begin();
-            it != m_frameQueue.end(); ++it)
+    // completion callbacks hand the frames over through this queue and in
+    // zero-copy mode the driver captures into the file mapping of the
+    // writer. Both must outlive the capture, so every exit of recordFrames()
+    // ends it here before the writer is deleted.
+    FitsWriter *writer = createWriter();
+    DoneQueue doneQueue(m_frames.size());
+    m_doneQueue = &doneQueue;
+
+    // the caller captures the frames, it is pinned only while recording
+    bool ok = true;
+    std::vector<int> callerCpus = Thread::currentCpuAffinity();
+    if (!m_cpus.empty() && !Thread::setCurrentCpuAffinity(m_cpus)) {
+        setError("Cannot set the CPU affinity of the capture thread.");
+        ok = false;
+    }
+    ok = ok && recordFrames(writer, fname, numFrames, clobber, width,
+                            height, pixelType);
+    if (!m_cpus.empty())
+        Thread::setCurrentCpuAffinity(callerCpus);
+    if (!ok)
+        m_camera->commandRun("AcquisitionStop");
+
+    err = m_camera->captureQueueClear();
+    if (err != ePvErrSuccess && ok) {
+        setPvError("Cannot clear capture queue.", err);
+        ok = false;
+    }
+    err = m_camera->captureEnd();
+    if (err != ePvErrSuccess && ok) {
+        setPvError("Cannot stop capturing.", err);
+        ok = false;
+    }
+    m_frameQueue.clear();
+    m_doneQueue = 0;
+    m_slotWriter = 0;
+    delete writer;
+    return ok;
+}
+
+// the backend wrapped into the decorators of the enabled processing steps,
+// see hasWriterDecorators()
+FitsWriter * Recorder::createWriter() const
+{
+    FitsWriter *writer;
+    if (m_segmentLimits.isEnabled()) {
+        SegmentLimits limits = m_segmentLimits;
+        limits.frameRate = frameRate();
+        writer = new SegmentedWriter(m_writerBackend, limits);
+    }
+    else
+        writer = FitsWriter::create(m_writerBackend);
+    if (m_stackSize > 1)
+        writer = new StackingWriter(writer, m_stackSize);
+    if (m_selectionPercent > 0)
+        writer = new SelectingWriter(writer, m_selectionWindow,
+                                     m_selectionPercent);
+    if (!m_darkFile.empty() || !m_flatFile.empty())
+        writer = new CalibratingWriter(writer, m_darkFile, m_flatFile);
+    return writer;
+}
+
+bool Recorder::recordFrames(FitsWriter *writer, const std::string &fname,
+                            int numFrames, bool clobber, int width,
+                            int height, FitsWriter::PixelType pixelType)
+{
+    int preFrames = m_preTriggerFrames;
+    tPvErr err;
+
+    int fileFrames = preFrames + numFrames;
+    if (!writer->open(fname, pixelType, width, height, fileFrames, clobber)) {
+        setError(writer->lastError());
+        return false;
+    }
+
+    // lets the writer prepare the frame buffers for its I/O
+    std::vector<unsigned char *> frameBuffers;
+    for (FrameVector::const_iterator it = m_frames.begin();
+            it != m_frames.end(); ++it)
+        frameBuffers.push_back(
+                static_cast<unsigned char *>((*it)->ImageBuffer));
+    writer->setFrameBuffers(frameBuffers);
+
+    // with zero-copy the frames are queued with a slot of the file mapping
+    // as image buffer, their own buffer takes frames without a slot
+    for (FrameVector::iterator it = m_frames.begin(); it != m_frames.end();
+            ++it)
     {
-        err = PvCaptureQueueFrame(m_device, *it, 0);
+        (*it)->Context[1] = 0;
+        (*it)->Context[2] = (*it)->ImageBuffer;
+    }
+    m_slotWriter = (m_zeroCopy && writer->frameBuffer(1)) ? writer : 0;
+    m_nextSlot = 1;
+    m_nextIndex = 1;
+    m_slotOwners.clear();
+    m_deferredFrames.clear();
+    m_readyFrames.clear();
+
+    // m_frameQueue holds the frames currently queued by the driver, in the
+    // order they are going to be filled
+    m_frameQueue.clear();
+    for (FrameVector::iterator it = m_frames.begin(); it != m_frames.end();
+            ++it)
+    {
+        err = queueFrame(*it);
         if (err != ePvErrSuccess) {
             setPvError("Cannot enqueue frame.", err);
-            PvCaptureQueueClear(m_device);
-            PvCaptureEnd(m_device);
             return false;
         }
-    }
-
-    // create output file
-    FitsWriter writer(fname, pixelType, width, height, numFrames, clobber);
-    if (!writer.isOpen()) {
-        setError(writer.lastError());
-        PvCaptureQueueClear(m_device);
-        PvCaptureEnd(m_device);
-        return false;
+        m_frameQueue.push_back(*it);
     }
 
     // write program version to the FITS header
     std::string creator = std::string("PvRec v") + PVREC_VERSION_STRING;
-    if (!writer.writeKey(TSTRING, "CREATOR",
+    if (!writer->writeKey(TSTRING, "CREATOR",
                          const_cast<char*>(creator.c_str()),
                          "program that created this file"))
     {
-        setError(writer.lastError());
-        PvCaptureQueueClear(m_device);
-        PvCaptureEnd(m_device);
+        setError(writer->lastError());
         return false;
     }
 
     // write settings to the FITS header
     double expTime = exposureTime();
     float maxFps = frameRate();
-    if (!writer.writeKey(
+    tPvUint32 tsFreq = 0;
+    m_camera->attrUint32Get("TimeStampFrequency", &tsFreq);
+    unsigned long tsFreqKey = tsFreq;
+    int binX = binningX(), binY = binningY();
+    int roiX = regionX(), roiY = regionY();
+    if (!writer->writeKey(
             TDOUBLE, "EXPTIME", &expTime, "exposure time [ms]") ||
-        !writer.writeKey(
-            TFLOAT, "MAXFPS", &maxFps, "maximum frame rate [Hz]"))
+        !writer->writeKey(
+            TFLOAT, "MAXFPS", &maxFps, "maximum frame rate [Hz]") ||
+        !writer->writeKey(
+            TULONG, "TSFREQ", &tsFreqKey, "camera time stamp frequency [Hz]") ||
+        !writer->writeKey(
+            TINT, "XBINNING", &binX, "binning factor in x") ||
+        !writer->writeKey(
+            TINT, "YBINNING", &binY, "binning factor in y") ||
+        !writer->writeKey(
+            TINT, "XORGSUBF", &roiX, "region origin in x [binned pixels]") ||
+        !writer->writeKey(
+            TINT, "YORGSUBF", &roiY, "region origin in y [binned pixels]"))
     {
-        setError(writer.lastError());
-        PvCaptureQueueClear(m_device);
-        PvCaptureEnd(m_device);
+        setError(writer->lastError());
         return false;
     }
 
-    err = PvCommandRun(m_device, "AcquisitionStart");
+    err = m_camera->commandRun("AcquisitionStart");
     if (err != ePvErrSuccess) {
         setPvError("Cannot start acquisition.", err);
-        PvCaptureQueueClear(m_device);
-        PvCaptureEnd(m_device);
+        return false;
+    }
+
+    // captured frames are handed over to the writer thread, which returns
+    // them through the free queue after they have been written to disk
+    // the write queue must take all pre-trigger frames at once
+    int writeQueueSize = m_queueSize > 0 ? m_queueSize : m_numBuffers;
+    if (preFrames > 0)
+        writeQueueSize = std::max(writeQueueSize, preFrames + m_numBuffers);
+    FrameItemQueue writeQueue(writeQueueSize);
+    FrameQueueRing freeQueue(int(m_frames.size()));
+    m_telemetry.reset(writeQueue.capacity(), m_frames.size());
+    WriterThread writerThread(writer, &writeQueue, &freeQueue,
+                              &m_telemetry);
+    writerThread.setCpuAffinity(m_cpus);
+    if (!writerThread.start()) {
+        setError("Cannot start writer thread.");
+        return false;
+    }
+
+    StatsWriter statsWriter(&m_telemetry);
+    if (!m_statsFile.empty() &&
+            !statsWriter.open(m_statsFile, m_statsInterval)) {
+        setError(statsWriter.lastError());
         return false;
     }
 
     // the capture loop
     m_droppedFrames.clear();
     m_missingDataFrames.clear();
-    for (unsigned long i = 1; i <= numFrames; ++i)
+    m_discardedFrames.clear();
+    bool block = (m_overflowPolicy == BlockOnOverflow);
+    bool armed = (preFrames > 0);
+    std::deque<FrameItem> heldFrames;   // pre-trigger frames, oldest first
+    ReorderMap reordered;               // CallbackCapture only
+    const char *eventSource = "";
+    unsigned long offset = 0;           // camera index minus file index
+    unsigned long lastIndex = (numFrames > 0 && !armed) ? numFrames : ULONG_MAX;
+    unsigned long i = 1;
+    while (i <= lastIndex && !__atomic_load_n(&m_stop, __ATOMIC_RELAXED))
     {
-        tPvFrame *frame = m_frameQueue.front();
-        m_frameQueue.pop_front();
-        m_frameQueue.push_back(frame);
+        // give written frames back to the driver
+        tPvFrame *frame;
+        while (freeQueue.pop(frame)) {
+            if (!requeueFrame(frame)) {
+                return false;
+            }
+        }
 
-        err = PvCaptureWaitForFrameDone(m_device, frame, PVINFINITE);
-        if (err != ePvErrSuccess) {
-            setPvError("Waiting for frame failed.", err);
-            PvCaptureQueueClear(m_device);
-            PvCaptureEnd(m_device);
-            return false;
+        // frames whose slot the driver has released in the meantime
+        while (!m_readyFrames.empty()) {
+            FrameItem ready = m_readyFrames.front();
+            m_readyFrames.pop_front();
+            if (pushFrame(writeQueue, ready, block)) {
+                m_telemetry.frameQueued(writeQueue.size());
+                continue;
+            }
+            m_telemetry.frameDiscarded();
+            m_discardedFrames.insert(std::lower_bound(
+                    m_discardedFrames.begin(), m_discardedFrames.end(),
+                    ready.index), ready.index);
+            if (!requeueFrame(ready.frame)) {
+                return false;
+            }
+        }
+
+        double hostTime;
+        if (m_captureMode == CallbackCapture)
+        {
+            if (!nextCompletedFrame(reordered, i, frame, hostTime)) {
+                microsleep(CaptureIdleSleepTime);
+                continue;
+            }
+        }
+        else
+        {
+            // all buffers are waiting to be written
+            if (m_frameQueue.empty()) {
+                microsleep(CaptureIdleSleepTime);
+                continue;
+            }
+
+            // don't block forever, so returned frames can be requeued in time
+            frame = m_frameQueue.front();
+            err = m_camera->captureWaitForFrameDone(frame, CaptureWaitTimeout);
+            if (err == ePvErrTimeout)
+                continue;
+            if (err != ePvErrSuccess) {
+                setPvError("Waiting for frame failed.", err);
+                return false;
+            }
+            m_frameQueue.pop_front();
+            hostTime = currentTime();
         }
+        m_telemetry.setDriverBuffers(m_frameQueue.size());
 
+        bool handedOver = false;
         if (frame->Status == ePvErrSuccess ||
             frame->Status == ePvErrDataMissing)
         {
             if (frame->FrameCount > i) {
+                m_telemetry.frameDropped(frame->FrameCount - i);
                 while (i < frame->FrameCount) {
-                    cout << "D";
-                    m_droppedFrames.push_back(i);
+                    m_droppedFrames.push_back(i - offset);
                     i++;
                 }
             }
-            else if (frame->FrameCount < i) // this should not occur
-                cout << "E" << flush;
+            else if (frame->FrameCount < i) {
+                // too late, the frame has already been counted as dropped
+                m_telemetry.frameFailed(ePvErrSuccess);
+                if (!requeueFrame(frame)) {
+                    return false;
+                }
+                continue;
+            }
+            m_nextIndex = i + 1;
 
-            if (i <= numFrames)
+            if (armed)
             {
-                if (frame->Status == ePvErrSuccess)
-                    cout << "." << flush;
-                else if (frame->Status == ePvErrDataMissing) {
-                    cout << "M" << flush;
+                // keep the frame until it drops out of the pre-trigger window
+                if (frame->Status == ePvErrDataMissing) {
+                    m_telemetry.frameMissingData();
                     m_missingDataFrames.push_back(i);
                 }
-
-                if (!writer.writeFrame(i, reinterpret_cast<unsigned char *>(
-                        frame->ImageBuffer)))
-                    cerr << endl << writer.lastError() << endl;
+                FrameItem item = { frame, i, hostTime };
+                heldFrames.push_back(item);
+                handedOver = true;
+
+                unsigned long first = (i > (unsigned long)preFrames) ?
+                            i - preFrames + 1 : 1;
+                while (heldFrames.front().index < first) {
+                    if (!requeueFrame(heldFrames.front().frame)) {
+                        return false;
+                    }
+                    heldFrames.pop_front();
+                }
+                pruneIndices(m_droppedFrames, first);
+                pruneIndices(m_missingDataFrames, first);
+
+                if (__atomic_exchange_n(&m_eventPending, 0, __ATOMIC_RELAXED))
+                    eventSource = "external";
+                else if (m_eventLevel > 0 &&
+                         sampledMean(frame) >= m_eventLevel)
+                    eventSource = "level";
+
+                if (*eventSource) {
+                    // write the pre-trigger frames and continue with the
+                    // post-trigger frames
+                    armed = false;
+                    m_eventFrame = i;
+                    offset = first - 1;
+                    lastIndex = i + numFrames;
+                    rebaseIndices(m_droppedFrames, first);
+                    rebaseIndices(m_missingDataFrames, first);
+
+                    while (!heldFrames.empty()) {
+                        FrameItem held = heldFrames.front();
+                        heldFrames.pop_front();
+                        held.index -= offset;
+                        bool skip = (m_stackSize > 1 &&
+                                held.frame->Status == ePvErrDataMissing);
+                        if (!skip && pushFrame(writeQueue, held, block)) {
+                            m_telemetry.frameQueued(writeQueue.size());
+                            continue;
+                        }
+                        if (!skip) {
+                            m_telemetry.frameDiscarded();
+                            m_discardedFrames.push_back(held.index);
+                        }
+                        if (!requeueFrame(held.frame)) {
+                            return false;
+                        }
+                    }
+                }
             }
+            else if (i <= lastIndex)
+            {
+                if (frame->Status == ePvErrDataMissing) {
+                    m_telemetry.frameMissingData();
+                    m_missingDataFrames.push_back(i - offset);
+                }
 
-            //cout << " " << frame->FrameCount << " " << flush;
-        }
-        else {
-            cout << endl;
-            cout << PvErrorMessage(frame->Status) << " ["
-                 << PvErrorCodeStr(frame->Status) << "]" << endl;
+                FrameItem item = { frame, i - offset, hostTime };
+                if (m_stackSize > 1 && frame->Status == ePvErrDataMissing)
+                    handedOver = false;  // left out of the co-added image
+                else if (m_slotWriter && !placeFrame(item))
+                    handedOver = true;  // written once its slot is free
+                else {
+                    handedOver = pushFrame(writeQueue, item, block);
+                    if (handedOver)
+                        m_telemetry.frameQueued(writeQueue.size());
+                    else {
+                        m_telemetry.frameDiscarded();
+                        m_discardedFrames.push_back(i - offset);
+                    }
+                }
+            }
         }
+        else
+            m_telemetry.frameFailed(frame->Status);
 
-        err = PvCaptureQueueFrame(m_device, frame, 0);
-        if (err != ePvErrSuccess) {
-            setPvError("Cannot reenqueue frame.", err);
-            PvCaptureQueueClear(m_device);
-            PvCaptureEnd(m_device);
+        // frames which are not written can be reused right away
+        if (!handedOver && !requeueFrame(frame)) {
             return false;
         }
+
+        ++i;
     }
-    cout << endl;
 
-    err = PvCommandRun(m_device, "AcquisitionStop");
+    err = m_camera->commandRun("AcquisitionStop");
     if (err != ePvErrSuccess) {
         setPvError("Cannot stop acquisition.", err);
         return false;
     }
 
-    err = PvCaptureQueueClear(m_device);
-    if (err != ePvErrSuccess) {
-        setPvError("Cannot clear capture queue.", err);
-        PvCaptureEnd(m_device);
-        return false;
+    // frames completed but not taken by the loop are accounted for like in
+    // the loop: late frames as failed, frames of the requested range left
+    // out by a stop request as discarded; they lie past the end of the
+    // file, so NDISC is not affected. Frames past the requested range are
+    // not part of the recording.
+    if (m_captureMode == CallbackCapture) {
+        takeCompletedFrames(reordered, currentTime());
+        for (ReorderMap::const_iterator it = reordered.begin();
+                it != reordered.end(); ++it)
+        {
+            tPvFrame *frame = it->second.first;
+            if (frame->Status != ePvErrSuccess &&
+                    frame->Status != ePvErrDataMissing)
+                m_telemetry.frameFailed(frame->Status);
+            else if (frame->FrameCount < i)
+                m_telemetry.frameFailed(ePvErrSuccess);
+            else if (frame->FrameCount <= lastIndex && !armed)
+                m_telemetry.frameDiscarded();
+        }
+        reordered.clear();
+    }
+
+    // once the driver has let go of all slots, the frames waiting for one
+    // can be written; slots without a frame stay empty
+    if (m_slotWriter) {
+        m_camera->captureQueueClear();
+        while (!m_slotOwners.empty())
+            releaseSlot(m_slotOwners.begin()->second, true);
+        for (size_t k = 0; k < m_readyFrames.size(); ++k) {
+            pushFrame(writeQueue, m_readyFrames[k], true);
+            m_telemetry.frameQueued(writeQueue.size());
+        }
+        m_readyFrames.clear();
+        m_slotWriter = 0;
+    }
+
+    // wait until all pending frames are written
+    writerThread.finish();
+    writerThread.join();
+    statsWriter.close();
+
+    // shrink the file if the recording was stopped early
+    unsigned long numRecorded = 0;
+    if (preFrames == 0 || m_eventFrame > 0)
+        numRecorded = std::min(i - 1, lastIndex) - offset;
+    if (numRecorded > 0 && numRecorded != (unsigned long)fileFrames &&
+            !writer->resize(int(numRecorded)))
+        cerr << endl << writer->lastError() << endl;
+
+    // an event recording without event leaves nothing worth keeping
+    if (preFrames > 0 && m_eventFrame == 0) {
+        writer->close();
+        std::remove(fname.c_str());
+        return true;
+    }
+
+    if (m_eventFrame > 0) {
+        unsigned long frame0 = offset + 1;
+        writer->writeKey(TULONG, "EVFRAME", &m_eventFrame,
+                        "camera frame number of the event");
+        writer->writeKey(TULONG, "FRAME0", &frame0,
+                        "camera frame number of the first frame");
+        writer->writeKey(TSTRING, "EVSOURCE", const_cast<char *>(eventSource),
+                        "what triggered the event");
     }
 
     // write number of buggy frames to the FITS header
     unsigned long numDrop = m_droppedFrames.size();
     unsigned long numMiss = m_missingDataFrames.size();
-    writer.writeKey(TULONG, "NDROP", &numDrop, "number of dropped frames");
-    writer.writeKey(TULONG, "NMISS", &numMiss,
+    writer->writeKey(TULONG, "NDROP", &numDrop, "number of dropped frames");
+    writer->writeKey(TULONG, "NMISS", &numMiss,
                     "number of frames with missing data");
+    unsigned long numDisc = m_discardedFrames.size();
+    writer->writeKey(TULONG, "NDISC", &numDisc,
+                    "number of frames discarded by the recorder");
+    return true;
+}
 
-    err = PvCaptureEnd(m_device);
-    if (err != ePvErrSuccess) {
-        setPvError("Cannot stop capturing.", err);
+tPvErr Recorder::queueFrame(tPvFrame *frame)
+{
+    if (m_slotWriter)
+        assignSlot(frame);
+    if (m_captureMode != CallbackCapture)
+        return m_camera->captureQueueFrame(frame, 0);
+    frame->Context[0] = m_doneQueue;
+    return m_camera->captureQueueFrame(frame, frameDone);
+}
+
+// Collects the frames completed by the driver callbacks and returns them in
+// the order of their FrameCount, starting with next. A frame that completes
+// before an older one is held back until the older one arrives, no frame is
+// left in the driver or it waited for ReorderTimeout. Frames with an error
+// status have no valid FrameCount and are returned right away.
+bool Recorder::nextCompletedFrame(ReorderMap &pending, unsigned long next,
+                                  tPvFrame *&frame, double &hostTime)
+{
+    double now = currentTime();
+    takeCompletedFrames(pending, now);
+
+    if (pending.empty())
         return false;
+    ReorderMap::iterator it = pending.begin();
+    if (it->first > next && !m_frameQueue.empty() &&
+            now - it->second.second < ReorderTimeout)
+        return false;
+
+    frame = it->second.first;
+    hostTime = it->second.second;
+    pending.erase(it);
+    return true;
+}
+
+// Moves the frames of the done queue into pending, they have left the
+// driver queue.
+void Recorder::takeCompletedFrames(ReorderMap &pending, double now)
+{
+    tPvFrame *frame;
+    while (m_doneQueue->pop(frame)) {
+        FrameQueue::iterator pos = std::find(m_frameQueue.begin(),
+                                             m_frameQueue.end(), frame);
+        if (pos != m_frameQueue.end())
+            m_frameQueue.erase(pos);
+        bool valid = (frame->Status == ePvErrSuccess ||
+                      frame->Status == ePvErrDataMissing);
+        pending.insert(std::make_pair(valid ? frame->FrameCount : 0,
+                                      std::make_pair(frame, now)));
     }
+}
 
+bool Recorder::requeueFrame(tPvFrame *frame)
+{
+    tPvErr err = queueFrame(frame);
+    if (err != ePvErrSuccess) {
+        setPvError("Cannot reenqueue frame.", err);
+        return false;
+    }
+    m_frameQueue.push_back(frame);
     return true;
 }
 
+// Context[1] of a frame is its slot in zero-copy mode, 0 without a slot
+static inline unsigned long frameSlot(const tPvFrame *frame)
+{
+    return reinterpret_cast<unsigned long>(frame->Context[1]);
+}
+
+void Recorder::assignSlot(tPvFrame *frame)
+{
+    // a slot the frame was not written to in place stays empty
+    releaseSlot(frame, true);
+
+    // the frame gets the slot of the index it is expected to have, i.e.
+    // after the frames at the driver, unless frames are dropped; frames
+    // past the end of the file use their own buffer
+    unsigned long slot = std::max<unsigned long>(
+            m_nextSlot, m_nextIndex + m_frameQueue.size());
+    unsigned char *buffer = m_slotWriter->frameBuffer(long(slot));
+    if (!buffer) {
+        frame->ImageBuffer = frame->Context[2];
+        return;
+    }
+    frame->ImageBuffer = buffer;
+    frame->Context[1] = reinterpret_cast<void *>(slot);
+    m_slotOwners[slot] = frame;
+    m_nextSlot = slot + 1;
+}
+
+void Recorder::releaseSlot(tPvFrame *frame, bool clear)
+{
+    unsigned long slot = frameSlot(frame);
+    if (slot == 0)
+        return;
+
+    if (clear)
+        std::memset(frame->ImageBuffer, 0, m_frameBufferSize);
+    frame->Context[1] = 0;
+    m_slotOwners.erase(slot);
+
+    // a frame waiting for this slot can be written now
+    std::map<unsigned long, FrameItem>::iterator it =
+            m_deferredFrames.find(slot);
+    if (it != m_deferredFrames.end()) {
+        m_readyFrames.push_back(it->second);
+        m_deferredFrames.erase(it);
+    }
+}
+
+bool Recorder::placeFrame(const FrameItem &item)
+{
+    tPvFrame *frame = item.frame;
+    unsigned long slot = frameSlot(frame);
+    if (slot == item.index) {
+        releaseSlot(frame, false);
+        return true;
+    }
+
+    // the frame ended up in the slot of another index, e.g. after dropped
+    // frames, so it moves to its own buffer and is copied by the writer
+    if (slot != 0) {
+        std::memcpy(frame->Context[2], frame->ImageBuffer, m_frameBufferSize);
+        releaseSlot(frame, true);
+        frame->ImageBuffer = frame->Context[2];
+    }
+
+    // its slot may still be filled by the driver with a later frame
+    if (m_slotOwners.count(item.index) == 0)
+        return true;
+    m_deferredFrames[item.index] = item;
+    return false;
+}
+
 Recorder::IndexVector Recorder::droppedFrames() const
 {
     return m_droppedFrames;
@@ -443,9 +1015,214 @@ Recorder::IndexVector Recorder::missingDataFrames() const
     return m_missingDataFrames;
 }
 
+Recorder::IndexVector Recorder::discardedFrames() const
+{
+    return m_discardedFrames;
+}
+
+void Recorder::setOverflowPolicy(OverflowPolicy policy)
+{
+    m_overflowPolicy = policy;
+}
+
+Recorder::OverflowPolicy Recorder::overflowPolicy() const
+{
+    return m_overflowPolicy;
+}
+
+void Recorder::setCaptureMode(CaptureMode mode)
+{
+    m_captureMode = mode;
+}
+
+Recorder::CaptureMode Recorder::captureMode() const
+{
+    return m_captureMode;
+}
+
+void Recorder::setQueueSize(int queueSize)
+{
+    m_queueSize = queueSize;
+}
+
+int Recorder::queueSize() const
+{
+    return m_queueSize;
+}
+
+void Recorder::setWriterBackend(FitsWriter::Backend backend)
+{
+    m_writerBackend = backend;
+}
+
+FitsWriter::Backend Recorder::writerBackend() const
+{
+    return m_writerBackend;
+}
+
+void Recorder::setZeroCopy(bool enable)
+{
+    m_zeroCopy = enable;
+}
+
+bool Recorder::zeroCopy() const
+{
+    return m_zeroCopy;
+}
+
+void Recorder::setStackSize(int numFrames)
+{
+    m_stackSize = std::max(numFrames, 1);
+}
+
+int Recorder::stackSize() const
+{
+    return m_stackSize;
+}
+
+void Recorder::setFrameSelection(int windowSize, double keepPercent)
+{
+    m_selectionWindow = std::max(windowSize, 1);
+    m_selectionPercent = std::max(keepPercent, 0.0);
+}
+
+int Recorder::selectionWindow() const
+{
+    return m_selectionWindow;
+}
+
+double Recorder::selectionPercent() const
+{
+    return m_selectionPercent;
+}
+
+void Recorder::setCalibrationFiles(const std::string &darkFile,
+                                   const std::string &flatFile)
+{
+    m_darkFile = darkFile;
+    m_flatFile = flatFile;
+}
+
+std::string Recorder::darkFile() const
+{
+    return m_darkFile;
+}
+
+std::string Recorder::flatFile() const
+{
+    return m_flatFile;
+}
+
+void Recorder::setSegmentLimits(const SegmentLimits &limits)
+{
+    m_segmentLimits = limits;
+}
+
+SegmentLimits Recorder::segmentLimits() const
+{
+    return m_segmentLimits;
+}
+
+bool Recorder::hasWriterDecorators() const
+{
+    return m_stackSize > 1 || m_selectionPercent > 0 || !m_darkFile.empty() ||
+            !m_flatFile.empty() || m_segmentLimits.isEnabled();
+}
+
+void Recorder::stop()
+{
+    __atomic_store_n(&m_stop, 1, __ATOMIC_RELAXED);
+}
+
+void Recorder::setPreTriggerFrames(int numFrames)
+{
+    m_preTriggerFrames = std::max(numFrames, 0);
+}
+
+int Recorder::preTriggerFrames() const
+{
+    return m_preTriggerFrames;
+}
+
+void Recorder::setEventLevel(double level)
+{
+    m_eventLevel = level;
+}
+
+double Recorder::eventLevel() const
+{
+    return m_eventLevel;
+}
+
+void Recorder::triggerEvent()
+{
+    __atomic_store_n(&m_eventPending, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long Recorder::eventFrame() const
+{
+    return m_eventFrame;
+}
+
+void Recorder::setCpuAffinity(const std::vector<int> &cpus)
+{
+    m_cpus = cpus;
+}
+
+std::vector<int> Recorder::cpuAffinity() const
+{
+    return m_cpus;
+}
+
+void Recorder::setStatsFile(const std::string &fname, double interval)
+{
+    m_statsFile = fname;
+    m_statsInterval = interval;
+}
+
+std::string Recorder::statsFile() const
+{
+    return m_statsFile;
+}
+
+const Telemetry &Recorder::telemetry() const
+{
+    return m_telemetry;
+}
+
+void Recorder::setHugePages(bool enable)
+{
+    m_framePool.setHugePages(enable);
+}
+
+bool Recorder::hugePages() const
+{
+    return m_framePool.hugePages();
+}
+
+void Recorder::setLockMemory(bool enable)
+{
+    m_framePool.setLockMemory(enable);
+}
+
+bool Recorder::lockMemory() const
+{
+    return m_framePool.lockMemory();
+}
+
+bool Recorder::buffersLocked() const
+{
+    return m_framePool.isLocked();
+}
+
+bool Recorder::hugePageBuffers() const
+{
+    return m_framePool.isHugePageBacked();
+}
+
 bool Recorder::setFrameRate(float frameRate)
 {
-    tPvErr err = PvAttrFloat32Set(m_device, "FrameRate", frameRate);
+    tPvErr err = m_camera->attrFloat32Set("FrameRate", frameRate);
     if (err != ePvErrSuccess) {
         setPvError("Cannot set frame rate.", err);
         return false;
@@ -456,14 +1233,14 @@ bool Recorder::setFrameRate(float frameRate)
 float Recorder::frameRate() const
 {
     tPvFloat32 value;
-    tPvErr err = PvAttrFloat32Get(m_device, "FrameRate", &value);
+    tPvErr err = m_camera->attrFloat32Get("FrameRate", &value);
     return (err == ePvErrSuccess) ? value : 0.0;
 }
 
 bool Recorder::setExposureTime(double exposureTime)
 {
     unsigned int value = static_cast<unsigned int>(1e3 * exposureTime + 0.5);
-    tPvErr err = PvAttrUint32Set(m_device, "ExposureValue", value);
+    tPvErr err = m_camera->attrUint32Set("ExposureValue", value);
     if (err != ePvErrSuccess) {
         setPvError("Cannot set exposure time.", err);
         return false;
@@ -474,13 +1251,13 @@ bool Recorder::setExposureTime(double exposureTime)
 double Recorder::exposureTime() const
 {
     tPvUint32 value;
-    tPvErr err = PvAttrUint32Get(m_device, "ExposureValue", &value);
+    tPvErr err = m_camera->attrUint32Get("ExposureValue", &value);
     return (err == ePvErrSuccess) ? double(value) / 1e3 : 0;
 }
 
 bool Recorder::setPixelFormat(const std::string &pixelFormat)
 {
-    tPvErr err = PvAttrEnumSet(m_device, "PixelFormat", pixelFormat.c_str());
+    tPvErr err = m_camera->attrEnumSet("PixelFormat", pixelFormat.c_str());
     if (err != ePvErrSuccess) {
         setPvError("Cannot set pixel format.", err);
         return false;
@@ -491,13 +1268,13 @@ bool Recorder::setPixelFormat(const std::string &pixelFormat)
 std::string Recorder::pixelFormat() const
 {
     char value[32];
-    tPvErr err = PvAttrEnumGet(m_device, "PixelFormat", value, 32, 0);
+    tPvErr err = m_camera->attrEnumGet("PixelFormat", value, 32);
     return (err == ePvErrSuccess) ? value : "";
 }
 
 bool Recorder::setTriggerMode(const std::string &triggerMode)
 {
-    tPvErr err = PvAttrEnumSet(m_device, "FrameStartTriggerMode", triggerMode.c_str());
+    tPvErr err = m_camera->attrEnumSet("FrameStartTriggerMode", triggerMode.c_str());
     if (err != ePvErrSuccess) {
         setPvError("Cannot set trigger mode.", err);
         return false;
@@ -508,13 +1285,13 @@ bool Recorder::setTriggerMode(const std::string &triggerMode)
 std::string Recorder::triggerMode() const
 {
     char value[32];
-    tPvErr err = PvAttrEnumGet(m_device, "FrameStartTriggerMode", value, 32, 0);
+    tPvErr err = m_camera->attrEnumGet("FrameStartTriggerMode", value, 32);
     return (err == ePvErrSuccess) ? value : "";
 }
 
 bool Recorder::setTriggerDelay(unsigned int triggerDelay)
 {
-    tPvErr err = PvAttrUint32Set(m_device, "FrameStartTriggerDelay", triggerDelay);
+    tPvErr err = m_camera->attrUint32Set("FrameStartTriggerDelay", triggerDelay);
     if (err != ePvErrSuccess) {
         setPvError("Cannot set trigger delay.", err);
         return false;
@@ -525,23 +1302,115 @@ bool Recorder::setTriggerDelay(unsigned int triggerDelay)
 unsigned int Recorder::triggerDelay() const
 {
     tPvUint32 value;
-    tPvErr err = PvAttrUint32Get(m_device, "FrameStartTriggerDelay", &value);
+    tPvErr err = m_camera->attrUint32Get("FrameStartTriggerDelay", &value);
     return (err == ePvErrSuccess) ? value : 0;
 }
 
+bool Recorder::setBinning(int binX, int binY)
+{
+    if (binX < 1 || binY < 1) {
+        setError("Invalid binning.");
+        return false;
+    }
+
+    tPvErr err = m_camera->attrUint32Set("BinningX", tPvUint32(binX));
+    if (err == ePvErrSuccess)
+        err = m_camera->attrUint32Set("BinningY", tPvUint32(binY));
+    if (err != ePvErrSuccess) {
+        setPvError("Cannot set binning.", err);
+        return false;
+    }
+    return setRegion(0, 0, 0, 0);
+}
+
+int Recorder::binningX() const
+{
+    tPvUint32 value;
+    tPvErr err = m_camera->attrUint32Get("BinningX", &value);
+    return (err == ePvErrSuccess) ? int(value) : 1;
+}
+
+int Recorder::binningY() const
+{
+    tPvUint32 value;
+    tPvErr err = m_camera->attrUint32Get("BinningY", &value);
+    return (err == ePvErrSuccess) ? int(value) : 1;
+}
+
+bool Recorder::setRegion(int x, int y, int width, int height)
+{
+    int maxWidth = m_sensorWidth / binningX();
+    int maxHeight = m_sensorHeight / binningY();
+    if (width == 0)
+        width = maxWidth - x;
+    if (height == 0)
+        height = maxHeight - y;
+    if (x < 0 || y < 0 || width < 1 || height < 1 ||
+            x + width > maxWidth || y + height > maxHeight) {
+        std::stringstream ss;
+        ss << "Region of interest " << width << "x" << height << "+"
+           << x << "+" << y << " exceeds the sensor size of "
+           << maxWidth << "x" << maxHeight << ".";
+        setError(ss.str());
+        return false;
+    }
+
+    // move the origin first, so that any new size fits on the sensor
+    const char *names[] = {
+        "RegionX", "RegionY", "Width", "Height", "RegionX", "RegionY" };
+    tPvUint32 values[] = {
+        0, 0, tPvUint32(width), tPvUint32(height), tPvUint32(x), tPvUint32(y) };
+    for (int i = 0; i < 6; ++i) {
+        tPvErr err = m_camera->attrUint32Set(names[i], values[i]);
+        if (err != ePvErrSuccess) {
+            setPvError("Cannot set region of interest.", err);
+            return false;
+        }
+    }
+    return true;
+}
+
+int Recorder::regionX() const
+{
+    tPvUint32 value;
+    tPvErr err = m_camera->attrUint32Get("RegionX", &value);
+    return (err == ePvErrSuccess) ? int(value) : 0;
+}
+
+int Recorder::regionY() const
+{
+    tPvUint32 value;
+    tPvErr err = m_camera->attrUint32Get("RegionY", &value);
+    return (err == ePvErrSuccess) ? int(value) : 0;
+}
+
+int Recorder::imageWidth() const
+{
+    tPvUint32 value;
+    tPvErr err = m_camera->attrUint32Get("Width", &value);
+    return (err == ePvErrSuccess) ? int(value) : m_sensorWidth;
+}
+
+int Recorder::imageHeight() const
+{
+    tPvUint32 value;
+    tPvErr err = m_camera->attrUint32Get("Height", &value);
+    return (err == ePvErrSuccess) ? int(value) : m_sensorHeight;
+}
+
 bool Recorder::setPacketSize(unsigned int packetSize)
 {
     tPvErr err;
 
     if (packetSize != 0)
     {
-        err = PvAttrUint32Set(m_device, "PacketSize", packetSize);
+        err = m_camera->attrUint32Set("PacketSize", packetSize);
         if (err != ePvErrSuccess) {
             setPvError("Cannot set packet size.", err);
             return false;
         }
     } else {
-        err = PvCaptureAdjustPacketSize(m_device, 8228);
+        err = m_camera->captureAdjustPacketSize(8228);
         if (err != ePvErrSuccess) {
             setPvError("Cannot adjust packet size.", err);
             return false;
@@ -553,14 +1422,14 @@ bool Recorder::setPacketSize(unsigned int packetSize)
 unsigned int Recorder::packetSize() const
 {
     tPvUint32 value;
-    tPvErr err = PvAttrUint32Get(m_device, "PacketSize", &value);
+    tPvErr err = m_camera->attrUint32Get("PacketSize", &value);
     return (err == ePvErrSuccess) ? value : 0;
 }
 
 bool Recorder::setBandwidth(double bandwidth)
 {
     unsigned int value = static_cast<unsigned int>(1e6 * bandwidth + 0.5);
-    tPvErr err = PvAttrUint32Set(m_device, "StreamBytesPerSecond", value);
+    tPvErr err = m_camera->attrUint32Set("StreamBytesPerSecond", value);
     if (err != ePvErrSuccess) {
         setPvError("Cannot set bandwidth.", err);
         return false;
@@ -571,7 +1440,7 @@ bool Recorder::setBandwidth(double bandwidth)
 double Recorder::bandwidth() const
 {
     tPvUint32 value;
-    tPvErr err = PvAttrUint32Get(m_device, "StreamBytesPerSecond", &value);
+    tPvErr err = m_camera->attrUint32Get("StreamBytesPerSecond", &value);
     return (err == ePvErrSuccess) ? double(value) / 1e6 : 0.0;
 }
 
@@ -607,37 +1476,12 @@ tPvCameraInfoEx Recorder::cameraInfo() const
 
 Recorder::CameraInfoVector Recorder::availableCameras(int timeout) const
 {
-    // try to find a camera for timeout miliseconds
-    int numLoops = timeout / 100;
-    unsigned long camCount = 0;
-    for (int i = 0; i < numLoops && camCount < 1; ++i) {
-        camCount = PvCameraCount();
-        msleep(100);
-    }
-
-    if (camCount < 1)
-        return CameraInfoVector();
-
-    tPvCameraInfoEx *camInfos = new tPvCameraInfoEx[camCount];
-    unsigned long n = PvCameraListEx(camInfos, camCount, 0,
-                                     sizeof(tPvCameraInfoEx));
-
-    CameraInfoVector result;
-    for (unsigned long i = 0; i < n; ++i)
-        result.push_back(*(camInfos + i));
-
-    delete [] camInfos;
-    return result;
+    return m_camera->availableCameras(timeout);
 }
 
 std::string Recorder::apiVersionStr() const
 {
-    unsigned long major, minor;
-    PvVersion(&major, &minor);
-
-    std::stringstream ss;
-    ss << major << "." << minor;
-    return ss.str();
+    return m_camera->apiVersionStr();
 }
 
 std::string Recorder::lastError() const
@@ -26,27 +26,136 @@
 #ifndef PVREC_RECORDER_H
 #define PVREC_RECORDER_H
 
+#include "fitswriter.h"
+#include "framepool.h"
+#include "segmentedwriter.h"
+#include "telemetry.h"
+#include "ringbuffer.h"
+#include "writerthread.h"
 #include <string>
 #include <vector>
 #include <deque>
+#include <map>
 #include <fitsio.h>
 #include <PvApi.h>
 
+class Camera;
+
 class Recorder
 {
 public:
-    explicit Recorder(int numBuffers = 3);
+    // takes ownership of the camera, a PvApi camera is used if none is given
+    explicit Recorder(int numBuffers = 3, Camera *camera = 0);
     virtual ~Recorder();
 
     bool openCamera(unsigned long camId = 0);
     void closeCamera();
     bool isCameraOpen() const;
 
+    // numFrames = 0 records until stop() is called, this needs segments
     bool record(const std::string &fname, int numFrames, bool clobber = false);
 
+    // ends a running recording, can be called from a signal handler
+    void stop();
+
+    // Event recording: with a pre-trigger length > 0, record() keeps the
+    // most recent frames in memory and only writes them, followed by
+    // numFrames post-trigger frames, when an event is triggered.
+    void setPreTriggerFrames(int numFrames);
+    int preTriggerFrames() const;
+
+    // triggers on frames with a mean pixel value >= level, 0 disables
+    void setEventLevel(double level);
+    double eventLevel() const;
+
+    // triggers an event, can be called from a signal handler or any thread
+    void triggerEvent();
+
+    // camera frame index of the last event, 0 if nothing was triggered
+    unsigned long eventFrame() const;
+
     typedef std::vector<unsigned long> IndexVector;
     IndexVector droppedFrames() const;
     IndexVector missingDataFrames() const;
+    IndexVector discardedFrames() const;
+
+    // what to do with captured frames when the write queue is full
+    enum OverflowPolicy { BlockOnOverflow, DropOnOverflow };
+
+    void setOverflowPolicy(OverflowPolicy policy);
+    OverflowPolicy overflowPolicy() const;
+
+    // how the capture thread learns about completed frames: by waiting for
+    // the oldest queued frame, or through the driver's completion callbacks,
+    // where frames may complete in any order
+    enum CaptureMode { WaitCapture, CallbackCapture };
+
+    void setCaptureMode(CaptureMode mode);
+    CaptureMode captureMode() const;
+
+    // size of the write queue, 0 means same as the number of buffers
+    void setQueueSize(int queueSize);
+    int queueSize() const;
+
+    void setWriterBackend(FitsWriter::Backend backend);
+    FitsWriter::Backend writerBackend() const;
+
+    // captures frames straight into the output file if the writer hands
+    // out frame buffers (see FitsWriter::frameBuffer()). record() fails for
+    // event recordings, whose file indices are not known in advance, and
+    // with writer decorators, which don't hand out buffers.
+    void setZeroCopy(bool enable);
+    bool zeroCopy() const;
+
+    // co-adds every numFrames frames into one 32 bit image, see
+    // StackingWriter; frames with missing data are left out, 1 disables
+    void setStackSize(int numFrames);
+    int stackSize() const;
+
+    // lucky imaging, keeps only the sharpest keepPercent percent of each
+    // window of windowSize frames, see SelectingWriter; 0 percent disables
+    void setFrameSelection(int windowSize, double keepPercent);
+    int selectionWindow() const;
+    double selectionPercent() const;
+
+    // applies a master dark and flat to all frames before they are written,
+    // see CalibratingWriter; empty names disable the calibration
+    void setCalibrationFiles(const std::string &darkFile,
+                             const std::string &flatFile);
+    std::string darkFile() const;
+    std::string flatFile() const;
+
+    // split recordings into several files, disabled by default
+    void setSegmentLimits(const SegmentLimits &limits);
+    SegmentLimits segmentLimits() const;
+
+    // true if stacking, frame selection, calibration or segments wrap the
+    // writer backend; the wrapping writers are synchronous, so an
+    // asynchronous backend is then used through writeFrame()
+    bool hasWriterDecorators() const;
+
+    // CPUs for the capture thread, i.e. the caller of record(), and the
+    // writer thread; empty allows all CPUs. The caller gets its own CPUs
+    // back when record() returns, other threads are not pinned.
+    void setCpuAffinity(const std::vector<int> &cpus);
+    std::vector<int> cpuAffinity() const;
+
+    // dumps the telemetry of each recording to this file every interval
+    // seconds, see StatsWriter; an empty name disables the stats file
+    void setStatsFile(const std::string &fname, double interval = 1);
+    std::string statsFile() const;
+
+    // live counters of the running recording, safe to read from any thread
+    const Telemetry &telemetry() const;
+
+    // frame buffer options, applied on the next allocation
+    void setHugePages(bool enable);
+    bool hugePages() const;
+    void setLockMemory(bool enable);
+    bool lockMemory() const;
+    // state of the frame buffers as allocated, both fall back silently
+    bool buffersLocked() const;
+    bool hugePageBuffers() const;
 
     bool setFrameRate(float frameRate);
     float frameRate() const;
@@ -63,6 +172,22 @@ public:
     bool setTriggerDelay(unsigned int triggerDelay);
     unsigned int triggerDelay() const;
 
+    // changing the binning resets the region of interest to the whole
+    // sensor
+    bool setBinning(int binX, int binY);
+    int binningX() const;
+    int binningY() const;
+
+    // region of interest in binned pixels, a zero width or height extends
+    // the region to the edge of the sensor
+    bool setRegion(int x, int y, int width, int height);
+    int regionX() const;
+    int regionY() const;
+
+    // size of the recorded images, i.e. of the binned region of interest
+    int imageWidth() const;
+    int imageHeight() const;
+
     bool setPacketSize(unsigned int packetSize);
     unsigned int packetSize() const;
 
@@ -84,7 +209,16 @@ public:
 
 protected:
     bool initCamera();
-    void allocateFrames(int numBuffers, size_t bufferSize);
+    bool allocateFrames(int numBuffers, size_t bufferSize);
+    FitsWriter * createWriter() const;
+    bool recordFrames(FitsWriter *writer, const std::string &fname,
+                      int numFrames, bool clobber, int width, int height,
+                      FitsWriter::PixelType pixelType);
+    tPvErr queueFrame(tPvFrame *frame);
+    bool requeueFrame(tPvFrame *frame);
+    void assignSlot(tPvFrame *frame);
+    void releaseSlot(tPvFrame *frame, bool clear);
+    bool placeFrame(const FrameItem &item);
     void freeFrames();
     void setError(const std::string &msg) const;
     void setPvError(const std::string &msg, tPvErr code) const;
@@ -92,8 +226,11 @@ protected:
     void clearCameraInfo();
 
 private:
+    Recorder(const Recorder &);
+    Recorder & operator=(const Recorder &);
+
     mutable std::string m_errorStr;
-    tPvHandle m_device;
+    Camera *m_camera;
     tPvCameraInfoEx m_camInfo;
     std::string m_ipAddress;
     std::string m_ethAddress;
@@ -101,11 +238,51 @@ private:
     int m_sensorWidth;
     int m_sensorHeight;
     int m_numBuffers;
+    int m_queueSize;
+    OverflowPolicy m_overflowPolicy;
+    CaptureMode m_captureMode;
+    FitsWriter::Backend m_writerBackend;
+    bool m_zeroCopy;
+    int m_stackSize;
+    int m_selectionWindow;
+    double m_selectionPercent;
+    std::string m_darkFile;
+    std::string m_flatFile;
+    SegmentLimits m_segmentLimits;
+    std::vector<int> m_cpus;
+    std::string m_statsFile;
+    double m_statsInterval;
+    Telemetry m_telemetry;
+    int m_stop;
+    int m_preTriggerFrames;
+    double m_eventLevel;
+    int m_eventPending;
+    unsigned long m_eventFrame;
     size_t m_frameBufferSize;
+    FramePool m_framePool;
+    typedef std::vector<tPvFrame *> FrameVector;
+    FrameVector m_frames;
     typedef std::deque<tPvFrame *> FrameQueue;
     FrameQueue m_frameQueue;
+    typedef RingBuffer<tPvFrame *> DoneQueue;
+    DoneQueue *m_doneQueue;
+    // completed frames by FrameCount with the time they were taken over
+    typedef std::multimap<unsigned long, std::pair<tPvFrame *, double> >
+            ReorderMap;
+    bool nextCompletedFrame(ReorderMap &pending, unsigned long next,
+                            tPvFrame *&frame, double &hostTime);
+    void takeCompletedFrames(ReorderMap &pending, double now);
+    // zero-copy state: the writer handing out the frame slots, the slots
+    // the driver may still write to and the frames waiting for their slot
+    FitsWriter *m_slotWriter;
+    unsigned long m_nextSlot;
+    unsigned long m_nextIndex;
+    std::map<unsigned long, tPvFrame *> m_slotOwners;
+    std::map<unsigned long, FrameItem> m_deferredFrames;
+    std::deque<FrameItem> m_readyFrames;
     IndexVector m_droppedFrames;
     IndexVector m_missingDataFrames;
+    IndexVector m_discardedFrames;
 };
 
 #endif // PVREC_RECORDER_H
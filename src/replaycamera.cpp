@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "replaycamera.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+bool ReplayCamera::Row::operator<(const Row &other) const
+{
+    return index < other.index;
+}
+
+ReplayCamera::ReplayCamera()
+    : m_file(0),
+      m_bitpix(0),
+      m_shift(0),
+      m_hasFrameTable(false),
+      m_cycleTime(0),
+      m_cycleFrames(0),
+      m_nextRow(0),
+      m_currentRow(0),
+      m_cycle(0)
+{
+}
+
+ReplayCamera::~ReplayCamera()
+{
+    // the acquisition thread reads from the file
+    close();
+    unload();
+}
+
+bool ReplayCamera::load(const std::string &fname)
+{
+    unload();
+
+    int status = 0;
+    fits_open_image(&m_file, fname.c_str(), READONLY, &status);
+    if (status != 0) {
+        m_file = 0;
+        setError("Cannot open the replay file '" + fname + "'.", status);
+        return false;
+    }
+
+    int naxis = 0;
+    long naxes[3] = { 1, 1, 1 };
+    fits_get_img_param(m_file, 3, &m_bitpix, &naxis, naxes, &status);
+    if (status != 0) {
+        setError("Cannot read the replay file '" + fname + "'.", status);
+        unload();
+        return false;
+    }
+    if (naxis < 2 || naxis > 3 || naxes[0] < 1 || naxes[1] < 1 ||
+            naxes[2] < 1 || (m_bitpix != BYTE_IMG && m_bitpix != SHORT_IMG)) {
+        setError("The replay file '" + fname + "' contains no 8 or 16 bit "
+                 "frames.");
+        unload();
+        return false;
+    }
+
+    int maxValue = -1;
+    if (!readFrameTable(naxes[2], maxValue)) {
+        unload();
+        return false;
+    }
+    if (m_rows.empty()) {
+        setError("The frame table of '" + fname + "' contains no frames.");
+        unload();
+        return false;
+    }
+
+    // the sensor bits of 16 bit cubes are guessed from the largest value
+    // in the frame table
+    int bits = 8;
+    if (m_bitpix == SHORT_IMG) {
+        bits = (maxValue < 0) ? 16 : 10;
+        while (bits < 16 && maxValue >= (1 << bits))
+            bits += 2;
+    }
+    setSensor(int(naxes[0]), int(naxes[1]), bits);
+    return true;
+}
+
+void ReplayCamera::setPaced(bool paced)
+{
+    m_paced = paced;
+}
+
+int ReplayCamera::numFrames() const
+{
+    return int(m_rows.size());
+}
+
+bool ReplayCamera::hasFrameTable() const
+{
+    return m_hasFrameTable;
+}
+
+std::string ReplayCamera::lastError() const
+{
+    return m_errorStr;
+}
+
+std::string ReplayCamera::apiVersionStr() const
+{
+    return "replay";
+}
+
+ReplayCamera::CameraInfoVector ReplayCamera::availableCameras(
+        int timeout) const
+{
+    CameraInfoVector cameras = SimCamera::availableCameras(timeout);
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        std::memset(cameras[i].CameraName, 0, sizeof(cameras[i].CameraName));
+        std::memset(cameras[i].ModelName, 0, sizeof(cameras[i].ModelName));
+        std::strncpy(cameras[i].CameraName, "Replay Camera",
+                     sizeof(cameras[i].CameraName) - 1);
+        std::strncpy(cameras[i].ModelName, "ReplayCamera",
+                     sizeof(cameras[i].ModelName) - 1);
+    }
+    return cameras;
+}
+
+tPvErr ReplayCamera::attrUint32Set(const char *name, tPvUint32 value)
+{
+    std::string attr(name);
+    if ((attr == "BinningX" || attr == "BinningY") && value != 1)
+        return ePvErrOutOfRange;
+    return SimCamera::attrUint32Set(name, value);
+}
+
+tPvErr ReplayCamera::attrEnumSet(const char *name, const char *value)
+{
+    if (std::string(name) == "PixelFormat" &&
+            std::string(value) == "Mono12Packed")
+        return ePvErrOutOfRange;
+    return SimCamera::attrEnumSet(name, value);
+}
+
+void ReplayCamera::prepareAcquisition()
+{
+    m_nextRow = 0;
+    m_currentRow = 0;
+    m_cycle = 0;
+
+    double period = 1.0 / m_float32Attrs["FrameRate"];
+    if (!m_hasFrameTable)
+        for (size_t i = 0; i < m_rows.size(); ++i)
+            m_rows[i].time = i * period;
+
+    // the next pass starts a mean frame interval after the last frame
+    size_t n = m_rows.size();
+    m_cycleTime = (n > 1) ? m_rows.back().time * n / (n - 1) : 0;
+    if (m_cycleTime <= 0)
+        m_cycleTime = n * period;
+    m_cycleFrames = m_rows.back().frameCount;
+
+    size_t numPixels = size_t(m_uint32Attrs["Width"]) *
+            size_t(m_uint32Attrs["Height"]);
+    m_shift = 0;
+    if (m_bitpix == SHORT_IMG && m_enumAttrs["PixelFormat"] == "Mono8")
+        m_shift = int(m_uint32Attrs["SensorBits"]) - 8;
+    m_buffer.resize(m_shift > 0 ? numPixels : 0);
+}
+
+void ReplayCamera::nextFrame(unsigned long &frameCount, double &t)
+{
+    if (m_nextRow == m_rows.size()) {
+        m_nextRow = 0;
+        ++m_cycle;
+    }
+
+    const Row &row = m_rows[m_nextRow];
+    frameCount = m_cycle * m_cycleFrames + row.frameCount;
+    t = m_cycle * m_cycleTime + row.time;
+    m_currentRow = m_nextRow++;
+}
+
+void ReplayCamera::fillFrame(tPvFrame *frame, unsigned long frameCount,
+                             double t)
+{
+    fillFrameInfo(frame, frameCount, t);
+
+    size_t imageSize = size_t(frame->Width) * frame->Height;
+    if (frame->Format == ePvFmtMono16)
+        imageSize *= 2;
+    if (frame->ImageBufferSize < imageSize) {
+        frame->ImageSize = 0;
+        frame->Status = ePvErrBufferTooSmall;
+        return;
+    }
+
+    const Row &row = m_rows[m_currentRow];
+    if (!readImage(frame, row.index)) {
+        frame->ImageSize = 0;
+        frame->Status = ePvErrDataLost;
+        return;
+    }
+    frame->ImageSize = imageSize;
+    frame->Status = tPvErr(row.status);
+}
+
+// reads the region of interest of a frame of the cube
+bool ReplayCamera::readImage(tPvFrame *frame, long index)
+{
+    long first[3] = { long(frame->RegionX) + 1, long(frame->RegionY) + 1,
+                      index };
+    long last[3] = { long(frame->RegionX + frame->Width),
+                     long(frame->RegionY + frame->Height), index };
+    long inc[3] = { 1, 1, 1 };
+    int status = 0;
+
+    if (frame->Format == ePvFmtMono16)
+        fits_read_subset(m_file, TUSHORT, first, last, inc, 0,
+                         frame->ImageBuffer, 0, &status);
+    else if (m_shift == 0)
+        fits_read_subset(m_file, TBYTE, first, last, inc, 0,
+                         frame->ImageBuffer, 0, &status);
+    else {
+        fits_read_subset(m_file, TUSHORT, first, last, inc, 0,
+                         &m_buffer[0], 0, &status);
+        unsigned char *dst = static_cast<unsigned char *>(frame->ImageBuffer);
+        for (size_t i = 0; i < m_buffer.size(); ++i)
+            dst[i] = (unsigned char)std::min(m_buffer[i] >> m_shift, 255);
+    }
+    return status == 0;
+}
+
+// Reads the frames to replay from the FRAMEINFO table. The times are taken
+// from the camera time stamps, or from the host times if the time stamp
+// frequency is unknown. Without a table all frames of the cube are
+// replayed.
+bool ReplayCamera::readFrameTable(long numFrames, int &maxValue)
+{
+    int status = 0;
+    int imageHdu = 0;
+    fits_get_hdu_num(m_file, &imageHdu);
+
+    unsigned long tsFreq = 0;
+    fits_read_key(m_file, TULONG, const_cast<char *>("TSFREQ"), &tsFreq, 0,
+                  &status);
+    status = 0;
+
+    m_rows.clear();
+    m_hasFrameTable = false;
+    fits_movnam_hdu(m_file, BINARY_TBL, const_cast<char *>("FRAMEINFO"), 0,
+                    &status);
+    if (status != 0) {
+        status = 0;
+        fits_movabs_hdu(m_file, imageHdu, 0, &status);
+        for (long i = 1; i <= numFrames; ++i) {
+            Row row = { i, (unsigned long)i, 0, ePvErrSuccess };
+            m_rows.push_back(row);
+        }
+        return true;
+    }
+
+    long numRows = 0;
+    int indexCol = 0, frameCountCol = 0, timeCol = 0, statusCol = 0;
+    fits_get_num_rows(m_file, &numRows, &status);
+    fits_get_colnum(m_file, CASEINSEN, const_cast<char *>("INDEX"),
+                    &indexCol, &status);
+    fits_get_colnum(m_file, CASEINSEN, const_cast<char *>("FRAMECNT"),
+                    &frameCountCol, &status);
+    fits_get_colnum(m_file, CASEINSEN, const_cast<char *>(
+                    tsFreq > 0 ? "TIMESTMP" : "HOSTTIME"), &timeCol, &status);
+    fits_get_colnum(m_file, CASEINSEN, const_cast<char *>("STATUS"),
+                    &statusCol, &status);
+
+    std::vector<LONGLONG> index(numRows), frameCount(numRows);
+    std::vector<LONGLONG> timestamp(numRows);
+    std::vector<double> hostTime(numRows);
+    std::vector<int> frameStatus(numRows);
+    if (status == 0 && numRows > 0) {
+        fits_read_col(m_file, TLONGLONG, indexCol, 1, 1, numRows, 0,
+                      &index[0], 0, &status);
+        fits_read_col(m_file, TLONGLONG, frameCountCol, 1, 1, numRows, 0,
+                      &frameCount[0], 0, &status);
+        if (tsFreq > 0)
+            fits_read_col(m_file, TLONGLONG, timeCol, 1, 1, numRows, 0,
+                          &timestamp[0], 0, &status);
+        else
+            fits_read_col(m_file, TDOUBLE, timeCol, 1, 1, numRows, 0,
+                          &hostTime[0], 0, &status);
+        fits_read_col(m_file, TINT, statusCol, 1, 1, numRows, 0,
+                      &frameStatus[0], 0, &status);
+    }
+    if (status != 0) {
+        setError("Cannot read the frame table of the replay file.", status);
+        return false;
+    }
+
+    // older files have no MAXVAL column
+    int maxValueCol = 0;
+    fits_get_colnum(m_file, CASEINSEN, const_cast<char *>("MAXVAL"),
+                    &maxValueCol, &status);
+    if (status == 0 && numRows > 0) {
+        std::vector<int> maxValues(numRows);
+        fits_read_col(m_file, TINT, maxValueCol, 1, 1, numRows, 0,
+                      &maxValues[0], 0, &status);
+        if (status == 0)
+            maxValue = *std::max_element(maxValues.begin(), maxValues.end());
+    }
+    status = 0;
+
+    fits_movabs_hdu(m_file, imageHdu, 0, &status);
+    if (status != 0) {
+        setError("Cannot read the replay file.", status);
+        return false;
+    }
+
+    // rows of frames beyond the cube are left out, e.g. of an interrupted
+    // recording
+    for (long i = 0; i < numRows; ++i) {
+        if (index[i] < 1 || index[i] > numFrames)
+            continue;
+        Row row;
+        row.index = long(index[i]);
+        row.frameCount = (unsigned long)frameCount[i];
+        row.time = (tsFreq > 0) ? double(timestamp[i]) / tsFreq
+                                : hostTime[i];
+        row.status = frameStatus[i];
+        m_rows.push_back(row);
+    }
+    std::sort(m_rows.begin(), m_rows.end());
+
+    // frame counts and times are relative to the first frame
+    if (!m_rows.empty()) {
+        Row first = m_rows.front();
+        for (size_t i = 0; i < m_rows.size(); ++i) {
+            m_rows[i].frameCount = m_rows[i].frameCount - first.frameCount + 1;
+            m_rows[i].time -= first.time;
+        }
+    }
+    m_hasFrameTable = true;
+    return true;
+}
+
+void ReplayCamera::unload()
+{
+    if (m_file) {
+        int status = 0;
+        fits_close_file(m_file, &status);
+        m_file = 0;
+    }
+    m_rows.clear();
+    m_hasFrameTable = false;
+}
+
+void ReplayCamera::setError(const std::string &msg, int code)
+{
+    std::stringstream ss;
+    ss << msg;
+
+    if (code != 0) {
+        char fitsioMsg[31];  // message has max 30 chars
+        fits_get_errstatus(code, fitsioMsg);
+        ss << " FITSIO: " << fitsioMsg << ".";
+    }
+
+    m_errorStr = ss.str();
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_REPLAYCAMERA_H
+#define PVREC_REPLAYCAMERA_H
+
+#include "simcamera.h"
+#include <fitsio.h>
+
+/*
+    Camera replaying a recorded FITS cube through the recording pipeline.
+
+    The frames are delivered at their recorded times, taken from the time
+    stamps of the FRAMEINFO table together with the gaps in the FrameCount
+    and the frame status. Files without a frame table are replayed at the
+    FrameRate attribute. Unpaced, frames are delivered as fast as buffers
+    are queued. The cube is repeated until the acquisition stops.
+
+    The sensor has the size of the recorded frames. A region of interest is
+    cut out of them, binning is not supported. 16 bit cubes can also be
+    replayed as Mono8 frames and 8 bit cubes as Mono16 frames.
+ */
+class ReplayCamera : public SimCamera
+{
+public:
+    ReplayCamera();
+    virtual ~ReplayCamera();
+
+    // opens the cube and reads its frame table
+    bool load(const std::string &fname);
+    void setPaced(bool paced);
+
+    int numFrames() const;
+    bool hasFrameTable() const;
+
+    std::string lastError() const;
+
+    virtual std::string apiVersionStr() const;
+    virtual CameraInfoVector availableCameras(int timeout) const;
+
+    virtual tPvErr attrUint32Set(const char *name, tPvUint32 value);
+    virtual tPvErr attrEnumSet(const char *name, const char *value);
+
+protected:
+    virtual void prepareAcquisition();
+    virtual void nextFrame(unsigned long &frameCount, double &t);
+    virtual void fillFrame(tPvFrame *frame, unsigned long frameCount,
+                           double t);
+
+private:
+    struct Row
+    {
+        long index;                 // frame in the cube
+        unsigned long frameCount;
+        double time;                // seconds since the first frame
+        int status;
+
+        bool operator<(const Row &other) const;
+    };
+
+    bool readFrameTable(long numFrames, int &maxValue);
+    bool readImage(tPvFrame *frame, long index);
+    void unload();
+    void setError(const std::string &msg, int code = 0);
+
+    fitsfile *m_file;
+    int m_bitpix;
+    int m_shift;                    // dropped bits of Mono8 frames
+    std::vector<Row> m_rows;
+    bool m_hasFrameTable;
+
+    // a pass through the cube, the next one starts after these
+    double m_cycleTime;
+    unsigned long m_cycleFrames;
+
+    size_t m_nextRow;
+    size_t m_currentRow;
+    unsigned long m_cycle;
+    std::vector<unsigned short> m_buffer;
+    std::string m_errorStr;
+};
+
+#endif // PVREC_REPLAYCAMERA_H
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ricecomp.h"
+
+namespace {
+
+// MSB first bit stream writer
+class BitWriter
+{
+public:
+    explicit BitWriter(unsigned char *dst)
+        : m_dst(dst), m_pos(0), m_bits(0), m_numBits(0) {}
+
+    // n <= 32
+    void put(unsigned int value, int n)
+    {
+        m_bits = (m_bits << n) | (value & (n < 32 ? (1u << n) - 1 : ~0u));
+        m_numBits += n;
+        while (m_numBits >= 8) {
+            m_numBits -= 8;
+            m_dst[m_pos++] = (unsigned char)(m_bits >> m_numBits);
+        }
+    }
+
+    void putZeros(unsigned int n)
+    {
+        for (; n > 32; n -= 32)
+            put(0, 32);
+        put(0, int(n));
+    }
+
+    // pads the last byte with zeros and returns the total size
+    size_t finish()
+    {
+        if (m_numBits > 0)
+            put(0, 8 - m_numBits);
+        return m_pos;
+    }
+
+private:
+    unsigned char *m_dst;
+    size_t m_pos;
+    unsigned long long m_bits;
+    int m_numBits;
+};
+
+/*
+    The first pixel is stored as is, followed by blocks of differences. Each
+    block starts with a code for the number of split bits fs: 0 means all
+    differences are zero, fsMax + 1 means they are stored uncompressed.
+    Otherwise each mapped difference is stored as (value >> fs) zeros, a one
+    bit and the lower fs bits.
+ */
+template <class T, int Bits, int FsBits, int FsMax>
+size_t riceCompress(const T *src, size_t n, T offset, unsigned char *dst)
+{
+    BitWriter out(dst);
+    if (n == 0)
+        return 0;
+
+    T lastPix = T(src[0] ^ offset);
+    out.put(lastPix, Bits);
+
+    unsigned int diff[RiceBlockSize];
+    for (size_t i = 0; i < n; i += RiceBlockSize)
+    {
+        size_t blockSize = (n - i < size_t(RiceBlockSize))
+                ? n - i : size_t(RiceBlockSize);
+
+        // differences are taken modulo 2^Bits, so the offset cancels out
+        // and signed values map to 0, 1, 2, ... by zigzag coding
+        double pixelSum = 0;
+        for (size_t j = 0; j < blockSize; ++j) {
+            T nextPix = T(src[i + j] ^ offset);
+            int d = (Bits == 8) ? int((signed char)(nextPix - lastPix))
+                                : int((short)(nextPix - lastPix));
+            unsigned int u = (unsigned int)d << 1;
+            diff[j] = (d < 0) ? ~u : u;
+            pixelSum += diff[j];
+            lastPix = nextPix;
+        }
+
+        // split bits from the mean difference
+        double dpSum = (pixelSum - double(blockSize / 2) - 1) / blockSize;
+        if (dpSum < 0)
+            dpSum = 0;
+        unsigned int pSum = (unsigned int)dpSum >> 1;
+        int fs = 0;
+        for (; pSum > 0; ++fs)
+            pSum >>= 1;
+
+        // fall back to uncompressed values if the code would be longer,
+        // which keeps the output within riceMaxCompressedSize()
+        if (fs < FsMax) {
+            size_t numBits = blockSize * (fs + 1);
+            for (size_t j = 0; j < blockSize; ++j)
+                numBits += diff[j] >> fs;
+            if (numBits >= blockSize * Bits)
+                fs = FsMax;
+        }
+
+        if (fs >= FsMax) {
+            out.put(FsMax + 1, FsBits);
+            for (size_t j = 0; j < blockSize; ++j)
+                out.put(diff[j], Bits);
+        }
+        else if (fs == 0 && pixelSum == 0) {
+            out.put(0, FsBits);
+        }
+        else {
+            out.put(fs + 1, FsBits);
+            for (size_t j = 0; j < blockSize; ++j) {
+                out.putZeros(diff[j] >> fs);
+                out.put(1, 1);
+                if (fs > 0)
+                    out.put(diff[j], fs);
+            }
+        }
+    }
+
+    return out.finish();
+}
+
+} // namespace
+
+size_t riceMaxCompressedSize(size_t n, int bytesPerPixel)
+{
+    // the worst case are uncompressed blocks: pixels, block codes, first
+    // pixel and the last partial byte
+    size_t numBlocks = (n + RiceBlockSize - 1) / RiceBlockSize;
+    return n * bytesPerPixel + numBlocks + 2 * bytesPerPixel + 1;
+}
+
+size_t riceCompress8(const unsigned char *src, size_t n, unsigned char *dst)
+{
+    return riceCompress<unsigned char, 8, 3, 6>(src, n, 0, dst);
+}
+
+size_t riceCompress16(const unsigned short *src, size_t n, bool unsignedPixels,
+                      unsigned char *dst)
+{
+    unsigned short offset = unsignedPixels ? 0x8000 : 0;
+    return riceCompress<unsigned short, 16, 4, 14>(src, n, offset, dst);
+}
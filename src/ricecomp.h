@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_RICECOMP_H
+#define PVREC_RICECOMP_H
+
+#include <cstddef>
+
+/*
+    Rice compression as used by the FITS tiled image convention (RICE_1),
+    producing the same bit stream format as the CFITSIO fits_rcomp_*()
+    functions. All functions are reentrant, so tiles can be compressed in
+    parallel.
+ */
+
+// pixels per Rice block, written to the header as BLOCKSIZE
+static const int RiceBlockSize = 32;
+
+// upper bound for the compressed size of n pixels with the given number of
+// bytes per pixel
+size_t riceMaxCompressedSize(size_t n, int bytesPerPixel);
+
+// compresses n 8 bit pixels, returns the number of bytes written to dst
+size_t riceCompress8(const unsigned char *src, size_t n, unsigned char *dst);
+
+// compresses n 16 bit pixels in host byte order, returns the number of bytes
+// written to dst; unsignedPixels selects the FITS representation with
+// BZERO = 32768 instead of plain signed values
+size_t riceCompress16(const unsigned short *src, size_t n, bool unsignedPixels,
+                      unsigned char *dst);
+
+#endif // PVREC_RICECOMP_H
@@ -0,0 +1,578 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "ricefitswriter.h"
+#include "ricecomp.h"
+
+#include <cassert>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+// additional header space reserved for keys written after open()
+static const size_t SpareHeaderBlocks = 3;
+
+// number of tile buffers per compression thread
+static const int TilesPerThread = 2;
+
+static const size_t BufferAlignment = 4096;
+
+// the primary HDU is empty, the image is stored in the first extension
+static const size_t PrimaryHeaderSize = FitsHeader::BlockSize;
+
+class RiceFitsWriter::Worker : public Thread
+{
+public:
+    explicit Worker(RiceFitsWriter *writer) : m_writer(writer) {}
+    virtual ~Worker() { join(); }
+
+protected:
+    virtual void run() { m_writer->compressTiles(); }
+
+private:
+    RiceFitsWriter *m_writer;
+};
+
+static void putBigEndian64(unsigned char *dst, unsigned long long value)
+{
+    for (int i = 7; i >= 0; --i, value >>= 8)
+        dst[i] = (unsigned char)(value & 0xff);
+}
+
+RiceFitsWriter::RiceFitsWriter(int numThreads)
+    : m_numThreads(numThreads),
+      m_pixelType(Uint8),
+      m_width(0),
+      m_height(0),
+      m_count(0),
+      m_capacity(0),
+      m_fd(-1),
+      m_heapSize(0),
+      m_maxTileSize(0),
+      m_emitting(false),
+      m_quit(false)
+{
+    if (m_numThreads <= 0) {
+        long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        m_numThreads = (numCpus > 0) ? int(numCpus) : 1;
+    }
+}
+
+RiceFitsWriter::~RiceFitsWriter()
+{
+    close();
+}
+
+bool RiceFitsWriter::open(const std::string &fname, PixelType pixelType,
+                          int width, int height, int count, bool clobber)
+{
+    clearError();
+
+    if (isOpen()) {
+        setError("File already opened.");
+        return false;
+    }
+
+    if (width <= 0 || height <= 0 || count <= 0) {
+        setError("Invalid width, height or count.");
+        return false;
+    }
+
+    if (pixelType == Int32) {
+        setError("Rice compression supports 8 and 16 bit pixels only.");
+        return false;
+    }
+
+    int flags = O_WRONLY | O_CREAT | (clobber ? O_TRUNC : O_EXCL);
+    m_fd = ::open(fname.c_str(), flags, 0666);
+    if (m_fd < 0) {
+        setSysError("Cannot create the file '" + fname + "'.", errno);
+        return false;
+    }
+
+    m_fname = fname;
+    m_pixelType = pixelType;
+    m_width = width;
+    m_height = height;
+    m_count = count;
+    m_capacity = count;
+    m_heapSize = 0;
+    Descriptor missing = { 0, 0 };
+    m_descriptors.assign(size_t(count), missing);
+
+    // the heap starts after the table rows of all initially requested
+    // frames, so that the table can shrink without moving the heap
+    typedef FitsHeader H;
+    int bitpix = (pixelType == Uint8) ? 8 : 16;
+    m_header.clear();
+    m_header.set("XTENSION", H::stringValue("BINTABLE"),
+                 "binary table extension");
+    m_header.set("BITPIX", H::intValue(8), "8-bit bytes");
+    m_header.set("NAXIS", H::intValue(2), "2-dimensional binary table");
+    m_header.set("NAXIS1", H::intValue(rowSize()), "width of table in bytes");
+    m_header.set("NAXIS2", H::intValue(count), "number of rows in table");
+    m_header.set("PCOUNT", H::intValue(0), "size of special data area");
+    m_header.set("GCOUNT", H::intValue(1), "one data group");
+    m_header.set("TFIELDS", H::intValue(1), "number of fields in each row");
+    m_header.set("TTYPE1", H::stringValue("COMPRESSED_DATA"),
+                 "label for field 1");
+    m_header.set("TFORM1", H::stringValue("1QB(0)"),
+                 "data format of field: variable length array");
+    m_header.set("THEAP", H::intValue(rowSize() * size_t(count)),
+                 "offset of the heap");
+    m_header.set("ZIMAGE", H::logicalValue(true),
+                 "extension contains compressed image");
+    m_header.set("ZBITPIX", H::intValue(bitpix),
+                 "data type of original image");
+    m_header.set("ZNAXIS", H::intValue(3), "dimension of original image");
+    m_header.set("ZNAXIS1", H::intValue(width), "length of original image axis");
+    m_header.set("ZNAXIS2", H::intValue(height),
+                 "length of original image axis");
+    m_header.set("ZNAXIS3", H::intValue(count),
+                 "length of original image axis");
+    m_header.set("ZTILE1", H::intValue(width), "size of tiles to be compressed");
+    m_header.set("ZTILE2", H::intValue(height),
+                 "size of tiles to be compressed");
+    m_header.set("ZTILE3", H::intValue(1), "size of tiles to be compressed");
+    m_header.set("ZCMPTYPE", H::stringValue("RICE_1"),
+                 "compression algorithm");
+    m_header.set("ZNAME1", H::stringValue("BLOCKSIZE"),
+                 "compression block size");
+    m_header.set("ZVAL1", H::intValue(RiceBlockSize), "pixels per block");
+    m_header.set("ZNAME2", H::stringValue("BYTEPIX"),
+                 "bytes per pixel (1, 2, 4, or 8)");
+    m_header.set("ZVAL2", H::intValue(bitpix / 8), "bytes per pixel");
+    m_header.set("EXTNAME", H::stringValue("COMPRESSED_IMAGE"),
+                 "name of this binary table extension");
+    if (pixelType == Uint16) {
+        m_header.set("BZERO", H::intValue(32768),
+                     "offset data range to that of unsigned short");
+        m_header.set("BSCALE", H::intValue(1), "default scaling factor");
+    }
+    m_header.setDate();
+    m_header.reserve(SpareHeaderBlocks);
+
+    // an empty primary HDU in front of the compressed image
+    FitsHeader primary;
+    primary.set("SIMPLE", H::logicalValue(true),
+                "file does conform to FITS standard");
+    primary.set("BITPIX", H::intValue(8), "number of bits per data pixel");
+    primary.set("NAXIS", H::intValue(0), "number of data axes");
+    primary.set("EXTEND", H::logicalValue(true),
+                "FITS dataset may contain extensions");
+    std::string primaryHeader = primary.toString();
+    assert(primaryHeader.size() == PrimaryHeaderSize);
+
+    if (!writeAll(reinterpret_cast<const unsigned char *>(
+                    primaryHeader.data()), primaryHeader.size(), 0) ||
+        !writeHeader())
+    {
+        setSysError("Cannot write header.", errno);
+        std::string msg = lastError();
+        close();
+        setError(msg);
+        return false;
+    }
+
+    if (!allocateTiles(TilesPerThread * m_numThreads)) {
+        close();
+        setError("Cannot allocate tile buffers.");
+        return false;
+    }
+
+    m_quit = false;
+    m_emitting = false;
+    m_writeError.clear();
+    for (int i = 0; i < m_numThreads; ++i) {
+        Worker *worker = new Worker(this);
+        m_workers.push_back(worker);
+        if (!worker->start()) {
+            close();
+            setError("Cannot start compression threads.");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void RiceFitsWriter::close()
+{
+    if (!isOpen())
+        return;
+
+    waitForTiles();
+
+    m_mutex.lock();
+    m_quit = true;
+    m_tileQueued.wakeAll();
+    m_mutex.unlock();
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        delete m_workers[i];
+    m_workers.clear();
+    freeTiles();
+
+    clearError();
+    if (!m_writeError.empty())
+        setError(m_writeError);
+
+    // write the tile table and the final header, then pad the data unit,
+    // the frame table follows the compressed image
+    FrameTable &table = frameTable();
+    if (writeTable() && writeHeader()) {
+        off_t dataSize = off_t(rowSize()) * m_capacity + m_heapSize;
+        off_t fileSize = tableOffset() + off_t(
+                FitsHeader::roundUpToBlock(size_t(dataSize)));
+        table.truncate(m_count);
+        if (!table.isEmpty() && !table.write(m_fd, fileSize, fileSize))
+            setSysError("Cannot write frame table.", errno);
+        if (ftruncate(m_fd, fileSize) != 0)
+            setSysError("Cannot resize the file '" + m_fname + "'.", errno);
+    }
+    ::close(m_fd);
+    table.clear();
+
+    m_fname.clear();
+    m_pixelType = Uint8;
+    m_width = 0;
+    m_height = 0;
+    m_count = 0;
+    m_capacity = 0;
+    m_fd = -1;
+    m_header.clear();
+    m_descriptors.clear();
+    m_heapSize = 0;
+}
+
+bool RiceFitsWriter::isOpen() const
+{
+    return m_fd >= 0;
+}
+
+bool RiceFitsWriter::writeFrame(long index, unsigned char *data)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write frame, file not open.");
+        return false;
+    }
+
+    if (index < 1 || index > m_count) {
+        setError("Frame index out of bounds.");
+        return false;
+    }
+
+    // wait for a free tile buffer, this throttles the caller if compression
+    // cannot keep up
+    m_mutex.lock();
+    while (m_freeTiles.empty() && m_writeError.empty())
+        m_tileWritten.wait(m_mutex);
+    if (!m_writeError.empty()) {
+        setError(m_writeError);
+        m_mutex.unlock();
+        return false;
+    }
+    Tile *tile = m_freeTiles.back();
+    m_freeTiles.pop_back();
+    m_mutex.unlock();
+
+    std::memcpy(tile->data, data, frameSize());
+    tile->index = index;
+    tile->compressedSize = 0;
+    tile->done = false;
+
+    m_mutex.lock();
+    m_queuedTiles.push_back(tile);
+    m_orderedTiles.push_back(tile);
+    m_tileQueued.wakeOne();
+    m_mutex.unlock();
+
+    return true;
+}
+
+bool RiceFitsWriter::writeKey(int datatype, const char *keyname, void *value,
+                              const char *comment)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write header entry, file not open.");
+        return false;
+    }
+
+    if (!m_header.setKey(datatype, keyname, value, comment)) {
+        setError("Cannot write header entry, unsupported datatype or "
+                 "header is full.");
+        return false;
+    }
+
+    return true;
+}
+
+bool RiceFitsWriter::resize(int count)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot resize image, file not open.");
+        return false;
+    }
+
+    if (count <= 0 || count > m_capacity) {
+        setError("Invalid count, compressed images cannot grow.");
+        return false;
+    }
+
+    // tiles of removed frames stay in the heap, but are not referenced
+    typedef FitsHeader H;
+    m_header.set("NAXIS2", H::intValue(count), "number of rows in table");
+    m_header.set("ZNAXIS3", H::intValue(count),
+                 "length of original image axis");
+    m_count = count;
+    return true;
+}
+
+int RiceFitsWriter::numThreads() const
+{
+    return m_numThreads;
+}
+
+void RiceFitsWriter::setSysError(const std::string &msg, int errnum) const
+{
+    setError(msg + " " + std::strerror(errnum) + ".");
+}
+
+bool RiceFitsWriter::allocateTiles(int numTiles)
+{
+    int bytesPerPixel = (m_pixelType == Uint8) ? 1 : 2;
+    m_maxTileSize = riceMaxCompressedSize(
+            size_t(m_width) * size_t(m_height), bytesPerPixel);
+
+    Tile empty = { 0, 0, 0, 0, false };
+    m_tiles.assign(size_t(numTiles), empty);
+    for (size_t i = 0; i < m_tiles.size(); ++i) {
+        Tile &tile = m_tiles[i];
+        if (posix_memalign(reinterpret_cast<void **>(&tile.data),
+                           BufferAlignment, frameSize()) != 0 ||
+            posix_memalign(reinterpret_cast<void **>(&tile.compressed),
+                           BufferAlignment, m_maxTileSize) != 0)
+            return false;
+        m_freeTiles.push_back(&tile);
+    }
+    return true;
+}
+
+void RiceFitsWriter::freeTiles()
+{
+    for (size_t i = 0; i < m_tiles.size(); ++i) {
+        std::free(m_tiles[i].data);
+        std::free(m_tiles[i].compressed);
+    }
+    m_tiles.clear();
+    m_freeTiles.clear();
+    m_queuedTiles.clear();
+    m_orderedTiles.clear();
+}
+
+// main loop of the worker threads
+void RiceFitsWriter::compressTiles()
+{
+    MutexLocker locker(m_mutex);
+    while (true)
+    {
+        while (!m_quit && m_queuedTiles.empty())
+            m_tileQueued.wait(m_mutex);
+        if (m_queuedTiles.empty())
+            break;
+
+        Tile *tile = m_queuedTiles.front();
+        m_queuedTiles.pop_front();
+        m_mutex.unlock();
+        compress(tile);
+        m_mutex.lock();
+        tile->done = true;
+
+        // only one thread writes, others just leave their tiles behind
+        if (!m_emitting) {
+            m_emitting = true;
+            emitTiles();
+            m_emitting = false;
+        }
+    }
+}
+
+void RiceFitsWriter::compress(Tile *tile) const
+{
+    size_t n = size_t(m_width) * size_t(m_height);
+    if (m_pixelType == Uint8)
+        tile->compressedSize = riceCompress8(tile->data, n, tile->compressed);
+    else
+        tile->compressedSize = riceCompress16(
+                reinterpret_cast<const unsigned short *>(tile->data), n,
+                m_pixelType == Uint16, tile->compressed);
+    assert(tile->compressedSize <= m_maxTileSize);
+}
+
+// writes all finished tiles in order, called with the mutex locked
+void RiceFitsWriter::emitTiles()
+{
+    while (!m_orderedTiles.empty() && m_orderedTiles.front()->done)
+    {
+        Tile *tile = m_orderedTiles.front();
+        m_orderedTiles.pop_front();
+
+        m_mutex.unlock();
+        Descriptor desc = { off_t(tile->compressedSize), m_heapSize };
+        bool ok = appendToHeap(tile->compressed, tile->compressedSize);
+        int errnum = errno;
+        m_mutex.lock();
+
+        if (ok)
+            m_descriptors[size_t(tile->index - 1)] = desc;
+        else if (m_writeError.empty())
+            m_writeError = std::string("Cannot write compressed frame. ") +
+                    std::strerror(errnum) + ".";
+        m_freeTiles.push_back(tile);
+        m_tileWritten.wakeAll();
+    }
+}
+
+bool RiceFitsWriter::appendToHeap(const unsigned char *data, size_t size)
+{
+    off_t offset = tableOffset() + off_t(rowSize()) * m_capacity + m_heapSize;
+    if (!writeAll(data, size, offset))
+        return false;
+    m_heapSize += off_t(size);
+    addBytesWritten(size);
+    return true;
+}
+
+void RiceFitsWriter::waitForTiles()
+{
+    MutexLocker locker(m_mutex);
+    while (!m_orderedTiles.empty())
+        m_tileWritten.wait(m_mutex);
+}
+
+bool RiceFitsWriter::writeTable()
+{
+    // frames which were never written become zero filled tiles, which all
+    // share the same heap entry
+    Descriptor zeroTile = { 0, 0 };
+    std::vector<unsigned char> table(rowSize() * size_t(m_count));
+    for (int i = 0; i < m_count; ++i)
+    {
+        Descriptor desc = m_descriptors[size_t(i)];
+        if (desc.size == 0) {
+            if (zeroTile.size == 0) {
+                std::vector<unsigned char> zeros(frameSize(), 0);
+                std::vector<unsigned char> compressed(m_maxTileSize);
+                Tile tile = { 0, &zeros[0], &compressed[0], 0, false };
+                compress(&tile);
+                zeroTile.offset = m_heapSize;
+                zeroTile.size = off_t(tile.compressedSize);
+                if (!appendToHeap(tile.compressed, tile.compressedSize)) {
+                    setSysError("Cannot write compressed frame.", errno);
+                    return false;
+                }
+            }
+            desc = zeroTile;
+        }
+        putBigEndian64(&table[rowSize() * i], (unsigned long long)desc.size);
+        putBigEndian64(&table[rowSize() * i + 8],
+                       (unsigned long long)desc.offset);
+    }
+
+    if (!table.empty() && !writeAll(&table[0], table.size(), tableOffset())) {
+        setSysError("Cannot write tile table.", errno);
+        return false;
+    }
+
+    // the maximum tile size is part of the column format
+    off_t maxSize = 0;
+    for (int i = 0; i < m_count; ++i)
+        maxSize = std::max(maxSize, m_descriptors[size_t(i)].size);
+    maxSize = std::max(maxSize, zeroTile.size);
+    std::ostringstream tform;
+    tform << "1QB(" << maxSize << ")";
+
+    typedef FitsHeader H;
+    off_t pcount = off_t(rowSize()) * (m_capacity - m_count) + m_heapSize;
+    m_header.set("PCOUNT", H::intValue(pcount), "size of special data area");
+    m_header.set("TFORM1", H::stringValue(tform.str().c_str()),
+                 "data format of field: variable length array");
+    return true;
+}
+
+bool RiceFitsWriter::writeHeader()
+{
+    std::string header = m_header.toString();
+    if (!writeAll(reinterpret_cast<const unsigned char *>(header.data()),
+                  header.size(), off_t(PrimaryHeaderSize)))
+    {
+        setSysError("Cannot write header.", errno);
+        return false;
+    }
+    return true;
+}
+
+bool RiceFitsWriter::writeAll(const unsigned char *data, size_t size,
+                              off_t offset)
+{
+    while (size > 0) {
+        ssize_t n = pwrite(m_fd, data, size, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= size_t(n);
+        offset += n;
+    }
+    return true;
+}
+
+size_t RiceFitsWriter::frameSize() const
+{
+    size_t bytesPerPixel = (m_pixelType == Uint8) ? 1 : 2;
+    return bytesPerPixel * size_t(m_width) * size_t(m_height);
+}
+
+// one 'Q' descriptor per row: 64 bit tile size and heap offset
+size_t RiceFitsWriter::rowSize() const
+{
+    return 16;
+}
+
+off_t RiceFitsWriter::tableOffset() const
+{
+    return off_t(PrimaryHeaderSize) + off_t(m_header.size());
+}
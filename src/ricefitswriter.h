@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RICEFITSWRITER_H
+#define RICEFITSWRITER_H
+
+#include "fitswriter.h"
+#include "fitsheader.h"
+#include "thread.h"
+#include <vector>
+#include <deque>
+#include <sys/types.h>
+
+/*
+    FitsWriter backend which writes a Rice compressed image using the FITS
+    tiled image convention, i.e. a binary table extension with one row per
+    frame. This can be read transparently by CFITSIO and converted into a
+    plain image by funpack.
+
+    Frames are copied into tile buffers and compressed in parallel by a pool
+    of threads. The compressed tiles are appended to the heap in the order
+    they were passed to writeFrame(), the tile descriptors and the header are
+    written on close().
+ */
+class RiceFitsWriter : public FitsWriter
+{
+public:
+    // numThreads = 0 uses one compression thread per CPU
+    explicit RiceFitsWriter(int numThreads = 0);
+    virtual ~RiceFitsWriter();
+
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber = false);
+    virtual void close();
+    virtual bool isOpen() const;
+
+    virtual bool writeFrame(long index, unsigned char *data);
+    virtual bool writeKey(int datatype, const char *keyname, void *value,
+                          const char *comment);
+
+    // the number of frames cannot grow beyond the count given to open()
+    virtual bool resize(int count);
+
+    int numThreads() const;
+
+protected:
+    struct Tile
+    {
+        long index;
+        unsigned char *data;
+        unsigned char *compressed;
+        size_t compressedSize;
+        bool done;
+    };
+
+    void setSysError(const std::string &msg, int errnum) const;
+    bool allocateTiles(int numTiles);
+    void freeTiles();
+    void compressTiles();
+    void compress(Tile *tile) const;
+    void emitTiles();
+    bool appendToHeap(const unsigned char *data, size_t size);
+    void waitForTiles();
+    bool writeTable();
+    bool writeHeader();
+    bool writeAll(const unsigned char *data, size_t size, off_t offset);
+
+    size_t frameSize() const;
+    size_t rowSize() const;
+    off_t tableOffset() const;
+
+private:
+    class Worker;
+    friend class Worker;
+
+    struct Descriptor
+    {
+        off_t size;
+        off_t offset;
+    };
+
+    int m_numThreads;
+    std::string m_fname;
+    PixelType m_pixelType;
+    int m_width;
+    int m_height;
+    int m_count;
+    int m_capacity;
+    int m_fd;
+    FitsHeader m_header;
+    std::vector<Descriptor> m_descriptors;
+    off_t m_heapSize;
+    size_t m_maxTileSize;
+
+    // shared with the worker threads
+    Mutex m_mutex;
+    WaitCondition m_tileQueued;
+    WaitCondition m_tileWritten;
+    std::vector<Worker *> m_workers;
+    std::vector<Tile> m_tiles;
+    std::vector<Tile *> m_freeTiles;
+    std::deque<Tile *> m_queuedTiles;
+    std::deque<Tile *> m_orderedTiles;
+    bool m_emitting;
+    bool m_quit;
+    std::string m_writeError;
+};
+
+#endif // RICEFITSWRITER_H
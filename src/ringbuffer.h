@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_RINGBUFFER_H
+#define PVREC_RINGBUFFER_H
+
+#include <cstddef>
+
+/*
+    Bounded lock-free queue for exactly one producer and one consumer thread.
+
+    push() must only be called by the producer, pop() only by the consumer.
+    The head and tail counters are kept on separate cache lines, so both
+    sides can run without bouncing the same line between cores.
+ */
+template <class T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t capacity);
+    ~RingBuffer();
+
+    size_t capacity() const { return m_capacity; }
+    size_t size() const;
+    bool isEmpty() const { return size() == 0; }
+    bool isFull() const { return size() >= m_capacity; }
+
+    bool push(const T &item);
+    bool pop(T &item);
+
+private:
+    RingBuffer(const RingBuffer &);
+    RingBuffer & operator=(const RingBuffer &);
+
+    enum { CacheLineSize = 64 };
+
+    T *m_items;
+    size_t m_capacity;
+    size_t m_mask;
+    char m_pad0[CacheLineSize];
+    size_t m_head;  // written by the producer
+    char m_pad1[CacheLineSize - sizeof(size_t)];
+    size_t m_tail;  // written by the consumer
+    char m_pad2[CacheLineSize - sizeof(size_t)];
+};
+
+template <class T>
+RingBuffer<T>::RingBuffer(size_t capacity)
+    : m_items(0),
+      m_capacity(capacity > 0 ? capacity : 1),
+      m_mask(0),
+      m_head(0),
+      m_tail(0)
+{
+    // the storage size is rounded up to a power of two, the counters are
+    // free running and only masked on access
+    size_t n = 1;
+    while (n < m_capacity)
+        n <<= 1;
+    m_items = new T[n];
+    m_mask = n - 1;
+}
+
+template <class T>
+RingBuffer<T>::~RingBuffer()
+{
+    delete [] m_items;
+}
+
+template <class T>
+size_t RingBuffer<T>::size() const
+{
+    size_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+    size_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+template <class T>
+bool RingBuffer<T>::push(const T &item)
+{
+    size_t head = m_head;
+    size_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= m_capacity)
+        return false;
+
+    m_items[head & m_mask] = item;
+    __atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+template <class T>
+bool RingBuffer<T>::pop(T &item)
+{
+    size_t tail = m_tail;
+    size_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return false;
+
+    item = m_items[tail & m_mask];
+    __atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#endif // PVREC_RINGBUFFER_H
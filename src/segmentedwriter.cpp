@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "segmentedwriter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+using std::cerr;
+using std::endl;
+
+static double monotonicTime()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return double(t.tv_sec) + 1e-9 * double(t.tv_nsec);
+}
+
+// size of a header value, given by its CFITSIO datatype
+static size_t keyValueSize(int datatype, void *value)
+{
+    switch (datatype)
+    {
+    case TSTRING: return std::strlen(static_cast<char *>(value)) + 1;
+    case TLOGICAL: return sizeof(int);
+    case TBYTE: return sizeof(unsigned char);
+    case TSHORT: return sizeof(short);
+    case TUSHORT: return sizeof(unsigned short);
+    case TINT: return sizeof(int);
+    case TUINT: return sizeof(unsigned int);
+    case TLONG: return sizeof(long);
+    case TULONG: return sizeof(unsigned long);
+    case TLONGLONG: return sizeof(LONGLONG);
+    case TFLOAT: return sizeof(float);
+    case TDOUBLE: return sizeof(double);
+    default: return 0;
+    }
+}
+
+/*
+    Creates upcoming segments and closes finished ones in the background.
+ */
+class SegmentThread : public Thread
+{
+public:
+    explicit SegmentThread(SegmentedWriter *owner)
+        : m_owner(owner),
+          m_requested(0),
+          m_prepared(0),
+          m_preparedSegment(0),
+          m_preparedKeys(0),
+          m_finish(false)
+    {
+    }
+
+    virtual ~SegmentThread()
+    {
+        finish();
+        join();
+    }
+
+    void prepare(int segment)
+    {
+        MutexLocker lock(m_mutex);
+        m_requested = segment;
+        m_cond.wakeAll();
+    }
+
+    // waits until the requested segment has been created
+    FitsWriter * takePrepared(int segment, size_t &numKeys,
+                              std::string &error)
+    {
+        MutexLocker lock(m_mutex);
+        while (m_preparedSegment != segment)
+            m_cond.wait(m_mutex);
+
+        FitsWriter *writer = m_prepared;
+        numKeys = m_preparedKeys;
+        error = m_prepareError;
+        m_prepared = 0;
+        m_preparedSegment = 0;
+        return writer;
+    }
+
+    void retire(FitsWriter *writer, int count)
+    {
+        MutexLocker lock(m_mutex);
+        m_closeJobs.push_back(CloseJob(writer, count));
+        m_cond.wakeAll();
+    }
+
+    void finish()
+    {
+        MutexLocker lock(m_mutex);
+        m_finish = true;
+        m_cond.wakeAll();
+    }
+
+    // a prepared segment which was never used, valid after join()
+    FitsWriter * takeUnused()
+    {
+        FitsWriter *writer = m_prepared;
+        m_prepared = 0;
+        m_preparedSegment = 0;
+        return writer;
+    }
+
+protected:
+    virtual void run()
+    {
+        MutexLocker lock(m_mutex);
+        while (true)
+        {
+            if (m_requested != 0) {
+                int segment = m_requested;
+                m_requested = 0;
+                m_mutex.unlock();
+                std::string error;
+                size_t numKeys = 0;
+                FitsWriter *writer = m_owner->createSegment(
+                        segment, numKeys, error);
+                m_mutex.lock();
+                m_prepared = writer;
+                m_preparedSegment = segment;
+                m_preparedKeys = numKeys;
+                m_prepareError = error;
+                m_cond.wakeAll();
+            }
+            else if (!m_closeJobs.empty()) {
+                CloseJob job = m_closeJobs.front();
+                m_closeJobs.pop_front();
+                m_mutex.unlock();
+                SegmentedWriter::closeSegment(job.first, job.second);
+                m_mutex.lock();
+            }
+            else if (m_finish)
+                break;
+            else
+                m_cond.wait(m_mutex);
+        }
+    }
+
+private:
+    typedef std::pair<FitsWriter *, int> CloseJob;
+
+    SegmentedWriter *m_owner;
+    Mutex m_mutex;
+    WaitCondition m_cond;
+    int m_requested;
+    FitsWriter *m_prepared;
+    int m_preparedSegment;
+    size_t m_preparedKeys;
+    std::string m_prepareError;
+    std::deque<CloseJob> m_closeJobs;
+    bool m_finish;
+};
+
+SegmentLimits::SegmentLimits()
+    : frames(0),
+      megabytes(0),
+      seconds(0),
+      frameRate(0)
+{
+}
+
+bool SegmentLimits::isEnabled() const
+{
+    return frames > 0 || megabytes > 0 || seconds > 0;
+}
+
+SegmentedWriter::SegmentedWriter(Backend backend, const SegmentLimits &limits)
+    : m_backend(backend),
+      m_limits(limits),
+      m_pixelType(Uint8),
+      m_width(0),
+      m_height(0),
+      m_count(0),
+      m_clobber(false),
+      m_capacity(0),
+      m_current(0),
+      m_segment(0),
+      m_firstIndex(1),
+      m_lastIndex(0),
+      m_startTime(-1),
+      m_thread(0)
+{
+}
+
+SegmentedWriter::~SegmentedWriter()
+{
+    close();
+}
+
+bool SegmentedWriter::open(const std::string &fname, PixelType pixelType,
+                           int width, int height, int count, bool clobber)
+{
+    clearError();
+
+    if (isOpen()) {
+        setError("File already opened.");
+        return false;
+    }
+
+    if (width <= 0 || height <= 0 || count < 0) {
+        setError("Invalid width, height or count.");
+        return false;
+    }
+
+    if (!m_limits.isEnabled()) {
+        setError("No segment limit given.");
+        return false;
+    }
+
+    // number of frames per segment file
+    double frameSize = double(bytesPerPixel(pixelType)) * width * height;
+    double capacity = INT_MAX;
+    if (m_limits.frames > 0)
+        capacity = std::min(capacity, double(m_limits.frames));
+    if (m_limits.megabytes > 0)
+        capacity = std::min(capacity,
+                            std::floor(1e6 * m_limits.megabytes / frameSize));
+    if (m_limits.seconds > 0 && m_limits.frames == 0 &&
+            m_limits.megabytes <= 0)
+    {
+        // leave some headroom, segments are rolled over by time anyway
+        if (m_limits.frameRate <= 0) {
+            setError("Time limited segments need a frame rate.");
+            return false;
+        }
+        capacity = std::min(capacity, std::ceil(
+                1.1 * m_limits.frameRate * m_limits.seconds) + 1);
+    }
+    if (count > 0)
+        capacity = std::min(capacity, double(count));
+
+    m_fname = fname;
+    m_pixelType = pixelType;
+    m_width = width;
+    m_height = height;
+    m_count = count;
+    m_clobber = clobber;
+    m_capacity = std::max(1, int(capacity));
+    m_segment = 1;
+    m_firstIndex = 1;
+    m_lastIndex = 0;
+    m_startTime = -1;
+
+    std::string error;
+    size_t numKeys;
+    m_current = createSegment(1, numKeys, error);
+    if (!m_current) {
+        setError(error);
+        m_fname.clear();
+        return false;
+    }
+
+    long frame0 = 1;
+    m_current->writeKey(TLONG, "FRAME0", &frame0,
+                        "index of the first frame of this segment");
+
+    m_thread = new SegmentThread(this);
+    if (!m_thread->start()) {
+        setError("Cannot start segment thread.");
+        delete m_thread;
+        m_thread = 0;
+        closeSegment(m_current, 1);
+        m_current = 0;
+        m_fname.clear();
+        return false;
+    }
+    m_thread->prepare(2);
+
+    return true;
+}
+
+void SegmentedWriter::close()
+{
+    if (!isOpen())
+        return;
+
+    if (m_current) {
+        addBytesWritten(m_current->bytesWritten());
+        long end = (m_count > 0) ? m_count : m_lastIndex;
+        closeSegment(m_current, int(std::max(1L, end - m_firstIndex + 1)));
+        m_current = 0;
+    }
+
+    m_thread->finish();
+    m_thread->join();
+
+    // remove the segment created in advance, if it was not needed
+    FitsWriter *unused = m_thread->takeUnused();
+    if (unused) {
+        unused->close();
+        delete unused;
+        std::remove(segmentFileName(m_fname, m_segment + 1).c_str());
+    }
+
+    delete m_thread;
+    m_thread = 0;
+
+    m_fname.clear();
+    m_keys.clear();
+}
+
+bool SegmentedWriter::isOpen() const
+{
+    return m_thread != 0;
+}
+
+bool SegmentedWriter::writeFrame(long index, unsigned char *data)
+{
+    clearError();
+
+    if (!m_current) {
+        setError("Cannot write frame, file not open.");
+        return false;
+    }
+
+    if (index < m_firstIndex || (m_count > 0 && index > m_count)) {
+        setError("Frame index out of bounds.");
+        return false;
+    }
+
+    // segment is full
+    while (index >= m_firstIndex + m_capacity)
+        if (!rollOver(m_firstIndex + m_capacity))
+            return false;
+
+    // segment duration is over
+    if (m_limits.seconds > 0 && index > m_firstIndex && m_startTime >= 0 &&
+            monotonicTime() - m_startTime >= m_limits.seconds)
+        if (!rollOver(index))
+            return false;
+
+    if (m_startTime < 0)
+        m_startTime = monotonicTime();
+    if (index > m_lastIndex)
+        m_lastIndex = index;
+
+    if (!m_current->writeFrame(index - m_firstIndex + 1, data)) {
+        setError(m_current->lastError());
+        return false;
+    }
+
+    return true;
+}
+
+// frame infos go to the segment of the last written frame
+bool SegmentedWriter::writeFrameInfo(long index, const FrameInfo &info)
+{
+    clearError();
+
+    if (!m_current) {
+        setError("Cannot write frame info, file not open.");
+        return false;
+    }
+
+    if (index < m_firstIndex || index >= m_firstIndex + m_capacity) {
+        setError("Frame index out of bounds.");
+        return false;
+    }
+
+    if (!m_current->writeFrameInfo(index - m_firstIndex + 1, info)) {
+        setError(m_current->lastError());
+        return false;
+    }
+
+    return true;
+}
+
+unsigned long long SegmentedWriter::bytesWritten() const
+{
+    return FitsWriter::bytesWritten() +
+            (m_current ? m_current->bytesWritten() : 0);
+}
+
+bool SegmentedWriter::writeKey(int datatype, const char *keyname,
+                               void *value, const char *comment)
+{
+    clearError();
+
+    size_t size = keyValueSize(datatype, value);
+    if (size == 0) {
+        setError("Cannot write header entry, unsupported datatype.");
+        return false;
+    }
+
+    // remember the key for all following segments
+    Key key;
+    key.datatype = datatype;
+    key.keyname = keyname;
+    key.comment = comment ? comment : "";
+    key.value.assign(static_cast<char *>(value),
+                     static_cast<char *>(value) + size);
+    {
+        MutexLocker lock(m_keyMutex);
+        m_keys.push_back(key);
+    }
+
+    if (m_current &&
+            !m_current->writeKey(datatype, keyname, value, comment)) {
+        setError(m_current->lastError());
+        return false;
+    }
+
+    return true;
+}
+
+bool SegmentedWriter::resize(int count)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot resize image, file not open.");
+        return false;
+    }
+
+    if (count < m_firstIndex) {
+        setError("Invalid count.");
+        return false;
+    }
+
+    // applied to the last segment on close()
+    m_count = count;
+    return true;
+}
+
+int SegmentedWriter::numSegments() const
+{
+    return m_segment;
+}
+
+std::string SegmentedWriter::segmentFileName(const std::string &fname,
+                                             int segment)
+{
+    std::string::size_type slash = fname.rfind('/');
+    std::string::size_type dot = fname.rfind('.');
+    if (dot == std::string::npos ||
+            (slash != std::string::npos && dot < slash))
+        dot = fname.size();
+
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%04d", segment);
+    return fname.substr(0, dot) + number + fname.substr(dot);
+}
+
+FitsWriter * SegmentedWriter::createSegment(int segment, size_t &numKeys,
+                                            std::string &error)
+{
+    FitsWriter *writer = FitsWriter::create(m_backend);
+    if (!writer->open(segmentFileName(m_fname, segment), m_pixelType,
+                      m_width, m_height, m_capacity, m_clobber))
+    {
+        error = writer->lastError();
+        delete writer;
+        return 0;
+    }
+
+    writer->writeKey(TINT, "SEGMENT", &segment, "segment number");
+    numKeys = applyKeys(writer, 0);
+    return writer;
+}
+
+size_t SegmentedWriter::applyKeys(FitsWriter *writer, size_t first)
+{
+    MutexLocker lock(m_keyMutex);
+    for (size_t i = first; i < m_keys.size(); ++i) {
+        Key &key = m_keys[i];
+        writer->writeKey(key.datatype, key.keyname.c_str(), &key.value[0],
+                         key.comment.c_str());
+    }
+    return m_keys.size();
+}
+
+bool SegmentedWriter::rollOver(long firstIndex)
+{
+    addBytesWritten(m_current->bytesWritten());
+    m_thread->retire(m_current, int(firstIndex - m_firstIndex));
+    m_current = 0;
+
+    std::string error;
+    size_t numKeys;
+    FitsWriter *writer = m_thread->takePrepared(m_segment + 1, numKeys,
+                                                error);
+    if (!writer) {
+        setError(error);
+        return false;
+    }
+
+    // keys written while the segment was created in the background
+    applyKeys(writer, numKeys);
+
+    m_current = writer;
+    m_segment++;
+    m_firstIndex = firstIndex;
+    m_lastIndex = firstIndex - 1;
+    m_startTime = -1;
+
+    long frame0 = firstIndex;
+    m_current->writeKey(TLONG, "FRAME0", &frame0,
+                        "index of the first frame of this segment");
+
+    m_thread->prepare(m_segment + 1);
+    return true;
+}
+
+void SegmentedWriter::closeSegment(FitsWriter *writer, int count)
+{
+    if (!writer->resize(count))
+        cerr << endl << writer->lastError() << endl;
+    writer->close();
+    delete writer;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_SEGMENTEDWRITER_H
+#define PVREC_SEGMENTEDWRITER_H
+
+#include "fitswriter.h"
+#include "thread.h"
+#include <vector>
+#include <deque>
+
+struct SegmentLimits
+{
+    SegmentLimits();
+    bool isEnabled() const;
+
+    unsigned long frames;   // frames per segment
+    double megabytes;       // data size per segment in MB
+    double seconds;         // duration of a segment
+    double frameRate;       // expected frame rate, used to size segments
+                            // that are only limited by time
+};
+
+class SegmentThread;
+
+/*
+    Writes a recording into a sequence of FITS files (name_0001.fits,
+    name_0002.fits, ...), which are rolled over when one of the segment
+    limits is reached.
+
+    Frame indices passed to writeFrame() are global, each segment stores its
+    first index in the FRAME0 key. The next segment is created ahead of time
+    and finished segments are closed by a background thread, so a rollover
+    only swaps two pointers. Header keys are written to the current and all
+    following segments.
+
+    A count of 0 in open() records an unbounded number of frames.
+ */
+class SegmentedWriter : public FitsWriter
+{
+public:
+    SegmentedWriter(Backend backend, const SegmentLimits &limits);
+    virtual ~SegmentedWriter();
+
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber = false);
+    virtual void close();
+    virtual bool isOpen() const;
+
+    virtual bool writeFrame(long index, unsigned char *data);
+    virtual bool writeKey(int datatype, const char *keyname, void *value,
+                          const char *comment);
+    virtual bool resize(int count);
+    virtual bool writeFrameInfo(long index, const FrameInfo &info);
+    // the closed segments and the current one
+    virtual unsigned long long bytesWritten() const;
+
+    int numSegments() const;
+
+    static std::string segmentFileName(const std::string &fname, int segment);
+
+protected:
+    struct Key {
+        int datatype;
+        std::string keyname;
+        std::string comment;
+        std::vector<char> value;
+    };
+
+    FitsWriter * createSegment(int segment, size_t &numKeys,
+                               std::string &error);
+    size_t applyKeys(FitsWriter *writer, size_t first);
+    bool rollOver(long firstIndex);
+    static void closeSegment(FitsWriter *writer, int count);
+
+private:
+    friend class SegmentThread;
+
+    Backend m_backend;
+    SegmentLimits m_limits;
+    std::string m_fname;
+    PixelType m_pixelType;
+    int m_width;
+    int m_height;
+    int m_count;
+    bool m_clobber;
+    int m_capacity;
+
+    FitsWriter *m_current;
+    int m_segment;
+    long m_firstIndex;
+    long m_lastIndex;
+    double m_startTime;
+
+    Mutex m_keyMutex;
+    std::vector<Key> m_keys;
+    SegmentThread *m_thread;
+};
+
+#endif // PVREC_SEGMENTEDWRITER_H
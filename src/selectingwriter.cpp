@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "selectingwriter.h"
+#include "pixelconv.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+static const size_t BufferAlignment = 4096;
+
+namespace {
+
+struct SharperFirst
+{
+    template <class T> bool operator()(const T &a, const T &b) const
+    {
+        return a.score > b.score || (a.score == b.score && a.index < b.index);
+    }
+};
+
+struct IndexOrder
+{
+    template <class T> bool operator()(const T &a, const T &b) const
+    {
+        return a.index < b.index;
+    }
+};
+
+} // namespace
+
+SelectingWriter::SelectingWriter(FitsWriter *writer, int windowSize,
+                                 double keepPercent)
+    : m_writer(writer),
+      m_windowSize(windowSize > 0 ? windowSize : 1),
+      m_keepPercent(std::min(std::max(keepPercent, 0.0), 100.0)),
+      m_pixelType(Uint8),
+      m_width(0),
+      m_height(0),
+      m_frameSize(0),
+      m_count(0),
+      m_window(0),
+      m_written(0),
+      m_numSelected(0),
+      m_outputCount(0),
+      m_numKept(0),
+      m_hasCandidate(false),
+      m_buffer(0)
+{
+    m_candidate.data = 0;
+}
+
+SelectingWriter::~SelectingWriter()
+{
+    close();
+    delete m_writer;
+}
+
+bool SelectingWriter::open(const std::string &fname, PixelType pixelType,
+                           int width, int height, int count, bool clobber)
+{
+    clearError();
+
+    if (isOpen()) {
+        setError("File already opened.");
+        return false;
+    }
+
+    if (pixelType != Uint8 && pixelType != Uint16) {
+        setError("Frames can only be selected from 8 and 16 bit unsigned "
+                 "pixels.");
+        return false;
+    }
+
+    if (width <= 0 || height <= 0 || count < 0) {
+        setError("Invalid width, height or count.");
+        return false;
+    }
+
+    // buffers for the frames kept of a window and the candidate
+    size_t numSlots = size_t(keepCount(m_windowSize));
+    m_frameSize = size_t(width) * size_t(height) * bytesPerPixel(pixelType);
+    if (posix_memalign(reinterpret_cast<void **>(&m_buffer), BufferAlignment,
+                       (numSlots + 1) * m_frameSize) != 0) {
+        m_buffer = 0;
+        setError("Cannot allocate the frame selection buffers.");
+        return false;
+    }
+    m_slots.resize(numSlots);
+    for (size_t i = 0; i < numSlots; ++i)
+        m_slots[i].data = m_buffer + i * m_frameSize;
+    m_candidate.data = m_buffer + numSlots * m_frameSize;
+    m_hasCandidate = false;
+
+    // an unbounded count stays unbounded
+    if (!m_writer->open(fname, pixelType, width, height,
+                        selectedCount(count), clobber)) {
+        setError(m_writer->lastError());
+        std::free(m_buffer);
+        m_buffer = 0;
+        m_slots.clear();
+        m_candidate.data = 0;
+        return false;
+    }
+
+    m_pixelType = pixelType;
+    m_width = width;
+    m_height = height;
+    m_count = count;
+    m_window = 0;
+    m_written = 0;
+    m_numSelected = 0;
+    m_outputCount = selectedCount(count);
+    m_numKept = 0;
+
+    int window = m_windowSize;
+    if (!m_writer->writeKey(TINT, "LUCKYWIN", &window,
+                            "frames per selection window") ||
+        !m_writer->writeKey(TDOUBLE, "LUCKYPCT", &m_keepPercent,
+                            "percentage of the frames kept per window")) {
+        setError(m_writer->lastError());
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SelectingWriter::close()
+{
+    if (!isOpen())
+        return;
+
+    clearError();
+    bool ok = writeWindow();
+    if (ok && m_numSelected > 0 && m_numSelected < m_outputCount)
+        ok = resizeOutput(m_numSelected);
+    std::string msg = lastError();
+    m_writer->close();
+    if (!ok)
+        setError(msg);
+    else if (!m_writer->lastError().empty())
+        setError(m_writer->lastError());
+
+    std::free(m_buffer);
+    m_buffer = 0;
+    m_slots.clear();
+    m_candidate.data = 0;
+    m_hasCandidate = false;
+    m_pixelType = Uint8;
+    m_width = 0;
+    m_height = 0;
+    m_frameSize = 0;
+    m_count = 0;
+    m_window = 0;
+    m_written = 0;
+    m_numSelected = 0;
+    m_outputCount = 0;
+    m_numKept = 0;
+}
+
+bool SelectingWriter::isOpen() const
+{
+    return m_writer->isOpen();
+}
+
+bool SelectingWriter::writeFrame(long index, unsigned char *data)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write frame, file not open.");
+        return false;
+    }
+
+    if (index < 1 || (m_count > 0 && index > m_count)) {
+        setError("Frame index out of bounds.");
+        return false;
+    }
+
+    long window = (index - 1) / m_windowSize + 1;
+    if (window < m_window || window <= m_written) {
+        setError("Frame of an already written selection window.");
+        return false;
+    }
+
+    // a frame without a row is ranked by its pixels
+    keepCandidate();
+    if (window != m_window) {
+        if (!writeWindow())
+            return false;
+        m_window = window;
+    }
+
+    m_candidate.index = index;
+    m_candidate.hasInfo = false;
+    std::memcpy(m_candidate.data, data, m_frameSize);
+    m_hasCandidate = true;
+    return true;
+}
+
+bool SelectingWriter::writeKey(int datatype, const char *keyname, void *value,
+                               const char *comment)
+{
+    clearError();
+    if (!m_writer->writeKey(datatype, keyname, value, comment)) {
+        setError(m_writer->lastError());
+        return false;
+    }
+    return true;
+}
+
+bool SelectingWriter::resize(int count)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot resize image, file not open.");
+        return false;
+    }
+
+    // the window at the end is complete now
+    m_count = count;
+    if (!writeWindow())
+        return false;
+
+    // room for the frames kept so far and those of the windows to come,
+    // the writers need at least one frame
+    long done = std::min(long(count), m_written * m_windowSize);
+    int numFrames = m_numSelected + selectedCount(count) -
+            selectedCount(int(done));
+    return resizeOutput(std::max(numFrames, 1));
+}
+
+// rows of frames that were not kept are dropped
+bool SelectingWriter::writeFrameInfo(long index, const FrameInfo &info)
+{
+    clearError();
+    if (m_hasCandidate && m_candidate.index == index) {
+        m_candidate.info = info;
+        m_candidate.hasInfo = true;
+        keepCandidate();
+        return true;
+    }
+    for (size_t i = 0; i < m_numKept; ++i)
+        if (m_slots[i].index == index) {
+            m_slots[i].info = info;
+            m_slots[i].hasInfo = true;
+            break;
+        }
+    return true;
+}
+
+unsigned long long SelectingWriter::bytesWritten() const
+{
+    return m_writer->bytesWritten();
+}
+
+int SelectingWriter::windowSize() const
+{
+    return m_windowSize;
+}
+
+double SelectingWriter::keepPercent() const
+{
+    return m_keepPercent;
+}
+
+int SelectingWriter::selectedCount(int count) const
+{
+    return (count / m_windowSize) * keepCount(m_windowSize) +
+            keepCount(count % m_windowSize);
+}
+
+int SelectingWriter::keepCount(int numFrames) const
+{
+    if (numFrames <= 0)
+        return 0;
+    // the tolerance keeps e.g. 10% of 100 frames at 10
+    int n = int(std::ceil(numFrames * m_keepPercent / 100 - 1e-9));
+    return std::min(std::max(n, 1), numFrames);
+}
+
+// number of indices in the window, the last one may be shorter
+int SelectingWriter::windowFrames(long window) const
+{
+    if (m_count <= 0)
+        return m_windowSize;
+    long first = (window - 1) * m_windowSize + 1;
+    return int(std::min(long(m_windowSize), m_count - first + 1));
+}
+
+double SelectingWriter::score(const unsigned char *data) const
+{
+    PixelStats s;
+    if (m_pixelType == Uint16)
+        pixelStatsUint16(reinterpret_cast<const unsigned short *>(data),
+                         m_width, m_height, ~0u, s);
+    else
+        pixelStatsUint8(data, m_width, m_height, ~0u, s);
+
+    double n = double(m_width) * m_height;
+    double numDiffs = 2 * n - m_width - m_height;
+    double mean = s.sum / n;
+    if (mean <= 0 || numDiffs <= 0)
+        return 0;
+    return s.gradient / numDiffs / (mean * mean);
+}
+
+// the writer thread already has the statistics of the frame in its row
+double SelectingWriter::score(const FrameInfo &info) const
+{
+    if (info.mean <= 0)
+        return 0;
+    return info.sharpness / (info.mean * info.mean);
+}
+
+// the candidate replaces the worst frame kept if it is sharper
+void SelectingWriter::keepCandidate()
+{
+    if (!m_hasCandidate)
+        return;
+    m_hasCandidate = false;
+
+    double s = m_candidate.hasInfo ? score(m_candidate.info)
+                                   : score(m_candidate.data);
+    size_t capacity = std::min(m_slots.size(),
+                               size_t(keepCount(windowFrames(m_window))));
+    size_t slot = m_numKept;
+    if (m_numKept < capacity)
+        ++m_numKept;
+    else {
+        slot = 0;
+        for (size_t i = 1; i < m_numKept; ++i)
+            if (m_slots[i].score < m_slots[slot].score)
+                slot = i;
+        if (m_numKept == 0 || s <= m_slots[slot].score)
+            return;
+    }
+
+    // the buffers are swapped, not copied
+    m_candidate.score = s;
+    std::swap(m_slots[slot], m_candidate);
+}
+
+bool SelectingWriter::writeWindow()
+{
+    keepCandidate();
+    if (m_window == 0)
+        return true;
+
+    long window = m_window;
+    size_t n = std::min(m_numKept, size_t(keepCount(windowFrames(window))));
+    m_window = 0;
+    m_written = window;
+
+    // the best frames in their original order, a window shortened by a
+    // resize may hold more than it keeps
+    std::sort(m_slots.begin(), m_slots.begin() + m_numKept, SharperFirst());
+    std::sort(m_slots.begin(), m_slots.begin() + n, IndexOrder());
+    m_numKept = 0;
+
+    // a window with fewer frames than it keeps leaves no gap in the image
+    for (size_t i = 0; i < n; ++i) {
+        const Slot &slot = m_slots[i];
+        long index = m_numSelected + 1;
+        if (!m_writer->writeFrame(index, slot.data)) {
+            setError(m_writer->lastError());
+            return false;
+        }
+        m_numSelected++;
+        if (slot.hasInfo)
+            m_writer->writeFrameInfo(index, slot.info);
+    }
+    return true;
+}
+
+bool SelectingWriter::resizeOutput(int count)
+{
+    if (!m_writer->resize(count)) {
+        setError(m_writer->lastError());
+        return false;
+    }
+    m_outputCount = count;
+    return true;
+}
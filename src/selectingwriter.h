@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_SELECTINGWRITER_H
+#define PVREC_SELECTINGWRITER_H
+
+#include "fitswriter.h"
+#include <vector>
+
+/*
+    Lucky imaging: passes only the sharpest frames on to the wrapped writer.
+
+    The frames are split into windows of windowSize consecutive indices, of
+    which the best keepPercent percent, at least one frame, are kept and
+    written in their original order. The score of a frame is its mean
+    squared gradient relative to the squared mean pixel value, so that it
+    does not depend on the brightness. It is taken from the SHARPNES and
+    MEAN values of the frame table row passed to writeFrameInfo(), so a
+    frame is only ranked when its row arrives, or when the next frame
+    arrives without one. Under a CalibratingWriter the row describes the
+    uncalibrated frame. Only the frames kept so far are held in memory.
+
+    Frames must arrive in ascending order and a window is written when the
+    first frame of a later window arrives, or when the writer is resized or
+    closed. The frame table only has rows of the kept frames, the original
+    index of each is in its RECINDEX column. The kept frames follow each
+    other without gaps, also when a window has fewer frames than it would
+    keep, e.g. after dropped frames; the image is shrunk to the frames kept
+    when the writer is resized or closed.
+ */
+class SelectingWriter : public FitsWriter
+{
+public:
+    // takes ownership of the writer
+    SelectingWriter(FitsWriter *writer, int windowSize, double keepPercent);
+    virtual ~SelectingWriter();
+
+    // width, height and count refer to the incoming frames
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber = false);
+    virtual void close();
+    virtual bool isOpen() const;
+
+    virtual bool writeFrame(long index, unsigned char *data);
+    virtual bool writeKey(int datatype, const char *keyname, void *value,
+                          const char *comment);
+    virtual bool resize(int count);
+    virtual bool writeFrameInfo(long index, const FrameInfo &info);
+    virtual unsigned long long bytesWritten() const;
+
+    int windowSize() const;
+    double keepPercent() const;
+
+    // number of frames kept out of count incoming frames
+    int selectedCount(int count) const;
+
+protected:
+    struct Slot
+    {
+        long index;
+        double score;
+        bool hasInfo;
+        FrameInfo info;
+        unsigned char *data;
+    };
+
+    int keepCount(int numFrames) const;
+    int windowFrames(long window) const;
+    double score(const unsigned char *data) const;
+    double score(const FrameInfo &info) const;
+    void keepCandidate();
+    bool writeWindow();
+    bool resizeOutput(int count);
+
+private:
+    FitsWriter *m_writer;
+    int m_windowSize;
+    double m_keepPercent;
+    PixelType m_pixelType;
+    int m_width;
+    int m_height;
+    size_t m_frameSize;
+    int m_count;
+    long m_window;      // window being selected, 0 if none
+    long m_written;     // last window written
+    int m_numSelected;  // frames passed on to the wrapped writer
+    int m_outputCount;  // size of the wrapped writer's image
+    std::vector<Slot> m_slots;
+    size_t m_numKept;
+    Slot m_candidate;   // last frame, waiting for its row to be ranked
+    bool m_hasCandidate;
+    unsigned char *m_buffer;
+};
+
+#endif // PVREC_SELECTINGWRITER_H
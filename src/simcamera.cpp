@@ -0,0 +1,668 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "simcamera.h"
+#include "pvutils.h"
+
+#include <algorithm>
+#include <ctime>
+#include <cstdlib>
+#include <cstring>
+
+static double monotonicTime()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return double(t.tv_sec) + 1e-9 * double(t.tv_nsec);
+}
+
+static const unsigned long DefaultSimUniqueId = 1;
+static const tPvUint32 SimTimeStampFrequency = 1000000;
+static const tPvUint32 SimMaxBinning = 8;
+
+// poll interval for a queued buffer without pacing in microseconds
+static const unsigned int BufferPollInterval = 100;
+
+SimCamera::SimCamera(int width, int height, int bits)
+    : m_paced(true),
+      m_width(width),
+      m_height(height),
+      m_bits(bits),
+      m_missingDataRate(0),
+      m_dropRate(0),
+      m_jitter(0),
+      m_uniqueId(DefaultSimUniqueId),
+      m_open(false),
+      m_capturing(false),
+      m_acquiring(false),
+      m_seed(1),
+      m_period(0)
+{
+    resetAttributes();
+}
+
+SimCamera::~SimCamera()
+{
+    close();
+}
+
+void SimCamera::setMissingDataRate(double rate)
+{
+    m_missingDataRate = rate;
+}
+
+void SimCamera::setDropRate(double rate)
+{
+    m_dropRate = rate;
+}
+
+void SimCamera::setJitter(double jitter)
+{
+    m_jitter = jitter;
+}
+
+void SimCamera::setUniqueId(unsigned long uniqueId)
+{
+    m_uniqueId = uniqueId;
+    m_seed = (unsigned int)uniqueId;
+}
+
+void SimCamera::setSensor(int width, int height, int bits)
+{
+    MutexLocker lock(m_mutex);
+    m_width = width;
+    m_height = height;
+    m_bits = bits;
+    resetAttributes();
+}
+
+std::string SimCamera::apiVersionStr() const
+{
+    return "simulated";
+}
+
+SimCamera::CameraInfoVector SimCamera::availableCameras(int /*timeout*/) const
+{
+    tPvCameraInfoEx info;
+    std::memset(&info, 0, sizeof(info));
+    info.UniqueId = m_uniqueId;
+    std::strncpy(info.CameraName, "Simulated Camera",
+                 sizeof(info.CameraName) - 1);
+    std::strncpy(info.ModelName, "SimCamera", sizeof(info.ModelName) - 1);
+    std::strncpy(info.SerialNumber, "0", sizeof(info.SerialNumber) - 1);
+    std::strncpy(info.FirmwareVersion, "0.0",
+                 sizeof(info.FirmwareVersion) - 1);
+    info.PermittedAccess = m_open ? ePvAccessMonitor
+                                  : (ePvAccessMaster | ePvAccessMonitor);
+    info.InterfaceType = ePvInterfaceEthernet;
+
+    return CameraInfoVector(1, info);
+}
+
+tPvErr SimCamera::open(unsigned long uniqueId)
+{
+    if (uniqueId != m_uniqueId)
+        return ePvErrNotFound;
+    if (m_open)
+        return ePvErrAccessDenied;
+
+    resetAttributes();
+    m_open = true;
+    return ePvErrSuccess;
+}
+
+void SimCamera::close()
+{
+    if (m_capturing)
+        captureEnd();
+    m_open = false;
+}
+
+bool SimCamera::isOpen() const
+{
+    return m_open;
+}
+
+tPvErr SimCamera::attrUint32Get(const char *name, tPvUint32 *value) const
+{
+    MutexLocker lock(m_mutex);
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    std::map<std::string, tPvUint32>::const_iterator it =
+            m_uint32Attrs.find(name);
+    if (it == m_uint32Attrs.end())
+        return ePvErrNotFound;
+
+    *value = it->second;
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::attrUint32Set(const char *name, tPvUint32 value)
+{
+    MutexLocker lock(m_mutex);
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    std::map<std::string, tPvUint32>::iterator it = m_uint32Attrs.find(name);
+    if (it == m_uint32Attrs.end())
+        return ePvErrNotFound;
+    if (std::strncmp(name, "Sensor", 6) == 0)
+        return ePvErrForbidden;
+
+    std::string attr(name);
+    bool binning = (attr == "BinningX" || attr == "BinningY");
+    if (binning || attr == "RegionX" || attr == "RegionY" ||
+            attr == "Width" || attr == "Height") {
+        if (m_acquiring)
+            return ePvErrForbidden;
+        tPvUint32 oldValue = it->second;
+        it->second = value;
+        if (!fitRegion(binning)) {
+            it->second = oldValue;
+            return ePvErrOutOfRange;
+        }
+        return ePvErrSuccess;
+    }
+
+    it->second = value;
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::attrFloat32Get(const char *name, tPvFloat32 *value) const
+{
+    MutexLocker lock(m_mutex);
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    std::map<std::string, tPvFloat32>::const_iterator it =
+            m_float32Attrs.find(name);
+    if (it == m_float32Attrs.end())
+        return ePvErrNotFound;
+
+    *value = it->second;
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::attrFloat32Set(const char *name, tPvFloat32 value)
+{
+    MutexLocker lock(m_mutex);
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    std::map<std::string, tPvFloat32>::iterator it =
+            m_float32Attrs.find(name);
+    if (it == m_float32Attrs.end())
+        return ePvErrNotFound;
+    if (value <= 0)
+        return ePvErrOutOfRange;
+
+    it->second = value;
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::attrEnumGet(const char *name, char *buffer,
+                              unsigned long bufferSize) const
+{
+    MutexLocker lock(m_mutex);
+    return getString(m_enumAttrs, name, buffer, bufferSize);
+}
+
+tPvErr SimCamera::attrEnumSet(const char *name, const char *value)
+{
+    MutexLocker lock(m_mutex);
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    std::map<std::string, std::string>::iterator it = m_enumAttrs.find(name);
+    if (it == m_enumAttrs.end())
+        return ePvErrNotFound;
+    if (it->first == "SensorType")
+        return ePvErrForbidden;
+    if (it->first == "PixelFormat") {
+        std::string format(value);
+        if (format != "Mono8" && format != "Mono16" &&
+                format != "Mono12Packed")
+            return ePvErrOutOfRange;
+        if (m_acquiring)
+            return ePvErrForbidden;
+    }
+
+    it->second = value;
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::attrStringGet(const char *name, char *buffer,
+                                unsigned long bufferSize) const
+{
+    MutexLocker lock(m_mutex);
+    return getString(m_stringAttrs, name, buffer, bufferSize);
+}
+
+tPvErr SimCamera::getString(const std::map<std::string, std::string> &attrs,
+                            const char *name, char *buffer,
+                            unsigned long bufferSize) const
+{
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    std::map<std::string, std::string>::const_iterator it = attrs.find(name);
+    if (it == attrs.end())
+        return ePvErrNotFound;
+    if (it->second.size() + 1 > bufferSize)
+        return ePvErrBadParameter;
+
+    std::strcpy(buffer, it->second.c_str());
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::commandRun(const char *name)
+{
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    std::string command(name);
+    if (command == "ConfigFileLoad") {
+        if (m_acquiring)
+            return ePvErrForbidden;
+        MutexLocker lock(m_mutex);
+        resetAttributes();
+    }
+    else if (command == "AcquisitionStart")
+        startAcquisition();
+    else if (command == "AcquisitionStop")
+        stopAcquisition();
+    else
+        return ePvErrNotFound;
+
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::captureStart()
+{
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    MutexLocker lock(m_mutex);
+    m_capturing = true;
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::captureEnd()
+{
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    stopAcquisition();
+    captureQueueClear();
+
+    MutexLocker lock(m_mutex);
+    m_capturing = false;
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::captureAdjustPacketSize(unsigned long maxPacketSize)
+{
+    MutexLocker lock(m_mutex);
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    // pretend the network supports jumbo frames up to 8228 bytes
+    m_uint32Attrs["PacketSize"] =
+            tPvUint32(maxPacketSize < 8228 ? maxPacketSize : 8228);
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::captureQueueFrame(tPvFrame *frame, tPvFrameCallback callback)
+{
+    MutexLocker lock(m_mutex);
+    if (!m_open)
+        return ePvErrBadHandle;
+    if (!m_capturing)
+        return ePvErrBadSequence;
+
+    m_queue.push_back(QueueEntry(frame, callback));
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::captureWaitForFrameDone(tPvFrame *frame,
+                                          unsigned long timeout)
+{
+    MutexLocker lock(m_mutex);
+    if (!m_open)
+        return ePvErrBadHandle;
+
+    if (timeout == PVINFINITE) {
+        while (isQueued(frame))
+            m_frameDone.wait(m_mutex);
+        return ePvErrSuccess;
+    }
+
+    double deadline = monotonicTime() + 1e-3 * timeout;
+    while (isQueued(frame)) {
+        double remaining = deadline - monotonicTime();
+        if (remaining <= 0)
+            return ePvErrTimeout;
+        m_frameDone.wait(m_mutex, (unsigned long)(1e3 * remaining) + 1);
+    }
+    return ePvErrSuccess;
+}
+
+tPvErr SimCamera::captureQueueClear()
+{
+    std::deque<QueueEntry> cancelled;
+    {
+        MutexLocker lock(m_mutex);
+        if (!m_open)
+            return ePvErrBadHandle;
+        cancelled.swap(m_queue);
+        for (std::deque<QueueEntry>::iterator it = cancelled.begin();
+                it != cancelled.end(); ++it)
+            it->first->Status = ePvErrCancelled;
+        m_frameDone.wakeAll();
+    }
+
+    for (std::deque<QueueEntry>::iterator it = cancelled.begin();
+            it != cancelled.end(); ++it)
+        if (it->second)
+            it->second(it->first);
+
+    return ePvErrSuccess;
+}
+
+void SimCamera::startAcquisition()
+{
+    {
+        MutexLocker lock(m_mutex);
+        if (m_acquiring)
+            return;
+        m_acquiring = true;
+        prepareAcquisition();
+    }
+
+    if (!start()) {
+        MutexLocker lock(m_mutex);
+        m_acquiring = false;
+    }
+}
+
+void SimCamera::prepareAcquisition()
+{
+    m_period = 1.0 / m_float32Attrs["FrameRate"];
+
+    // prepare a mostly dark test image with a faint gradient and noise,
+    // which is copied with a varying offset into each frame
+    // of the binned region of interest
+    // packed frames are made from the 16 bit image
+    const std::string &format = m_enumAttrs["PixelFormat"];
+    bool mono16 = (format == "Mono16" || format == "Mono12Packed");
+    int bits = format == "Mono12Packed" ? std::min(m_bits, 12) : m_bits;
+    int binX = int(m_uint32Attrs["BinningX"]);
+    int binY = int(m_uint32Attrs["BinningY"]);
+    int x0 = int(m_uint32Attrs["RegionX"]) * binX;
+    int y0 = int(m_uint32Attrs["RegionY"]) * binY;
+    int width = int(m_uint32Attrs["Width"]);
+    int height = int(m_uint32Attrs["Height"]);
+    size_t numPixels = size_t(width) * size_t(height);
+    m_imageData.resize(mono16 ? 2 * numPixels : numPixels);
+    unsigned int maxValue = (1u << m_bits) - 1;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            unsigned int value = (unsigned int)(
+                    (x0 + x * binX + y0 + y * binY) * (maxValue / 4)
+                    / (m_width + m_height)) * binX * binY
+                    + (rand_r(&m_seed) & 0x3f);
+            if (value > maxValue)
+                value = maxValue;
+            size_t i = size_t(y) * width + x;
+            if (mono16) {
+                if (bits < m_bits)
+                    value >>= m_bits - bits;
+                m_imageData[2*i] = (unsigned char)(value & 0xff);
+                m_imageData[2*i+1] = (unsigned char)(value >> 8);
+            }
+            else
+                m_imageData[i] = (unsigned char)(
+                        m_bits > 8 ? value >> (m_bits - 8) : value);
+        }
+    }
+}
+
+void SimCamera::stopAcquisition()
+{
+    {
+        MutexLocker lock(m_mutex);
+        m_acquiring = false;
+    }
+    join();
+}
+
+void SimCamera::run()
+{
+    double t0 = monotonicTime();
+    unsigned long frameCount = 0;
+    bool acquiring = true;
+    while (acquiring)
+    {
+        double t;
+        nextFrame(frameCount, t);
+        double due = t0 + t;
+        // the jitter delays the delivery, the time stamps stay regular
+        if (m_jitter > 0)
+            due += 1e-6 * m_jitter *
+                    (2 * rand_r(&m_seed) / (RAND_MAX + 1.0) - 1);
+
+        // sleep in small steps, so that AcquisitionStop is not delayed
+        while (m_paced && acquiring) {
+            double dt = due - monotonicTime();
+            if (dt <= 0)
+                break;
+            microsleep((unsigned int)(1e6 * (dt < 0.01 ? dt : 0.01)));
+            MutexLocker lock(m_mutex);
+            acquiring = m_acquiring;
+        }
+
+        // without a queued buffer the frame is lost, unless unpaced
+        QueueEntry entry(0, 0);
+        while (acquiring) {
+            {
+                MutexLocker lock(m_mutex);
+                acquiring = m_acquiring;
+                if (acquiring && !m_queue.empty()) {
+                    entry = m_queue.front();
+                    m_queue.pop_front();
+                    fillFrame(entry.first, frameCount, t);
+                    m_frameDone.wakeAll();
+                    break;
+                }
+            }
+            if (m_paced)
+                break;
+            microsleep(BufferPollInterval);
+        }
+
+        if (entry.second)
+            entry.second(entry.first);
+    }
+}
+
+void SimCamera::nextFrame(unsigned long &frameCount, double &t)
+{
+    ++frameCount;
+    if (m_dropRate > 0 && rand_r(&m_seed) / (RAND_MAX + 1.0) < m_dropRate)
+        ++frameCount;
+
+    t = frameCount * m_period;
+}
+
+void SimCamera::resetAttributes()
+{
+    m_uint32Attrs.clear();
+    m_uint32Attrs["SensorBits"] = m_bits;
+    m_uint32Attrs["SensorWidth"] = m_width;
+    m_uint32Attrs["SensorHeight"] = m_height;
+    m_uint32Attrs["BinningX"] = 1;
+    m_uint32Attrs["BinningY"] = 1;
+    m_uint32Attrs["RegionX"] = 0;
+    m_uint32Attrs["RegionY"] = 0;
+    m_uint32Attrs["Width"] = m_width;
+    m_uint32Attrs["Height"] = m_height;
+    m_uint32Attrs["ExposureValue"] = 15000;
+    m_uint32Attrs["FrameStartTriggerDelay"] = 0;
+    m_uint32Attrs["PacketSize"] = 1500;
+    m_uint32Attrs["StreamBytesPerSecond"] = 115000000;
+    m_uint32Attrs["TimeStampFrequency"] = SimTimeStampFrequency;
+
+    m_float32Attrs.clear();
+    m_float32Attrs["FrameRate"] = 20;
+
+    m_enumAttrs.clear();
+    m_enumAttrs["SensorType"] = "Mono";
+    m_enumAttrs["ConfigFileIndex"] = "Factory";
+    m_enumAttrs["AcquisitionMode"] = "Continuous";
+    m_enumAttrs["FrameStartTriggerMode"] = "Freerun";
+    m_enumAttrs["SyncOut1Mode"] = "GPO";
+    m_enumAttrs["SyncOut2Mode"] = "GPO";
+    m_enumAttrs["PixelFormat"] = "Mono8";
+
+    m_stringAttrs.clear();
+    m_stringAttrs["DeviceIPAddress"] = "127.0.0.1";
+    m_stringAttrs["DeviceEthAddress"] = "00-00-00-00-00-00";
+}
+
+// checks the region of interest against the binned sensor; with shrink set,
+// as after a changed binning, the region is first cut to the sensor size
+bool SimCamera::fitRegion(bool shrink)
+{
+    tPvUint32 binX = m_uint32Attrs["BinningX"];
+    tPvUint32 binY = m_uint32Attrs["BinningY"];
+    if (binX < 1 || binX > SimMaxBinning || binY < 1 || binY > SimMaxBinning)
+        return false;
+
+    tPvUint32 maxWidth = tPvUint32(m_width) / binX;
+    tPvUint32 maxHeight = tPvUint32(m_height) / binY;
+    if (maxWidth < 1 || maxHeight < 1)
+        return false;
+    tPvUint32 &x = m_uint32Attrs["RegionX"];
+    tPvUint32 &y = m_uint32Attrs["RegionY"];
+    tPvUint32 &width = m_uint32Attrs["Width"];
+    tPvUint32 &height = m_uint32Attrs["Height"];
+    if (shrink) {
+        x = std::min(x, maxWidth - 1);
+        y = std::min(y, maxHeight - 1);
+        width = std::min(width, maxWidth - x);
+        height = std::min(height, maxHeight - y);
+    }
+    return width >= 1 && height >= 1 &&
+            x + width <= maxWidth && y + height <= maxHeight;
+}
+
+bool SimCamera::isQueued(tPvFrame *frame) const
+{
+    for (std::deque<QueueEntry>::const_iterator it = m_queue.begin();
+            it != m_queue.end(); ++it)
+        if (it->first == frame)
+            return true;
+    return false;
+}
+
+void SimCamera::fillFrameInfo(tPvFrame *frame, unsigned long frameCount,
+                              double t)
+{
+    const std::string &format = m_enumAttrs["PixelFormat"];
+    frame->Width = m_uint32Attrs["Width"];
+    frame->Height = m_uint32Attrs["Height"];
+    frame->RegionX = m_uint32Attrs["RegionX"];
+    frame->RegionY = m_uint32Attrs["RegionY"];
+    if (format == "Mono12Packed") {
+        frame->Format = ePvFmtMono12Packed;
+        frame->BitDepth = std::min(m_bits, 12);
+    }
+    else if (format == "Mono16") {
+        frame->Format = ePvFmtMono16;
+        frame->BitDepth = m_bits;
+    }
+    else {
+        frame->Format = ePvFmtMono8;
+        frame->BitDepth = 8;
+    }
+    frame->FrameCount = frameCount;
+
+    unsigned long long ticks =
+            (unsigned long long)(t * SimTimeStampFrequency);
+    frame->TimestampLo = (unsigned long)(ticks & 0xffffffffUL);
+    frame->TimestampHi = (unsigned long)(ticks >> 32);
+}
+
+void SimCamera::fillFrame(tPvFrame *frame, unsigned long frameCount, double t)
+{
+    bool mono16 = (m_enumAttrs["PixelFormat"] == "Mono16");
+    bool packed = (m_enumAttrs["PixelFormat"] == "Mono12Packed");
+    size_t numPixels = packed ? m_imageData.size() / 2 : 0;
+    size_t imageSize = packed ? (3 * numPixels + 1) / 2 : m_imageData.size();
+
+    fillFrameInfo(frame, frameCount, t);
+    if (frame->ImageBufferSize < imageSize) {
+        frame->ImageSize = 0;
+        frame->Status = ePvErrBufferTooSmall;
+        return;
+    }
+
+    // copy the test image with a per frame offset, so that consecutive
+    // frames differ
+    unsigned char *buffer = reinterpret_cast<unsigned char *>(
+            frame->ImageBuffer);
+    if (packed) {
+        // pixels shifted like the Mono16 frames, two in three bytes
+        size_t shift = (frameCount * 7) % numPixels;
+        for (size_t i = 0; i < numPixels; i += 2) {
+            size_t k = (i + shift) % numPixels;
+            unsigned int p0 = m_imageData[2*k] | (m_imageData[2*k+1] << 8);
+            unsigned char *p = buffer + 3 * (i / 2);
+            p[0] = (unsigned char)(p0 >> 4);
+            if (i + 1 < numPixels) {
+                k = (k + 1) % numPixels;
+                unsigned int p1 = m_imageData[2*k] | (m_imageData[2*k+1] << 8);
+                p[1] = (unsigned char)((p0 & 0x0f) | ((p1 & 0x0f) << 4));
+                p[2] = (unsigned char)(p1 >> 4);
+            }
+            else
+                p[1] = (unsigned char)(p0 & 0x0f);
+        }
+    }
+    else {
+        size_t pixelSize = mono16 ? 2 : 1;
+        size_t offset = (frameCount * 7 * pixelSize) % imageSize;
+        std::memcpy(buffer, &m_imageData[offset], imageSize - offset);
+        std::memcpy(buffer + imageSize - offset, &m_imageData[0], offset);
+    }
+    frame->ImageSize = imageSize;
+
+    if (m_missingDataRate > 0 &&
+            rand_r(&m_seed) / (RAND_MAX + 1.0) < m_missingDataRate)
+        frame->Status = ePvErrDataMissing;
+    else
+        frame->Status = ePvErrSuccess;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_SIMCAMERA_H
+#define PVREC_SIMCAMERA_H
+
+#include "camera.h"
+#include "thread.h"
+
+#include <map>
+#include <deque>
+#include <utility>
+
+/*
+    Synthetic camera for recording without hardware.
+
+    Frames are generated by a background thread at the configured FrameRate
+    attribute and handed to the queued buffers in FIFO order. If no buffer
+    is queued when a frame is due, the frame is lost and shows up as a gap in
+    the FrameCount, like on a real camera. Additional FrameCount gaps,
+    frames with missing data and timing jitter can be injected. Binning
+    and a region of interest shrink the generated images.
+ */
+class SimCamera : public Camera, private Thread
+{
+public:
+    SimCamera(int width = 1024, int height = 1024, int bits = 12);
+    virtual ~SimCamera();
+
+    // probability of a frame with status ePvErrDataMissing
+    void setMissingDataRate(double rate);
+    // probability of an additional gap in the FrameCount
+    void setDropRate(double rate);
+    // maximum deviation of the frame delivery from the nominal frame time
+    // in microseconds, the time stamps are not affected
+    void setJitter(double jitter);
+    // allows several simulated cameras with different ids
+    void setUniqueId(unsigned long uniqueId);
+
+    virtual std::string apiVersionStr() const;
+    virtual CameraInfoVector availableCameras(int timeout) const;
+
+    virtual tPvErr open(unsigned long uniqueId);
+    virtual void close();
+    virtual bool isOpen() const;
+
+    virtual tPvErr attrUint32Get(const char *name, tPvUint32 *value) const;
+    virtual tPvErr attrUint32Set(const char *name, tPvUint32 value);
+    virtual tPvErr attrFloat32Get(const char *name, tPvFloat32 *value) const;
+    virtual tPvErr attrFloat32Set(const char *name, tPvFloat32 value);
+    virtual tPvErr attrEnumGet(const char *name, char *buffer,
+                               unsigned long bufferSize) const;
+    virtual tPvErr attrEnumSet(const char *name, const char *value);
+    virtual tPvErr attrStringGet(const char *name, char *buffer,
+                                 unsigned long bufferSize) const;
+    virtual tPvErr commandRun(const char *name);
+
+    virtual tPvErr captureStart();
+    virtual tPvErr captureEnd();
+    virtual tPvErr captureAdjustPacketSize(unsigned long maxPacketSize);
+    virtual tPvErr captureQueueFrame(tPvFrame *frame,
+                                     tPvFrameCallback callback = 0);
+    virtual tPvErr captureWaitForFrameDone(tPvFrame *frame,
+                                           unsigned long timeout);
+    virtual tPvErr captureQueueClear();
+
+protected:
+    virtual void run();
+    void startAcquisition();
+    void stopAcquisition();
+    void resetAttributes();
+    bool fitRegion(bool shrink);
+    bool isQueued(tPvFrame *frame) const;
+    tPvErr getString(const std::map<std::string, std::string> &attrs,
+                     const char *name, char *buffer,
+                     unsigned long bufferSize) const;
+
+    // replaces the sensor and resets the attributes
+    void setSensor(int width, int height, int bits);
+
+    // The frames are produced by these, so that other frame sources can
+    // reuse the simulation. prepareAcquisition() and fillFrame() are called
+    // with the mutex locked, nextFrame() gives the FrameCount and the time
+    // in seconds since the start of the acquisition of the next frame.
+    virtual void prepareAcquisition();
+    virtual void nextFrame(unsigned long &frameCount, double &t);
+    virtual void fillFrame(tPvFrame *frame, unsigned long frameCount,
+                           double t);
+
+    // sets everything but the image data and the status of a frame
+    void fillFrameInfo(tPvFrame *frame, unsigned long frameCount, double t);
+
+    std::map<std::string, tPvUint32> m_uint32Attrs;
+    std::map<std::string, tPvFloat32> m_float32Attrs;
+    std::map<std::string, std::string> m_enumAttrs;
+    std::map<std::string, std::string> m_stringAttrs;
+
+    // without pacing a frame is delivered as soon as a buffer is queued
+    // instead of at its time, and no frames are lost
+    bool m_paced;
+
+private:
+    int m_width;
+    int m_height;
+    int m_bits;
+    double m_missingDataRate;
+    double m_dropRate;
+    double m_jitter;
+    unsigned long m_uniqueId;
+
+    bool m_open;
+    bool m_capturing;
+    bool m_acquiring;
+    unsigned int m_seed;
+    double m_period;
+    std::vector<unsigned char> m_imageData;
+
+    typedef std::pair<tPvFrame *, tPvFrameCallback> QueueEntry;
+    std::deque<QueueEntry> m_queue;
+    mutable Mutex m_mutex;
+    WaitCondition m_frameDone;
+};
+
+#endif // PVREC_SIMCAMERA_H
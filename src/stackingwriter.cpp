@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "stackingwriter.h"
+#include "pixelconv.h"
+
+#include <cstdlib>
+#include <cstring>
+
+static const size_t BufferAlignment = 4096;
+
+const int StackingWriter::MaxStackSize;
+
+StackingWriter::StackingWriter(FitsWriter *writer, int stackSize)
+    : m_writer(writer),
+      m_stackSize(stackSize > 0 ? stackSize : 1),
+      m_pixelType(Uint8),
+      m_numPixels(0),
+      m_count(0),
+      m_stack(0),
+      m_written(0),
+      m_numAdded(0),
+      m_numWritten(0),
+      m_sum(0)
+{
+}
+
+StackingWriter::~StackingWriter()
+{
+    close();
+    delete m_writer;
+}
+
+bool StackingWriter::open(const std::string &fname, PixelType pixelType,
+                          int width, int height, int count, bool clobber)
+{
+    clearError();
+
+    if (isOpen()) {
+        setError("File already opened.");
+        return false;
+    }
+
+    if (pixelType != Uint8 && pixelType != Uint16) {
+        setError("Only 8 and 16 bit unsigned pixels can be co-added.");
+        return false;
+    }
+
+    if (width <= 0 || height <= 0 || count < 0) {
+        setError("Invalid width, height or count.");
+        return false;
+    }
+
+    m_numPixels = size_t(width) * size_t(height);
+    if (posix_memalign(reinterpret_cast<void **>(&m_sum), BufferAlignment,
+                       m_numPixels * sizeof(unsigned int)) != 0) {
+        m_sum = 0;
+        setError("Cannot allocate the sum buffer.");
+        return false;
+    }
+
+    // an unbounded count stays unbounded
+    int numStacks = (count + m_stackSize - 1) / m_stackSize;
+    if (!m_writer->open(fname, Int32, width, height, numStacks, clobber)) {
+        setError(m_writer->lastError());
+        std::free(m_sum);
+        m_sum = 0;
+        return false;
+    }
+
+    m_pixelType = pixelType;
+    m_count = count;
+    m_stack = 0;
+    m_written = 0;
+    m_numAdded = 0;
+    m_numWritten = 0;
+    m_pendingRows.clear();
+
+    int n = m_stackSize;
+    if (!m_writer->writeKey(TINT, "NSTACK", &n,
+                            "frames co-added per image, at most")) {
+        setError(m_writer->lastError());
+        close();
+        return false;
+    }
+    return true;
+}
+
+void StackingWriter::close()
+{
+    if (!isOpen())
+        return;
+
+    clearError();
+    bool ok = writeStack();
+    std::string msg = lastError();
+    m_writer->close();
+    if (!ok)
+        setError(msg);
+    else if (!m_writer->lastError().empty())
+        setError(m_writer->lastError());
+
+    std::free(m_sum);
+    m_sum = 0;
+    m_pixelType = Uint8;
+    m_numPixels = 0;
+    m_count = 0;
+    m_stack = 0;
+    m_written = 0;
+    m_numAdded = 0;
+    m_numWritten = 0;
+    m_pendingRows.clear();
+}
+
+bool StackingWriter::isOpen() const
+{
+    return m_writer->isOpen();
+}
+
+bool StackingWriter::writeFrame(long index, unsigned char *data)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write frame, file not open.");
+        return false;
+    }
+
+    if (index < 1 || (m_count > 0 && index > m_count)) {
+        setError("Frame index out of bounds.");
+        return false;
+    }
+
+    long stack = stackIndex(index);
+    if (stack < m_stack || stack <= m_written) {
+        setError("Frame of an already written image.");
+        return false;
+    }
+    if (stack != m_stack) {
+        if (!writeStack())
+            return false;
+        std::memset(m_sum, 0, m_numPixels * sizeof(unsigned int));
+        m_stack = stack;
+        m_numAdded = 0;
+    }
+
+    if (m_pixelType == Uint16)
+        accumulateUint16(reinterpret_cast<const unsigned short *>(data),
+                         m_sum, m_numPixels);
+    else
+        accumulateUint8(data, m_sum, m_numPixels);
+    m_numAdded++;
+
+    // the last frame of an image or of the recording completes the image
+    if (index % m_stackSize == 0 || index == m_count)
+        return writeStack();
+    return true;
+}
+
+bool StackingWriter::writeKey(int datatype, const char *keyname, void *value,
+                              const char *comment)
+{
+    clearError();
+    if (!m_writer->writeKey(datatype, keyname, value, comment)) {
+        setError(m_writer->lastError());
+        return false;
+    }
+    return true;
+}
+
+bool StackingWriter::resize(int count)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot resize image, file not open.");
+        return false;
+    }
+
+    // a partial image at the end is complete now
+    if (!writeStack())
+        return false;
+
+    int numStacks = (count + m_stackSize - 1) / m_stackSize;
+    if (!m_writer->resize(numStacks)) {
+        setError(m_writer->lastError());
+        return false;
+    }
+    m_count = count;
+    return true;
+}
+
+// the row of a frame follows the frame, so it belongs either to the image
+// being accumulated, whose count is not known yet, or to the image the
+// frame has just completed
+bool StackingWriter::writeFrameInfo(long index, const FrameInfo &info)
+{
+    clearError();
+    long stack = stackIndex(index);
+    if (stack == m_stack) {
+        m_pendingRows.push_back(info);
+        return true;
+    }
+
+    FrameInfo row = info;
+    if (stack == m_written)
+        row.numCombined = m_numWritten;
+    if (!m_writer->writeFrameInfo(stack, row)) {
+        setError(m_writer->lastError());
+        return false;
+    }
+    return true;
+}
+
+unsigned long long StackingWriter::bytesWritten() const
+{
+    return m_writer->bytesWritten();
+}
+
+int StackingWriter::stackSize() const
+{
+    return m_stackSize;
+}
+
+long StackingWriter::stackIndex(long index) const
+{
+    return (index - 1) / m_stackSize + 1;
+}
+
+bool StackingWriter::writeStack()
+{
+    if (m_stack == 0)
+        return true;
+
+    long stack = m_stack;
+    m_stack = 0;
+    m_written = stack;
+    m_numWritten = m_numAdded;
+    bool ok = m_writer->writeFrame(stack,
+                                   reinterpret_cast<unsigned char *>(m_sum));
+    if (!ok)
+        setError(m_writer->lastError());
+
+    for (size_t i = 0; i < m_pendingRows.size(); ++i) {
+        m_pendingRows[i].numCombined = m_numWritten;
+        m_writer->writeFrameInfo(stack, m_pendingRows[i]);
+    }
+    m_pendingRows.clear();
+    return ok;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_STACKINGWRITER_H
+#define PVREC_STACKINGWRITER_H
+
+#include "fitswriter.h"
+#include <vector>
+
+/*
+    Co-adds every stackSize consecutive frames into one 32 bit image and
+    passes only these sums on to the wrapped writer.
+
+    Frame n goes into image (n - 1) / stackSize + 1. Frames must arrive in
+    ascending order, as they do from the writer thread, and missing indices,
+    e.g. dropped frames, simply don't contribute. An image is written when
+    its last frame has been added or a frame of a later image arrives, and
+    when the writer is resized or closed.
+
+    The frame table keeps a row for every frame that went into an image,
+    with the index of the image and the number of frames co-added into it
+    as NCOMBINE, which is less than stackSize if frames are missing. The
+    rows of an image are held back until the image is written.
+ */
+class StackingWriter : public FitsWriter
+{
+public:
+    // takes ownership of the writer
+    StackingWriter(FitsWriter *writer, int stackSize);
+    virtual ~StackingWriter();
+
+    // width, height and count refer to the incoming frames
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber = false);
+    virtual void close();
+    virtual bool isOpen() const;
+
+    virtual bool writeFrame(long index, unsigned char *data);
+    virtual bool writeKey(int datatype, const char *keyname, void *value,
+                          const char *comment);
+    virtual bool resize(int count);
+    virtual bool writeFrameInfo(long index, const FrameInfo &info);
+    virtual unsigned long long bytesWritten() const;
+
+    int stackSize() const;
+
+    // the largest stack which cannot overflow the sum of 16 bit pixels
+    static const int MaxStackSize = 32768;
+
+protected:
+    long stackIndex(long index) const;
+    bool writeStack();
+
+private:
+    FitsWriter *m_writer;
+    int m_stackSize;
+    PixelType m_pixelType;
+    size_t m_numPixels;
+    int m_count;
+    long m_stack;       // image being accumulated, 0 if none
+    long m_written;     // last image written
+    int m_numAdded;     // frames added to the image being accumulated
+    int m_numWritten;   // frames co-added into the last image written
+    std::vector<FrameInfo> m_pendingRows;   // rows of the image m_stack
+    unsigned int *m_sum;
+};
+
+#endif // PVREC_STACKINGWRITER_H
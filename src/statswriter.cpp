@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "statswriter.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+static double megabytes(unsigned long long bytes)
+{
+    return double(bytes) / (1024.0 * 1024.0);
+}
+
+StatsWriter::StatsWriter(const Telemetry *telemetry)
+    : m_telemetry(telemetry),
+      m_interval(1),
+      m_open(false),
+      m_quit(false)
+{
+    std::memset(&m_last, 0, sizeof(m_last));
+}
+
+StatsWriter::~StatsWriter()
+{
+    close();
+}
+
+bool StatsWriter::open(const std::string &fname, double interval)
+{
+    close();
+    m_errorStr.clear();
+
+    // start with an empty file, also catches unwritable paths early
+    std::ofstream file(fname.c_str(), std::ios::trunc);
+    if (!file) {
+        m_errorStr = std::string("Cannot create stats file '") + fname +
+                "': " + std::strerror(errno);
+        return false;
+    }
+    file.close();
+
+    m_fname = fname;
+    m_interval = interval > 0 ? interval : 1;
+    m_telemetry->snapshot(m_last);
+    m_quit = false;
+    if (!start()) {
+        m_errorStr = "Cannot start stats thread.";
+        return false;
+    }
+    m_open = true;
+    return true;
+}
+
+void StatsWriter::close()
+{
+    if (!m_open)
+        return;
+
+    {
+        MutexLocker lock(m_mutex);
+        m_quit = true;
+        m_wake.wakeAll();
+    }
+    join();
+    dump();
+    m_open = false;
+}
+
+bool StatsWriter::isOpen() const
+{
+    return m_open;
+}
+
+std::string StatsWriter::lastError() const
+{
+    return m_errorStr;
+}
+
+bool StatsWriter::isPrometheusFile(const std::string &fname)
+{
+    return fname.size() > 5 && fname.compare(fname.size() - 5, 5, ".prom") == 0;
+}
+
+void StatsWriter::run()
+{
+    MutexLocker lock(m_mutex);
+    while (!m_quit) {
+        m_wake.wait(m_mutex, (unsigned long)(1e3 * m_interval));
+        if (!m_quit)
+            dump();
+    }
+}
+
+bool StatsWriter::dump()
+{
+    TelemetrySnapshot s;
+    m_telemetry->snapshot(s);
+    bool ok = isPrometheusFile(m_fname) ? writePrometheus(s) : writeJson(s);
+    m_last = s;
+    return ok;
+}
+
+bool StatsWriter::writeJson(const TelemetrySnapshot &s)
+{
+    double dt = s.time - m_last.time;
+    double fps = dt > 0 ? (s.framesWritten - m_last.framesWritten) / dt : 0;
+    double mbps = dt > 0
+            ? megabytes(s.bytesWritten - m_last.bytesWritten) / dt : 0;
+    unsigned long count = s.framesWritten;
+
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(6)
+       << "{\"time\": " << s.time
+       << ", \"elapsed\": " << s.time - s.startTime
+       << std::setprecision(3)
+       << ", \"queued\": " << s.framesQueued
+       << ", \"written\": " << s.framesWritten
+       << ", \"write_errors\": " << s.writeErrors
+       << ", \"dropped\": " << s.droppedFrames
+       << ", \"missing\": " << s.missingDataFrames
+       << ", \"discarded\": " << s.discardedFrames
+       << ", \"failed\": " << s.failedFrames
+       << ", \"fps\": " << fps
+       << ", \"write_mb_per_s\": " << mbps
+       << ", \"written_mb\": " << megabytes(s.bytesWritten)
+       << ", \"queue_depth\": " << s.queueDepth()
+       << ", \"queue_high_water\": " << s.queueHighWater
+       << ", \"queue_size\": " << s.queueSize
+       << ", \"driver_buffers\": " << s.driverBuffers
+       << ", \"driver_low_water\": " << s.driverLowWater
+       << ", \"num_buffers\": " << s.numBuffers
+       << ", \"latency_mean_us\": " << (count > 0 ? double(s.latencySum) / count : 0)
+       << ", \"latency_p50_us\": " << 1e6 * s.latencyQuantile(0.5)
+       << ", \"latency_p99_us\": " << 1e6 * s.latencyQuantile(0.99)
+       << ", \"latency_max_us\": " << s.latencyMax
+       << ", \"latency_hist\": [";
+    // bin k counts latencies below 2^k microseconds
+    for (int k = 0; k < TelemetrySnapshot::NumLatencyBins; ++k)
+        ss << (k > 0 ? ", " : "") << s.latency[k];
+    ss << "]}\n";
+
+    std::ofstream file(m_fname.c_str(), std::ios::app);
+    file << ss.str();
+    return bool(file);
+}
+
+bool StatsWriter::writePrometheus(const TelemetrySnapshot &s)
+{
+    double dt = s.time - m_last.time;
+    double mbps = dt > 0
+            ? megabytes(s.bytesWritten - m_last.bytesWritten) / dt : 0;
+
+    std::ostringstream ss;
+    ss << "# HELP pvrec_frames_total Frames by what happened to them.\n"
+       << "# TYPE pvrec_frames_total counter\n"
+       << "pvrec_frames_total{state=\"queued\"} " << s.framesQueued << "\n"
+       << "pvrec_frames_total{state=\"written\"} " << s.framesWritten << "\n"
+       << "pvrec_frames_total{state=\"write_error\"} " << s.writeErrors << "\n"
+       << "pvrec_frames_total{state=\"dropped\"} " << s.droppedFrames << "\n"
+       << "pvrec_frames_total{state=\"missing_data\"} "
+            << s.missingDataFrames << "\n"
+       << "pvrec_frames_total{state=\"discarded\"} "
+            << s.discardedFrames << "\n"
+       << "pvrec_frames_total{state=\"failed\"} " << s.failedFrames << "\n"
+       << "# HELP pvrec_written_bytes_total Image data written to disk.\n"
+       << "# TYPE pvrec_written_bytes_total counter\n"
+       << "pvrec_written_bytes_total " << s.bytesWritten << "\n"
+       << "# HELP pvrec_write_rate_megabytes Write rate since the last update.\n"
+       << "# TYPE pvrec_write_rate_megabytes gauge\n"
+       << "pvrec_write_rate_megabytes " << mbps << "\n"
+       << "# HELP pvrec_write_queue_frames Frames waiting to be written.\n"
+       << "# TYPE pvrec_write_queue_frames gauge\n"
+       << "pvrec_write_queue_frames " << s.queueDepth() << "\n"
+       << "# HELP pvrec_write_queue_high_water_frames Largest write queue depth.\n"
+       << "# TYPE pvrec_write_queue_high_water_frames gauge\n"
+       << "pvrec_write_queue_high_water_frames " << s.queueHighWater << "\n"
+       << "# HELP pvrec_write_queue_size_frames Capacity of the write queue.\n"
+       << "# TYPE pvrec_write_queue_size_frames gauge\n"
+       << "pvrec_write_queue_size_frames " << s.queueSize << "\n"
+       << "# HELP pvrec_driver_buffers Buffers queued at the camera driver.\n"
+       << "# TYPE pvrec_driver_buffers gauge\n"
+       << "pvrec_driver_buffers " << s.driverBuffers << "\n"
+       << "# HELP pvrec_driver_buffers_low_water Fewest buffers queued at the driver.\n"
+       << "# TYPE pvrec_driver_buffers_low_water gauge\n"
+       << "pvrec_driver_buffers_low_water " << s.driverLowWater << "\n"
+       << "# HELP pvrec_frame_latency_seconds Time from frame done to written.\n"
+       << "# TYPE pvrec_frame_latency_seconds histogram\n";
+    unsigned long cumulative = 0;
+    for (int k = 0; k < TelemetrySnapshot::NumLatencyBins - 1; ++k) {
+        cumulative += s.latency[k];
+        ss << "pvrec_frame_latency_seconds_bucket{le=\""
+           << TelemetrySnapshot::latencyBinLimit(k) << "\"} "
+           << cumulative << "\n";
+    }
+    cumulative += s.latency[TelemetrySnapshot::NumLatencyBins - 1];
+    ss << "pvrec_frame_latency_seconds_bucket{le=\"+Inf\"} "
+       << cumulative << "\n"
+       << "pvrec_frame_latency_seconds_sum " << 1e-6 * s.latencySum << "\n"
+       << "pvrec_frame_latency_seconds_count " << cumulative << "\n";
+
+    // scrapers must never see a half written file
+    std::string tmpName = m_fname + ".tmp";
+    {
+        std::ofstream file(tmpName.c_str(), std::ios::trunc);
+        file << ss.str();
+        if (!file)
+            return false;
+    }
+    return std::rename(tmpName.c_str(), m_fname.c_str()) == 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_STATSWRITER_H
+#define PVREC_STATSWRITER_H
+
+#include "thread.h"
+#include "telemetry.h"
+#include <string>
+
+/*
+    Periodically dumps the telemetry of a recording to a stats file.
+
+    Files ending in ".prom" are rewritten with the current values in the
+    Prometheus text format, suitable for the node exporter's textfile
+    collector. All other files get one JSON object per line appended.
+    close() writes a last entry with the final counters.
+ */
+class StatsWriter : private Thread
+{
+public:
+    explicit StatsWriter(const Telemetry *telemetry);
+    virtual ~StatsWriter();
+
+    bool open(const std::string &fname, double interval);
+    void close();
+    bool isOpen() const;
+
+    std::string lastError() const;
+
+    static bool isPrometheusFile(const std::string &fname);
+
+protected:
+    virtual void run();
+    bool dump();
+    bool writeJson(const TelemetrySnapshot &s);
+    bool writePrometheus(const TelemetrySnapshot &s);
+
+private:
+    const Telemetry *m_telemetry;
+    std::string m_fname;
+    double m_interval;
+    bool m_open;
+    bool m_quit;
+    TelemetrySnapshot m_last;
+    Mutex m_mutex;
+    WaitCondition m_wake;
+    std::string m_errorStr;
+};
+
+#endif // PVREC_STATSWRITER_H
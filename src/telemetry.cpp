@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "telemetry.h"
+#include "pvutils.h"
+
+#include <cstring>
+
+// single writer counters, so a relaxed load and store is enough
+template <class T>
+static inline void add(T *counter, T value)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED)
+            + value, __ATOMIC_RELAXED);
+}
+
+template <class T>
+static inline void store(T *counter, T value)
+{
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+template <class T>
+static inline T load(const T *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+unsigned long TelemetrySnapshot::queueDepth() const
+{
+    unsigned long done = framesWritten + writeErrors;
+    return framesQueued > done ? framesQueued - done : 0;
+}
+
+double TelemetrySnapshot::latencyBinLimit(int bin)
+{
+    return 1e-6 * double(1UL << bin);
+}
+
+// upper limit of the bin that contains the given quantile, in seconds
+double TelemetrySnapshot::latencyQuantile(double q) const
+{
+    unsigned long count = 0;
+    for (int k = 0; k < NumLatencyBins; ++k)
+        count += latency[k];
+    if (count == 0)
+        return 0;
+
+    unsigned long sum = 0;
+    for (int k = 0; k < NumLatencyBins - 1; ++k) {
+        sum += latency[k];
+        if (sum >= q * count)
+            return latencyBinLimit(k);
+    }
+    return 1e-6 * latencyMax;
+}
+
+Telemetry::Telemetry()
+{
+    reset(0, 0);
+}
+
+void Telemetry::reset(size_t queueSize, size_t numBuffers)
+{
+    std::memset(&m_counters, 0, sizeof(m_counters));
+    m_counters.startTime = currentTime();
+    m_counters.queueSize = queueSize;
+    m_counters.numBuffers = numBuffers;
+    m_counters.driverLowWater = numBuffers;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void Telemetry::frameQueued(size_t queueDepth)
+{
+    add(&m_counters.framesQueued, 1UL);
+    if (queueDepth > m_counters.queueHighWater)
+        store(&m_counters.queueHighWater, (unsigned long)queueDepth);
+}
+
+void Telemetry::frameDropped(unsigned long count)
+{
+    add(&m_counters.droppedFrames, count);
+}
+
+void Telemetry::frameMissingData()
+{
+    add(&m_counters.missingDataFrames, 1UL);
+}
+
+void Telemetry::frameDiscarded()
+{
+    add(&m_counters.discardedFrames, 1UL);
+}
+
+void Telemetry::frameFailed(int status)
+{
+    if (status != 0)
+        store(&m_counters.lastFailure, status);
+    add(&m_counters.failedFrames, 1UL);
+}
+
+void Telemetry::setDriverBuffers(size_t count)
+{
+    store(&m_counters.driverBuffers, (unsigned long)count);
+    if (count < m_counters.driverLowWater)
+        store(&m_counters.driverLowWater, (unsigned long)count);
+}
+
+void Telemetry::frameWritten(size_t bytes, double latency)
+{
+    unsigned long us = latency > 0 ? (unsigned long)(1e6 * latency) : 0;
+    int bin = 0;
+    while (bin < TelemetrySnapshot::NumLatencyBins - 1 && (us >> bin) != 0)
+        ++bin;
+
+    add(&m_counters.latency[bin], 1UL);
+    add(&m_counters.latencySum, (unsigned long long)us);
+    if (us > m_counters.latencyMax)
+        store(&m_counters.latencyMax, us);
+    add(&m_counters.bytesWritten, (unsigned long long)bytes);
+    add(&m_counters.framesWritten, 1UL);
+}
+
+void Telemetry::writeFailed()
+{
+    add(&m_counters.writeErrors, 1UL);
+}
+
+void Telemetry::snapshot(TelemetrySnapshot &s) const
+{
+    const TelemetrySnapshot &c = m_counters;
+    s.time = currentTime();
+    s.startTime = c.startTime;
+    s.framesQueued = load(&c.framesQueued);
+    s.framesWritten = load(&c.framesWritten);
+    s.writeErrors = load(&c.writeErrors);
+    s.droppedFrames = load(&c.droppedFrames);
+    s.missingDataFrames = load(&c.missingDataFrames);
+    s.discardedFrames = load(&c.discardedFrames);
+    s.failedFrames = load(&c.failedFrames);
+    s.lastFailure = load(&c.lastFailure);
+    s.bytesWritten = load(&c.bytesWritten);
+    s.queueSize = c.queueSize;
+    s.queueHighWater = load(&c.queueHighWater);
+    s.numBuffers = c.numBuffers;
+    s.driverBuffers = load(&c.driverBuffers);
+    s.driverLowWater = load(&c.driverLowWater);
+    s.latencyMax = load(&c.latencyMax);
+    s.latencySum = load(&c.latencySum);
+    for (int k = 0; k < TelemetrySnapshot::NumLatencyBins; ++k)
+        s.latency[k] = load(&c.latency[k]);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_TELEMETRY_H
+#define PVREC_TELEMETRY_H
+
+#include <cstddef>
+
+// consistent copy of the telemetry counters, see Telemetry::snapshot()
+struct TelemetrySnapshot
+{
+    enum { NumLatencyBins = 24 };
+
+    double time;                    // host time of the snapshot
+    double startTime;               // host time of the last reset()
+    unsigned long framesQueued;     // handed over to the writer thread
+    unsigned long framesWritten;
+    unsigned long writeErrors;
+    unsigned long droppedFrames;    // FrameCount gaps, lost by the camera
+    unsigned long missingDataFrames;
+    unsigned long discardedFrames;  // not taken by a full write queue
+    unsigned long failedFrames;     // error status or FrameCount out of order
+    int lastFailure;                // last error status of a failed frame
+    unsigned long long bytesWritten;  // image data as stored in the file
+    unsigned long queueSize;        // capacity of the write queue
+    unsigned long queueHighWater;
+    unsigned long numBuffers;
+    unsigned long driverBuffers;    // buffers currently queued at the driver
+    unsigned long driverLowWater;
+    unsigned long latencyMax;       // in microseconds
+    unsigned long long latencySum;  // in microseconds
+
+    // bin k counts latencies below 2^k microseconds (and not below 2^(k-1)),
+    // the last bin also counts all larger latencies
+    unsigned long latency[NumLatencyBins];
+
+    unsigned long queueDepth() const;
+    static double latencyBinLimit(int bin);
+    double latencyQuantile(double q) const;
+};
+
+/*
+    Counters describing how close a running recording is to losing frames.
+
+    Every counter has exactly one writing thread, the capture thread or the
+    writer thread, which updates it with relaxed atomic stores. There are no
+    locks, so snapshot() can be called from any thread at any time without
+    slowing down the recording. Counters written by different threads may
+    be slightly out of step with each other in a snapshot.
+ */
+class Telemetry
+{
+public:
+    Telemetry();
+
+    // starts a new recording
+    void reset(size_t queueSize, size_t numBuffers);
+
+    // called by the capture thread
+    void frameQueued(size_t queueDepth);
+    void frameDropped(unsigned long count = 1);
+    void frameMissingData();
+    void frameDiscarded();
+    void frameFailed(int status);
+    void setDriverBuffers(size_t count);
+
+    // called by the writer thread, latency in seconds
+    void frameWritten(size_t bytes, double latency);
+    void writeFailed();
+
+    void snapshot(TelemetrySnapshot &s) const;
+
+private:
+    Telemetry(const Telemetry &);
+    Telemetry & operator=(const Telemetry &);
+
+    TelemetrySnapshot m_counters;
+};
+
+#endif // PVREC_TELEMETRY_H
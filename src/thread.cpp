@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "thread.h"
+
+#include <ctime>
+#include <cerrno>
+#include <csignal>
+#include <sched.h>
+
+Mutex::Mutex()
+{
+    pthread_mutex_init(&m_mutex, 0);
+}
+
+Mutex::~Mutex()
+{
+    pthread_mutex_destroy(&m_mutex);
+}
+
+void Mutex::lock()
+{
+    pthread_mutex_lock(&m_mutex);
+}
+
+void Mutex::unlock()
+{
+    pthread_mutex_unlock(&m_mutex);
+}
+
+WaitCondition::WaitCondition()
+{
+    pthread_cond_init(&m_cond, 0);
+}
+
+WaitCondition::~WaitCondition()
+{
+    pthread_cond_destroy(&m_cond);
+}
+
+void WaitCondition::wait(Mutex &mutex)
+{
+    pthread_cond_wait(&m_cond, &mutex.m_mutex);
+}
+
+bool WaitCondition::wait(Mutex &mutex, unsigned long ms)
+{
+    timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += ms / 1000;
+    t.tv_nsec += (ms % 1000) * 1000000L;
+    if (t.tv_nsec >= 1000000000L) {
+        t.tv_sec += 1;
+        t.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(&m_cond, &mutex.m_mutex, &t) != ETIMEDOUT;
+}
+
+void WaitCondition::wakeOne()
+{
+    pthread_cond_signal(&m_cond);
+}
+
+void WaitCondition::wakeAll()
+{
+    pthread_cond_broadcast(&m_cond);
+}
+
+Thread::Thread()
+    : m_running(false)
+{
+}
+
+Thread::~Thread()
+{
+    join();
+}
+
+bool Thread::start()
+{
+    if (m_running)
+        return false;
+
+    // the PvApi uses SIGALRM internally, keep it away from our threads
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &mask, &oldMask);
+    m_running = (pthread_create(&m_thread, 0, threadFunc, this) == 0);
+    pthread_sigmask(SIG_SETMASK, &oldMask, 0);
+
+    return m_running;
+}
+
+void Thread::join()
+{
+    if (!m_running)
+        return;
+
+    pthread_join(m_thread, 0);
+    m_running = false;
+}
+
+bool Thread::isRunning() const
+{
+    return m_running;
+}
+
+void Thread::setCpuAffinity(const std::vector<int> &cpus)
+{
+    m_cpus = cpus;
+}
+
+std::vector<int> Thread::cpuAffinity() const
+{
+    return m_cpus;
+}
+
+// the CPUs the process was started on, taken before any thread is pinned
+static cpu_set_t processCpuSet()
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        CPU_ZERO(&set);
+        for (int i = 0; i < CPU_SETSIZE; ++i)
+            CPU_SET(i, &set);
+    }
+    return set;
+}
+
+static const cpu_set_t ProcessCpuSet = processCpuSet();
+
+bool Thread::setCurrentCpuAffinity(const std::vector<int> &cpus)
+{
+    cpu_set_t set = ProcessCpuSet;
+    if (!cpus.empty())
+        CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+            return false;
+        CPU_SET(cpus[i], &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+std::vector<int> Thread::currentCpuAffinity()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        return cpus;
+    for (int i = 0; i < CPU_SETSIZE; ++i)
+        if (CPU_ISSET(i, &set))
+            cpus.push_back(i);
+    return cpus;
+}
+
+// threads don't inherit the CPUs of a pinned creator
+void * Thread::threadFunc(void *arg)
+{
+    Thread *thread = static_cast<Thread *>(arg);
+    setCurrentCpuAffinity(thread->m_cpus);
+    thread->run();
+    return 0;
+}
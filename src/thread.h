@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_THREAD_H
+#define PVREC_THREAD_H
+
+#include <pthread.h>
+#include <vector>
+
+class Mutex
+{
+public:
+    Mutex();
+    ~Mutex();
+
+    void lock();
+    void unlock();
+
+private:
+    Mutex(const Mutex &);
+    Mutex & operator=(const Mutex &);
+
+    friend class WaitCondition;
+    pthread_mutex_t m_mutex;
+};
+
+class MutexLocker
+{
+public:
+    explicit MutexLocker(Mutex &mutex) : m_mutex(mutex) { m_mutex.lock(); }
+    ~MutexLocker() { m_mutex.unlock(); }
+
+private:
+    MutexLocker(const MutexLocker &);
+    MutexLocker & operator=(const MutexLocker &);
+
+    Mutex &m_mutex;
+};
+
+class WaitCondition
+{
+public:
+    WaitCondition();
+    ~WaitCondition();
+
+    void wait(Mutex &mutex);
+    bool wait(Mutex &mutex, unsigned long ms);
+    void wakeOne();
+    void wakeAll();
+
+private:
+    WaitCondition(const WaitCondition &);
+    WaitCondition & operator=(const WaitCondition &);
+
+    pthread_cond_t m_cond;
+};
+
+/*
+    Minimal pthread wrapper, subclasses implement run().
+ */
+class Thread
+{
+public:
+    Thread();
+    virtual ~Thread();
+
+    bool start();
+    void join();
+    bool isRunning() const;
+
+    // restricts the thread to the given CPUs, applied by start(); without
+    // CPUs the thread runs on the CPUs the process was started on, not on
+    // those of the thread calling start()
+    void setCpuAffinity(const std::vector<int> &cpus);
+    std::vector<int> cpuAffinity() const;
+
+    // restricts the calling thread to the given CPUs, an empty list allows
+    // the CPUs the process was started on
+    static bool setCurrentCpuAffinity(const std::vector<int> &cpus);
+    static std::vector<int> currentCpuAffinity();
+
+protected:
+    virtual void run() = 0;
+
+private:
+    Thread(const Thread &);
+    Thread & operator=(const Thread &);
+
+    static void * threadFunc(void *arg);
+
+    pthread_t m_thread;
+    bool m_running;
+    std::vector<int> m_cpus;
+};
+
+#endif // PVREC_THREAD_H
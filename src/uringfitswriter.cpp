@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "uringfitswriter.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// maximum number of frame writes in flight
+static const int QueueDepth = 16;
+
+// offset, size and memory alignment required for direct I/O
+static const size_t DirectAlignment = 4096;
+
+static inline size_t roundUp(size_t n, size_t alignment)
+{
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+UringFitsWriter::UringFitsWriter(bool direct)
+    : m_direct(direct),
+      m_dataFd(-1),
+      m_bounce(0),
+      m_bounceStride(0),
+      m_bounceFixed(false)
+{
+    if (m_direct)
+        setDataAlignment(DirectAlignment);
+}
+
+UringFitsWriter::~UringFitsWriter()
+{
+    close();
+}
+
+bool UringFitsWriter::open(const std::string &fname, PixelType pixelType,
+                           int width, int height, int count, bool clobber)
+{
+    if (!RawFitsWriter::open(fname, pixelType, width, height, count,
+                             clobber))
+        return false;
+
+    if (!m_ring.init(QueueDepth)) {
+        int err = errno;
+        RawFitsWriter::close();
+        setSysError("Cannot set up io_uring.", err);
+        return false;
+    }
+
+    // frames are written through a second descriptor which bypasses the
+    // page cache, the header and frame table still use the first one
+    m_dataFd = fileDescriptor();
+    if (m_direct) {
+        if (frameSize() % DirectAlignment != 0) {
+            close();
+            setError("Direct I/O needs a frame size which is a multiple "
+                     "of 4096 bytes.");
+            return false;
+        }
+        m_dataFd = ::open(fname.c_str(), O_WRONLY | O_DIRECT);
+        if (m_dataFd < 0) {
+            int err = errno;
+            m_dataFd = -1;
+            close();
+            setSysError("Cannot open the file '" + fname +
+                        "' for direct I/O.", err);
+            return false;
+        }
+    }
+
+    // 8 bit frames only need a copy if direct I/O gets a misaligned buffer
+    if (pixelType != Uint8 || m_direct) {
+        m_bounceStride = roundUp(frameSize(), DirectAlignment);
+        if (posix_memalign(reinterpret_cast<void **>(&m_bounce),
+                           DirectAlignment,
+                           QueueDepth * m_bounceStride) != 0)
+        {
+            m_bounce = 0;
+            close();
+            setError("Cannot allocate frame buffers.");
+            return false;
+        }
+    }
+
+    m_requests.assign(QueueDepth, Request());
+    m_freeSlots.clear();
+    for (int i = QueueDepth - 1; i >= 0; --i)
+        m_freeSlots.push_back(i);
+    m_completed.clear();
+    registerBuffers();
+    return true;
+}
+
+void UringFitsWriter::close()
+{
+    if (!isOpen())
+        return;
+
+    // writes still in flight reference the buffers and the descriptor
+    while (pendingFrames() > 0 && collect(true))
+        ;
+    m_ring.release();
+    m_fixedBuffers.clear();
+    m_frameBuffers.clear();
+    m_bounceFixed = false;
+    m_requests.clear();
+    m_freeSlots.clear();
+    m_completed.clear();
+
+    if (m_dataFd >= 0 && m_dataFd != fileDescriptor())
+        ::close(m_dataFd);
+    m_dataFd = -1;
+    std::free(m_bounce);
+    m_bounce = 0;
+    m_bounceStride = 0;
+
+    // writes the header and frame table and truncates the file
+    RawFitsWriter::close();
+}
+
+bool UringFitsWriter::writeFrame(long index, unsigned char *data)
+{
+    if (!submitFrame(index, data, 0))
+        return false;
+
+    // keep the error of a failed write, collect() doesn't clear it
+    bool ok = true;
+    while (pendingFrames() > 0)
+        if (!collect(true))
+            return false;
+    for (size_t i = 0; i < m_completed.size(); ++i)
+        ok = ok && m_completed[i].ok;
+    m_completed.clear();
+    return ok;
+}
+
+bool UringFitsWriter::isAsync() const
+{
+    return true;
+}
+
+bool UringFitsWriter::submitFrame(long index, unsigned char *data, void *tag)
+{
+    clearError();
+
+    if (!isOpen()) {
+        setError("Cannot write frame, file not open.");
+        return false;
+    }
+
+    if (index < 1 || index > count()) {
+        setError("Frame index out of bounds.");
+        return false;
+    }
+
+    while (m_freeSlots.empty())
+        if (!collect(true))
+            return false;
+    int slot = m_freeSlots.back();
+
+    Request &req = m_requests[slot];
+    req.tag = tag;
+    req.size = frameSize();
+    req.offset = frameOffset(index);
+
+    bool aligned = (size_t(data) % DirectAlignment) == 0;
+    if (pixelType() != Uint8 || (m_direct && !aligned)) {
+        unsigned char *bounce = m_bounce + size_t(slot) * m_bounceStride;
+        convertFrame(data, bounce);
+        req.data = bounce;
+        req.bufIndex = m_bounceFixed ? slot : -1;
+    }
+    else {
+        std::map<const unsigned char *, int>::const_iterator it =
+                m_fixedBuffers.find(data);
+        req.data = data;
+        req.bufIndex = (it != m_fixedBuffers.end()) ? it->second : -1;
+    }
+
+    if (!submitRequest(slot))
+        return false;
+    m_freeSlots.pop_back();
+    return true;
+}
+
+bool UringFitsWriter::reapFrames(std::vector<CompletedWrite> &done, bool wait)
+{
+    if (!isOpen())
+        return true;
+
+    if (!collect(wait && m_completed.empty() && pendingFrames() > 0))
+        return false;
+    done.insert(done.end(), m_completed.begin(), m_completed.end());
+    m_completed.clear();
+    return true;
+}
+
+int UringFitsWriter::pendingFrames() const
+{
+    return int(m_requests.size() - m_freeSlots.size());
+}
+
+void UringFitsWriter::setFrameBuffers(
+        const std::vector<unsigned char *> &buffers)
+{
+    if (!isOpen() || pixelType() != Uint8)
+        return;
+
+    m_frameBuffers = buffers;
+    registerBuffers();
+}
+
+bool UringFitsWriter::submitRequest(int slot)
+{
+    const Request &req = m_requests[slot];
+    if (!m_ring.prepareWrite(m_dataFd, req.data, req.size, req.offset,
+                             req.bufIndex, (unsigned long long)slot)) {
+        setError("Cannot write frame, io_uring submission queue is full.");
+        return false;
+    }
+    if (!m_ring.submit()) {
+        setSysError("Cannot submit frame write.", errno);
+        return false;
+    }
+    return true;
+}
+
+bool UringFitsWriter::collect(bool wait)
+{
+    if (wait && !m_ring.submit(1)) {
+        setSysError("Cannot wait for frame writes.", errno);
+        return false;
+    }
+
+    unsigned long long userData;
+    int result;
+    while (m_ring.popCompletion(userData, result)) {
+        int slot = int(userData);
+        Request &req = m_requests[slot];
+        if (result > 0)
+            addBytesWritten(size_t(result));
+
+        bool ok = true;
+        if (result < 0) {
+            setSysError("Cannot write frame.", -result);
+            ok = false;
+        }
+        else if (result == 0) {
+            setError("Cannot write frame, no data written.");
+            ok = false;
+        }
+        else if (size_t(result) < req.size) {
+            // short write, submit the rest again
+            req.data += result;
+            req.size -= size_t(result);
+            req.offset += result;
+            if (submitRequest(slot))
+                continue;
+            ok = false;
+        }
+
+        CompletedWrite c;
+        c.tag = req.tag;
+        c.ok = ok;
+        m_completed.push_back(c);
+        m_freeSlots.push_back(slot);
+    }
+    return true;
+}
+
+void UringFitsWriter::registerBuffers()
+{
+    // the kernel keeps a single table, bounce buffers come first
+    m_ring.unregisterBuffers();
+    m_fixedBuffers.clear();
+    m_bounceFixed = false;
+
+    std::vector<struct iovec> iov;
+    if (m_bounce) {
+        for (int i = 0; i < QueueDepth; ++i) {
+            struct iovec v;
+            v.iov_base = m_bounce + size_t(i) * m_bounceStride;
+            v.iov_len = m_bounceStride;
+            iov.push_back(v);
+        }
+    }
+    for (size_t i = 0; i < m_frameBuffers.size(); ++i) {
+        struct iovec v;
+        v.iov_base = m_frameBuffers[i];
+        v.iov_len = frameSize();
+        iov.push_back(v);
+    }
+    if (iov.empty())
+        return;
+
+    // without registration (e.g. memory lock limit too low) plain writes
+    // are used
+    if (!m_ring.registerBuffers(&iov[0], unsigned(iov.size())))
+        return;
+    m_bounceFixed = (m_bounce != 0);
+    int first = m_bounce ? QueueDepth : 0;
+    for (size_t i = 0; i < m_frameBuffers.size(); ++i)
+        m_fixedBuffers[m_frameBuffers[i]] = first + int(i);
+}
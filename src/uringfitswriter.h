@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef URINGFITSWRITER_H
+#define URINGFITSWRITER_H
+
+#include "rawfitswriter.h"
+#include "iouring.h"
+#include <map>
+#include <vector>
+
+/*
+    RawFitsWriter variant which writes frames asynchronously with io_uring.
+
+    Up to QueueDepth frame writes are in flight at once, so that the writer
+    thread doesn't block on every single write. 8 bit frames are written
+    straight from the frame buffers announced with setFrameBuffers(), 16 bit
+    frames are converted into bounce buffers first. All buffers are
+    registered with the kernel if the memory lock limit permits it.
+
+    With direct I/O the frames bypass the page cache. The header is padded
+    so that the image data starts on an aligned offset, and the frame size
+    must be a multiple of the alignment.
+ */
+class UringFitsWriter : public RawFitsWriter
+{
+public:
+    explicit UringFitsWriter(bool direct = false);
+    virtual ~UringFitsWriter();
+
+    virtual bool open(const std::string &fname, PixelType pixelType,
+                      int width, int height, int count, bool clobber = false);
+    virtual void close();
+
+    virtual bool writeFrame(long index, unsigned char *data);
+
+    virtual bool isAsync() const;
+    virtual bool submitFrame(long index, unsigned char *data, void *tag);
+    virtual bool reapFrames(std::vector<CompletedWrite> &done, bool wait);
+    virtual int pendingFrames() const;
+    virtual void setFrameBuffers(const std::vector<unsigned char *> &buffers);
+
+protected:
+    bool submitRequest(int slot);
+    bool collect(bool wait);
+    void registerBuffers();
+
+private:
+    struct Request
+    {
+        void *tag;
+        const unsigned char *data;
+        size_t size;
+        off_t offset;
+        int bufIndex;
+    };
+
+    bool m_direct;
+    int m_dataFd;
+    IoUring m_ring;
+    std::vector<Request> m_requests;
+    std::vector<int> m_freeSlots;
+    unsigned char *m_bounce;
+    size_t m_bounceStride;
+    std::vector<unsigned char *> m_frameBuffers;
+    std::map<const unsigned char *, int> m_fixedBuffers;
+    bool m_bounceFixed;
+    std::vector<CompletedWrite> m_completed;
+};
+
+#endif // URINGFITSWRITER_H
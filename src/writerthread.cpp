@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "writerthread.h"
+#include "fitswriter.h"
+#include "telemetry.h"
+#include "pixelconv.h"
+#include "pvutils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+using std::cerr;
+using std::endl;
+
+// poll interval of an idle writer thread in microseconds
+static const unsigned int IdleSleepTime = 100;
+
+// Mono12Packed frames are unpacked in their own buffer, which has room for
+// the 16 bit pixels
+static void unpackFrame(tPvFrame *frame)
+{
+    if (frame->Format != ePvFmtMono12Packed)
+        return;
+    size_t n = size_t(frame->Width) * frame->Height;
+    if (frame->ImageBufferSize < 2 * n)
+        return;
+
+    unpackMono12(static_cast<unsigned char *>(frame->ImageBuffer), n);
+    frame->ImageSize = 2 * std::min(n, size_t(frame->ImageSize) * 2 / 3);
+    frame->Format = ePvFmtMono16;
+}
+
+// fills in the image statistics of the frame info; pixels at the largest
+// value of the bit depth count as saturated
+static void frameStats(const tPvFrame *frame, FrameInfo &info)
+{
+    size_t width = frame->Width, height = frame->Height;
+    PixelStats s;
+    if (frame->Format == ePvFmtMono16 &&
+            frame->ImageSize >= 2 * width * height) {
+        unsigned int bits = frame->BitDepth;
+        unsigned int level = (bits > 0 && bits < 16) ? (1u << bits) - 1 : 65535;
+        pixelStatsUint16(static_cast<const unsigned short *>(
+                frame->ImageBuffer), width, height, level, s);
+    }
+    else if (frame->Format == ePvFmtMono8 &&
+             frame->ImageSize >= width * height)
+        pixelStatsUint8(static_cast<const unsigned char *>(
+                frame->ImageBuffer), width, height, 255, s);
+    else
+        width = height = 0;
+
+    size_t n = width * height;
+    if (n == 0) {
+        info.mean = info.rms = info.sharpness = 0;
+        info.minValue = info.maxValue = info.saturated = 0;
+        return;
+    }
+
+    info.mean = double(s.sum) / n;
+    double var = double(s.sumSquares) / n - info.mean * info.mean;
+    info.rms = var > 0 ? std::sqrt(var) : 0;
+    info.minValue = int(s.min);
+    info.maxValue = int(s.max);
+    info.saturated = int(s.saturated);
+    size_t numDiffs = (width - 1) * height + width * (height - 1);
+    info.sharpness = numDiffs > 0 ? double(s.gradient) / numDiffs : 0;
+}
+
+WriterThread::WriterThread(FitsWriter *writer, FrameItemQueue *input,
+                           FrameQueueRing *output, Telemetry *telemetry)
+    : m_writer(writer),
+      m_input(input),
+      m_output(output),
+      m_telemetry(telemetry),
+      m_finish(0),
+      m_numErrors(0),
+      m_bytesWritten(0)
+{
+}
+
+WriterThread::~WriterThread()
+{
+    finish();
+    join();
+}
+
+void WriterThread::finish()
+{
+    __atomic_store_n(&m_finish, 1, __ATOMIC_RELEASE);
+}
+
+unsigned long WriterThread::numErrors() const
+{
+    return m_numErrors;
+}
+
+std::string WriterThread::lastError() const
+{
+    return m_errorStr;
+}
+
+void WriterThread::run()
+{
+    const bool async = m_writer->isAsync();
+    m_bytesWritten = m_writer->bytesWritten();
+    while (true)
+    {
+        if (async)
+            completeFrames(false);
+
+        FrameItem item;
+        if (m_input->pop(item)) {
+            unpackFrame(item.frame);
+            if (async)
+                submitFrame(item);
+            else
+                processFrame(item);
+            continue;
+        }
+
+        // the producer pushes its last frame before setting the flag
+        if (__atomic_load_n(&m_finish, __ATOMIC_ACQUIRE) && m_input->isEmpty())
+            break;
+
+        microsleep(IdleSleepTime);
+    }
+
+    while (!m_inFlight.empty())
+        completeFrames(true);
+}
+
+void WriterThread::processFrame(const FrameItem &item)
+{
+    if (!m_writer->writeFrame(item.index, reinterpret_cast<unsigned char *>(
+            item.frame->ImageBuffer)))
+        writeFailed();
+    else
+        frameWritten(item);
+    releaseFrame(item.frame);
+}
+
+void WriterThread::submitFrame(const FrameItem &item)
+{
+    if (!m_writer->submitFrame(item.index, reinterpret_cast<unsigned char *>(
+            item.frame->ImageBuffer), item.frame))
+    {
+        writeFailed();
+        releaseFrame(item.frame);
+        return;
+    }
+    m_inFlight[item.frame] = item;
+}
+
+void WriterThread::completeFrames(bool wait)
+{
+    std::vector<FitsWriter::CompletedWrite> done;
+    if (!m_writer->reapFrames(done, wait)) {
+        // the writer cannot report the frames anymore, give them up
+        writeFailed();
+        std::map<tPvFrame *, FrameItem>::iterator it;
+        for (it = m_inFlight.begin(); it != m_inFlight.end(); ++it)
+            releaseFrame(it->first);
+        m_inFlight.clear();
+        return;
+    }
+
+    for (size_t i = 0; i < done.size(); ++i) {
+        std::map<tPvFrame *, FrameItem>::iterator it =
+                m_inFlight.find(static_cast<tPvFrame *>(done[i].tag));
+        if (it == m_inFlight.end())
+            continue;
+        if (done[i].ok)
+            frameWritten(it->second);
+        else
+            writeFailed();
+        releaseFrame(it->first);
+        m_inFlight.erase(it);
+    }
+}
+
+void WriterThread::frameWritten(const FrameItem &item)
+{
+    const tPvFrame *frame = item.frame;
+    FrameInfo info;
+    info.frameCount = frame->FrameCount;
+    info.timestamp = ((unsigned long long)frame->TimestampHi << 32) |
+            frame->TimestampLo;
+    info.hostTime = item.hostTime;
+    info.status = frame->Status;
+    info.recordIndex = long(item.index);
+    info.numCombined = 1;
+    frameStats(frame, info);
+    m_writer->writeFrameInfo(item.index, info);
+
+    // what reached the file since the last frame, which is less than the
+    // frame with compression, stacking or frame selection
+    unsigned long long bytes = m_writer->bytesWritten();
+    if (m_telemetry)
+        m_telemetry->frameWritten(size_t(bytes - m_bytesWritten),
+                                  currentTime() - item.hostTime);
+    m_bytesWritten = bytes;
+}
+
+void WriterThread::writeFailed()
+{
+    m_numErrors++;
+    m_errorStr = m_writer->lastError();
+    cerr << endl << m_errorStr << endl;
+    if (m_telemetry)
+        m_telemetry->writeFailed();
+}
+
+void WriterThread::releaseFrame(tPvFrame *frame)
+{
+    // the output queue can hold all frames, so this never spins for long
+    while (!m_output->push(frame))
+        microsleep(IdleSleepTime);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2012 Kolja Glogowski
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PVREC_WRITERTHREAD_H
+#define PVREC_WRITERTHREAD_H
+
+#include "thread.h"
+#include "ringbuffer.h"
+#include <map>
+#include <string>
+#include <PvApi.h>
+
+class FitsWriter;
+class Telemetry;
+
+struct FrameItem
+{
+    tPvFrame *frame;
+    unsigned long index;
+    double hostTime;    // when the capture thread received the frame
+};
+
+typedef RingBuffer<FrameItem> FrameItemQueue;
+typedef RingBuffer<tPvFrame *> FrameQueueRing;
+
+/*
+    Takes captured frames from the input queue, writes them to the FITS file
+    and hands the frame buffers back to the capture thread through the
+    output queue.
+
+    With an asynchronous writer a frame goes back only after its write has
+    completed, several writes can be in flight meanwhile.
+
+    Mono12Packed frames are unpacked into 16 bit pixels here before they
+    are written.
+
+    The image statistics in the frame table (mean, RMS, min/max, saturated
+    pixels and sharpness) are computed here as well, from the frame as
+    captured, so they cost no time in the capture thread.
+ */
+class WriterThread : public Thread
+{
+public:
+    WriterThread(FitsWriter *writer, FrameItemQueue *input,
+                 FrameQueueRing *output, Telemetry *telemetry = 0);
+    virtual ~WriterThread();
+
+    // write all remaining frames and quit
+    void finish();
+
+    unsigned long numErrors() const;
+    std::string lastError() const;
+
+protected:
+    virtual void run();
+    void processFrame(const FrameItem &item);
+    void submitFrame(const FrameItem &item);
+    void completeFrames(bool wait);
+    void frameWritten(const FrameItem &item);
+    void writeFailed();
+    void releaseFrame(tPvFrame *frame);
+
+private:
+    FitsWriter *m_writer;
+    FrameItemQueue *m_input;
+    FrameQueueRing *m_output;
+    Telemetry *m_telemetry;
+    int m_finish;
+    unsigned long m_numErrors;
+    std::string m_errorStr;
+    std::map<tPvFrame *, FrameItem> m_inFlight;
+    unsigned long long m_bytesWritten;  // writer total at the last frame
+};
+
+#endif // PVREC_WRITERTHREAD_H